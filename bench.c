@@ -0,0 +1,912 @@
+/*
+ * 性能测试
+ *
+ * gcc -O2 -o bench bench.c packf.c packf_frame.c packf_lz.c packf_io.c \
+ *      packf_mpsc.c packf_text.c -lm -lpthread
+ * ./bench > bench_output.txt
+ */
+
+# include <stdio.h>
+# include <stdint.h>
+# include <string.h>
+# include <stdlib.h>
+# include <time.h>
+# include <assert.h>
+# include <unistd.h>
+# include <pthread.h>
+# include <sched.h>
+# include <sys/socket.h>
+
+# include "packf.h"
+# include "packf_lz.h"
+# include "packf_io.h"
+# include "packf_mpsc.h"
+# include "packf_text.h"
+
+# define BENCH_MSGS     1024
+# define BENCH_ROUNDS   200
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(char const *name, double ns, long ops, long bytes)
+{
+    printf("%-32s %10.1f ns/op %10.1f MB/s\n", name, ns / ops,
+            bytes / (ns / 1e9) / 1e6);
+}
+
+/* 已打包的消息，按顺序存放 */
+struct corpus
+{
+    uint8_t    *buf;
+    int         off[BENCH_MSGS];
+    int         len[BENCH_MSGS];
+    long        total;
+};
+
+# pragma pack(1)
+struct record
+{
+    int64_t     id;
+    int32_t     type;
+    uint8_t     name_len;
+    char        name[32];
+    uint16_t    nvals;
+    int32_t     vals[64];
+    struct
+    {
+        int16_t     w;
+        int32_t     d;
+    } legs[8];
+    double      price;
+};
+# pragma pack()
+
+static char const *record_format = "[D d -32s =64d 8[w d] F]";
+
+static void record_fill(struct record *r, int i)
+{
+    int j;
+
+    memset(r, 0, sizeof(*r));
+    r->id    = 1000000 + i;
+    r->type  = i % 7;
+    snprintf(r->name, sizeof(r->name), "instrument-%d", i);
+    r->nvals = (uint16_t)(8 + i % 57);
+    for (j = 0; j < r->nvals; ++j)
+        r->vals[j] = i * 31 + j;
+    for (j = 0; j < 8; ++j)
+    {
+        r->legs[j].w = (int16_t)j;
+        r->legs[j].d = i - j;
+    }
+    r->price = 100.0 + i * 0.25;
+}
+
+static void corpus_build(struct corpus *c)
+{
+    struct record r;
+    int i, pos = 0, ret;
+
+    c->buf = malloc(BENCH_MSGS * sizeof(struct record) * 2);
+    assert(c->buf);
+    for (i = 0; i < BENCH_MSGS; ++i)
+    {
+        record_fill(&r, i);
+        ret = packf(c->buf + pos, sizeof(struct record) * 2, record_format,
+                &r);
+        assert(ret > 0);
+        c->off[i] = pos;
+        c->len[i] = ret;
+        pos += ret;
+    }
+    c->total = pos;
+}
+
+/* 校验的 unpackf 与 unpackf_trusted, 交替运行，取最短的一次 */
+static void bench_trusted(void)
+{
+    struct corpus c;
+    struct record r;
+    double start, t, t_safe = 1e30, t_trusted = 1e30;
+    int i, k, m;
+
+    corpus_build(&c);
+
+    for (k = 0; k < 5; ++k)
+    {
+        start = now_ns();
+        for (i = 0; i < BENCH_MSGS * BENCH_ROUNDS; ++i)
+        {
+            m = i % BENCH_MSGS;
+            if (unpackf(c.buf + c.off[m], c.len[m], record_format, &r) < 0)
+                abort();
+        }
+        if ((t = now_ns() - start) < t_safe)
+            t_safe = t;
+
+        start = now_ns();
+        for (i = 0; i < BENCH_MSGS * BENCH_ROUNDS; ++i)
+        {
+            m = i % BENCH_MSGS;
+            if (unpackf_trusted(c.buf + c.off[m], c.len[m], record_format,
+                        &r) < 0)
+                abort();
+        }
+        if ((t = now_ns() - start) < t_trusted)
+            t_trusted = t;
+    }
+
+    report("unpackf", t_safe, (long)BENCH_MSGS * BENCH_ROUNDS,
+            c.total * BENCH_ROUNDS);
+    report("unpackf_trusted", t_trusted, (long)BENCH_MSGS * BENCH_ROUNDS,
+            c.total * BENCH_ROUNDS);
+
+    free(c.buf);
+}
+
+/*
+ * 最坏情况的输入：解包时间应与数据长度加 format 长度成正比，而不是与 LV
+ * 长度或嵌套层数的乘积成正比
+ */
+static double time_unpack(uint8_t *buf, int len, char const *format,
+        void *out, int rounds)
+{
+    double start, t, best = 1e30;
+    int i, k;
+
+    for (k = 0; k < 5; ++k)
+    {
+        start = now_ns();
+        for (i = 0; i < rounds; ++i)
+            if (unpackf(buf, len, format, out) < 0)
+                abort();
+        if ((t = now_ns() - start) < best)
+            best = t;
+    }
+
+    return best;
+}
+
+static uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+
+    return *s;
+}
+
+static void bench_adversarial(void)
+{
+    struct packf_limits limits = { 32, 10000, 1 << 20 };
+    static char deep[8192], wide[4096];
+    static uint8_t buf[1 << 16], data[1 << 16];
+    struct corpus c;
+    struct record r;
+    double start, t, t_deep[2];
+    uint16_t n;
+    int32_t x;
+    int i, j, k, m, pos, len, ok, bad;
+    uint32_t seed = 12345;
+
+    /* 65535 个 0 字节的结构体元素 */
+    buf[0] = 0xFF;
+    buf[1] = 0xFF;
+    t = time_unpack(buf, 2, "[=65535[0s 0S]]", &n, BENCH_ROUNDS * 100);
+    report("zero width elems x65535", t, BENCH_ROUNDS * 100,
+            2L * BENCH_ROUNDS * 100);
+    assert(unpackf_limited(buf, 2, &limits, "[=65535[0s 0S]]", &n) ==
+            PACKF_OVER_LIMIT);
+
+    /* 嵌套 1000 层和 4000 层，时间应与层数成正比 */
+    x = 1;
+    for (k = 1000; k <= 4000; k *= 4)
+    {
+        for (i = 0; i < k; ++i)
+            deep[i] = '[';
+        deep[i++] = 'd';
+        for (j = 0; j < k; ++j)
+            deep[i++] = ']';
+        deep[i] = '\0';
+        assert(packf(buf, sizeof(buf), deep, &x) == 4);
+        t_deep[k / 4000] = time_unpack(buf, 4, deep, &x, BENCH_ROUNDS);
+        report(k == 1000 ? "nested x1000" : "nested x4000",
+                t_deep[k / 4000], BENCH_ROUNDS, 4L * BENCH_ROUNDS);
+        assert(unpackf_limited(buf, 4, &limits, deep, &x) ==
+                PACKF_OVER_LIMIT);
+    }
+    /* 层数的平方时为 16 倍 */
+    assert(t_deep[1] < 8 * t_deep[0]);
+
+    /* 元素内层 format 很长的结构体数组，每个元素都要跳过内层的 ']' */
+    pos = sprintf(wide, "[=4000[c");
+    for (i = 0; i < 100; ++i)
+        pos += sprintf(wide + pos, " [0c]");
+    sprintf(wide + pos, "]]");
+    len = 2 + 4000;
+    memset(buf, 0, len);
+    buf[0] = 4000 >> 8;
+    buf[1] = 4000 & 0xFF;
+    t = time_unpack(buf, len, wide, data, BENCH_ROUNDS);
+    report("struct array x4000", t, BENCH_ROUNDS, (long)len * BENCH_ROUNDS);
+
+    /* 随机改写已打包的消息，全部在限制内解包或者失败 */
+    corpus_build(&c);
+    ok = bad = 0;
+    start = now_ns();
+    for (k = 0; k < BENCH_ROUNDS / 10; ++k)
+    {
+        for (i = 0; i < BENCH_MSGS; ++i)
+        {
+            memcpy(data, c.buf + c.off[i], c.len[i]);
+            for (j = 0; j < 4; ++j)
+            {
+                m = xorshift(&seed) % c.len[i];
+                data[m] = (uint8_t)xorshift(&seed);
+            }
+            if (unpackf_limited(data, c.len[i], &limits, record_format,
+                        &r) < 0)
+                ++bad;
+            else
+                ++ok;
+        }
+    }
+    t = now_ns() - start;
+    report("fuzzed records", t, (long)BENCH_MSGS * (BENCH_ROUNDS / 10),
+            c.total * (BENCH_ROUNDS / 10));
+    printf("%-32s %10d ok %10d rejected\n", "", ok, bad);
+
+    free(c.buf);
+}
+
+/* 压缩的批输出到内存 */
+struct mem_out
+{
+    uint8_t    *buf;
+    int         len;
+    int         cap;
+};
+
+static int mem_write(void *ctx, void const *data, int len)
+{
+    struct mem_out *out = ctx;
+
+    if (out->len + len > out->cap)
+        return PACKF_OUT_OF_BUF;
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+
+    return 0;
+}
+
+/* 打包并压缩一批记录，再逐条解压解包，与 packf/unpackf 比较 */
+static void bench_lz(void)
+{
+    static char raw[PACKF_LZ_BLOCK], tmp[PACKF_LZ_BOUND(PACKF_LZ_BLOCK)];
+    static char block[PACKF_LZ_BLOCK];
+    static struct record recs[BENCH_MSGS];
+    struct packf_lz_writer w;
+    struct packf_lz_reader r;
+    struct packf_frame frame;
+    struct packf_sink sink;
+    struct mem_out out;
+    struct corpus c;
+    struct record rec;
+    char stage[4096];
+    double start, t, t_pack = 1e30, t_unpack = 1e30, t_c = 1e30, t_d = 1e30;
+    int i, k, n = 0;
+
+    corpus_build(&c);
+    for (i = 0; i < BENCH_MSGS; ++i)
+        record_fill(&recs[i], i);
+    out.cap = c.total * 2;
+    out.buf = malloc(out.cap);
+    assert(out.buf);
+
+    for (k = 0; k < 5; ++k)
+    {
+        out.len = 0;
+        start = now_ns();
+        packf_sink_init(&sink, stage, sizeof(stage), mem_write, &out);
+        packf_lz_writer_init(&w, &sink, raw, sizeof(raw), tmp);
+        for (i = 0; i < BENCH_MSGS; ++i)
+            if (packf_lz_write(&w, record_format, &recs[i]) < 0)
+                abort();
+        if (packf_lz_writer_flush(&w) < 0)
+            abort();
+        if ((t = now_ns() - start) < t_pack)
+            t_pack = t;
+
+        start = now_ns();
+        packf_lz_reader_init(&r, out.buf, out.len, block, sizeof(block));
+        for (n = 0; packf_lz_next(&r, &frame) == 1; ++n)
+            if (unpackf(frame.data, frame.len, record_format, &rec) < 0)
+                abort();
+        if ((t = now_ns() - start) < t_unpack)
+            t_unpack = t;
+        assert(n == BENCH_MSGS);
+
+        /* 只有压缩和解压，整个语料为一块 */
+        start = now_ns();
+        n = packf_lz_compress(c.buf, c.total, out.buf, out.cap);
+        if ((t = now_ns() - start) < t_c)
+            t_c = t;
+        assert(n > 0);
+        start = now_ns();
+        if (packf_lz_decompress(out.buf, n, c.buf + c.total, c.total) !=
+                c.total)
+            abort();
+        if ((t = now_ns() - start) < t_d)
+            t_d = t;
+    }
+
+    report("packf_lz_write", t_pack, BENCH_MSGS, c.total);
+    report("packf_lz_next + unpackf", t_unpack, BENCH_MSGS, c.total);
+    report("packf_lz_compress", t_c, 1, c.total);
+    report("packf_lz_decompress", t_d, 1, c.total);
+    printf("%-32s %10ld raw %10ld lz  ratio %.2f\n", "", (long)w.raw_total,
+            (long)w.lz_total, (double)w.raw_total / w.lz_total);
+
+    free(out.buf);
+    free(c.buf);
+}
+
+/* 价格数组按 F、定点小数 d.4 和半精度浮点 h 打包解包 */
+static double time_numeric(char const *format, double *px, float *temp,
+        uint8_t *buf, int *len)
+{
+    double start, t, best = 1e30;
+    int i, k;
+
+    for (k = 0; k < 5; ++k)
+    {
+        start = now_ns();
+        for (i = 0; i < BENCH_ROUNDS * 10; ++i)
+        {
+            if ((*len = packf(buf, 65536, format, px, temp)) < 0)
+                abort();
+            if (unpackf(buf, *len, format, px, temp) < 0)
+                abort();
+        }
+        if ((t = now_ns() - start) < best)
+            best = t;
+    }
+
+    return best;
+}
+
+static void bench_numeric(void)
+{
+    static double px[1024];
+    static float temp[1024];
+    static uint8_t buf[65536];
+    static char const *formats[] = { "1024F 1024f", "1024d.4 1024h" };
+    double t;
+    int i, k, len;
+
+    for (k = 0; k < 2; ++k)
+    {
+        for (i = 0; i < 1024; ++i)
+        {
+            px[i]   = (1000000 + i * 37) / 1e4;
+            temp[i] = 20.0f + (i % 64) * 0.125f;
+        }
+        t = time_numeric(formats[k], px, temp, buf, &len);
+        report(formats[k], t, BENCH_ROUNDS * 10,
+                (long)len * BENCH_ROUNDS * 10);
+        printf("%-32s %10d bytes\n", "", len);
+    }
+}
+
+/* 读出 socket 中的全部数据，直到对端关闭 */
+static void *io_drain(void *arg)
+{
+    static char buf[1 << 16];
+    long total = 0;
+    ssize_t n;
+
+    while ((n = read(*(int *)arg, buf, sizeof(buf))) > 0)
+        total += n;
+
+    return (void *)total;
+}
+
+/* 每条消息一次 write 与 packf_io 批量发送 */
+static void bench_io(void)
+{
+    static char const *names[] = { "packf + write", "packf_io (poll)",
+        "packf_io (io_uring)" };
+    static struct record recs[BENCH_MSGS];
+    struct packf_io *io;
+    uint8_t buf[4096];
+    pthread_t tid;
+    void *total;
+    double start, t;
+    int sv[2], i, k, len;
+
+    for (i = 0; i < BENCH_MSGS; ++i)
+        record_fill(&recs[i], i);
+
+    for (k = 0; k < 3; ++k)
+    {
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        assert(pthread_create(&tid, NULL, io_drain, &sv[1]) == 0);
+        io = k ? packf_io_open(sv[0], 8, 65536, k == 1 ? PACKF_IO_POLL : 0) :
+            NULL;
+        if (k == 2 && packf_io_backend(io) != PACKF_IO_URING)
+        {
+            printf("%-32s %10s\n", names[k], "n/a");
+            packf_io_close(io);
+            io = NULL;
+        }
+
+        start = now_ns();
+        for (i = 0; i < BENCH_MSGS * BENCH_ROUNDS && (k < 2 || io); ++i)
+        {
+            if (!io)
+            {
+                len = packf_frame(buf, sizeof(buf), 2, record_format,
+                        &recs[i % BENCH_MSGS]);
+                if (len < 0 || write(sv[0], buf, len) != len)
+                    abort();
+            }
+            else if (packf_io_send(io, record_format,
+                        &recs[i % BENCH_MSGS]) < 0)
+                abort();
+        }
+        if (io && packf_io_flush(io) < 0)
+            abort();
+        t = now_ns() - start;
+
+        packf_io_close(io);
+        shutdown(sv[0], SHUT_WR);
+        pthread_join(tid, &total);
+        close(sv[0]);
+        close(sv[1]);
+        if (k < 2 || (long)total)
+            report(names[k], t, (long)BENCH_MSGS * BENCH_ROUNDS, (long)total);
+    }
+}
+
+# define MPSC_PRODUCERS 4
+# define MPSC_BUF       (1 << 20)
+
+/* 生产者共享的发送缓冲区：互斥锁或 packf_mpsc */
+struct mpsc_bench
+{
+    pthread_mutex_t     lock;
+    char               *buf;
+    int                 len;
+    struct packf_mpsc  *q;
+    struct record      *recs;
+    int                 done;
+    long                total;
+};
+
+/* 消费者把数据拷贝到连接的缓冲区中（代替 write） */
+static int mpsc_out(void *ctx, void const *data, int len)
+{
+    static char out[MPSC_BUF];
+
+    memcpy(out, data, len);
+    ((struct mpsc_bench *)ctx)->total += len;
+
+    return 0;
+}
+
+static void *mpsc_lock_producer(void *arg)
+{
+    struct mpsc_bench *b = arg;
+    uint8_t buf[4096];
+    int i, len;
+
+    for (i = 0; i < BENCH_MSGS * BENCH_ROUNDS / MPSC_PRODUCERS; ++i)
+    {
+        len = packf_frame(buf, sizeof(buf), 2, record_format,
+                &b->recs[i % BENCH_MSGS]);
+        if (len < 0)
+            abort();
+        pthread_mutex_lock(&b->lock);
+        while (b->len + len > MPSC_BUF)
+        {
+            pthread_mutex_unlock(&b->lock);
+            sched_yield();
+            pthread_mutex_lock(&b->lock);
+        }
+        memcpy(b->buf + b->len, buf, len);
+        b->len += len;
+        pthread_mutex_unlock(&b->lock);
+    }
+    __atomic_add_fetch(&b->done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+static void *mpsc_ring_producer(void *arg)
+{
+    struct mpsc_bench *b = arg;
+    int i;
+
+    for (i = 0; i < BENCH_MSGS * BENCH_ROUNDS / MPSC_PRODUCERS; ++i)
+        if (packf_mpsc_pack(b->q, 512, record_format,
+                    &b->recs[i % BENCH_MSGS]) < 0)
+            abort();
+    __atomic_add_fetch(&b->done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/* 多个线程向同一个连接发送：打包后加锁追加与 packf_mpsc 直接打包 */
+static void bench_mpsc(void)
+{
+    static struct record recs[BENCH_MSGS];
+    static struct mpsc_bench b;
+    pthread_t tids[MPSC_PRODUCERS];
+    double start, t;
+    int i, k, last;
+
+    for (i = 0; i < BENCH_MSGS; ++i)
+        record_fill(&recs[i], i);
+
+    pthread_mutex_init(&b.lock, NULL);
+    b.buf  = malloc(MPSC_BUF);
+    b.q    = packf_mpsc_new(MPSC_BUF);
+    b.recs = recs;
+    assert(b.buf && b.q);
+
+    for (k = 0; k < 2; ++k)
+    {
+        b.done  = 0;
+        b.total = 0;
+        start = now_ns();
+        for (i = 0; i < MPSC_PRODUCERS; ++i)
+            assert(pthread_create(&tids[i], NULL, k ? mpsc_ring_producer :
+                        mpsc_lock_producer, &b) == 0);
+        do
+        {
+            last = __atomic_load_n(&b.done, __ATOMIC_ACQUIRE) ==
+                MPSC_PRODUCERS;
+            if (k)
+            {
+                if (packf_mpsc_flush(b.q, mpsc_out, &b) < 0)
+                    abort();
+                continue;
+            }
+            pthread_mutex_lock(&b.lock);
+            mpsc_out(&b, b.buf, b.len);
+            b.len = 0;
+            pthread_mutex_unlock(&b.lock);
+        } while (!last);
+        t = now_ns() - start;
+        for (i = 0; i < MPSC_PRODUCERS; ++i)
+            pthread_join(tids[i], NULL);
+
+        report(k ? "packf_mpsc" : "packf + mutex append", t,
+                (long)BENCH_MSGS / MPSC_PRODUCERS * BENCH_ROUNDS *
+                MPSC_PRODUCERS, b.total);
+    }
+
+    packf_mpsc_free(b.q);
+    free(b.buf);
+    pthread_mutex_destroy(&b.lock);
+}
+
+/* 重复的 symbol/venue, 普通打包与批内字典，打包和解包一批 */
+static void bench_dict(void)
+{
+    static char const *syms[] = { "IBM", "MSFT", "AAPL", "GOOG", "ORCL" };
+    static char const *venues[] = { "XNYS", "XNAS" };
+    static uint8_t buf[BENCH_MSGS * 64];
+    static char const *names[] = { "-16s -32s D", "-16s@ -32s@ D" };
+    struct packf_dict *pd, *ud;
+    char sym[17], venue[33];
+    int64_t qty;
+    double t0, t1;
+    int k, r, i, pos, ret;
+
+    pd = packf_dict_new(64, 4096, 0);
+    ud = packf_dict_new(64, 0, PACKF_DICT_SHARED);
+    assert(pd && ud);
+
+    for (k = 0; k < 2; ++k)
+    {
+        t0 = now_ns();
+        for (r = 0; r < BENCH_ROUNDS; ++r)
+        {
+            packf_dict_reset(pd);
+            for (i = pos = 0; i < BENCH_MSGS; ++i, pos += ret)
+            {
+                ret = k ? packf_dict(buf + pos, 64, pd, names[k],
+                        syms[i % 5], venues[i % 2], (int64_t)i) :
+                    packf(buf + pos, 64, names[k], syms[i % 5],
+                            venues[i % 2], (int64_t)i);
+                assert(ret > 0);
+            }
+        }
+        t1 = now_ns();
+        report(k ? "pack dict" : "pack", t1 - t0,
+                (long)BENCH_ROUNDS * BENCH_MSGS, (long)pos * BENCH_ROUNDS);
+
+        t0 = now_ns();
+        for (r = 0; r < BENCH_ROUNDS; ++r)
+        {
+            packf_dict_reset(ud);
+            for (i = pos = 0; i < BENCH_MSGS; ++i, pos += ret)
+            {
+                ret = k ? unpackf_dict(buf + pos, sizeof(buf) - pos, ud,
+                        names[k], sym, venue, &qty) :
+                    unpackf(buf + pos, sizeof(buf) - pos, names[k], sym,
+                            venue, &qty);
+                assert(ret > 0);
+            }
+        }
+        t1 = now_ns();
+        report(k ? "unpack dict" : "unpack", t1 - t0,
+                (long)BENCH_ROUNDS * BENCH_MSGS, (long)pos * BENCH_ROUNDS);
+        printf("%-32s %10d bytes\n", names[k], pos);
+    }
+
+    packf_dict_free(pd);
+    packf_dict_free(ud);
+}
+
+/* 记录转换为 JSON: unpackf 后逐个字段 snprintf 与 packf_text */
+static int text_printf(struct record const *r, char *out, int max)
+{
+    int n, j;
+
+    n = snprintf(out, max, "{\"r\":{\"id\":%lld,\"type\":%d,\"name\":\"%s\","
+            "\"vals\":[", (long long)r->id, r->type, r->name);
+    for (j = 0; j < r->nvals; ++j)
+        n += snprintf(out + n, max - n, j ? ",%d" : "%d", r->vals[j]);
+    n += snprintf(out + n, max - n, "],\"legs\":[");
+    for (j = 0; j < 8; ++j)
+        n += snprintf(out + n, max - n, "%s{\"w\":%d,\"d\":%d}",
+                j ? "," : "", r->legs[j].w, r->legs[j].d);
+    n += snprintf(out + n, max - n, "],\"price\":%.17g}}\n", r->price);
+
+    return n;
+}
+
+static void bench_text(void)
+{
+    static char out[8192];
+    struct packf_text *t;
+    struct corpus c;
+    struct record r;
+    double start, el, t_printf = 1e30, t_text = 1e30;
+    long text_bytes = 0, printf_bytes = 0;
+    int i, k, m, rounds = BENCH_ROUNDS / 10;
+
+    corpus_build(&c);
+    t = packf_text_new(record_format,
+            "r[id, type, name, vals, legs[w, d], price]", PACKF_TEXT_JSON);
+    assert(t);
+
+    for (k = 0; k < 5; ++k)
+    {
+        printf_bytes = 0;
+        start = now_ns();
+        for (i = 0; i < BENCH_MSGS * rounds; ++i)
+        {
+            m = i % BENCH_MSGS;
+            if (unpackf(c.buf + c.off[m], c.len[m], record_format, &r) < 0)
+                abort();
+            printf_bytes += text_printf(&r, out, sizeof(out));
+        }
+        if ((el = now_ns() - start) < t_printf)
+            t_printf = el;
+
+        text_bytes = 0;
+        start = now_ns();
+        for (i = 0; i < BENCH_MSGS * rounds; ++i)
+        {
+            m = i % BENCH_MSGS;
+            text_bytes += packf_text(t, c.buf + c.off[m], c.len[m], out,
+                    sizeof(out));
+        }
+        if ((el = now_ns() - start) < t_text)
+            t_text = el;
+    }
+
+    report("unpackf + snprintf", t_printf, (long)BENCH_MSGS * rounds,
+            printf_bytes);
+    report("packf_text", t_text, (long)BENCH_MSGS * rounds, text_bytes);
+
+    packf_text_free(t);
+    free(c.buf);
+}
+
+/*
+ * 大块数据的打包对工作集的影响：每次打包一个大的数组之后，遍历一次 cache
+ * 中的工作集（小于 L2），比较普通拷贝和非临时存储时打包和遍历的时间
+ */
+# define BULK_HOT       (256 * 1024)
+# define BULK_PAYLOAD   (16 * 1024 * 1024)
+
+static uint64_t bulk_hot_pass(uint64_t const *hot)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < BULK_HOT / 8; i += 8)
+        sum += hot[i];
+
+    return sum;
+}
+
+static void bench_bulk(void)
+{
+    static char const *formats[] = { "16777216c",
+        "4194304d" };
+    size_t saved = packf_bulk_threshold, thresholds[2];
+    uint64_t *hot, sum = 0;
+    char *payload, *buf, name[64];
+    double start, t_pack, t_unpack, t_hot;
+    int k, m, r, rounds = 20;
+
+    hot     = malloc(BULK_HOT);
+    payload = malloc(BULK_PAYLOAD);
+    buf     = malloc(BULK_PAYLOAD + 16);
+    assert(hot && payload && buf);
+    memset(hot, 1, BULK_HOT);
+    memset(payload, 7, BULK_PAYLOAD);
+    memset(buf, 0, BULK_PAYLOAD + 16);
+
+    t_hot = 1e30;
+    for (r = 0; r < rounds; ++r)
+    {
+        start = now_ns();
+        sum += bulk_hot_pass(hot);
+        if (now_ns() - start < t_hot)
+            t_hot = now_ns() - start;
+    }
+    printf("%-32s %10.1f ns/pass\n", "working set alone", t_hot);
+
+    /* 自动设置的阈值可能大于 BULK_PAYLOAD, 这里强制使用非临时存储 */
+    thresholds[0] = 0;
+    thresholds[1] = 1;
+    for (k = 0; k < 2; ++k)
+    {
+        for (m = 0; m < 2; ++m)
+        {
+            packf_bulk_threshold = thresholds[m];
+            t_pack = t_unpack = t_hot = 0;
+            for (r = 0; r < rounds; ++r)
+            {
+                bulk_hot_pass(hot);
+                start = now_ns();
+                if (packf(buf + 1, BULK_PAYLOAD, formats[k], payload) < 0)
+                    abort();
+                t_pack += now_ns() - start;
+                start = now_ns();
+                sum += bulk_hot_pass(hot);
+                t_hot += now_ns() - start;
+
+                start = now_ns();
+                if (unpackf(buf + 1, BULK_PAYLOAD, formats[k], payload) < 0)
+                    abort();
+                t_unpack += now_ns() - start;
+                start = now_ns();
+                sum += bulk_hot_pass(hot);
+                t_hot += now_ns() - start;
+            }
+
+            snprintf(name, sizeof(name), "pack %s%s", formats[k],
+                    m ? " stream" : "");
+            report(name, t_pack, rounds, (long)BULK_PAYLOAD * rounds);
+            snprintf(name, sizeof(name), "unpack %s%s", formats[k],
+                    m ? " stream" : "");
+            report(name, t_unpack, rounds, (long)BULK_PAYLOAD * rounds);
+            printf("%-32s %10.1f ns/pass\n", "working set after", t_hot /
+                    (2 * rounds));
+        }
+    }
+    printf("%-32s %10zu bytes (checksum %llu)\n", "threshold", saved,
+            (unsigned long long)sum);
+
+    packf_bulk_threshold = saved;
+    free(hot);
+    free(payload);
+    free(buf);
+}
+
+/* 每条消息只有少数字段变化的状态：完整打包与增量编码 */
+# define DELTA_FIELDS   24
+
+static void bench_delta(void)
+{
+    static uint8_t buf[BENCH_MSGS * 256];
+    static int32_t states[BENCH_MSGS][DELTA_FIELDS];
+    char format[DELTA_FIELDS * 2 + 3], *f = format;
+    struct packf_delta *d;
+    int32_t cur[DELTA_FIELDS], rx[DELTA_FIELDS];
+    double t0, t1;
+    int k, r, i, pos, ret;
+
+    *f++ = '[';
+    for (i = 0; i < DELTA_FIELDS; ++i)
+        f += sprintf(f, i ? " d" : "d");
+    d = packf_delta_new(format + 1);
+    strcpy(f, "]");
+    assert(d);
+
+    /* 每一步有 2 个字段变化 */
+    memset(cur, 0, sizeof(cur));
+    for (i = 0; i < BENCH_MSGS; ++i)
+    {
+        cur[i * 7 % DELTA_FIELDS] += i;
+        cur[(i * 13 + 5) % DELTA_FIELDS] -= i;
+        memcpy(states[i], cur, sizeof(cur));
+    }
+
+    for (k = 0; k < 2; ++k)
+    {
+        t0 = now_ns();
+        for (r = 0; r < BENCH_ROUNDS; ++r)
+        {
+            for (i = pos = 0; i < BENCH_MSGS; ++i, pos += ret)
+            {
+                ret = k ? packf_delta(d, buf + pos, 256,
+                        i ? states[i - 1] : NULL, states[i]) :
+                    packf(buf + pos, 256, format, states[i]);
+                assert(ret > 0);
+            }
+        }
+        t1 = now_ns();
+        report(k ? "pack delta" : "pack", t1 - t0,
+                (long)BENCH_ROUNDS * BENCH_MSGS, (long)pos * BENCH_ROUNDS);
+
+        t0 = now_ns();
+        for (r = 0; r < BENCH_ROUNDS; ++r)
+        {
+            for (i = pos = 0; i < BENCH_MSGS; ++i, pos += ret)
+            {
+                ret = k ? unpackf_delta(d, buf + pos, sizeof(buf) - pos, rx,
+                        NULL) :
+                    unpackf(buf + pos, sizeof(buf) - pos, format, rx);
+                assert(ret > 0);
+            }
+        }
+        t1 = now_ns();
+        assert(memcmp(rx, states[BENCH_MSGS - 1], sizeof(rx)) == 0);
+        report(k ? "unpack delta" : "unpack", t1 - t0,
+                (long)BENCH_ROUNDS * BENCH_MSGS, (long)pos * BENCH_ROUNDS);
+        printf("%-32s %10d bytes\n", k ? "delta" : "full", pos);
+    }
+
+    packf_delta_free(d);
+}
+
+int main(void)
+{
+    printf("== trusted unpack ==\n");
+    bench_trusted();
+    printf("== adversarial unpack ==\n");
+    bench_adversarial();
+    printf("== lz batch ==\n");
+    bench_lz();
+    printf("== numeric ==\n");
+    bench_numeric();
+    printf("== batched io ==\n");
+    bench_io();
+    printf("== multi-producer ==\n");
+    bench_mpsc();
+    printf("== string dictionary ==\n");
+    bench_dict();
+    printf("== json transcode ==\n");
+    bench_text();
+    printf("== bulk copy ==\n");
+    bench_bulk();
+    printf("== field delta ==\n");
+    bench_delta();
+
+    return 0;
+}
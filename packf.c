@@ -13,13 +13,20 @@
 # endif
 
 # include <stdio.h>
+# include <stdlib.h>
 # include <string.h>
+# include <limits.h>
 # include <stdarg.h>
+# include <sys/uio.h>
+# include <unistd.h>
+# include <errno.h>
+# include <pthread.h>
 
 # include "packf.h"
 
 # define FROM_ARG 1
 # define FROM_PTR 2
+# define FROM_ONE 3     /* 和 FROM_PTR 相同，但只处理 format 中的第一个字段 */
 
 static char const *err_msg[] =
 {
@@ -29,6 +36,11 @@ static char const *err_msg[] =
     "expect format",
     "be cut off",
     "null pointer",
+    "no memory",
+    "bad checksum",
+    "bad data",
+    "io error",
+    "over limit",
 };
 
 char *packf_error_format = NULL;
@@ -42,7 +54,7 @@ int packf_print_error = 0;
 # define PRINT_ERR_FMT(ret) do {                                        \
     if ((ret) < 0 && packf_print_error)                                 \
     {                                                                   \
-        fprintf(stderr, "%s: %s", __func__, err_msg[-(ret) - 1]);       \
+        fprintf(stderr, "%s: %s", __func__, packf_strerror(ret));       \
         if (packf_print_error && packf_error_format)                    \
             fprintf(stderr, ": %s\n", packf_error_format);              \
         else                                                            \
@@ -52,7 +64,7 @@ int packf_print_error = 0;
 
 # define ERR_RET_PRINT(ret) do {                                        \
     if (packf_print_error)                                              \
-        fprintf(stderr, "%s: %s\n", __func__, err_msg[-(ret) - 1]);     \
+        fprintf(stderr, "%s: %s\n", __func__, packf_strerror(ret));     \
     return ret;                                                         \
 } while (0)
 
@@ -66,6 +78,11 @@ int packf_print_error = 0;
     if (__ret < 0) return __ret;                                        \
 } while (0)
 
+# define NEG_FMT(x) do {                                                \
+    int __ret = (x);                                                    \
+    if (__ret < 0) ERR_RET_FMT(__ret);                                  \
+} while (0)
+
 # include <endian.h>
 # include <byteswap.h>
 
@@ -131,7 +148,135 @@ static double __bswap_d(double x)
 
 # define NO_SWAP(x) (x)
 
+# ifdef __GNUC__
+#  define UNLIKELY(x) __builtin_expect(!!(x), 0)
+# else
+#  define UNLIKELY(x) (x)
+# endif
+
+/*
+ * CRC32C (Castagnoli), 使用 SSE4.2 或 ARMv8 的 CRC 指令计算，
+ * 不支持时使用查表法（slicing-by-8）。
+ */
+static uint32_t __crc_table[8][256];
+static pthread_once_t __crc_once = PTHREAD_ONCE_INIT;
+
+static void __crc_init(void)
+{
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; ++i)
+    {
+        c = i;
+        for (j = 0; j < 8; ++j)
+            c = (c >> 1) ^ (c & 1 ? 0x82f63b78 : 0);
+        __crc_table[0][i] = c;
+    }
+    for (i = 0; i < 256; ++i)
+        for (j = 1; j < 8; ++j)
+            __crc_table[j][i] = (__crc_table[j - 1][i] >> 8) ^
+                __crc_table[0][__crc_table[j - 1][i] & 0xff];
+}
+
+static uint32_t __crc32c_sw(uint32_t crc, uint8_t const *p, size_t n)
+{
+    /* 多个线程第一次同时计算时，只有一个建表，其余等待建表完成 */
+    pthread_once(&__crc_once, __crc_init);
+
+# if __BYTE_ORDER == __LITTLE_ENDIAN
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t v;
+
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = __crc_table[7][v & 0xff] ^
+            __crc_table[6][(v >> 8) & 0xff] ^
+            __crc_table[5][(v >> 16) & 0xff] ^
+            __crc_table[4][(v >> 24) & 0xff] ^
+            __crc_table[3][(v >> 32) & 0xff] ^
+            __crc_table[2][(v >> 40) & 0xff] ^
+            __crc_table[1][(v >> 48) & 0xff] ^
+            __crc_table[0][v >> 56];
+    }
+# endif
+    for (; n; --n, ++p)
+        crc = __crc_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+# if defined(__x86_64__) && defined(__GNUC__)
+#  include <nmmintrin.h>
+#  define HAVE_CRC_HW
+
+__attribute__((target("sse4.2")))
+static uint32_t __crc32c_hw(uint32_t crc, uint8_t const *p, size_t n)
+{
+    uint64_t c = crc, v;
+
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; n; --n, ++p)
+        c = _mm_crc32_u8((uint32_t)c, *p);
+
+    return (uint32_t)c;
+}
+
+static int __crc_hw(void)
+{
+    static int cached = -1;
+    int hw = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+
+    if (hw < 0)
+    {
+        hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+        __atomic_store_n(&cached, hw, __ATOMIC_RELAXED);
+    }
+
+    return hw;
+}
+# elif defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define HAVE_CRC_HW
+
+static uint32_t __crc32c_hw(uint32_t crc, uint8_t const *p, size_t n)
+{
+    uint64_t v;
+
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    for (; n; --n, ++p)
+        crc = __crc32cb(crc, *p);
+
+    return crc;
+}
+
+#  define __crc_hw() 1
+# endif
+
+uint32_t packf_crc32c(uint32_t crc, void const *buf, size_t len)
+{
+    crc = ~crc;
+# ifdef HAVE_CRC_HW
+    if (__crc_hw())
+        crc = __crc32c_hw(crc, buf, len);
+    else
+# endif
+        crc = __crc32c_sw(crc, buf, len);
+
+    return ~crc;
+}
+
 # define __ISDIGIT(c) ((c) >= '0' && (c) <= '9')
+# define __ISCODEC(c) ((c) == '%' || (c) == '+' || (c) == '^')
 
 static inline int __atoi(char *s, size_t n)
 {
@@ -144,12 +289,152 @@ static inline int __atoi(char *s, size_t n)
     return r;
 }
 
-static int __struct_len_locale(char const *format)
+# define DEC_MAX_SCALE  18
+
+/* 解析 type 之后的定点小数的 .<scale>, 没有时返回 -1 */
+static inline int __dec_scale(char **fp)
 {
-    int len = 0, u_len, num, bracket_stack;
-    char *f = (char *)format, *__f, *str_num, type;
+    char *f = *fp, *str_num;
 
-    while (*f)
+    if (*f != '.')
+        return -1;
+
+    str_num = ++f;
+    while (__ISDIGIT(*f))
+        ++f;
+    *fp = f;
+    if (str_num == f || f - str_num > 2 ||
+            __atoi(str_num, f - str_num) > DEC_MAX_SCALE)
+        return PACKF_NOT_FORMAT;
+
+    return __atoi(str_num, f - str_num);
+}
+
+/*
+ * 本地结构体的长度。arena 不为 0 时按 arena 解包的布局计算：除了 LV 结构体
+ * 以外的 LV 字段在结构体中只占长度和一个指针。
+ */
+static int __struct_len_locale(char const *format, int arena);
+
+/* 解析 *fp 处的一个字段，返回它的本地长度，*fp 移到字段之后 */
+static int __field_len_locale(char **fp, int arena)
+{
+    int len = 0, u_len, num, bracket_stack, lv, has_num, bits = 0, scale;
+    char *f = *fp, *__f = f, *str_num, type;
+
+    if (*f == '?')
+    {
+        len += sizeof(uint64_t);
+        ++f;
+    }
+
+    lv = 0;
+    if (*f == '-')
+    {
+        len += 1;
+        lv = 1;
+        ++f;
+    }
+    else if (*f == '=')
+    {
+        len += 2;
+        lv = 1;
+        ++f;
+    }
+
+    str_num = f;
+    while (__ISDIGIT(*f))
+        ++f;
+    has_num = str_num != f;
+    if (!has_num)
+        num = 1;
+    else
+        num = __atoi(str_num, f - str_num);
+
+    type = *(f++);
+    if (!type)
+        ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+    if (type == 'b')
+    {
+        str_num = f;
+        while (__ISDIGIT(*f))
+            ++f;
+        if (str_num != f)
+            bits = __atoi(str_num, f - str_num);
+    }
+    scale = __dec_scale(&f);
+    if (scale != -1 && (scale < 0 || (type != 'c' && type != 'w' &&
+                    type != 'd' && type != 'D')))
+        ERR_RET_FMT(PACKF_NOT_FORMAT);
+    if (__ISCODEC(*f))
+        ++f;
+    if (*f == '@')
+        ++f;
+    if (arena && lv && type != 'a' && (type != '[' || has_num))
+    {
+        len += sizeof(void *);
+        num = 0;
+    }
+
+    switch (type)
+    {
+        case 'a':
+        case 'c':
+        case 's':
+        case 'S':
+            u_len = 1;
+            break;
+        case 'w':
+            u_len = 2;
+            break;
+        case 'd':
+        case 'f':
+        case 'h':
+            u_len = 4;
+            break;
+        case 'D':
+        case 'F':
+            u_len = 8;
+            break;
+        case 'b':
+            if (lv || bits < 1 || bits > 63)
+                ERR_RET_FMT(PACKF_NOT_FORMAT);
+            u_len = bits <= 8 ? 1 : (bits <= 16 ? 2 : (bits <= 32 ? 4 : 8));
+            break;
+        case '[':
+            NEG_RET(u_len = __struct_len_locale(f, arena));
+            bracket_stack = 1;
+            while (bracket_stack)
+            {
+                if (!(*f))
+                    ERR_RET_FMT(PACKF_NOT_MATCH);
+                else if (*f == '[')
+                    ++bracket_stack;
+                else if (*f == ']')
+                    --bracket_stack;
+
+                ++f;
+            }
+
+            break;
+        default:
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+    }
+
+    /* 定点小数在本地为 double */
+    if (scale != -1)
+        u_len = sizeof(double);
+    *fp = f;
+
+    return len + num * u_len;
+}
+
+static int __struct_len_locale(char const *format, int arena)
+{
+    int len = 0, u_len;
+    char *f = (char *)format;
+
+    while (*f && *f != ']')
     {
         if (*f == ' ')
         {
@@ -157,153 +442,5607 @@ static int __struct_len_locale(char const *format)
             continue;
         }
 
-        __f = f;
+        NEG_RET(u_len = __field_len_locale(&f, arena));
+        len += u_len;
+    }
 
-        if (*f == '-')
-        {
-            len += 1;
-            ++f;
-        }
-        else if (*f == '=')
+    return  len;
+}
+
+/*
+ * 可选字段的结构体 ?[...]: 网络上先是 (字段数 + 7) / 8 字节的位图，第 i 个
+ * 字段对应第 i / 8 字节的第 i % 8 位（低位在前），之后只有位图中为 1 的字段。
+ * 解析时预先记录每个字段的 format 和本地偏移，按位图直接跳到存在的字段。
+ */
+# define OPT_MAX_FIELDS 64
+
+struct __opt
+{
+    int                         n;      /* 字段数 */
+    int                         len;    /* 本地结构体长度，不含掩码 */
+    char const                 *f[OPT_MAX_FIELDS];
+    int                         off[OPT_MAX_FIELDS];
+    char const                 *format; /* 打包时缓存的键 */
+    struct __opt               *next;
+};
+
+/* format 为 '[' 之后的格式 */
+static int __opt_build(char const *format, int arena, struct __opt *opt)
+{
+    char *f = (char *)format, *__f = f;
+    int u_len;
+
+    opt->n   = 0;
+    opt->len = 0;
+    while (*f != ']')
+    {
+        if (!*f)
+            ERR_RET_FMT(PACKF_NOT_MATCH);
+        if (*f == ' ')
         {
-            len += 2;
             ++f;
+            continue;
         }
+        if (opt->n == OPT_MAX_FIELDS)
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
 
-        str_num = f;
-        while (__ISDIGIT(*f))
-            ++f;
-        if (str_num == f)
-            num = 1;
-        else
-            num = __atoi(str_num, f - str_num);
+        __f = f;
+        opt->f[opt->n]   = f;
+        opt->off[opt->n] = opt->len;
+        NEG_RET(u_len = __field_len_locale(&f, arena));
+        opt->len += u_len;
+        ++opt->n;
+    }
 
-        type = *(f++);
-        if (!type)
-            ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+    return 0;
+}
 
-        switch (type)
-        {
-            case 'a':
-            case 'c':
-            case 's':
-                u_len = 1;
-                break;
-            case 'w':
-                u_len = 2;
-                break;
-            case 'd':
-            case 'f':
-                u_len = 4;
-                break;
-            case 'D':
-            case 'F':
-                u_len = 8;
-                break;
-            case '[':
-                NEG_RET(u_len = __struct_len_locale(f));
-                bracket_stack = 1;
-                while (bracket_stack)
-                {
-                    if (!(*f))
-                        ERR_RET_FMT(PACKF_NOT_MATCH);
-                    else if (*f == '[')
-                        ++bracket_stack;
-                    else if (*f == ']')
-                        --bracket_stack;
+/*
+ * 网络序数据可以分布在多个不连续的段中（例如环形缓冲区回绕时的两段），
+ * seg 为 NULL 时表示数据是连续的。只有跨越段边界的字段才走慢速路径。
+ */
+struct __seg
+{
+    struct iovec const *iov;
+    int                 cnt;
+    int                 idx;
+    struct packf_sink  *sink;   /* 不为 NULL 时 iov 为 sink 的缓冲区 */
+};
 
-                    ++f;
-                }
+# define SEG_LEFT(p) ((int)((char *)seg->iov[seg->idx].iov_base +       \
+            seg->iov[seg->idx].iov_len - (char *)(p)))
 
-                break;
-            case ']':
-                return len;
-            default:
-                ERR_RET_FMT(PACKF_NOT_FORMAT);
-        }
+/*
+ * sink 的缓冲区已满：输出 pin 之前的数据，pin 之后的数据（还没有回填长度的
+ * LV 结构体）移到缓冲区开头。出错后丢弃数据，只是让打包继续走完。
+ */
+static void __sink_drain(struct packf_sink *sink, void **net)
+{
+    int len = (int)((char *)*net - sink->buf), keep = 0, ret;
+
+    if (sink->pin >= 0)
+        keep = len - (int)(sink->pin - sink->flushed);
+    if (!sink->err && keep == len)
+        sink->err = PACKF_OUT_OF_BUF;
+    if (!sink->err && (ret = sink->flush(sink->ctx, sink->buf, len - keep)) < 0)
+        sink->err = ret;
+    if (sink->err)
+    {
+        *net = sink->buf;
+        return;
+    }
+
+    memmove(sink->buf, sink->buf + len - keep, keep);
+    sink->flushed += len - keep;
+    *net = sink->buf + keep;
+}
+
+static void __seg_next(struct __seg *seg, void **net)
+{
+    while (SEG_LEFT(*net) == 0 && seg->idx + 1 < seg->cnt)
+        *net = seg->iov[++seg->idx].iov_base;
+    if (seg->sink && SEG_LEFT(*net) == 0)
+        __sink_drain(seg->sink, net);
+}
+
+static void __seg_put(struct __seg *seg, void **net, void const *src, int n)
+{
+    int k;
 
-        len += num * u_len;
+    while (n > 0)
+    {
+        __seg_next(seg, net);
+        if ((k = SEG_LEFT(*net)) == 0)
+            break;
+        if (k > n)
+            k = n;
+        memcpy(*net, src, k);
+        *net = (char *)*net + k;
+        src = (char const *)src + k;
+        n -= k;
     }
+}
 
-    return  len;
+static void __seg_put_at(struct __seg const *seg, void *p, int idx,
+        void const *src, int n)
+{
+    struct __seg at = *seg;
+
+    at.idx = idx;
+    __seg_put(&at, &p, src, n);
 }
 
-# define SET_LV_LEN(des) do {                                           \
-    IF_LESS(*left_len, lv_type);                                        \
-    if (lv_type == 1) *((uint8_t *)(des)) = (uint8_t)lv_len;            \
-    else *((uint16_t *)(des)) = htobe16((uint16_t)lv_len);              \
-    (des) = (char *)(des) + lv_type;                                    \
+static void __seg_get(struct __seg *seg, void **net, void *des, int n)
+{
+    int k;
+
+    while (n > 0)
+    {
+        __seg_next(seg, net);
+        if ((k = SEG_LEFT(*net)) == 0)
+            break;
+        if (k > n)
+            k = n;
+        memcpy(des, *net, k);
+        *net = (char *)*net + k;
+        des = (char *)des + k;
+        n -= k;
+    }
+}
+
+static void __seg_set(struct __seg *seg, void **net, int c, int n)
+{
+    int k;
+
+    while (n > 0)
+    {
+        __seg_next(seg, net);
+        if ((k = SEG_LEFT(*net)) == 0)
+            break;
+        if (k > n)
+            k = n;
+        memset(*net, c, k);
+        *net = (char *)*net + k;
+        n -= k;
+    }
+}
+
+static void __seg_skip(struct __seg *seg, void **net, int n)
+{
+    int k;
+
+    while (n > 0)
+    {
+        __seg_next(seg, net);
+        if ((k = SEG_LEFT(*net)) == 0)
+            break;
+        if (k > n)
+            k = n;
+        *net = (char *)*net + k;
+        n -= k;
+    }
+}
+
+static int __seg_strnlen(struct __seg const *cur, void *p, int max)
+{
+    struct __seg at = *cur, *seg = &at;
+    int len = 0, k;
+    char *end;
+
+    for (;;)
+    {
+        __seg_next(seg, &p);
+        if ((k = SEG_LEFT(p)) == 0)
+            break;
+        if (k > max - len)
+            k = max - len;
+        if ((end = memchr(p, '\0', k)))
+            return len + (int)(end - (char *)p);
+        len += k;
+        if (len == max)
+            break;
+        p = (char *)p + k;
+    }
+
+    return len;
+}
+
+# define NET_SPLIT(n) UNLIKELY(seg && SEG_LEFT(*net) < (int)(n))
+
+# define NET_PUT(src, n) do {                                           \
+    if (NET_SPLIT(n))                                                   \
+        __seg_put(seg, net, src, n);                                    \
+    else                                                                \
+    {                                                                   \
+        memcpy(*net, src, n);                                           \
+        *net = (char *)*net + (n);                                      \
+    }                                                                   \
 } while (0)
 
-# define SET_LV(des, src) do {                                          \
-    if (lv_type)                                                        \
+# define NET_GET(des, n) do {                                           \
+    if (NET_SPLIT(n))                                                   \
+        __seg_get(seg, net, des, n);                                    \
+    else                                                                \
     {                                                                   \
-        if (from == FROM_ARG) lv_len = va_arg(va, int);                 \
-        else                                                            \
-        {                                                               \
-            if (lv_type == 1) lv_len = *((uint8_t *)(src));             \
-            else lv_len = *((uint16_t *)(src));                         \
-            (src) = (char *)(src) + lv_type;                            \
-        }                                                               \
-        if (num != -1 && lv_len > num) ERR_RET_FMT(PACKF_BE_CUT_OFF);   \
-        SET_LV_LEN(des);                                                \
+        memcpy(des, *net, n);                                           \
+        *net = (char *)*net + (n);                                      \
     }                                                                   \
 } while (0)
 
-# define DO_PACKF(type1, type2, swap, swap_flag) do {                   \
-    SET_LV(*net, *locale);                                              \
-    if (num == -1 && !lv_type)                                          \
+# define NET_SET(c, n) do {                                             \
+    if (NET_SPLIT(n))                                                   \
+        __seg_set(seg, net, c, n);                                      \
+    else                                                                \
     {                                                                   \
-        IF_LESS(*left_len, sizeof(type1));                              \
-        if (from == FROM_ARG)                                           \
-            *((type1 *)(*net)) = swap((type1)(va_arg(va, type2)));      \
-        else                                                            \
-        {                                                               \
-            *((type1 *)(*net)) = swap(*((type1 *)(*locale)));           \
-            *locale = (char *)*locale + sizeof(type1);                  \
-        }                                                               \
-        *net = (char *)*net + sizeof(type1);                            \
+        memset(*net, c, n);                                             \
+        *net = (char *)*net + (n);                                      \
+    }                                                                   \
+} while (0)
+
+# define NET_SKIP(n) do {                                               \
+    if (NET_SPLIT(n))                                                   \
+        __seg_skip(seg, net, n);                                        \
+    else                                                                \
+        *net = (char *)*net + (n);                                      \
+} while (0)
+
+# define NET_STRNLEN(max) (NET_SPLIT(max) ?                             \
+        __seg_strnlen(seg, *net, max) : (int)strnlen(*net, max))
+
+# define NET_PUT_VAL(type, v) do {                                      \
+    if (NET_SPLIT(sizeof(type)))                                        \
+    {                                                                   \
+        type __v = (v);                                                 \
+        __seg_put(seg, net, &__v, sizeof(type));                        \
     }                                                                   \
     else                                                                \
     {                                                                   \
-        if (from == FROM_ARG)                                           \
-            src = va_arg(va, char *);                                   \
-        else                                                            \
-            src = *locale;                                              \
-        des = *net;                                                     \
-        array_size = lv_type ? lv_len : num;                            \
-        offset = sizeof(type1) * array_size;                            \
-        if (offset)                                                     \
+        *((type *)(*net)) = (v);                                        \
+        *net = (char *)*net + sizeof(type);                             \
+    }                                                                   \
+} while (0)
+
+# define NET_GET_VAL(type, v) do {                                      \
+    if (NET_SPLIT(sizeof(type)))                                        \
+        __seg_get(seg, net, &(v), sizeof(type));                        \
+    else                                                                \
+    {                                                                   \
+        (v) = *((type *)(*net));                                        \
+        *net = (char *)*net + sizeof(type);                             \
+    }                                                                   \
+} while (0)
+
+/* 数组按段内连续的部分批量转换，跨越段边界的单个元素单独处理 */
+# define NET_PUT_ARRAY(type, swap, src, n) do {                         \
+    for (i = 0; i < (n); )                                              \
+    {                                                                   \
+        k = seg ? SEG_LEFT(*net) / (int)sizeof(type) : (n) - i;         \
+        if (k > (n) - i)                                                \
+            k = (n) - i;                                                \
+        if (k)                                                          \
         {                                                               \
-            IF_LESS(*left_len, offset);                                 \
-            if (swap_flag)                                              \
-                for (i = 0; i < array_size; i++)                        \
-                    ((type1 *)des)[i] = swap(((type1 *)src)[i]);        \
-            else                                                        \
-                memcpy(des, src, offset);                               \
-            *net = (char *)*net + offset;                               \
+            type *__d = (type *)(*net), *__s = (type *)(src) + i;       \
+            for (j = 0; j < k; j++)                                     \
+                __d[j] = swap(__s[j]);                                  \
+            *net = (char *)*net + k * sizeof(type);                     \
+            i += k;                                                     \
         }                                                               \
-        if (from == FROM_PTR)                                           \
+        else                                                            \
         {                                                               \
-            if (lv_type && num)                                         \
-                *locale = (char *)*locale + num * sizeof(type1);        \
-            else                                                        \
-                *locale = (char *)*locale + offset;                     \
+            type __v = swap(((type *)(src))[i]);                        \
+            __seg_put(seg, net, &__v, sizeof(type));                    \
+            ++i;                                                        \
         }                                                               \
     }                                                                   \
 } while (0)
 
-static int __packf(void **net, int *left_len, char const *format, \
-        int from, va_list va, void **locale)
+# define NET_GET_ARRAY(type, swap, des, n) do {                         \
+    for (i = 0; i < (n); )                                              \
+    {                                                                   \
+        k = seg ? SEG_LEFT(*net) / (int)sizeof(type) : (n) - i;         \
+        if (k > (n) - i)                                                \
+            k = (n) - i;                                                \
+        if (k)                                                          \
+        {                                                               \
+            type *__d = (type *)(des) + i, *__s = (type *)(*net);       \
+            for (j = 0; j < k; j++)                                     \
+                __d[j] = swap(__s[j]);                                  \
+            *net = (char *)*net + k * sizeof(type);                     \
+            i += k;                                                     \
+        }                                                               \
+        else                                                            \
+        {                                                               \
+            type __v;                                                   \
+            __seg_get(seg, net, &__v, sizeof(type));                    \
+            ((type *)(des))[i] = swap(__v);                             \
+            ++i;                                                        \
+        }                                                               \
+    }                                                                   \
+} while (0)
+
+/*
+ * 格式中有 C 时，每处理完一个顶层字段就把新写入（或读取）的数据计入
+ * CRC, 数据还在缓存中，不需要在打包之后再扫描一遍。
+ */
+static uint32_t __crc_net(uint32_t crc, struct __seg *seg, void **done,
+        int *done_idx, void *net)
+{
+    struct iovec const *iov;
+
+    if (!seg || *done_idx == seg->idx)
+    {
+        crc = packf_crc32c(crc, *done, (char *)net - (char *)*done);
+    }
+    else
+    {
+        iov = &seg->iov[*done_idx];
+        crc = packf_crc32c(crc, *done, (char *)iov->iov_base + iov->iov_len -
+                (char *)*done);
+        while (++(*done_idx) < seg->idx)
+            crc = packf_crc32c(crc, seg->iov[*done_idx].iov_base,
+                    seg->iov[*done_idx].iov_len);
+        crc = packf_crc32c(crc, seg->iov[seg->idx].iov_base,
+                (char *)net - (char *)seg->iov[seg->idx].iov_base);
+    }
+    *done = net;
+
+    return crc;
+}
+
+# define CRC_UPDATE() do {                                              \
+    if (use_crc)                                                        \
+        crc = __crc_net(crc, seg, &crc_done, &crc_idx, *net);           \
+} while (0)
+
+/*
+ * 固定布局：不含 -/= 的 LV 字段，也不含不定长的 s/S 时，网络序数据的
+ * 长度和布局与 # pragma pack(1) 的本地结构体完全相同。此时预先计算出
+ * 需要转换字节序的位置（swap map），打包和解包只需要一次长度检查，然后
+ * 对字节序相同的部分整体拷贝，对需要转换的部分批量翻转字节序。
+ */
+enum
+{
+    FX_SWAP = 1,        /* 转换字节序，size 为元素长度 */
+    FX_ZERO,            /* a: 填充 '\0' */
+    FX_STR,             /* 定长 s: 以 '\0' 结尾，剩余部分填充 '\0' */
+};
+
+struct __fixed_op
+{
+    int         kind;
+    int         size;
+    int         offset;
+    int         count;
+};
+
+enum
+{
+    FX_NOT_FIXED    = -1,
+    FX_TOO_MANY_OPS = -2,
+};
+
+# define FX_STACK_OPS   32
+
+/* 与前一个操作相邻且类型相同时合并，下标小于 floor 的操作不参与合并 */
+static int __fixed_add(struct __fixed_op *ops, int *nops, int max_ops,
+        int floor, int kind, int size, int offset, int count)
+{
+    struct __fixed_op *last = *nops > floor ? &ops[*nops - 1] : NULL;
+
+    if (count == 0 || !ops)
+        return 0;
+
+    if (last && kind != FX_STR && last->kind == kind && last->size == size &&
+            last->offset + last->size * last->count == offset)
+    {
+        last->count += count;
+        return 0;
+    }
+
+    if (*nops == max_ops)
+        return FX_TOO_MANY_OPS;
+
+    ops[*nops].kind   = kind;
+    ops[*nops].size   = size;
+    ops[*nops].offset = offset;
+    ops[*nops].count  = count;
+    ++(*nops);
+
+    return 0;
+}
+
+static void __fixed_compact(struct __fixed_op *ops, int start, int *nops)
+{
+    int i, n = start;
+
+    for (i = start; i < *nops; ++i)
+    {
+        if (n > start && ops[i].kind != FX_STR &&
+                ops[n - 1].kind == ops[i].kind &&
+                ops[n - 1].size == ops[i].size &&
+                ops[n - 1].offset + ops[n - 1].size * ops[n - 1].count ==
+                ops[i].offset)
+            ops[n - 1].count += ops[i].count;
+        else
+            ops[n++] = ops[i];
+    }
+
+    *nops = n;
+}
+
+/*
+ * 计算 format 的 swap map, 遇到 ']' 或结尾时结束，*len 为布局的长度，
+ * *end 指向结束位置。format 不是固定布局时返回 FX_NOT_FIXED.
+ * ops 为 NULL 时只计算长度。
+ */
+static int __fixed_build(char const *format, struct __fixed_op *ops,
+        int *nops, int max_ops, int base, int *len, char const **end)
+{
+    char const *f = format, *str_num;
+    int num, i, j, ret, size, swap, start, inner_len, inner_ops;
+    int offset = base;
+
+    while (*f && *f != ']')
+    {
+        if (*f == ' ')
+        {
+            ++f;
+            continue;
+        }
+        if (*f == '-' || *f == '=')
+            return FX_NOT_FIXED;
+
+        str_num = f;
+        while (__ISDIGIT(*f))
+            ++f;
+        num = str_num == f ? -1 : __atoi((char *)str_num, f - str_num);
+
+        swap = __BYTE_ORDER == __LITTLE_ENDIAN;
+        switch (*(f++))
+        {
+            case 'c':
+                offset += num == -1 ? 1 : num;
+                continue;
+            case 'a':
+                size = num == -1 ? 1 : num;
+                if ((ret = __fixed_add(ops, nops, max_ops, 0, FX_ZERO, 1,
+                                offset, size)) < 0)
+                    return ret;
+                offset += size;
+                continue;
+            case 's':
+                if (num == -1)
+                    return FX_NOT_FIXED;
+                if ((ret = __fixed_add(ops, nops, max_ops, 0, FX_STR, num,
+                                offset, 1)) < 0)
+                    return ret;
+                offset += num;
+                continue;
+            case 'w':
+                size = 2;
+                break;
+            case 'd':
+                size = 4;
+                break;
+            case 'D':
+                size = 8;
+                break;
+            case 'f':
+                size = 4;
+                swap = __FLOAT_WORD_ORDER == __LITTLE_ENDIAN;
+                break;
+            case 'F':
+                size = 8;
+                swap = __FLOAT_WORD_ORDER == __LITTLE_ENDIAN;
+                break;
+            case '[':
+                start = *nops;
+                if ((ret = __fixed_build(f, ops, nops, max_ops, offset,
+                                &inner_len, &f)) < 0)
+                    return ret;
+                if (*f++ != ']')
+                    return FX_NOT_FIXED;
+                num = num == -1 ? 1 : num;
+                inner_ops = *nops - start;
+                if (num == 0)
+                {
+                    /* 0 个元素：撤销结构体中的操作 */
+                    *nops = start;
+                }
+                else if (inner_ops == 1 && ops[start].kind != FX_STR &&
+                        ops[start].offset == offset &&
+                        ops[start].size * ops[start].count == inner_len)
+                {
+                    ops[start].count *= num;
+                }
+                else
+                {
+                    for (i = 1; i < num; ++i)
+                    {
+                        for (j = 0; j < inner_ops; ++j)
+                        {
+                            struct __fixed_op op = ops[start + j];
+
+                            if ((ret = __fixed_add(ops, nops, max_ops,
+                                            start + inner_ops, op.kind,
+                                            op.size,
+                                            op.offset + inner_len * i,
+                                            op.count)) < 0)
+                                return ret;
+                        }
+                    }
+                    __fixed_compact(ops, start, nops);
+                }
+                offset += inner_len * num;
+                continue;
+            default:
+                return FX_NOT_FIXED;
+        }
+
+        num = num == -1 ? 1 : num;
+        if (swap && (ret = __fixed_add(ops, nops, max_ops, 0, FX_SWAP, size,
+                        offset, num)) < 0)
+            return ret;
+        offset += size * num;
+    }
+
+    *len = offset - base;
+    if (end)
+        *end = f;
+
+    return 0;
+}
+
+/* 固定布局的长度，不是固定布局时返回 FX_NOT_FIXED */
+static int __fixed_len(char const *format)
+{
+    int nops = 0, len;
+
+    if (__fixed_build(format, NULL, &nops, 0, 0, &len, NULL) < 0)
+        return FX_NOT_FIXED;
+
+    return len;
+}
+
+# if defined(__SSSE3__)
+#  include <tmmintrin.h>
+# elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+# endif
+
+/* 拷贝 count 个 size 字节的元素并翻转每个元素的字节序 */
+static void __swap_copy(void *des, void const *src, int size, int count)
+{
+    char *d = des;
+    char const *s = src;
+    int n = size * count;
+
+# if defined(__SSSE3__)
+    __m128i mask = size == 2 ?
+        _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+        size == 4 ?
+        _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12) :
+        _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+    for (; n >= 16; n -= 16, d += 16, s += 16)
+        _mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(
+                    _mm_loadu_si128((__m128i const *)s), mask));
+# elif defined(__ARM_NEON)
+    for (; n >= 16; n -= 16, d += 16, s += 16)
+    {
+        uint8x16_t v = vld1q_u8((uint8_t const *)s);
+
+        v = size == 2 ? vrev16q_u8(v) : size == 4 ? vrev32q_u8(v) :
+            vrev64q_u8(v);
+        vst1q_u8((uint8_t *)d, v);
+    }
+# endif
+
+    for (; n > 0; n -= size, d += size, s += size)
+    {
+        if (size == 2)
+            *((uint16_t *)d) = bswap_16(*((uint16_t *)s));
+        else if (size == 4)
+            *((uint32_t *)d) = bswap_32(*((uint32_t *)s));
+        else
+            *((uint64_t *)d) = bswap_64(*((uint64_t *)s));
+    }
+}
+
+/*
+ * 大块数据的拷贝：数据不小于 packf_bulk_threshold 时，目标使用非临时存储
+ * (movntdq)，不经过 cache, 拷贝不会用目标数据把调用者的工作集挤出 cache.
+ * 需要翻转字节序的数组先按块翻转到栈上的缓冲区，再从这里写出。
+ * 源数据是顺序读取的，硬件预取已经足够；软件的 NTA 预取实测更慢。
+ */
+# define BULK_CHUNK     4096
+# define BULK_SWAP      (__BYTE_ORDER == __LITTLE_ENDIAN)
+# define BULK_SWAP_FLOAT (__FLOAT_WORD_ORDER == __LITTLE_ENDIAN)
+# define BULK(n)        UNLIKELY(packf_bulk_threshold &&                \
+        (size_t)(n) >= packf_bulk_threshold)
+
+# ifdef __SSE2__
+#  include <emmintrin.h>
+# endif
+
+size_t packf_bulk_threshold = (size_t)4 << 20;
+
+/*
+ * 数据超过最后一级 cache 的 3/4 时，普通的存储会把 cache 中的大部分数据
+ * 换出，并且写完时开头的数据已经不在 cache 中；更小的数据普通的存储更快，
+ * 之后读取时也还在 cache 中。不知道 cache 的大小时保持 4M.
+ */
+__attribute__((constructor)) static void __bulk_init(void)
+{
+    long size = -1;
+
+# ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+# endif
+# ifdef _SC_LEVEL2_CACHE_SIZE
+    if (size <= 0)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+# endif
+    if (size >= 256 * 1024)
+        packf_bulk_threshold = (size_t)size / 4 * 3;
+}
+
+# ifdef __SSE2__
+/* d 按 16 字节对齐，写出 n 的 16 字节整数倍，返回写出的长度 */
+static size_t __bulk_stream(char *d, char const *s, size_t n)
+{
+    size_t done;
+
+    for (done = 0; n - done >= 64; done += 64)
+    {
+        _mm_stream_si128((__m128i *)(d + done),
+                _mm_loadu_si128((__m128i const *)(s + done)));
+        _mm_stream_si128((__m128i *)(d + done + 16),
+                _mm_loadu_si128((__m128i const *)(s + done + 16)));
+        _mm_stream_si128((__m128i *)(d + done + 32),
+                _mm_loadu_si128((__m128i const *)(s + done + 32)));
+        _mm_stream_si128((__m128i *)(d + done + 48),
+                _mm_loadu_si128((__m128i const *)(s + done + 48)));
+    }
+    for (; n - done >= 16; done += 16)
+        _mm_stream_si128((__m128i *)(d + done),
+                _mm_loadu_si128((__m128i const *)(s + done)));
+
+    return done;
+}
+# endif
+
+static void __bulk_copy(void *des, void const *src, size_t n)
+{
+# ifdef __SSE2__
+    char *d = des;
+    char const *s = src;
+    size_t k = (-(uintptr_t)d) & 15;
+
+    if (n < 64)
+    {
+        memcpy(d, s, n);
+        return;
+    }
+    memcpy(d, s, k);
+    d += k;
+    s += k;
+    n -= k;
+    k  = __bulk_stream(d, s, n);
+    memcpy(d + k, s + k, n - k);
+    _mm_sfence();
+# else
+    memcpy(des, src, n);
+# endif
+}
+
+# ifdef __SSE2__
+/* 翻转到缓冲区中，每次 16 字节 */
+static void __bulk_swap_chunk(char *d, char const *s, int size, int n)
+{
+    __m128i v;
+    int k, len = size * n;
+
+    for (k = 0; len - k >= 16; k += 16)
+    {
+        v = _mm_loadu_si128((__m128i const *)(s + k));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        if (size == 4)
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+        else if (size == 8)
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1B), 0x1B);
+        _mm_storeu_si128((__m128i *)(d + k), v);
+    }
+    __swap_copy(d + k, s + k, size, (len - k) / size);
+}
+# endif
+
+/* 拷贝 count 个 size 字节的元素并翻转字节序 */
+static void __bulk_swap(void *des, void const *src, int size, int count)
+{
+# ifdef __SSE2__
+    char buf[BULK_CHUNK + 32] __attribute__((aligned(16)));
+    char *d = des;
+    char const *s = src, *end = s + (size_t)size * count;
+    size_t have, k, head = (-(uintptr_t)d) & 15;
+
+    if (count < 64)
+    {
+        __swap_copy(des, src, size, count);
+        return;
+    }
+
+    /* 开头不对齐的部分，多翻转的字节留在 buf 中 */
+    k = (head + size - 1) / size;
+    __swap_copy(buf, s, size, (int)k);
+    memcpy(d, buf, head);
+    d += head;
+    s += k * size;
+    have = k * size - head;
+    memmove(buf, buf + head, have);
+
+    while (s < end)
+    {
+        k = (BULK_CHUNK - have) / size;
+        if (k > (size_t)(end - s) / size)
+            k = (end - s) / size;
+        __bulk_swap_chunk(buf + have, s, size, (int)k);
+        s    += k * size;
+        have += k * size;
+
+        k = __bulk_stream(d, buf, have);
+        d    += k;
+        have -= k;
+        memmove(buf, buf + k, have);
+    }
+    memcpy(d, buf, have);
+    _mm_sfence();
+# else
+    __swap_copy(des, src, size, count);
+# endif
+}
+
+/*
+ * 打包或解包一个大的数组，数据在一个段中。swap 为 BULK_SWAP（整数）或
+ * BULK_SWAP_FLOAT（浮点数），本地的字节序与网络序不同时为 1
+ */
+static void __bulk_put(void **net, void const *src, int size, int n,
+        int swap)
+{
+    if (swap && size > 1)
+        __bulk_swap(*net, src, size, n);
+    else
+        __bulk_copy(*net, src, (size_t)size * n);
+    *net = (char *)*net + size * n;
+}
+
+static void __bulk_get(void **net, void *des, int size, int n, int swap)
+{
+    if (swap && size > 1)
+        __bulk_swap(des, *net, size, n);
+    else
+        __bulk_copy(des, *net, (size_t)size * n);
+    *net = (char *)*net + size * n;
+}
+
+/* 字段之间不需要转换的部分通常很短，避免调用 memcpy */
+static inline void __gap_copy(char *des, char const *src, int n)
+{
+    if (n > 16)
+        memcpy(des, src, n);
+    else
+        while (n-- > 0)
+            *des++ = *src++;
+}
+
+/*
+ * 按 swap map 转换 n 个长度为 len 的记录，ops 之间的部分整体拷贝。
+ * 打包和解包的区别只在于 s 的处理。
+ */
+static int __fixed_run(struct __fixed_op const *ops, int nops, int len,
+        char *des, char const *src, int n, int unpack)
+{
+    int r, k, pos, str_len;
+    struct __fixed_op op;
+    char *d;
+    char const *s;
+
+    /* 整条记录只有一个转换操作时，所有记录合并为一次处理 */
+    if (nops == 1 && ops[0].kind == FX_SWAP && ops[0].offset == 0 &&
+            ops[0].size * ops[0].count == len)
+    {
+        __swap_copy(des, src, ops[0].size, ops[0].count * n);
+        return 0;
+    }
+    if (nops == 0)
+    {
+        memcpy(des, src, (size_t)len * n);
+        return 0;
+    }
+
+    for (r = 0; r < n; ++r, des += len, src += len)
+    {
+        for (k = 0, pos = 0; k < nops; ++k)
+        {
+            /* 拷贝到局部变量，避免对 des 的写入导致每次重新读取 ops */
+            op = ops[k];
+            d  = des + op.offset;
+            s  = src + op.offset;
+            __gap_copy(des + pos, src + pos, op.offset - pos);
+            pos = op.offset + op.size * op.count;
+
+            switch (op.kind)
+            {
+                case FX_SWAP:
+                    if (op.count > 1)
+                        __swap_copy(d, s, op.size, op.count);
+                    else if (op.size == 2)
+                        *((uint16_t *)d) = bswap_16(*((uint16_t *)s));
+                    else if (op.size == 4)
+                        *((uint32_t *)d) = bswap_32(*((uint32_t *)s));
+                    else
+                        *((uint64_t *)d) = bswap_64(*((uint64_t *)s));
+                    break;
+                case FX_ZERO:
+                    memset(d, 0, op.count);
+                    break;
+                case FX_STR:
+                    if (op.size == 0)
+                        break;
+                    str_len = strnlen(s, op.size);
+                    if (str_len == op.size)
+                        return PACKF_BE_CUT_OFF;
+                    memcpy(d, s, str_len + 1);
+                    if (!unpack)
+                        memset(d + str_len, 0, op.size - str_len);
+                    break;
+            }
+        }
+        __gap_copy(des + pos, src + pos, len - pos);
+    }
+
+    return 0;
+}
+
+/*
+ * 结构体数组的元素为固定布局时，一次处理所有 n 个元素并返回 1,
+ * 否则返回 0, 由调用者逐个元素解析 format.
+ */
+static int __fixed_array(void **net, int *left_len, char *f, void **locale,
+        int n, struct __seg *seg, int unpack, int *struct_len, char *__f)
+{
+    struct __fixed_op ops[FX_STACK_OPS];
+    int nops = 0, len, offset, ret;
+
+    if (__fixed_build(f, ops, &nops, FX_STACK_OPS, 0, &len, NULL) < 0)
+        return 0;
+
+    offset = len * n;
+    if (seg && SEG_LEFT(*net) < offset)
+        return 0;
+
+    IF_LESS(*left_len, offset);
+    if (unpack)
+        ret = __fixed_run(ops, nops, len, *locale, *net, n, 1);
+    else
+        ret = __fixed_run(ops, nops, len, *net, *locale, n, 0);
+    if (ret < 0)
+        ERR_RET_FMT(ret);
+
+    *net    = (char *)*net + offset;
+    *locale = (char *)*locale + offset;
+    *struct_len = len;
+
+    return 1;
+}
+
+/*
+ * 整数数组的压缩编码，在 w/d/D 数组的 type 之后加上编码方式：
+ *     %  frame-of-reference: 每块的值减去块内最小值后按位打包
+ *     +  delta: 相邻元素之差 (zigzag) 按位打包
+ *     ^  delta-of-delta: 相邻元素之差的差 (zigzag) 按位打包
+ *
+ * 网络上的格式：+/^ 先保存第一个元素（网络序），之后的值每 BP_BLOCK 个
+ * 一块，每块为 1 字节的位宽 b + 块内最小值（元素长度，网络序）+ 位流。
+ * 完整的块按 SIMD 友好的纵向布局保存：值 i 属于第 i % lanes 个通道，
+ * 每个通道的值从低位开始依次放入 32/64 位的字（小端），各通道的字交错
+ * 存放，一共 16 * b 字节；不足一块时按顺序从低位开始打包，共
+ * (k * b + 7) / 8 字节。
+ */
+# define BP_BLOCK   128
+# define BP_MAX     (1 + 8 + BP_BLOCK * 8)
+
+# if __BYTE_ORDER == __LITTLE_ENDIAN
+#  define __le32(x) (x)
+#  define __le64(x) (x)
+# else
+#  define __le32(x) bswap_32(x)
+#  define __le64(x) bswap_64(x)
+# endif
+
+# ifdef __SSE2__
+#  include <emmintrin.h>
+# endif
+
+static inline int __bit_width(uint64_t v)
+{
+# ifdef __GNUC__
+    return v ? 64 - __builtin_clzll(v) : 0;
+# else
+    int b = 0;
+
+    for (; v; v >>= 1)
+        ++b;
+
+    return b;
+# endif
+}
+
+/* 128 个 32 位的值，4 个通道，每个通道 b 个字 */
+static void __bp_pack32(uint32_t const *in, uint8_t *out, int b)
+{
+# ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128(), v;
+    int j, bits = 0;
+
+    for (j = 0; b && j < BP_BLOCK / 4; ++j)
+    {
+        v   = _mm_loadu_si128((__m128i const *)(in + 4 * j));
+        acc = _mm_or_si128(acc, _mm_sll_epi32(v, _mm_cvtsi32_si128(bits)));
+        if ((bits += b) >= 32)
+        {
+            _mm_storeu_si128((__m128i *)out, acc);
+            out += 16;
+            bits -= 32;
+            acc = bits ? _mm_srl_epi32(v, _mm_cvtsi32_si128(b - bits)) :
+                _mm_setzero_si128();
+        }
+    }
+# else
+    uint64_t acc;
+    uint32_t w;
+    uint8_t *p;
+    int l, j, bits;
+
+    for (l = 0; b && l < 4; ++l)
+    {
+        for (j = 0, acc = 0, bits = 0, p = out + 4 * l; j < BP_BLOCK / 4; ++j)
+        {
+            acc |= (uint64_t)in[4 * j + l] << bits;
+            if ((bits += b) >= 32)
+            {
+                w = __le32((uint32_t)acc);
+                memcpy(p, &w, 4);
+                p += 16;
+                acc >>= 32;
+                bits -= 32;
+            }
+        }
+    }
+# endif
+}
+
+static void __bp_unpack32(uint8_t const *in, uint32_t *out, int b)
+{
+    uint32_t mask = b == 32 ? 0xffffffff : ((uint32_t)1 << b) - 1;
+# ifdef __SSE2__
+    __m128i w, v, m = _mm_set1_epi32((int)mask);
+    int j, shift = 0;
+
+    if (!b)
+    {
+        memset(out, 0, BP_BLOCK * sizeof(*out));
+        return;
+    }
+
+    w = _mm_loadu_si128((__m128i const *)in);
+    for (j = 0; j < BP_BLOCK / 4; ++j)
+    {
+        v = _mm_srl_epi32(w, _mm_cvtsi32_si128(shift));
+        if (shift + b < 32)
+        {
+            shift += b;
+        }
+        else if (shift + b == 32)
+        {
+            shift = 0;
+            if (j < BP_BLOCK / 4 - 1)
+                w = _mm_loadu_si128((__m128i const *)(in += 16));
+        }
+        else
+        {
+            w = _mm_loadu_si128((__m128i const *)(in += 16));
+            v = _mm_or_si128(v, _mm_sll_epi32(w,
+                        _mm_cvtsi32_si128(32 - shift)));
+            shift += b - 32;
+        }
+        _mm_storeu_si128((__m128i *)(out + 4 * j), _mm_and_si128(v, m));
+    }
+# else
+    uint64_t acc;
+    uint32_t w;
+    uint8_t const *p;
+    int l, j, bits;
+
+    for (l = 0; l < 4; ++l)
+    {
+        for (j = 0, acc = 0, bits = 0, p = in + 4 * l; j < BP_BLOCK / 4; ++j)
+        {
+            if (bits < b)
+            {
+                memcpy(&w, p, 4);
+                p += 16;
+                acc |= (uint64_t)__le32(w) << bits;
+                bits += 32;
+            }
+            out[4 * j + l] = (uint32_t)acc & mask;
+            acc >>= b;
+            bits -= b;
+        }
+    }
+# endif
+}
+
+/* 128 个 64 位的值，2 个通道，每个通道 b 个字 */
+static void __bp_pack64(uint64_t const *in, uint8_t *out, int b)
+{
+# ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128(), v;
+    int j, bits = 0;
+
+    for (j = 0; b && j < BP_BLOCK / 2; ++j)
+    {
+        v   = _mm_loadu_si128((__m128i const *)(in + 2 * j));
+        acc = _mm_or_si128(acc, _mm_sll_epi64(v, _mm_cvtsi32_si128(bits)));
+        if ((bits += b) >= 64)
+        {
+            _mm_storeu_si128((__m128i *)out, acc);
+            out += 16;
+            bits -= 64;
+            acc = bits ? _mm_srl_epi64(v, _mm_cvtsi32_si128(b - bits)) :
+                _mm_setzero_si128();
+        }
+    }
+# else
+    uint64_t acc, v, w;
+    uint8_t *p;
+    int l, j, bits;
+
+    for (l = 0; b && l < 2; ++l)
+    {
+        for (j = 0, acc = 0, bits = 0, p = out + 8 * l; j < BP_BLOCK / 2; ++j)
+        {
+            v = in[2 * j + l];
+            acc |= v << bits;
+            if (bits + b >= 64)
+            {
+                w = __le64(acc);
+                memcpy(p, &w, 8);
+                p += 16;
+                acc = bits ? v >> (64 - bits) : 0;
+                bits += b - 64;
+            }
+            else
+            {
+                bits += b;
+            }
+        }
+    }
+# endif
+}
+
+static void __bp_unpack64(uint8_t const *in, uint64_t *out, int b)
+{
+    uint64_t mask = b == 64 ? ~(uint64_t)0 : ((uint64_t)1 << b) - 1;
+# ifdef __SSE2__
+    __m128i w, v, m = _mm_set1_epi64x((long long)mask);
+    int j, shift = 0;
+
+    if (!b)
+    {
+        memset(out, 0, BP_BLOCK * sizeof(*out));
+        return;
+    }
+
+    w = _mm_loadu_si128((__m128i const *)in);
+    for (j = 0; j < BP_BLOCK / 2; ++j)
+    {
+        v = _mm_srl_epi64(w, _mm_cvtsi32_si128(shift));
+        if (shift + b < 64)
+        {
+            shift += b;
+        }
+        else if (shift + b == 64)
+        {
+            shift = 0;
+            if (j < BP_BLOCK / 2 - 1)
+                w = _mm_loadu_si128((__m128i const *)(in += 16));
+        }
+        else
+        {
+            w = _mm_loadu_si128((__m128i const *)(in += 16));
+            v = _mm_or_si128(v, _mm_sll_epi64(w,
+                        _mm_cvtsi32_si128(64 - shift)));
+            shift += b - 64;
+        }
+        _mm_storeu_si128((__m128i *)(out + 2 * j), _mm_and_si128(v, m));
+    }
+# else
+    uint64_t acc, w;
+    uint8_t const *p;
+    int l, j, bits;
+
+    for (l = 0; l < 2; ++l)
+    {
+        for (j = 0, acc = 0, bits = 0, p = in + 8 * l; j < BP_BLOCK / 2; ++j)
+        {
+            if (bits >= b)
+            {
+                out[2 * j + l] = acc & mask;
+                acc = b == 64 ? 0 : acc >> b;
+                bits -= b;
+                continue;
+            }
+            memcpy(&w, p, 8);
+            p += 16;
+            w = __le64(w);
+            out[2 * j + l] = (acc | (w << bits)) & mask;
+            acc = b - bits == 64 ? 0 : w >> (b - bits);
+            bits = 64 - (b - bits);
+        }
+    }
+# endif
+}
+
+/* 不足一块时按顺序打包，返回字节数 */
+static int __bp_pack_tail(uint64_t const *in, int k, int b, uint8_t *out)
+{
+    uint64_t acc = 0, w;
+    int j, n = 0, bits = 0;
+
+    for (j = 0; j < k; ++j)
+    {
+        acc |= in[j] << bits;
+        if (bits + b >= 64)
+        {
+            w = __le64(acc);
+            memcpy(out + n, &w, 8);
+            n += 8;
+            acc = bits ? in[j] >> (64 - bits) : 0;
+            bits += b - 64;
+        }
+        else
+        {
+            bits += b;
+        }
+    }
+    for (; bits > 0; bits -= 8, acc >>= 8)
+        out[n++] = (uint8_t)acc;
+
+    return n;
+}
+
+static void __bp_unpack_tail(uint8_t const *in, int len, uint64_t *out,
+        int k, int b)
+{
+    uint64_t mask = b == 64 ? ~(uint64_t)0 : ((uint64_t)1 << b) - 1, w;
+    int j, i, pos, shift, n;
+
+    for (j = 0; j < k; ++j)
+    {
+        pos   = j * b / 8;
+        shift = j * b % 8;
+        n     = len - pos < 8 ? len - pos : 8;
+        if (n == 8)
+        {
+            memcpy(&w, in + pos, 8);
+            w = __le64(w);
+        }
+        else
+        {
+            for (i = 0, w = 0; i < n; ++i)
+                w |= (uint64_t)in[pos + i] << (8 * i);
+        }
+        w >>= shift;
+        if (shift + b > 64)
+            w |= (uint64_t)in[pos + 8] << (64 - shift);
+        out[j] = w & mask;
+    }
+}
+
+/* 编码一块 k 个值，u 会被修改，返回编码后的字节数 */
+static int __bp_block_put(uint64_t *u, int k, int size, uint8_t *out)
+{
+    uint32_t u32[BP_BLOCK];
+    uint64_t min = u[0], max = u[0];
+    int j, b;
+
+    for (j = 1; j < k; ++j)
+    {
+        min = u[j] < min ? u[j] : min;
+        max = u[j] > max ? u[j] : max;
+    }
+    b = __bit_width(max - min);
+
+    out[0] = (uint8_t)b;
+    for (j = 0; j < size; ++j)
+        out[1 + j] = (uint8_t)(min >> (8 * (size - 1 - j)));
+    out += 1 + size;
+
+    for (j = 0; j < k; ++j)
+        u[j] -= min;
+
+    if (k < BP_BLOCK)
+        return 1 + size + __bp_pack_tail(u, k, b, out);
+
+    if (size == 8)
+    {
+        __bp_pack64(u, out, b);
+    }
+    else
+    {
+        for (j = 0; j < BP_BLOCK; ++j)
+            u32[j] = (uint32_t)u[j];
+        __bp_pack32(u32, out, b);
+    }
+
+    return 1 + size + 16 * b;
+}
+
+static inline uint64_t __codec_load(void const *src, int size, int i)
+{
+    if (size == 2)
+        return ((uint16_t const *)src)[i];
+    if (size == 4)
+        return ((uint32_t const *)src)[i];
+
+    return ((uint64_t const *)src)[i];
+}
+
+static inline uint64_t __zigzag(uint64_t d, int width, uint64_t mask)
+{
+    return ((d << 1) ^ (0 - ((d >> (width - 1)) & 1))) & mask;
+}
+
+static inline uint64_t __unzigzag(uint64_t z)
+{
+    return (z >> 1) ^ (0 - (z & 1));
+}
+
+/* 按 codec 编码 src 中 n 个 size 字节的整数 */
+static int __codec_pack(void **net, int *left_len, struct __seg *seg,
+        char codec, int size, void const *src, int n)
+{
+    uint64_t u[BP_BLOCK], mask, v, d, prev = 0, delta = 0;
+    uint8_t out[BP_MAX];
+    int width = size * 8, i = 0, j, k, len;
+
+    mask = size == 8 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+    if (codec != '%' && n > 0)
+    {
+        prev = __codec_load(src, size, 0);
+        for (j = 0; j < size; ++j)
+            out[j] = (uint8_t)(prev >> (8 * (size - 1 - j)));
+        if (*left_len < size)
+            return PACKF_OUT_OF_BUF;
+        *left_len -= size;
+        NET_PUT(out, size);
+        i = 1;
+    }
+
+    for (; i < n; i += k)
+    {
+        k = n - i < BP_BLOCK ? n - i : BP_BLOCK;
+        switch (codec)
+        {
+            case '%':
+                for (j = 0; j < k; ++j)
+                    u[j] = __codec_load(src, size, i + j);
+                break;
+            case '+':
+                for (j = 0; j < k; ++j)
+                {
+                    v = __codec_load(src, size, i + j);
+                    u[j] = __zigzag((v - prev) & mask, width, mask);
+                    prev = v;
+                }
+                break;
+            default:
+                for (j = 0; j < k; ++j)
+                {
+                    v = __codec_load(src, size, i + j);
+                    d = (v - prev) & mask;
+                    u[j] = __zigzag((d - delta) & mask, width, mask);
+                    delta = d;
+                    prev = v;
+                }
+                break;
+        }
+
+        len = __bp_block_put(u, k, size, out);
+        if (*left_len < len)
+            return PACKF_OUT_OF_BUF;
+        *left_len -= len;
+        NET_PUT(out, len);
+    }
+
+    return 0;
+}
+
+# define CODEC_STORE(type, u) do {                                      \
+    type *__d = (type *)des + i;                                        \
+    switch (codec)                                                      \
+    {                                                                   \
+        case '%':                                                       \
+            for (j = 0; j < k; ++j)                                     \
+                __d[j] = (type)(u[j] + ref);                            \
+            break;                                                      \
+        case '+':                                                       \
+            for (j = 0; j < k; ++j)                                     \
+            {                                                           \
+                prev += __unzigzag((uint64_t)(u[j] + ref) & mask);      \
+                __d[j] = (type)prev;                                    \
+            }                                                           \
+            break;                                                      \
+        default:                                                        \
+            for (j = 0; j < k; ++j)                                     \
+            {                                                           \
+                delta += __unzigzag((uint64_t)(u[j] + ref) & mask);     \
+                prev  += delta;                                         \
+                __d[j] = (type)prev;                                    \
+            }                                                           \
+            break;                                                      \
+    }                                                                   \
+} while (0)
+
+/*
+ * 分段解码时在两段之间保存的状态。除了第一段（'+' '^' 时包括开头的原始值），
+ * 每段的个数应为 BP_BLOCK 的整数倍，最后一段除外。
+ */
+struct __codec_carry
+{
+    uint64_t    prev;
+    uint64_t    delta;
+    int         head;   /* 还没有读入开头的原始值 */
+};
+
+/* 解码 n 个 size 字节的整数到 des, carry 为 NULL 时解码整个数组 */
+static int __codec_unpack(void **net, int *left_len, struct __seg *seg,
+        char codec, int size, void *des, int n, struct __codec_carry *carry)
+{
+    struct __codec_carry whole = { 0, 0, 1 };
+    uint32_t u32[BP_BLOCK];
+    uint64_t u64[BP_BLOCK], mask, ref, prev, delta;
+    uint8_t hdr[1 + 8], body[BP_BLOCK * 8];
+    uint8_t const *p;
+    int width = size * 8, i = 0, j, k, b, len;
+
+    if (!carry)
+        carry = &whole;
+    prev  = carry->prev;
+    delta = carry->delta;
+
+    mask = size == 8 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+    if (codec != '%' && n > 0 && carry->head)
+    {
+        carry->head = 0;
+        if (*left_len < size)
+            return PACKF_OUT_OF_BUF;
+        *left_len -= size;
+        NET_GET(hdr, size);
+        for (j = 0; j < size; ++j)
+            prev = (prev << 8) | hdr[j];
+        if (size == 2)
+            *((uint16_t *)des) = (uint16_t)prev;
+        else if (size == 4)
+            *((uint32_t *)des) = (uint32_t)prev;
+        else
+            *((uint64_t *)des) = prev;
+        i = 1;
+    }
+
+    for (; i < n; i += k)
+    {
+        k = n - i < BP_BLOCK ? n - i : BP_BLOCK;
+        if (*left_len < 1 + size)
+            return PACKF_OUT_OF_BUF;
+        *left_len -= 1 + size;
+        NET_GET(hdr, 1 + size);
+        if ((b = hdr[0]) > width)
+            return PACKF_BAD_DATA;
+        for (j = 0, ref = 0; j < size; ++j)
+            ref = (ref << 8) | hdr[1 + j];
+
+        len = k == BP_BLOCK ? 16 * b : (k * b + 7) / 8;
+        if (*left_len < len)
+            return PACKF_OUT_OF_BUF;
+        *left_len -= len;
+        if (NET_SPLIT(len))
+        {
+            __seg_get(seg, net, body, len);
+            p = body;
+        }
+        else
+        {
+            p = *net;
+            *net = (char *)*net + len;
+        }
+
+        if (k < BP_BLOCK)
+            __bp_unpack_tail(p, len, u64, k, b);
+        else if (size == 8)
+            __bp_unpack64(p, u64, b);
+        else
+            __bp_unpack32(p, u32, b);
+
+        if (size == 8)
+            CODEC_STORE(uint64_t, u64);
+        else if (k < BP_BLOCK && size == 4)
+            CODEC_STORE(uint32_t, u64);
+        else if (k < BP_BLOCK)
+            CODEC_STORE(uint16_t, u64);
+        else if (size == 4)
+            CODEC_STORE(uint32_t, u32);
+        else
+            CODEC_STORE(uint16_t, u32);
+    }
+    carry->prev  = prev;
+    carry->delta = delta;
+
+    return 0;
+}
+
+/* 编码后的数据长度，用于视图 */
+static int __codec_size(uint8_t const *p, int left, char codec, int size,
+        int n)
+{
+    int pos = 0, k, b;
+
+    if (codec != '%' && n > 0)
+    {
+        pos = size;
+        --n;
+    }
+    for (; n > 0; n -= k)
+    {
+        k = n < BP_BLOCK ? n : BP_BLOCK;
+        if (left - pos < 1 + size)
+            return PACKF_OUT_OF_BUF;
+        if ((b = p[pos]) > size * 8)
+            return PACKF_BAD_DATA;
+        pos += 1 + size + (k == BP_BLOCK ? 16 * b : (k * b + 7) / 8);
+    }
+
+    return pos > left ? PACKF_OUT_OF_BUF : pos;
+}
+
+/*
+ * 位域 [num]b<bits>, bits 为 1 到 63. 同一层中连续的位域（中间可以有空格）
+ * 组成一个位流，按 MSB 优先依次存放，位流结束时补 0 到整字节。本地为
+ * 能放下 bits 的最小无符号整数 (uint8_t/uint16_t/uint32_t/uint64_t).
+ *
+ * 位流开始时计算整个位流的长度，只检查一次剩余长度。打包时在 64 位的寄存器
+ * 中累积，满 64 位时整字写出；解包时每次读入多个字节，字节对齐的 1/2/4 位
+ * 数组按字节展开 (SSE2).
+ */
+struct __bits
+{
+    uint64_t    acc;
+    int         n;      /* acc 中的位数 */
+    int         left;   /* 位流中还没有处理的位数 */
+    int         bytes;  /* 解包时位流中还没有读入的字节数 */
+};
+
+static inline int __bits_size(int bits)
+{
+    return bits <= 8 ? 1 : (bits <= 16 ? 2 : (bits <= 32 ? 4 : 8));
+}
+
+static inline uint64_t __bits_load(void const *p, int size)
+{
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch (size)
+    {
+        case 1:
+            memcpy(&u8, p, 1);
+            return u8;
+        case 2:
+            memcpy(&u16, p, 2);
+            return u16;
+        case 4:
+            memcpy(&u32, p, 4);
+            return u32;
+        default:
+            memcpy(&u64, p, 8);
+            return u64;
+    }
+}
+
+static inline void __bits_store(void *p, int size, uint64_t v)
+{
+    uint8_t u8 = (uint8_t)v;
+    uint16_t u16 = (uint16_t)v;
+    uint32_t u32 = (uint32_t)v;
+
+    switch (size)
+    {
+        case 1:
+            memcpy(p, &u8, 1);
+            break;
+        case 2:
+            memcpy(p, &u16, 2);
+            break;
+        case 4:
+            memcpy(p, &u32, 4);
+            break;
+        default:
+            memcpy(p, &v, 8);
+    }
+}
+
+/* 从 f 开始的连续位域的总位数，one 为真时只计算一个字段 */
+static int __bits_run(char const *f, int one)
+{
+    char const *str_num;
+    int64_t total = 0;
+    int num, bits;
+
+    while (1)
+    {
+        while (*f == ' ')
+            ++f;
+
+        str_num = f;
+        while (__ISDIGIT(*f))
+            ++f;
+        if (*f != 'b')
+            break;
+        num = str_num == f ? 1 : __atoi((char *)str_num, f - str_num);
+
+        str_num = ++f;
+        while (__ISDIGIT(*f))
+            ++f;
+        bits = str_num == f ? 0 : __atoi((char *)str_num, f - str_num);
+        if (bits < 1 || bits > 63)
+            return PACKF_NOT_FORMAT;
+
+        total += (int64_t)num * bits;
+        if (total > INT_MAX - 7)
+            return PACKF_OUT_OF_BUF;
+        if (one)
+            break;
+    }
+
+    return (int)total;
+}
+
+/* 写入 v 的低 w 位 */
+static inline void __bits_put(struct __bits *b, void **net, struct __seg *seg,
+        uint64_t v, int w)
+{
+    uint64_t be;
+    int r;
+
+    b->left -= w;
+    if (b->n + w < 64)
+    {
+        b->acc |= v << (64 - b->n - w);
+        b->n   += w;
+        return;
+    }
+
+    r = 64 - b->n;
+    b->acc |= v >> (w - r);
+    be = htobe64(b->acc);
+    NET_PUT(&be, 8);
+    b->n   = w - r;
+    b->acc = b->n ? v << (64 - b->n) : 0;
+}
+
+/* 位流结束，写出剩余的位 */
+static inline void __bits_flush(struct __bits *b, void **net,
+        struct __seg *seg)
+{
+    uint64_t be = htobe64(b->acc);
+
+    NET_PUT(&be, (b->n + 7) / 8);
+    b->acc = 0;
+    b->n   = 0;
+}
+
+/* 读入尽量多的整字节，acc 中至少有 57 位或者位流已经读完 */
+static inline void __bits_fill(struct __bits *b, void **net, struct __seg *seg)
+{
+    uint8_t tmp[8];
+    int k, i;
+
+    k = (64 - b->n) / 8;
+    if (k > b->bytes)
+        k = b->bytes;
+    if (!k)
+        return;
+
+    NET_GET(tmp, k);
+    for (i = 0; i < k; ++i)
+        b->acc = (b->acc << 8) | tmp[i];
+    b->n     += 8 * k;
+    b->bytes -= k;
+}
+
+/* 读出 w 位 */
+static inline uint64_t __bits_get(struct __bits *b, void **net,
+        struct __seg *seg, int w)
+{
+    uint64_t v;
+    int k;
+
+    if (w > 32)
+    {
+        k = w - 32;
+        v = __bits_get(b, net, seg, k) << 32;
+        return v | __bits_get(b, net, seg, 32);
+    }
+
+    if (b->n < w)
+        __bits_fill(b, net, seg);
+    b->n    -= w;
+    b->left -= w;
+
+    return (b->acc >> b->n) & (((uint64_t)1 << w) - 1);
+}
+
+/* 把 n 字节中 MSB 优先的 w (1/2/4) 位的值展开为每个值一个字节 */
+static void __bits_expand8(uint8_t const *in, int n, uint8_t *out, int w)
+{
+    int per = 8 / w, mask = (1 << w) - 1, i = 0, k;
+# ifdef __SSE2__
+    __m128i v, p[8], a[4], c0, c1, m = _mm_set1_epi8((char)mask);
+    int h, j;
+
+    for (; i + 16 <= n; i += 16, out += 16 * per)
+    {
+        v = _mm_loadu_si128((__m128i const *)(in + i));
+        for (j = 0; j < per; ++j)
+            p[j] = _mm_and_si128(_mm_srl_epi16(v,
+                        _mm_cvtsi32_si128(8 - w * (j + 1))), m);
+
+        if (per == 2)
+        {
+            _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(p[0], p[1]));
+            _mm_storeu_si128((__m128i *)(out + 16),
+                    _mm_unpackhi_epi8(p[0], p[1]));
+            continue;
+        }
+
+        for (h = 0; h < 2; ++h)
+        {
+            for (j = 0; j < per / 2; ++j)
+                a[j] = h ? _mm_unpackhi_epi8(p[2 * j], p[2 * j + 1]) :
+                    _mm_unpacklo_epi8(p[2 * j], p[2 * j + 1]);
+
+            if (per == 4)
+            {
+                _mm_storeu_si128((__m128i *)(out + 32 * h),
+                        _mm_unpacklo_epi16(a[0], a[1]));
+                _mm_storeu_si128((__m128i *)(out + 32 * h + 16),
+                        _mm_unpackhi_epi16(a[0], a[1]));
+                continue;
+            }
+
+            c0 = _mm_unpacklo_epi16(a[0], a[1]);
+            c1 = _mm_unpacklo_epi16(a[2], a[3]);
+            _mm_storeu_si128((__m128i *)(out + 64 * h),
+                    _mm_unpacklo_epi32(c0, c1));
+            _mm_storeu_si128((__m128i *)(out + 64 * h + 16),
+                    _mm_unpackhi_epi32(c0, c1));
+            c0 = _mm_unpackhi_epi16(a[0], a[1]);
+            c1 = _mm_unpackhi_epi16(a[2], a[3]);
+            _mm_storeu_si128((__m128i *)(out + 64 * h + 32),
+                    _mm_unpacklo_epi32(c0, c1));
+            _mm_storeu_si128((__m128i *)(out + 64 * h + 48),
+                    _mm_unpackhi_epi32(c0, c1));
+        }
+    }
+# endif
+
+    for (; i < n; ++i)
+        for (k = 0; k < per; ++k)
+            *out++ = (in[i] >> (8 - w * (k + 1))) & mask;
+}
+
+/*
+ * 定点小数 c/w/d/D.<scale>, scale 为 0 到 DEC_MAX_SCALE. 本地为 double, 网络
+ * 上为 v * 10^scale 四舍五入（0.5 远离 0）后的有符号整数，长度为 type 的
+ * 长度（网络序）。超出整数的范围（包括 NaN 和无穷大）时返回
+ * PACKF_BE_CUT_OFF. 解包时为整数 / 10^scale, 整数的绝对值不超过 2^53 时得到
+ * 与十进制值最接近的 double.
+ *
+ * 半精度浮点 h: 本地为 float, 网络上为 IEEE 754 binary16（网络序），舍入到
+ * 最近的偶数，超出范围时为无穷大。
+ *
+ * 数组每次转换 CONV_CHUNK 个元素后整块写入或读出。d.<scale> 使用 SSE2 每次
+ * 转换 4 个；编译时启用 F16C (-mf16c) 时半精度浮点也每次转换 4 个。
+ */
+# define CONV_CHUNK     64
+
+# ifdef __F16C__
+#  include <immintrin.h>
+# endif
+
+static double const __pow10[DEC_MAX_SCALE + 1] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+static inline uint16_t __f32_to_f16(float f)
+{
+    uint32_t x, sign, man, rem, half, h;
+    int e, shift;
+
+    memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000;
+    man  = x & 0x7FFFFF;
+    e    = (int)((x >> 23) & 0xFF) - 127 + 15;
+
+    /* NaN 保留尾数的高位并置 quiet 位 */
+    if (e == 0xFF - 127 + 15)
+        return sign | 0x7C00 | (man ? 0x200 | (man >> 13) : 0);
+    if (e >= 31)
+        return sign | 0x7C00;
+    if (e <= 0)
+    {
+        /* 非规格化数，小于最小值的一半时为 0 */
+        if (e < -10)
+            return sign;
+        man  |= 0x800000;
+        shift = 14 - e;
+        h     = man >> shift;
+        rem   = man & ((1u << shift) - 1);
+        half  = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1)))
+            ++h;
+
+        return sign | h;
+    }
+
+    /* 尾数进位到指数时结果仍然正确，最大值进位后为无穷大 */
+    h   = ((uint32_t)e << 10) | (man >> 13);
+    rem = man & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        ++h;
+
+    return sign | h;
+}
+
+static inline float __f16_to_f32(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16, e = (h >> 10) & 0x1F;
+    uint32_t man = h & 0x3FF, x;
+    float f;
+
+    /* NaN 和 F16C 相同，转换为 quiet NaN */
+    if (e == 0x1F)
+        x = sign | 0x7F800000 | (man ? 0x400000 | (man << 13) : 0);
+    else if (e)
+        x = sign | ((e + 112) << 23) | (man << 13);
+    else if (man)
+    {
+        for (e = 113; !(man & 0x400); --e)
+            man <<= 1;
+        x = sign | (e << 23) | ((man & 0x3FF) << 13);
+    }
+    else
+        x = sign;
+
+    memcpy(&f, &x, sizeof(f));
+
+    return f;
+}
+
+/* n 个 float 转换为网络序的半精度浮点 */
+static void __f16_encode(float const *in, uint16_t *out, int n)
+{
+    int i = 0;
+# ifdef __F16C__
+    __m128i h;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        h = _mm_cvtps_ph(_mm_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        h = _mm_or_si128(_mm_slli_epi16(h, 8), _mm_srli_epi16(h, 8));
+        _mm_storel_epi64((__m128i *)(out + i), h);
+    }
+# endif
+
+    for (; i < n; ++i)
+        out[i] = htobe16(__f32_to_f16(in[i]));
+}
+
+static void __f16_decode(uint16_t const *in, float *out, int n)
+{
+    int i = 0;
+# ifdef __F16C__
+    __m128i h;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        h = _mm_loadl_epi64((__m128i const *)(in + i));
+        h = _mm_or_si128(_mm_slli_epi16(h, 8), _mm_srli_epi16(h, 8));
+        _mm_storeu_ps(out + i, _mm_cvtph_ps(h));
+    }
+# endif
+
+    for (; i < n; ++i)
+        out[i] = __f16_to_f32(be16toh(in[i]));
+}
+
+/*
+ * 打包 src 中 n 个 float, 本地的数组可以不对齐。两个缓冲区在栈上，不内联到
+ * 递归的 __packf 中
+ */
+__attribute__((noinline))
+static void __f16_pack(void **net, struct __seg *seg, void const *src, int n)
+{
+    float in[CONV_CHUNK];
+    uint16_t out[CONV_CHUNK];
+    int i, k;
+
+    for (i = 0; i < n; i += k)
+    {
+        k = n - i < CONV_CHUNK ? n - i : CONV_CHUNK;
+        memcpy(in, (char const *)src + i * sizeof(float), k * sizeof(float));
+        __f16_encode(in, out, k);
+        NET_PUT(out, k * sizeof(uint16_t));
+    }
+}
+
+__attribute__((noinline))
+static void __f16_unpack(void **net, struct __seg *seg, void *des, int n)
+{
+    uint16_t in[CONV_CHUNK];
+    float out[CONV_CHUNK];
+    int i, k;
+
+    for (i = 0; i < n; i += k)
+    {
+        k = n - i < CONV_CHUNK ? n - i : CONV_CHUNK;
+        NET_GET(in, k * sizeof(uint16_t));
+        __f16_decode(in, out, k);
+        memcpy((char *)des + i * sizeof(float), out, k * sizeof(float));
+    }
+}
+
+# ifdef __SSE2__
+static inline __m128i __bswap32_sse2(__m128i v)
+{
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+}
+
+/*
+ * 2 个已经乘以 10^scale 的值舍入为 int32, 不在 [-lim, lim) 中（包括 NaN）时
+ * *bad 置位。超出范围的值 cvttpd 返回 INT_MIN, 结果丢弃。
+ */
+static inline __m128i __dec_round2(__m128d x, __m128d lim, __m128d *bad)
+{
+    __m128d half = _mm_set1_pd(0.5), one = _mm_set1_pd(1.0);
+    __m128d lo = _mm_sub_pd(_mm_setzero_pd(), lim), t, r;
+
+    *bad = _mm_or_pd(*bad, _mm_or_pd(_mm_cmpnlt_pd(x, lim),
+                _mm_cmpngt_pd(x, _mm_sub_pd(lo, one))));
+    t = _mm_cvtepi32_pd(_mm_cvttpd_epi32(x));
+    x = _mm_sub_pd(x, t);
+    r = _mm_add_pd(t, _mm_and_pd(_mm_cmpge_pd(x, half), one));
+    r = _mm_sub_pd(r, _mm_and_pd(_mm_cmple_pd(x, _mm_sub_pd(_mm_setzero_pd(),
+                        half)), one));
+    *bad = _mm_or_pd(*bad, _mm_or_pd(_mm_cmplt_pd(r, lo),
+                _mm_cmpnlt_pd(r, lim)));
+
+    return _mm_cvttpd_epi32(r);
+}
+# endif
+
+# define DEC_PUT(type, swap) do {                                       \
+    for (; m < k; ++m)                                                  \
+    {                                                                   \
+        type __v = swap((type)q[m]);                                    \
+        memcpy(out + m * sizeof(type), &__v, sizeof(type));             \
+    }                                                                   \
+} while (0)
+
+/* 打包 src 中 n 个 double 为 size 字节的定点小数 */
+static int __dec_pack(void **net, struct __seg *seg, int size, int scale,
+        void const *src, int n)
+{
+    double v[CONV_CHUNK], x, p = __pow10[scale];
+    double lim = (double)((uint64_t)1 << (size * 8 - 1));
+    int64_t q[CONV_CHUNK], t;
+    int64_t hi = (int64_t)(((uint64_t)1 << (size * 8 - 1)) - 1);
+    uint8_t out[CONV_CHUNK * 8];
+    int i, j, k, m;
+# ifdef __SSE2__
+    __m128d vp = _mm_set1_pd(p), vlim = _mm_set1_pd(lim), bad;
+    __m128i a, b;
+# endif
+
+    for (i = 0; i < n; i += k)
+    {
+        k = n - i < CONV_CHUNK ? n - i : CONV_CHUNK;
+        memcpy(v, (char const *)src + i * sizeof(double), k * sizeof(double));
+        j = 0;
+# ifdef __SSE2__
+        if (size == 4)
+        {
+            bad = _mm_setzero_pd();
+            for (; j + 4 <= k; j += 4)
+            {
+                a = __dec_round2(_mm_mul_pd(_mm_loadu_pd(v + j), vp), vlim,
+                        &bad);
+                b = __dec_round2(_mm_mul_pd(_mm_loadu_pd(v + j + 2), vp),
+                        vlim, &bad);
+                _mm_storeu_si128((__m128i *)(out + 4 * j),
+                        __bswap32_sse2(_mm_unpacklo_epi64(a, b)));
+            }
+            if (_mm_movemask_pd(bad))
+                return PACKF_BE_CUT_OFF;
+        }
+# endif
+
+        /* 截断后按小数部分舍入，小数部分的计算没有误差 */
+        for (m = j; j < k; ++j)
+        {
+            x = v[j] * p;
+            if (!(x > -lim - 1 && x < lim))
+                return PACKF_BE_CUT_OFF;
+            t = (int64_t)x;
+            x -= (double)t;
+            t += (x >= 0.5) - (x <= -0.5);
+            if (t > hi || t < -hi - 1)
+                return PACKF_BE_CUT_OFF;
+            q[j] = t;
+        }
+
+        switch (size)
+        {
+            case 1:
+                DEC_PUT(uint8_t, NO_SWAP);
+                break;
+            case 2:
+                DEC_PUT(uint16_t, htobe16);
+                break;
+            case 4:
+                DEC_PUT(uint32_t, htobe32);
+                break;
+            default:
+                DEC_PUT(uint64_t, htobe64);
+                break;
+        }
+        NET_PUT(out, k * size);
+    }
+
+    return 0;
+}
+
+# define DEC_GET(type, stype, swap) do {                                \
+    for (; j < k; ++j)                                                  \
+    {                                                                   \
+        type __v;                                                       \
+        memcpy(&__v, in + j * sizeof(type), sizeof(type));             \
+        v[j] = (stype)swap(__v) / p;                                    \
+    }                                                                   \
+} while (0)
+
+static void __dec_unpack(void **net, struct __seg *seg, int size, int scale,
+        void *des, int n)
+{
+    double v[CONV_CHUNK], p = __pow10[scale];
+    uint8_t in[CONV_CHUNK * 8];
+    int i, j, k;
+# ifdef __SSE2__
+    __m128d vp = _mm_set1_pd(p);
+    __m128i a;
+# endif
+
+    for (i = 0; i < n; i += k)
+    {
+        k = n - i < CONV_CHUNK ? n - i : CONV_CHUNK;
+        NET_GET(in, k * size);
+        j = 0;
+# ifdef __SSE2__
+        if (size == 4)
+        {
+            for (; j + 4 <= k; j += 4)
+            {
+                a = __bswap32_sse2(_mm_loadu_si128((__m128i const *)
+                            (in + 4 * j)));
+                _mm_storeu_pd(v + j, _mm_div_pd(_mm_cvtepi32_pd(a), vp));
+                _mm_storeu_pd(v + j + 2, _mm_div_pd(_mm_cvtepi32_pd(
+                                _mm_srli_si128(a, 8)), vp));
+            }
+        }
+# endif
+        switch (size)
+        {
+            case 1:
+                DEC_GET(uint8_t, int8_t, NO_SWAP);
+                break;
+            case 2:
+                DEC_GET(uint16_t, int16_t, be16toh);
+                break;
+            case 4:
+                DEC_GET(uint32_t, int32_t, be32toh);
+                break;
+            default:
+                DEC_GET(uint64_t, int64_t, be64toh);
+                break;
+        }
+        memcpy((char *)des + i * sizeof(double), v, k * sizeof(double));
+    }
+}
+
+# define CHECK_LV_LEN() do {                                            \
+    if ((unsigned)lv_len >> (lv_type * 8))                              \
+        ERR_RET_FMT(PACKF_BE_CUT_OFF);                                  \
+} while (0)
+
+# define SET_LV_LEN() do {                                              \
+    CHECK_LV_LEN();                                                     \
+    IF_LESS(*left_len, lv_type);                                        \
+    if (lv_type == 1) NET_PUT_VAL(uint8_t, (uint8_t)lv_len);            \
+    else NET_PUT_VAL(uint16_t, htobe16((uint16_t)lv_len));              \
+} while (0)
+
+# define SET_LV() do {                                                  \
+    if (lv_type)                                                        \
+    {                                                                   \
+        if (from == FROM_ARG) lv_len = va_arg(va, int);                 \
+        else                                                            \
+        {                                                               \
+            if (lv_type == 1) lv_len = *((uint8_t *)(*locale));         \
+            else lv_len = *((uint16_t *)(*locale));                     \
+            *locale = (char *)*locale + lv_type;                        \
+        }                                                               \
+        if (num != -1 && lv_len > num) ERR_RET_FMT(PACKF_BE_CUT_OFF);   \
+        SET_LV_LEN();                                                   \
+    }                                                                   \
+} while (0)
+
+# define DO_PACKF(type1, type2, swap, swap_flag) do {                   \
+    SET_LV();                                                           \
+    if (num == -1 && !lv_type)                                          \
+    {                                                                   \
+        IF_LESS(*left_len, sizeof(type1));                              \
+        if (from == FROM_ARG)                                           \
+            NET_PUT_VAL(type1, swap((type1)(va_arg(va, type2))));       \
+        else                                                            \
+        {                                                               \
+            NET_PUT_VAL(type1, swap(*((type1 *)(*locale))));            \
+            *locale = (char *)*locale + sizeof(type1);                  \
+        }                                                               \
+    }                                                                   \
+    else                                                                \
+    {                                                                   \
+        if (from == FROM_ARG)                                           \
+            src = va_arg(va, char *);                                   \
+        else                                                            \
+            src = *locale;                                              \
+        array_size = lv_type ? lv_len : num;                            \
+        offset = sizeof(type1) * array_size;                            \
+        if (offset)                                                     \
+        {                                                               \
+            IF_LESS(*left_len, offset);                                 \
+            if (BULK(offset) && !NET_SPLIT(offset))                     \
+                __bulk_put(net, src, sizeof(type1), array_size,         \
+                        swap_flag);                                     \
+            else if (swap_flag)                                         \
+                NET_PUT_ARRAY(type1, swap, src, array_size);            \
+            else                                                        \
+                NET_PUT(src, offset);                                   \
+        }                                                               \
+        if (from == FROM_PTR)                                           \
+        {                                                               \
+            if (lv_type && num)                                         \
+                *locale = (char *)*locale + num * sizeof(type1);        \
+            else                                                        \
+                *locale = (char *)*locale + offset;                     \
+        }                                                               \
+    }                                                                   \
+} while (0)
+
+/* 压缩编码的 w/d/D 数组，只能是数组或 LV 数组 */
+# define DO_PACKF_CODEC(size) do {                                      \
+    if (num == -1 && !lv_type)                                          \
+        ERR_RET_FMT(PACKF_NOT_FORMAT);                                  \
+    SET_LV();                                                           \
+    if (from == FROM_ARG)                                               \
+        src = va_arg(va, char *);                                       \
+    else                                                                \
+        src = *locale;                                                  \
+    array_size = lv_type ? lv_len : num;                                \
+    NEG_FMT(__codec_pack(net, left_len, seg, codec, size, src,          \
+                array_size));                                           \
+    if (from == FROM_PTR)                                               \
+        *locale = (char *)*locale + (size) *                            \
+            (lv_type && num != -1 ? num : array_size);                  \
+} while (0)
+
+/* 定点小数和半精度浮点，本地为 loc_size 字节，网络上为 net_size 字节 */
+# define DO_PACKF_CONV(net_size, loc_size, conv) do {                   \
+    SET_LV();                                                           \
+    if (from == FROM_ARG && num == -1 && !lv_type)                      \
+    {                                                                   \
+        dv = va_arg(va, double);                                        \
+        fv = (float)dv;                                                 \
+        src = (loc_size) == sizeof(float) ? (char *)&fv : (char *)&dv;  \
+    }                                                                   \
+    else if (from == FROM_ARG)                                          \
+        src = va_arg(va, char *);                                       \
+    else                                                                \
+        src = *locale;                                                  \
+    array_size = lv_type ? lv_len : (num == -1 ? 1 : num);              \
+    IF_LESS(*left_len, (net_size) * array_size);                        \
+    conv;                                                               \
+    if (from == FROM_PTR)                                               \
+        *locale = (char *)*locale + (loc_size) *                        \
+            (lv_type && num != -1 ? num : array_size);                  \
+} while (0)
+
+# define DO_PACKF_DEC(size)                                             \
+    DO_PACKF_CONV(size, sizeof(double),                                 \
+            NEG_FMT(__dec_pack(net, seg, size, scale, src, array_size)))
+
+/*
+ * 字符串字典：s/S 之后加 @ 的字段前有一个 LEB128 的标记，0 为字面量，1 为
+ * 加入字典的字面量（编号依次递增），n >= 2 为引用第 n - 2 个字面量。字典
+ * 保存的是字面量字段的网络数据，引用在解包时从这份数据按同样的 format
+ * 解包，本地的布局和不使用字典时完全相同。
+ */
+# define DICT_NO_SLOT   UINT32_MAX
+# define DICT_TAG_MAX   3               /* 标记不超过 3 字节 */
+
+struct __dict_ent
+{
+    char const             *ptr;    /* 字面量字段的网络数据，不含标记 */
+    int                     len;
+    uint32_t                hash;
+    uint32_t                slot;   /* 打包时在 slots 中的位置 */
+};
+
+struct packf_dict
+{
+    int                     max;
+    int                     n;
+    int                     flags;
+    uint32_t                mask;
+    uint32_t               *slots;  /* 编号 + 1, 0 为空 */
+    struct __dict_ent      *ents;
+    char                   *mem;
+    size_t                  mem_size;
+    size_t                  mem_used;
+};
+
+static uint32_t __dict_hash(uint8_t const *p, int len)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)len, v;
+
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&v, p, sizeof(v));
+        h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    if (len)
+    {
+        v = 0;
+        memcpy(&v, p, len);
+        h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+
+    return (uint32_t)h;
+}
+
+/* 加入一个字面量，slot 为 DICT_NO_SLOT 时不加入散列表（解包） */
+static int __dict_add(struct packf_dict *dict, char const *p, int len,
+        uint32_t hash, uint32_t slot)
+{
+    struct __dict_ent *e;
+
+    if (dict->n >= dict->max)
+        return PACKF_NO_MEMORY;
+    e = &dict->ents[dict->n];
+    if (slot == DICT_NO_SLOT && (dict->flags & PACKF_DICT_SHARED))
+    {
+        e->ptr = p;
+    }
+    else
+    {
+        if (dict->mem_size - dict->mem_used < (size_t)len)
+            return PACKF_NO_MEMORY;
+        e->ptr = memcpy(dict->mem + dict->mem_used, p, len);
+        dict->mem_used += len;
+    }
+    e->len  = len;
+    e->hash = hash;
+    e->slot = slot;
+    if (slot != DICT_NO_SLOT)
+        dict->slots[slot] = dict->n + 1;
+    ++dict->n;
+
+    return 0;
+}
+
+/* 撤销 n 之后加入的字面量，按加入的相反顺序清除散列表 */
+static void __dict_rollback(struct packf_dict *dict, int n, size_t mem_used)
+{
+    while (dict->n > n)
+    {
+        --dict->n;
+        if (dict->ents[dict->n].slot != DICT_NO_SLOT)
+            dict->slots[dict->ents[dict->n].slot] = 0;
+    }
+    dict->mem_used = mem_used;
+}
+
+/*
+ * 打包时 tag 处为标记 0, 之后到 *net 为字面量。字典中已经有同样的字面量
+ * 并且引用更短时改为引用，否则在字典未满时加入字典。
+ */
+static int __dict_pack(struct packf_dict *dict, void **net, int *left_len,
+        uint8_t *tag)
+{
+    uint8_t const *lit = tag + 1;
+    int len = (int)((uint8_t *)*net - lit), id, n;
+    uint32_t hash = __dict_hash(lit, len), slot = hash & dict->mask;
+    struct __dict_ent *e;
+
+    while (dict->slots[slot])
+    {
+        e = &dict->ents[dict->slots[slot] - 1];
+        if (e->hash == hash && e->len == len && !memcmp(e->ptr, lit, len))
+        {
+            id = dict->slots[slot] + 1;
+            n = id < 0x80 ? 1 : (id < 0x4000 ? 2 : 3);
+            if (n > len)
+                return 0;
+
+            *tag = (uint8_t)(id | (n > 1 ? 0x80 : 0));
+            if (n > 1)
+                tag[1] = (uint8_t)((id >> 7) | (n > 2 ? 0x80 : 0));
+            if (n > 2)
+                tag[2] = (uint8_t)(id >> 14);
+            *left_len += len + 1 - n;
+            *net = tag + n;
+
+            return 0;
+        }
+        slot = (slot + 1) & dict->mask;
+    }
+
+    if (dict->n < dict->max &&
+            dict->mem_size - dict->mem_used >= (size_t)len)
+    {
+        NEG_RET(__dict_add(dict, (char const *)lit, len, hash, slot));
+        *tag = 1;
+    }
+
+    return 0;
+}
+
+/* 读取字典字段的标记 */
+static int __dict_tag(void **net, int *left_len, struct __seg *seg)
+{
+    uint8_t b;
+    int tag = 0, i;
+
+    for (i = 0; i < DICT_TAG_MAX; ++i)
+    {
+        if (*left_len < 1)
+            return PACKF_OUT_OF_BUF;
+        --*left_len;
+        NET_GET_VAL(uint8_t, b);
+        tag |= (b & 0x7F) << (7 * i);
+        if (!(b & 0x80))
+            return tag;
+    }
+
+    return PACKF_BAD_DATA;
+}
+
+/*
+ * 打包的上下文，只在最外层建立。逐个元素打包过结构体数组之后，?[...] 的字段表
+ * 建立一次并缓存在 opts 中，之后的元素不再重新解析。
+ */
+struct __pctx
+{
+    struct packf_dict          *dict;
+    struct __opt               *opts;   /* 已经建立的字段表 */
+    int                         cache;  /* 是否缓存字段表 */
+};
+
+static int __packf_opt(void **net, int *left_len, char const *format,
+        uint64_t mask, void **locale, struct __seg *seg,
+        struct __pctx *ctx);
+
+static int __packf(void **net, int *left_len, char const *format, \
+        int from, va_list va, void **locale, struct __seg *seg,
+        struct __pctx *ctx)
+{
+    int buf_len = *left_len;
+    int num, i, j, k, array_size, offset, bracket_stack, lv_len = 0;
+    char *f = (char *)format, *__f, *str_num, *src;
+    char type, lv_type, codec, opt;
+    int struct_len_locale = 0, struct_len_net, p_struct_seg, fixed;
+    void *struct_start_locale, *p_struct_len;
+    int64_t p_struct_pos = 0;
+    int pinned = 0;
+    union { uint8_t u8; uint16_t u16; } lv_buf;
+    int use_crc = from == FROM_ARG && strchr(format, 'C');
+    int crc_idx = seg ? seg->idx : 0;
+    void *crc_done = *net;
+    uint32_t crc = 0;
+    uint64_t mask, v;
+    struct __bits bit = { 0, 0, 0, 0 };
+    int bits, size, scale, at;
+    uint8_t *at_pos = NULL;
+    double dv;
+    float fv;
+    int one = from == FROM_ONE;
+
+    if (one)
+        from = FROM_PTR;
+
+    while (*f)
+    {
+        if (*f == ' ')
+        {
+            ++f;
+            continue;
+        }
+
+        __f = f;
+        CRC_UPDATE();
+
+        opt = *f == '?';
+        if (opt)
+            ++f;
+
+        if (*f == '-')
+        {
+            lv_type = 1;
+            ++f;
+        }
+        else if (*f == '=')
+        {
+            lv_type = 2;
+            ++f;
+        }
+        else
+        {
+            lv_type = 0;
+        }
+
+        str_num = f;
+        while (__ISDIGIT(*f))
+            ++f;
+        if (str_num == f)
+            num = -1;
+        else
+            num = __atoi(str_num, f - str_num);
+
+        type = *(f++);
+        if (!type)
+            ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+        bits = 0;
+        if (type == 'b')
+        {
+            str_num = f;
+            while (__ISDIGIT(*f))
+                ++f;
+            if (str_num != f)
+                bits = __atoi(str_num, f - str_num);
+        }
+        scale = __dec_scale(&f);
+        if (scale != -1 && (scale < 0 || (type != 'c' && type != 'w' &&
+                        type != 'd' && type != 'D')))
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        codec = __ISCODEC(*f) ? *(f++) : 0;
+        if (codec && ((type != 'w' && type != 'd' && type != 'D') ||
+                    scale != -1))
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        at = *f == '@' ? (++f, 1) : 0;
+        if (at && type != 's' && type != 'S')
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        if (opt && type != '[')
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+
+        switch (type)
+        {
+            case '[':
+                if (opt)
+                {
+                    if (lv_type || num != -1)
+                        ERR_RET_FMT(PACKF_NOT_FORMAT);
+                    if (from == FROM_ARG)
+                    {
+                        mask = va_arg(va, uint64_t);
+                        *locale = va_arg(va, char *);
+                    }
+                    else
+                    {
+                        memcpy(&mask, *locale, sizeof(mask));
+                        *locale = (char *)*locale + sizeof(mask);
+                    }
+                    NEG_RET(__packf_opt(net, left_len, f, mask, locale, seg,
+                                ctx));
+                }
+                else if (lv_type && num == -1)
+                {
+                    if (from == FROM_ARG)
+                        *locale = va_arg(va, char *);
+
+                    IF_LESS(*left_len, lv_type);
+                    p_struct_len = *net;
+                    p_struct_seg = seg ? seg->idx : 0;
+                    if (seg && seg->sink)
+                    {
+                        /* 回填长度之前，长度头之后的数据不能输出 */
+                        p_struct_pos = seg->sink->flushed +
+                            ((char *)*net - seg->sink->buf);
+                        if ((pinned = seg->sink->pin < 0))
+                            seg->sink->pin = p_struct_pos;
+                    }
+                    NET_SKIP(lv_type);
+                    if (from == FROM_PTR)
+                        *locale = (char *)*locale + lv_type;
+                    struct_len_net = *left_len;
+                    NEG_RET(__packf(net, left_len, f, FROM_PTR, NULL,
+                                locale, seg, ctx));
+                    lv_len = struct_len_net - *left_len;
+                    CHECK_LV_LEN();
+                    if (lv_type == 1)
+                        lv_buf.u8 = (uint8_t)lv_len;
+                    else
+                        lv_buf.u16 = htobe16((uint16_t)lv_len);
+                    if (seg && seg->sink)
+                    {
+                        if (p_struct_pos >= seg->sink->flushed &&
+                                p_struct_pos - seg->sink->flushed + lv_type <=
+                                seg->sink->size)
+                            memcpy(seg->sink->buf + (p_struct_pos -
+                                        seg->sink->flushed), &lv_buf, lv_type);
+                        if (pinned)
+                            seg->sink->pin = -1;
+                    }
+                    else if (seg)
+                        __seg_put_at(seg, p_struct_len, p_struct_seg,
+                                &lv_buf, lv_type);
+                    else
+                        memcpy(p_struct_len, &lv_buf, lv_type);
+                }
+                else
+                {
+                    SET_LV();
+                    if (from == FROM_ARG)
+                        *locale = va_arg(va, char *);
+
+                    array_size = lv_type ? lv_len : (num == -1 ? 1 : num);
+                    fixed = 0;
+                    if (array_size > 1)
+                        NEG_RET(fixed = __fixed_array(net, left_len, f,
+                                    locale, array_size, seg, 0,
+                                    &struct_len_locale, __f));
+                    if (!fixed && array_size > 1 && ctx)
+                        ctx->cache = 1;
+                    for (i = 0; !fixed && i < array_size; i++)
+                    {
+                        struct_start_locale = *locale;
+                        NEG_RET(__packf(net, left_len, f, FROM_PTR,
+                                    NULL, locale, seg, ctx));
+                        struct_len_locale = (char *)*locale -
+                            (char *)struct_start_locale;
+                    }
+                    if (lv_type && from == FROM_PTR)
+                    {
+                        if (array_size == 0)
+                            NEG_RET(struct_len_locale =
+                                    __struct_len_locale(f, 0));
+                        *locale = (char *)*locale + struct_len_locale *
+                            (num - lv_len);
+                    }
+                }
+
+                bracket_stack = 1;
+                while (bracket_stack)
+                {
+                    if (!(*f))
+                        ERR_RET_FMT(PACKF_NOT_MATCH);
+                    else if (*f == '[')
+                        ++bracket_stack;
+                    else if (*f == ']')
+                        --bracket_stack;
+
+                    ++f;
+                }
+
+                break;
+            case ']':
+                return 0;
+            case 'b':
+                if (lv_type || bits < 1 || bits > 63)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                if (!bit.left)
+                {
+                    NEG_FMT(bit.left = __bits_run(__f, one));
+                    IF_LESS(*left_len, (bit.left + 7) / 8);
+                }
+
+                size = __bits_size(bits);
+                array_size = num == -1 ? 1 : num;
+                if (from == FROM_ARG && num == -1)
+                {
+                    v = bits > 32 ? va_arg(va, uint64_t) :
+                        va_arg(va, unsigned int);
+                    if (v >> bits)
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                    __bits_put(&bit, net, seg, v, bits);
+                }
+                else
+                {
+                    src = from == FROM_ARG ? va_arg(va, char *) : *locale;
+                    for (i = 0; i < array_size; ++i)
+                    {
+                        v = __bits_load(src + i * size, size);
+                        if (v >> bits)
+                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                        __bits_put(&bit, net, seg, v, bits);
+                    }
+                    if (from == FROM_PTR)
+                        *locale = (char *)*locale + size * array_size;
+                }
+                if (!bit.left)
+                    __bits_flush(&bit, net, seg);
+
+                break;
+            case 's':
+            case 'S':
+                if (at)
+                {
+                    IF_LESS(*left_len, 1);
+                    at_pos = *net;
+                    NET_PUT_VAL(uint8_t, 0);
+                }
+                if (from == FROM_ARG)
+                    src = va_arg(va, char *);
+                else
+                    src = (char *)*locale + lv_type;
+
+                if (lv_type)
+                {
+                    lv_len = 0;
+                    if (num == -1)
+                        lv_len = strlen(src);
+                    else if (num)
+                    {
+                        lv_len = strnlen(src, num - 1);
+                        if (src[lv_len])
+                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                    }
+
+                    SET_LV_LEN();
+
+                    if (lv_len)
+                    {
+                        IF_LESS(*left_len, lv_len);
+                        NET_PUT(src, lv_len);
+                    }
+
+                    if (from == FROM_PTR)
+                    {
+                        if (num == -1)
+                            *locale = (char *)*locale + lv_type + lv_len + 1;
+                        else
+                            *locale = (char *)*locale + lv_type + num;
+                    }
+                }
+                else
+                {
+                    if (num == -1)
+                    {
+                        offset = strlen(src) + 1;
+                        IF_LESS(*left_len, offset);
+                        NET_PUT(src, offset);
+                    }
+                    else if (type == 's')
+                    {
+                        offset = num;
+                        IF_LESS(*left_len, offset);
+
+                        i = strnlen(src, offset);
+                        if (offset && i == offset)
+                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+
+                        NET_PUT(src, i);
+                        NET_SET(0, offset - i);
+                    }
+                    else
+                    {
+                        offset = strnlen(src, num);
+                        if (num && offset == num)
+                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                        offset += num ? 1 : 0;
+                        IF_LESS(*left_len, offset);
+                        NET_PUT(src, offset);
+                    }
+
+                    if (from == FROM_PTR)
+                    {
+                        if (num >= 0 && type == 'S')
+                            *locale = (char *)*locale + num;
+                        else
+                            *locale = (char *)*locale + offset;
+                    }
+                }
+
+                /* 只有 packf_dict 传入字典，此时 net 是连续的 */
+                if (at && ctx && ctx->dict)
+                    NEG_FMT(__dict_pack(ctx->dict, net, left_len, at_pos));
+
+                break;
+            case 'a':
+                SET_LV();
+
+                offset = lv_type ? lv_len : (num == -1 ? 1 : num);
+                IF_LESS(*left_len, offset);
+                NET_SET(0, offset);
+                if (from == FROM_PTR)
+                {
+                    if (lv_type && num)
+                        *locale = (char *)*locale + num;
+                    else
+                        *locale = (char *)*locale + offset;
+                }
+
+                break;
+            case 'c':
+                if (scale != -1)
+                    DO_PACKF_DEC(1);
+                else
+                    DO_PACKF(int8_t, int, NO_SWAP, 0);
+
+                break;
+            case 'w':
+                if (codec)
+                    DO_PACKF_CODEC(2);
+                else if (scale != -1)
+                    DO_PACKF_DEC(2);
+                else
+                    DO_PACKF(int16_t, int, htobe16, BULK_SWAP);
+
+                break;
+            case 'd':
+                if (codec)
+                    DO_PACKF_CODEC(4);
+                else if (scale != -1)
+                    DO_PACKF_DEC(4);
+                else
+                    DO_PACKF(int32_t, int, htobe32, BULK_SWAP);
+
+                break;
+            case 'D':
+                if (codec)
+                    DO_PACKF_CODEC(8);
+                else if (scale != -1)
+                    DO_PACKF_DEC(8);
+                else
+                    DO_PACKF(int64_t, int64_t, htobe64, BULK_SWAP);
+
+                break;
+            case 'f':
+                DO_PACKF(float, double, htobef, BULK_SWAP_FLOAT);
+
+                break;
+            case 'F':
+                DO_PACKF(double, double, htobed, BULK_SWAP_FLOAT);
+
+                break;
+            case 'h':
+                DO_PACKF_CONV(2, sizeof(float),
+                        __f16_pack(net, seg, src, array_size));
+
+                break;
+            case 'C':
+                if (lv_type || num != -1 || !use_crc)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                IF_LESS(*left_len, 4);
+                NET_PUT_VAL(uint32_t, htobe32(crc));
+
+                break;
+            default:
+                ERR_RET_FMT(PACKF_NOT_FORMAT);
+        }
+
+        if (one)
+            break;
+    }
+
+    return buf_len - *left_len;
+}
+
+/* 按 mask 和已经建立的字段表打包，format 为 '[' 之后的格式 */
+static int __packf_opt_run(void **net, int *left_len, char const *format,
+        struct __opt const *opt, uint64_t mask, void **locale,
+        struct __seg *seg, struct __pctx *ctx)
+{
+    uint8_t bitmap[OPT_MAX_FIELDS / 8];
+    char *__f = (char *)format - 1;
+    void *field;
+    int i, n;
+
+    if (opt->n < OPT_MAX_FIELDS && (mask >> opt->n))
+        ERR_RET_FMT(PACKF_BAD_DATA);
+
+    n = (opt->n + 7) / 8;
+    for (i = 0; i < n; ++i)
+        bitmap[i] = (uint8_t)(mask >> (i * 8));
+    IF_LESS(*left_len, n);
+    NET_PUT(bitmap, n);
+
+    while (mask)
+    {
+        i = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        field = (char *)*locale + opt->off[i];
+        NEG_RET(__packf(net, left_len, opt->f[i], FROM_ONE, NULL, &field,
+                    seg, ctx));
+    }
+    *locale = (char *)*locale + opt->len;
+
+    return 0;
+}
+
+/*
+ * format 为 ?[ 中 '[' 之后的位置，返回字段表。结构体数组中的 ?[...] 只在第一个
+ * 元素建立一次，不需要缓存时建立在 buf 中
+ */
+static int __pctx_opt(struct __pctx *ctx, char const *format,
+        struct __opt *buf, struct __opt **opt)
+{
+    struct __opt *o;
+
+    if (!ctx || !ctx->cache)
+    {
+        *opt = buf;
+        return __opt_build(format, 0, buf);
+    }
+
+    for (o = ctx->opts; o; o = o->next)
+    {
+        if (o->format == format)
+        {
+            *opt = o;
+            return 0;
+        }
+    }
+    if (!(o = malloc(sizeof(struct __opt))))
+        return PACKF_NO_MEMORY;
+    o->format = format;
+    o->next = ctx->opts;
+    ctx->opts = o;
+    NEG_RET(__opt_build(format, 0, o));
+    *opt = o;
+
+    return 0;
+}
+
+static void __pctx_free(struct __pctx *ctx)
+{
+    struct __opt *opt;
+
+    while ((opt = ctx->opts))
+    {
+        ctx->opts = opt->next;
+        free(opt);
+    }
+}
+
+/*
+ * 按 mask 打包可选字段的结构体，format 为 '[' 之后的格式。字段表很大，不内联
+ * 到递归的 __packf 中，以免每一层嵌套的栈帧都包含它
+ */
+__attribute__((noinline))
+static int __packf_opt(void **net, int *left_len, char const *format,
+        uint64_t mask, void **locale, struct __seg *seg,
+        struct __pctx *ctx)
+{
+    struct __opt buf, *opt;
+
+    NEG_RET(__pctx_opt(ctx, format, &buf, &opt));
+
+    return __packf_opt_run(net, left_len, format, opt, mask, locale, seg,
+            ctx);
+}
+
+/* 建立打包上下文，从最外层开始打包 */
+static int __packf_top(void **net, int *left_len, char const *format,
+        va_list va, struct __seg *seg, struct packf_dict *dict)
+{
+    struct __pctx ctx;
+    void *locale = NULL;
+    int ret;
+
+    ctx.dict  = dict;
+    ctx.opts  = NULL;
+    ctx.cache = 0;
+
+    ret = __packf(net, left_len, format, FROM_ARG, va, &locale, seg, &ctx);
+    __pctx_free(&ctx);
+
+    return ret;
+}
+
+# define SET_LEN(des, len) do {                                         \
+    if (lv_type == 1) *((uint8_t *)(des)) = (uint8_t)len;               \
+    else *((uint16_t *)(des)) = (uint16_t)lv_len;                       \
+} while (0)
+
+# define GET_LV_LEN() do {                                              \
+    IF_LESS(*left_len, lv_type);                                        \
+    if (lv_type == 1)                                                   \
+    {                                                                   \
+        uint8_t __len;                                                  \
+        NET_GET_VAL(uint8_t, __len);                                    \
+        lv_len = __len;                                                 \
+    }                                                                   \
+    else                                                                \
+    {                                                                   \
+        uint16_t __len;                                                 \
+        NET_GET_VAL(uint16_t, __len);                                   \
+        lv_len = be16toh(__len);                                        \
+    }                                                                   \
+} while (0)
+
+# define GET_LV() do {                                                  \
+    if (lv_type)                                                        \
+    {                                                                   \
+        GET_LV_LEN();                                                   \
+        if (num != -1 && lv_len > num) ERR_RET_FMT(PACKF_BE_CUT_OFF);   \
+        if (from == FROM_ARG) SET_LEN(va_arg(va, char *), lv_len);      \
+        else                                                            \
+        {                                                               \
+            SET_LEN(*locale, lv_len);                                   \
+            *locale = (char *)*locale + lv_type;                        \
+        }                                                               \
+    }                                                                   \
+} while (0)
+
+/*
+ * 解包的上下文，只在最外层建立，递归时传递给结构体。
+ *
+ * 每个 '[' 对应的 ']' 之后的位置和本地结构体长度计算一次并保存在 br 中（下标
+ * 为 '[' 之后的字符在 format 中的偏移），结构体数组的每个元素不再重新查找
+ * ']'. 这样解包的工作量只与数据长度和 format 长度成正比，除了元素在网络上
+ * 可以为 0 字节的结构体数组，这种情况由 limits 中的元素个数限制。br 在第一次
+ * 逐个元素解包结构体数组或者遇到嵌套的结构体时才建立，只有一层结构体的
+ * format 不需要它。
+ */
+struct __br
+{
+    int                         end;    /* ']' 之后的偏移，-1 表示不匹配 */
+    int                         slen;   /* 本地结构体长度，-2 表示还没有计算 */
+    struct __opt               *opt;    /* ?[...] 的字段表 */
+};
+
+struct __uctx
+{
+    struct packf_arena         *arena;
+    struct packf_limits const  *limits;
+    struct packf_dict          *dict;
+    char const                 *base;
+    struct __br                *br;     /* 还没有建立时为 NULL */
+    struct __br                *stack;  /* format 较短时 br 使用的栈空间 */
+    struct __opt               *opts;   /* 已经建立的字段表 */
+    int                         depth;
+    int                         elems;
+    int64_t                     out;
+};
+
+# define UCTX_STACK_BR  256
+
+static void __uctx_init(struct __uctx *ctx, char const *format,
+        struct __br *stack_br)
+{
+    ctx->base  = format;
+    ctx->br    = NULL;
+    ctx->stack = stack_br;
+    ctx->opts  = NULL;
+    ctx->depth = 0;
+    ctx->elems = 0;
+    ctx->out   = 0;
+}
+
+/* 建立 br, 结构体数组逐个元素解包之前调用 */
+static int __uctx_br(struct __uctx *ctx)
+{
+    char const *format = ctx->base;
+    int len, i, open = -1, next;
+    struct __br *br;
+
+    len = strlen(format);
+    if (len < UCTX_STACK_BR)
+        br = ctx->stack;
+    else if (!(br = malloc(sizeof(*br) * (len + 1))))
+        return PACKF_NO_MEMORY;
+
+    /* 未匹配的 '[' 通过 end 串成栈 */
+    for (i = 0; format[i]; ++i)
+    {
+        if (format[i] == '[')
+        {
+            br[i + 1].end  = open;
+            br[i + 1].slen = -2;
+            br[i + 1].opt  = NULL;
+            open = i + 1;
+        }
+        else if (format[i] == ']' && open >= 0)
+        {
+            next = br[open].end;
+            br[open].end = i + 1;
+            open = next;
+        }
+    }
+    while (open >= 0)
+    {
+        next = br[open].end;
+        br[open].end = -1;
+        open = next;
+    }
+    ctx->br = br;
+
+    return 0;
+}
+
+static void __uctx_free(struct __uctx *ctx, struct __br *stack_br)
+{
+    struct __opt *opt;
+
+    while ((opt = ctx->opts))
+    {
+        ctx->opts = opt->next;
+        free(opt);
+    }
+    if (ctx->br && ctx->br != stack_br)
+        free(ctx->br);
+}
+
+/* f 为 '[' 之后的位置，返回本地结构体长度 */
+static int __uctx_slen(struct __uctx *ctx, char const *f, int arena)
+{
+    struct __br *b;
+
+    if (!ctx || !ctx->br)
+        return __struct_len_locale(f, arena);
+
+    b = &ctx->br[f - ctx->base];
+    if (b->slen == -2)
+        b->slen = __struct_len_locale(f, arena);
+
+    return b->slen;
+}
+
+/*
+ * f 为 ?[ 中 '[' 之后的位置，返回字段表。结构体数组中的 ?[...] 只在第一个元素
+ * 建立一次，没有上下文或者 br 还没有建立时建立在 buf 中
+ */
+static int __uctx_opt(struct __uctx *ctx, char const *f, struct __opt *buf,
+        struct __opt **opt)
+{
+    struct __br *b;
+    int arena = ctx && ctx->arena;
+
+    if (!ctx || !ctx->br)
+    {
+        *opt = buf;
+        return __opt_build(f, arena, buf);
+    }
+
+    b = &ctx->br[f - ctx->base];
+    if (!b->opt)
+    {
+        if (!(b->opt = malloc(sizeof(struct __opt))))
+            return PACKF_NO_MEMORY;
+        b->opt->next = ctx->opts;
+        ctx->opts = b->opt;
+        NEG_RET(__opt_build(f, arena, b->opt));
+    }
+    *opt = b->opt;
+
+    return 0;
+}
+
+/* 检查并累计元素个数和输出的字节数 */
+static int __uctx_charge(struct __uctx *ctx, int elems, int64_t out)
+{
+    struct packf_limits const *l = ctx->limits;
+
+    ctx->elems += elems;
+    ctx->out   += out;
+    if ((l->max_elems > 0 && ctx->elems > l->max_elems) ||
+            (l->max_out > 0 && ctx->out > l->max_out))
+        return PACKF_OVER_LIMIT;
+
+    return 0;
+}
+
+# define UNPACK_DEPTH(call) do {                                         \
+    if (ctx && ctx->limits && ctx->limits->max_depth > 0 &&             \
+            ctx->depth >= ctx->limits->max_depth)                       \
+        ERR_RET_FMT(PACKF_OVER_LIMIT);                                  \
+    if (ctx)                                                            \
+        ++ctx->depth;                                                   \
+    ret = (call);                                                       \
+    if (ctx)                                                            \
+        --ctx->depth;                                                   \
+    NEG_RET(ret);                                                       \
+} while (0)
+
+# define UNPACK_CHARGE(elems, out) do {                                 \
+    if (ctx && ctx->limits)                                             \
+        NEG_FMT(__uctx_charge(ctx, (elems), (out)));                    \
+} while (0)
+
+/* 从 arena 中分配 len 字节，按 8 字节对齐 */
+static void *__arena_alloc(struct packf_arena *arena, size_t len)
+{
+    size_t start = (arena->used + 7) & ~(size_t)7;
+
+    if (start > arena->size || arena->size - start < len)
+        return NULL;
+    arena->used = start + len;
+
+    return (char *)arena->base + start;
+}
+
+/* arena 解包时，LV 字段的数据放到 arena 中，本地只保存指向它的指针 */
+# define USE_ARENA() (ctx && ctx->arena && lv_type)
+
+# define ARENA_DES(len) do {                                            \
+    if (!(des = __arena_alloc(ctx->arena, (len))))                      \
+        ERR_RET_FMT(PACKF_NO_MEMORY);                                   \
+    if (from == FROM_ARG)                                               \
+        *((char **)va_arg(va, char *)) = des;                           \
+    else                                                                \
+    {                                                                   \
+        memcpy(*locale, &des, sizeof(des));                             \
+        *locale = (char *)*locale + sizeof(des);                        \
+    }                                                                   \
+} while (0)
+
+# define DO_UNPACKF(type, swap, swap_flag) do {                         \
+    GET_LV();                                                           \
+    if (num == -1 && !lv_type)                                          \
+    {                                                                   \
+        type __v;                                                       \
+        IF_LESS(*left_len, sizeof(type));                               \
+        NET_GET_VAL(type, __v);                                         \
+        if (from == FROM_ARG)                                           \
+            *((type *)(va_arg(va, char *))) = swap(__v);                \
+        else                                                            \
+        {                                                               \
+            *((type *)(*locale)) = swap(__v);                           \
+            *locale = (char *)*locale + sizeof(type);                   \
+        }                                                               \
+    }                                                                   \
+    else                                                                \
+    {                                                                   \
+        array_size = lv_type ? lv_len : num;                            \
+        offset = sizeof(type) * array_size;                             \
+        UNPACK_CHARGE(array_size, offset);                              \
+        if (USE_ARENA())                                                \
+            ARENA_DES(offset);                                          \
+        else if (from == FROM_ARG)                                      \
+            des = va_arg(va, char *);                                   \
+        else                                                            \
+            des = *locale;                                              \
+        if (offset)                                                     \
+        {                                                               \
+            IF_LESS(*left_len, offset);                                 \
+            if (BULK(offset) && !NET_SPLIT(offset))                     \
+                __bulk_get(net, des, sizeof(type), array_size,          \
+                        swap_flag);                                     \
+            else if (swap_flag)                                         \
+                NET_GET_ARRAY(type, swap, des, array_size);             \
+            else                                                        \
+                NET_GET(des, offset);                                   \
+        }                                                               \
+        if (from == FROM_PTR && !USE_ARENA())                           \
+        {                                                               \
+            if (lv_type && num)                                         \
+                *locale = (char *)*locale + num * sizeof(type);         \
+            else                                                        \
+                *locale = (char *)*locale + offset;                     \
+        }                                                               \
+    }                                                                   \
+} while (0)
+
+# define DO_UNPACKF_CODEC(size) do {                                    \
+    if (num == -1 && !lv_type)                                          \
+        ERR_RET_FMT(PACKF_NOT_FORMAT);                                  \
+    GET_LV();                                                           \
+    array_size = lv_type ? lv_len : num;                                \
+    UNPACK_CHARGE(array_size, (size) * array_size);                     \
+    if (USE_ARENA())                                                    \
+        ARENA_DES((size) * array_size);                                 \
+    else if (from == FROM_ARG)                                          \
+        des = va_arg(va, char *);                                       \
+    else                                                                \
+        des = *locale;                                                  \
+    NEG_FMT(__codec_unpack(net, left_len, seg, codec, size, des,        \
+                array_size, NULL));                                     \
+    if (from == FROM_PTR && !USE_ARENA())                               \
+        *locale = (char *)*locale + (size) *                            \
+            (lv_type && num != -1 ? num : array_size);                  \
+} while (0)
+
+# define DO_UNPACKF_CONV(net_size, loc_size, conv) do {                 \
+    GET_LV();                                                           \
+    array_size = lv_type ? lv_len : (num == -1 ? 1 : num);              \
+    if (num != -1 || lv_type)                                           \
+        UNPACK_CHARGE(array_size, (loc_size) * array_size);             \
+    if (USE_ARENA())                                                    \
+        ARENA_DES((loc_size) * array_size);                             \
+    else if (from == FROM_ARG)                                          \
+        des = va_arg(va, char *);                                       \
+    else                                                                \
+        des = *locale;                                                  \
+    IF_LESS(*left_len, (net_size) * array_size);                        \
+    conv;                                                               \
+    if (from == FROM_PTR && !USE_ARENA())                               \
+        *locale = (char *)*locale + (loc_size) *                        \
+            (lv_type && num != -1 ? num : array_size);                  \
+} while (0)
+
+# define DO_UNPACKF_DEC(size)                                           \
+    DO_UNPACKF_CONV(size, sizeof(double),                               \
+            __dec_unpack(net, seg, size, scale, des, array_size))
+
+static int __unpackf_opt(void **net, int *left_len, char const *format,
+        void *p_mask, void **locale, struct __seg *seg, struct __uctx *ctx);
+
+static int __unpackf(void **net, int *left_len, char const *format, \
+        int from, va_list va, void **locale, struct __seg *seg,
+        struct __uctx *ctx)
+{
+    int buf_len = *left_len;
+    int num, i, j, k, array_size, offset, bracket_stack, lv_len = 0, ret;
+    char *f = (char *)format, *__f, *str_num, *des;
+    char type, lv_type, codec, opt;
+    int struct_len_locale = 0, struct_len_net = 0, fixed;
+    void *struct_start_locale, *struct_save_locale = NULL;
+    int use_crc = from == FROM_ARG && strchr(format, 'C');
+    int crc_idx = seg ? seg->idx : 0;
+    void *crc_done = *net;
+    uint32_t crc = 0, crc_net;
+    void *p_mask;
+    struct __bits bit = { 0, 0, 0, 0 };
+    uint8_t bit_buf[64];
+    int bits, size, scale, at, tag, at_left = 0, *at_save_left = NULL;
+    void *at_net = NULL, **at_save_net = NULL;
+    struct __seg *at_save_seg = NULL;
+    char *at_lit = NULL;
+    int one = from == FROM_ONE;
+
+    if (one)
+        from = FROM_PTR;
+
+    while (*f)
+    {
+        if (*f == ' ')
+        {
+            ++f;
+            continue;
+        }
+
+        __f = f;
+        CRC_UPDATE();
+
+        opt = *f == '?';
+        if (opt)
+            ++f;
+
+        if (*f == '-')
+        {
+            lv_type = 1;
+            ++f;
+        }
+        else if (*f == '=')
+        {
+            lv_type = 2;
+            ++f;
+        }
+        else
+        {
+            lv_type = 0;
+        }
+
+        str_num = f;
+        while (__ISDIGIT(*f))
+            ++f;
+        if (str_num == f)
+            num = -1;
+        else
+            num = __atoi(str_num, f - str_num);
+
+        type = *(f++);
+        if (!type)
+            ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+        bits = 0;
+        if (type == 'b')
+        {
+            str_num = f;
+            while (__ISDIGIT(*f))
+                ++f;
+            if (str_num != f)
+                bits = __atoi(str_num, f - str_num);
+        }
+        scale = __dec_scale(&f);
+        if (scale != -1 && (scale < 0 || (type != 'c' && type != 'w' &&
+                        type != 'd' && type != 'D')))
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        codec = __ISCODEC(*f) ? *(f++) : 0;
+        if (codec && ((type != 'w' && type != 'd' && type != 'D') ||
+                    scale != -1))
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        at = *f == '@' ? (++f, 1) : 0;
+        if (at && type != 's' && type != 'S')
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        if (opt && type != '[')
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+
+        switch (type)
+        {
+            case '[':
+                if (opt)
+                {
+                    if (lv_type || num != -1)
+                        ERR_RET_FMT(PACKF_NOT_FORMAT);
+                    if (from == FROM_ARG)
+                    {
+                        p_mask = va_arg(va, uint64_t *);
+                        *locale = va_arg(va, char *);
+                    }
+                    else
+                    {
+                        p_mask = *locale;
+                        *locale = (char *)*locale + sizeof(uint64_t);
+                    }
+                    UNPACK_DEPTH(__unpackf_opt(net, left_len, f, p_mask,
+                                locale, seg, ctx));
+                }
+                else if (lv_type && num == -1)
+                {
+                    if (from == FROM_ARG)
+                        *locale = va_arg(va, char *);
+
+                    GET_LV_LEN();
+                    IF_LESS(*left_len, lv_len);
+                    struct_len_net = lv_len;
+                    if (from == FROM_PTR)
+                    {
+                        SET_LEN(*locale, lv_len);
+                        *locale = (char *)*locale + lv_type;
+                    }
+                    UNPACK_DEPTH(__unpackf(net, &struct_len_net, f, FROM_PTR,
+                                NULL, locale, seg, ctx));
+                    NET_SKIP(struct_len_net);
+                }
+                else
+                {
+                    GET_LV();
+                    array_size = lv_type ? lv_len : (num == -1 ? 1 : num);
+                    UNPACK_CHARGE(array_size, 0);
+                    if (USE_ARENA())
+                    {
+                        NEG_RET(struct_len_locale = __uctx_slen(ctx, f, 1));
+                        ARENA_DES((size_t)struct_len_locale * array_size);
+                        struct_save_locale = *locale;
+                        *locale = des;
+                    }
+                    else if (from == FROM_ARG)
+                    {
+                        *locale = va_arg(va, char *);
+                    }
+
+                    fixed = 0;
+                    if (array_size > 1)
+                        NEG_RET(fixed = __fixed_array(net, left_len, f,
+                                    locale, array_size, seg, 1,
+                                    &struct_len_locale, __f));
+                    if (!fixed && array_size > 1 && ctx && !ctx->br)
+                        NEG_RET(__uctx_br(ctx));
+                    for (i = 0; !fixed && i < array_size; i++)
+                    {
+                        struct_start_locale = *locale;
+                        offset = *left_len;
+                        UNPACK_DEPTH(__unpackf(net, left_len, f, FROM_PTR,
+                                    NULL, locale, seg, ctx));
+                        struct_len_locale = (char *)*locale -
+                            (char *)struct_start_locale;
+
+                        /*
+                         * 元素在网络上为 0 字节时，其余的元素解出的结果完全相同，
+                         * 不再逐个解析，以免工作量与数据长度无关
+                         */
+                        if (*left_len == offset)
+                        {
+                            UNPACK_CHARGE(0, (int64_t)struct_len_locale *
+                                    (array_size - i - 1));
+                            for (j = i + 1; struct_len_locale &&
+                                    j < array_size; j++)
+                            {
+                                memmove(*locale, struct_start_locale,
+                                        struct_len_locale);
+                                *locale = (char *)*locale + struct_len_locale;
+                            }
+                            break;
+                        }
+                    }
+                    if (USE_ARENA())
+                    {
+                        *locale = struct_save_locale;
+                    }
+                    else if (lv_type && from == FROM_PTR)
+                    {
+                        if (array_size == 0)
+                            NEG_RET(struct_len_locale =
+                                    __uctx_slen(ctx, f, 0));
+                        *locale = (char *)*locale + struct_len_locale *
+                            (num - lv_len);
+                    }
+                }
+
+                /* 嵌套的结构体逐层向后查找 ']' 时工作量与深度的平方成正比 */
+                if (ctx && !ctx->br && ctx->depth > 0)
+                    NEG_RET(__uctx_br(ctx));
+                if (ctx && ctx->br)
+                {
+                    if (ctx->br[f - ctx->base].end < 0)
+                        ERR_RET_FMT(PACKF_NOT_MATCH);
+                    f = (char *)ctx->base + ctx->br[f - ctx->base].end;
+                    break;
+                }
+
+                bracket_stack = 1;
+                while (bracket_stack)
+                {
+                    if (!(*f))
+                        ERR_RET_FMT(PACKF_NOT_MATCH);
+                    else if (*f == '[')
+                        ++bracket_stack;
+                    else if (*f == ']')
+                        --bracket_stack;
+
+                    ++f;
+                }
+
+                break;
+            case ']':
+                return 0;
+            case 'b':
+                if (lv_type || bits < 1 || bits > 63)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                if (!bit.left)
+                {
+                    NEG_FMT(bit.left = __bits_run(__f, one));
+                    bit.bytes = (bit.left + 7) / 8;
+                    IF_LESS(*left_len, bit.bytes);
+                    bit.acc = 0;
+                    bit.n   = 0;
+                }
+
+                size = __bits_size(bits);
+                array_size = num == -1 ? 1 : num;
+                UNPACK_CHARGE(array_size, (int64_t)size * array_size);
+                des = from == FROM_ARG ? va_arg(va, char *) : *locale;
+                i = 0;
+                if (size == 1 && 8 % bits == 0 && bit.n % 8 == 0)
+                {
+                    /* 字节对齐时整字节展开 */
+                    for (; i < array_size && bit.n; ++i)
+                        des[i] = (char)__bits_get(&bit, net, seg, bits);
+                    while ((k = (array_size - i) * bits / 8) > 0)
+                    {
+                        if (k > (int)sizeof(bit_buf))
+                            k = sizeof(bit_buf);
+                        NET_GET(bit_buf, k);
+                        if (bits == 8)
+                            memcpy(des + i, bit_buf, k);
+                        else
+                            __bits_expand8(bit_buf, k, (uint8_t *)des + i,
+                                    bits);
+                        i += k * 8 / bits;
+                        bit.left  -= 8 * k;
+                        bit.bytes -= k;
+                    }
+                }
+                for (; i < array_size; ++i)
+                    __bits_store(des + i * size, size,
+                            __bits_get(&bit, net, seg, bits));
+                if (from == FROM_PTR)
+                    *locale = (char *)*locale + size * array_size;
+                if (!bit.left)
+                {
+                    /* 丢弃补齐的位 */
+                    NET_SKIP(bit.bytes);
+                    bit.bytes = 0;
+                    bit.n     = 0;
+                }
+
+                break;
+            case 's':
+            case 'S':
+                if (at)
+                {
+                    NEG_FMT(tag = __dict_tag(net, left_len, seg));
+                    if (tag >= 2)
+                    {
+                        if (!ctx || !ctx->dict || tag - 2 >= ctx->dict->n)
+                            ERR_RET_FMT(PACKF_BAD_DATA);
+                        /* 引用：从字典中的字面量解包，之后恢复 net */
+                        at_net  = (void *)ctx->dict->ents[tag - 2].ptr;
+                        at_left = ctx->dict->ents[tag - 2].len;
+                        at_save_net  = net;
+                        at_save_left = left_len;
+                        at_save_seg  = seg;
+                        net      = &at_net;
+                        left_len = &at_left;
+                        seg      = NULL;
+                    }
+                    else if (tag == 1 && ctx && ctx->dict)
+                    {
+                        at_lit = *net;
+                    }
+                }
+                if (USE_ARENA())
+                {
+                    GET_LV_LEN();
+
+                    if ((num == 0 && lv_len) || (num > 0 && lv_len > num - 1))
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
+
+                    if (from == FROM_PTR)
+                    {
+                        SET_LEN(*locale, lv_len);
+                        *locale = (char *)*locale + lv_type;
+                    }
+                    UNPACK_CHARGE(1, lv_len + 1);
+                    ARENA_DES(lv_len + 1);
+                    if (lv_len)
+                    {
+                        IF_LESS(*left_len, lv_len);
+                        NET_GET(des, lv_len);
+                    }
+                    des[lv_len] = '\0';
+
+                    break;
+                }
+
+                if (from == FROM_ARG)
+                    des = va_arg(va, char *);
+                else
+                    des = (char *)*locale;
+
+                if (lv_type)
+                {
+                    GET_LV_LEN();
+
+                    if ((num == 0 && lv_len) || (num > 0 && lv_len > num - 1))
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
+
+                    UNPACK_CHARGE(1, lv_len + 1);
+                    if (from == FROM_PTR)
+                    {
+                        SET_LEN(des, lv_len);
+                        des += lv_type;
+                    }
+
+                    if (lv_len)
+                    {
+                        IF_LESS(*left_len, lv_len);
+                        NET_GET(des, lv_len);
+                    }
+
+                    if (num != 0)
+                        *(des + lv_len) = '\0';
+
+                    if (from == FROM_PTR)
+                    {
+                        if (num == -1)
+                            *locale = (char *)*locale + lv_type + lv_len + 1;
+                        else
+                            *locale = (char *)*locale + lv_type + num;
+                    }
+                }
+                else
+                {
+                    if (num == -1)
+                    {
+                        offset = NET_STRNLEN(*left_len) + 1;
+                        IF_LESS(*left_len, offset);
+                        NET_GET(des, offset);
+                    }
+                    else if (type == 's')
+                    {
+                        offset = num;
+                        IF_LESS(*left_len, offset);
+
+                        i = NET_STRNLEN(offset);
+                        if (offset && i == offset)
+                        {
+                            NET_GET(des, offset);
+                            des[offset - 1] = 0;
+                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                        }
+
+                        if (offset)
+                        {
+                            NET_GET(des, i + 1);
+                            NET_SKIP(offset - i - 1);
+                        }
+                    }
+                    else
+                    {
+                        offset = NET_STRNLEN(num < *left_len ? num : *left_len);
+                        if (num && offset == num)
+                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                        offset += num ? 1 : 0;
+                        IF_LESS(*left_len, offset);
+                        NET_GET(des, offset);
+                    }
+
+                    if (from == FROM_PTR)
+                    {
+                        if (num >= 0 && type == 'S')
+                            *locale = (char *)*locale + num;
+                        else
+                            *locale = (char *)*locale + offset;
+                    }
+                }
+
+                break;
+            case 'a':
+                GET_LV();
+
+                offset = lv_type ? lv_len : (num == -1 ? 1 : num);
+                IF_LESS(*left_len, offset);
+                NET_SKIP(offset);
+                if (from == FROM_PTR)
+                {
+                    memset(*locale, 0, offset);
+                    if (lv_type && num)
+                        *locale = (char *)*locale + num;
+                    else
+                        *locale = (char *)*locale + offset;
+                }
+
+                break;
+            case 'c':
+                if (scale != -1)
+                    DO_UNPACKF_DEC(1);
+                else
+                    DO_UNPACKF(int8_t, NO_SWAP, 0);
+
+                break;
+            case 'w':
+                if (codec)
+                    DO_UNPACKF_CODEC(2);
+                else if (scale != -1)
+                    DO_UNPACKF_DEC(2);
+                else
+                    DO_UNPACKF(int16_t, be16toh, BULK_SWAP);
+
+                break;
+            case 'd':
+                if (codec)
+                    DO_UNPACKF_CODEC(4);
+                else if (scale != -1)
+                    DO_UNPACKF_DEC(4);
+                else
+                    DO_UNPACKF(int32_t, be32toh, BULK_SWAP);
+
+                break;
+            case 'D':
+                if (codec)
+                    DO_UNPACKF_CODEC(8);
+                else if (scale != -1)
+                    DO_UNPACKF_DEC(8);
+                else
+                    DO_UNPACKF(int64_t, be64toh, BULK_SWAP);
+
+                break;
+            case 'f':
+                DO_UNPACKF(float, beftoh, BULK_SWAP_FLOAT);
+
+                break;
+            case 'F':
+                DO_UNPACKF(double, bedtoh, BULK_SWAP_FLOAT);
+
+                break;
+            case 'h':
+                DO_UNPACKF_CONV(2, sizeof(float),
+                        __f16_unpack(net, seg, des, array_size));
+
+                break;
+            case 'C':
+                if (lv_type || num != -1 || !use_crc)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                IF_LESS(*left_len, 4);
+                NET_GET_VAL(uint32_t, crc_net);
+                if (be32toh(crc_net) != crc)
+                    ERR_RET_FMT(PACKF_BAD_CHECKSUM);
+
+                break;
+            default:
+                ERR_RET_FMT(PACKF_NOT_FORMAT);
+        }
+
+        if (at && at_save_net)
+        {
+            net      = at_save_net;
+            left_len = at_save_left;
+            seg      = at_save_seg;
+            at_save_net = NULL;
+        }
+        else if (at && at_lit)
+        {
+            NEG_FMT(__dict_add(ctx->dict, at_lit, (char *)*net - at_lit, 0,
+                        DICT_NO_SLOT));
+            at_lit = NULL;
+        }
+
+        if (one)
+            break;
+    }
+
+    return buf_len - *left_len;
+}
+
+/*
+ * 按已经建立的字段表解包可选字段的结构体，format 为 '[' 之后的格式。位图写入
+ * p_mask, 只有存在的字段写入本地结构体，其余字段保持不变
+ */
+static int __unpackf_opt_run(void **net, int *left_len, char const *format,
+        struct __opt const *opt, void *p_mask, void **locale,
+        struct __seg *seg, struct __uctx *ctx)
+{
+    uint8_t bitmap[OPT_MAX_FIELDS / 8];
+    char *__f = (char *)format - 1;
+    uint64_t mask = 0;
+    void *field;
+    int i, n;
+
+    n = (opt->n + 7) / 8;
+    IF_LESS(*left_len, n);
+    NET_GET(bitmap, n);
+    for (i = 0; i < n; ++i)
+        mask |= (uint64_t)bitmap[i] << (i * 8);
+    if (opt->n < OPT_MAX_FIELDS && (mask >> opt->n))
+        ERR_RET_FMT(PACKF_BAD_DATA);
+    memcpy(p_mask, &mask, sizeof(mask));
+    UNPACK_CHARGE(__builtin_popcountll(mask), 0);
+
+    while (mask)
+    {
+        i = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        field = (char *)*locale + opt->off[i];
+        NEG_RET(__unpackf(net, left_len, opt->f[i], FROM_ONE, NULL, &field,
+                    seg, ctx));
+    }
+    *locale = (char *)*locale + opt->len;
+
+    return 0;
+}
+
+/* 解包可选字段的结构体，format 为 '[' 之后的格式。同 __packf_opt, 不内联 */
+__attribute__((noinline))
+static int __unpackf_opt(void **net, int *left_len, char const *format,
+        void *p_mask, void **locale, struct __seg *seg, struct __uctx *ctx)
+{
+    struct __opt buf, *opt;
+
+    NEG_RET(__uctx_opt(ctx, format, &buf, &opt));
+
+    return __unpackf_opt_run(net, left_len, format, opt, p_mask, locale,
+            seg, ctx);
+}
+
+int packf(void *dest, size_t max, char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = (int)max;
+    void *net = dest;
+
+    if (!dest)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    va_start(va, format);
+    ret = __packf_top(&net, &left_len, format, va, NULL, NULL);
+    va_end(va);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+/* 建立解包上下文，从最外层开始解包 */
+static int __unpackf_top(void **net, int *left_len, char const *format,
+        va_list va, struct __seg *seg, struct packf_arena *arena,
+        struct packf_limits const *limits, struct packf_dict *dict)
+{
+    struct __br stack_br[UCTX_STACK_BR];
+    struct __uctx ctx;
+    void *locale = NULL;
+    int ret;
+
+    __uctx_init(&ctx, format, stack_br);
+    ctx.arena  = arena;
+    ctx.limits = limits;
+    ctx.dict   = dict;
+
+    ret = __unpackf(net, left_len, format, FROM_ARG, va, &locale, seg, &ctx);
+    __uctx_free(&ctx, stack_br);
+
+    return ret;
+}
+
+int unpackf(void *src, size_t max, char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = (int)max;
+    void *net = src;
+
+    if (!src)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    va_start(va, format);
+    ret = __unpackf_top(&net, &left_len, format, va, NULL, NULL, NULL,
+            NULL);
+    va_end(va);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+void packf_arena_init(struct packf_arena *arena, void *buf, size_t size)
+{
+    arena->base = buf;
+    arena->size = size;
+    arena->used = 0;
+}
+
+int unpackf_arena(void *src, size_t max, struct packf_arena *arena,
+        char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = (int)max;
+    void *net = src;
+    size_t used;
+
+    if (!src || !arena)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    used = arena->used;
+    va_start(va, format);
+    ret = __unpackf_top(&net, &left_len, format, va, NULL, arena, NULL,
+            NULL);
+    va_end(va);
+
+    /* 失败时释放本次分配的空间 */
+    if (ret < 0)
+        arena->used = used;
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int unpackf_limited(void *src, size_t max, struct packf_limits const *limits,
+        char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = (int)max;
+    void *net = src;
+
+    if (!src || !limits)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    va_start(va, format);
+    ret = __unpackf_top(&net, &left_len, format, va, NULL, NULL, limits,
+            NULL);
+    va_end(va);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+struct packf_dict *packf_dict_new(int max, size_t mem, int flags)
+{
+    struct packf_dict *dict;
+    uint32_t n = 16;
+
+    if (max <= 0 || max > PACKF_DICT_MAX)
+        return NULL;
+    while (n < 2 * (uint32_t)max)
+        n <<= 1;
+
+    if (!(dict = calloc(1, sizeof(*dict))))
+        return NULL;
+    dict->max      = max;
+    dict->flags    = flags;
+    dict->mask     = n - 1;
+    dict->mem_size = mem;
+    dict->slots    = calloc(n, sizeof(*dict->slots));
+    dict->ents     = malloc(max * sizeof(*dict->ents));
+    dict->mem      = malloc(mem ? mem : 1);
+    if (!dict->slots || !dict->ents || !dict->mem)
+    {
+        packf_dict_free(dict);
+        return NULL;
+    }
+
+    return dict;
+}
+
+void packf_dict_free(struct packf_dict *dict)
+{
+    if (!dict)
+        return;
+
+    free(dict->slots);
+    free(dict->ents);
+    free(dict->mem);
+    free(dict);
+}
+
+void packf_dict_reset(struct packf_dict *dict)
+{
+    __dict_rollback(dict, 0, 0);
+}
+
+int packf_dict_count(struct packf_dict const *dict)
+{
+    return dict->n;
+}
+
+int packf_dicta(void *dest, size_t max, struct packf_dict *dict,
+        char const *format, va_list arg)
+{
+    int ret, n, left_len = (int)max;
+    void *net = dest;
+    size_t used;
+
+    if (!dest || !dict)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    n = dict->n;
+    used = dict->mem_used;
+    ret = __packf_top(&net, &left_len, format, arg, NULL, dict);
+
+    /* 失败时撤销本条消息加入的字面量，两端的字典保持一致 */
+    if (ret < 0)
+        __dict_rollback(dict, n, used);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int packf_dict(void *dest, size_t max, struct packf_dict *dict,
+        char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = packf_dicta(dest, max, dict, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int unpackf_dicta(void *src, size_t max, struct packf_dict *dict,
+        char const *format, va_list arg)
+{
+    int ret, n, left_len = (int)max;
+    void *net = src;
+    size_t used;
+
+    if (!src || !dict)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    n = dict->n;
+    used = dict->mem_used;
+    ret = __unpackf_top(&net, &left_len, format, arg, NULL, NULL, NULL,
+            dict);
+    if (ret < 0)
+        __dict_rollback(dict, n, used);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int unpackf_dict(void *src, size_t max, struct packf_dict *dict,
+        char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = unpackf_dicta(src, max, dict, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+/*
+ * 增量编码：格式为 "?[" format "]" 的可选字段的结构体，掩码为与上一条消息
+ * 相比有变化的字段。本地结构体是连续的 (# pragma pack(1))，先按 16 字节一块
+ * 比较（没有 SSE2 时按 8 字节），找到第一个不同的字节后标记它所在的字段，
+ * 直接跳到下一个字段继续比较。
+ */
+struct packf_delta
+{
+    struct __opt        opt;
+    char                format[];   /* "?[" format "]", opt.f 指向这里 */
+};
+
+/* 从 i 开始比较 a 和 b, 返回第一个不同的字节的位置，都相同时返回 len */
+static int __delta_diff(uint8_t const *a, uint8_t const *b, int i, int len)
+{
+    uint64_t x, y;
+# ifdef __SSE2__
+    unsigned m;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128((__m128i const *)(a + i)),
+                    _mm_loadu_si128((__m128i const *)(b + i)))) ^ 0xFFFF;
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+# endif
+
+    for (; i + 8 <= len; i += 8)
+    {
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y)
+# if __BYTE_ORDER == __LITTLE_ENDIAN
+            return i + __builtin_ctzll(x ^ y) / 8;
+# else
+            return i + __builtin_clzll(x ^ y) / 8;
+# endif
+    }
+    for (; i < len && a[i] == b[i]; ++i)
+        ;
+
+    return i;
+}
+
+static uint64_t __delta_mask(struct __opt const *opt, uint8_t const *prev,
+        uint8_t const *cur)
+{
+    uint64_t mask = 0;
+    int i = 0, f = 0;
+
+    if (!prev)
+        return opt->n == OPT_MAX_FIELDS ? ~(uint64_t)0 :
+            ((uint64_t)1 << opt->n) - 1;
+
+    while ((i = __delta_diff(prev, cur, i, opt->len)) < opt->len)
+    {
+        while (f + 1 < opt->n && opt->off[f + 1] <= i)
+            ++f;
+        mask |= (uint64_t)1 << f;
+        i = f + 1 < opt->n ? opt->off[f + 1] : opt->len;
+    }
+
+    return mask;
+}
+
+struct packf_delta *packf_delta_new(char const *format)
+{
+    struct packf_delta *d;
+    size_t len;
+    int depth = 0;
+    char const *f;
+
+    if (!format)
+        return NULL;
+
+    /* 括号不匹配时 ?[ 会提前结束 */
+    for (f = format; *f; ++f)
+    {
+        if (*f == '[')
+            ++depth;
+        else if (*f == ']' && --depth < 0)
+            return NULL;
+    }
+    if (depth)
+        return NULL;
+
+    len = strlen(format);
+    if (!(d = malloc(sizeof(*d) + len + 4)))
+        return NULL;
+    memcpy(d->format, "?[", 2);
+    memcpy(d->format + 2, format, len);
+    memcpy(d->format + 2 + len, "]", 2);
+
+    if (__opt_build(d->format + 2, 0, &d->opt) < 0 || !d->opt.n)
+    {
+        free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+void packf_delta_free(struct packf_delta *d)
+{
+    free(d);
+}
+
+int packf_delta_len(struct packf_delta const *d)
+{
+    return d ? d->opt.len : 0;
+}
+
+uint64_t packf_delta_mask(struct packf_delta const *d, void const *prev,
+        void const *cur)
+{
+    if (!d || !cur)
+        return 0;
+
+    return __delta_mask(&d->opt, prev, cur);
+}
+
+int packf_delta(struct packf_delta const *d, void *dest, size_t max,
+        void const *prev, void const *cur)
+{
+    struct __pctx ctx;
+    int ret, left_len = (int)max;
+    void *net = dest, *locale = (void *)cur;
+
+    if (!d || !dest || !cur)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    ctx.dict  = NULL;
+    ctx.opts  = NULL;
+    ctx.cache = 0;
+    ret = __packf_opt_run(&net, &left_len, d->format + 2, &d->opt,
+            __delta_mask(&d->opt, prev, cur), &locale, NULL, &ctx);
+    __pctx_free(&ctx);
+    if (ret >= 0)
+        ret = (int)max - left_len;
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int unpackf_delta(struct packf_delta const *d, void *src, size_t max,
+        void *prev, uint64_t *mask)
+{
+    struct __br stack_br[UCTX_STACK_BR];
+    struct __uctx ctx;
+    uint64_t m;
+    int ret, left_len = (int)max;
+    void *net = src, *locale = prev;
+
+    if (!d || !src || !prev)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    __uctx_init(&ctx, d->format, stack_br);
+    ctx.arena  = NULL;
+    ctx.limits = NULL;
+    ctx.dict   = NULL;
+
+    ret = __unpackf_opt_run(&net, &left_len, d->format + 2, &d->opt, &m,
+            &locale, NULL, &ctx);
+    __uctx_free(&ctx, stack_br);
+    if (ret >= 0)
+    {
+        ret = (int)max - left_len;
+        if (mask)
+            *mask = m;
+    }
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int vpackf(void **current, int *left, char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = *left;
+    void *net = *current;
+
+    if (!current || !*current || !left)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    va_start(va, format);
+    ret = __packf_top(&net, &left_len, format, va, NULL, NULL);
+    va_end(va);
+
+    if (ret > 0)
+    {
+        *current = net;
+        *left    = left_len;
+    }
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int vunpackf(void **current, int *left, char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = *left;
+    void *net = *current;
+
+    if (!current || !*current || !left)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    va_start(va, format);
+    ret = __unpackf_top(&net, &left_len, format, va, NULL, NULL, NULL,
+            NULL);
+    va_end(va);
+
+    if (ret > 0)
+    {
+        *current = net;
+        *left    = left_len;
+    }
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int vpacka(void **current, int *left, char const *format, va_list arg)
+{
+    int ret, left_len = *left;
+    void *net = *current;
+
+    if (!current || !*current || !left)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    ret = __packf_top(&net, &left_len, format, arg, NULL, NULL);
+
+    if (ret > 0)
+    {
+        *current = net;
+        *left    = left_len;
+    }
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int vunpacka(void **current, int *left, char const *format, va_list arg)
+{
+    int ret, left_len = *left;
+    void *net = *current;
+
+    if (!current || !*current || !left)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    ret = __unpackf_top(&net, &left_len, format, arg, NULL, NULL, NULL,
+            NULL);
+
+    if (ret > 0)
+    {
+        *current = net;
+        *left    = left_len;
+    }
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+static int __seg_init(struct __seg *seg, struct iovec const *iov, int iovcnt,
+        void **net)
+{
+    size_t total = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; ++i)
+        total += iov[i].iov_len;
+
+    seg->iov = iov;
+    seg->cnt = iovcnt;
+    seg->idx  = 0;
+    seg->sink = NULL;
+    *net      = iov[0].iov_base;
+
+    return total > INT_MAX ? INT_MAX : (int)total;
+}
+
+int packf_iova(struct iovec const *iov, int iovcnt, char const *format,
+        va_list arg)
+{
+    struct __seg seg;
+    int ret, left_len;
+    void *net;
+
+    if (!iov || iovcnt <= 0)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    left_len = __seg_init(&seg, iov, iovcnt, &net);
+    ret = __packf_top(&net, &left_len, format, arg, &seg, NULL);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int unpackf_iova(struct iovec const *iov, int iovcnt, char const *format,
+        va_list arg)
+{
+    struct __seg seg;
+    int ret, left_len;
+    void *net;
+
+    if (!iov || iovcnt <= 0)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+
+    left_len = __seg_init(&seg, iov, iovcnt, &net);
+    ret = __unpackf_top(&net, &left_len, format, arg, &seg, NULL, NULL,
+            NULL);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int packf_iov(struct iovec const *iov, int iovcnt, char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = packf_iova(iov, iovcnt, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int unpackf_iov(struct iovec const *iov, int iovcnt, char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = unpackf_iova(iov, iovcnt, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+void packf_sink_init(struct packf_sink *sink, void *buf, int size,
+        int (*flush)(void *ctx, void const *data, int len), void *ctx)
+{
+    sink->flush   = flush;
+    sink->ctx     = ctx;
+    sink->buf     = buf;
+    sink->size    = size;
+    sink->len     = 0;
+    sink->flushed = 0;
+    sink->pin     = -1;
+    sink->err     = 0;
+}
+
+int packf_sinka(struct packf_sink *sink, char const *format, va_list arg)
+{
+    struct iovec iov;
+    struct __seg seg;
+    int ret, left_len = INT_MAX;
+    void *net;
+    int64_t start;
+
+    if (!sink || !sink->buf || !sink->flush)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!format)
+        return 0;
+    /* 输出后的数据不能再计算校验和 */
+    if (strchr(format, 'C'))
+        ERR_RET_PRINT(PACKF_NOT_FORMAT);
+
+    iov.iov_base = sink->buf;
+    iov.iov_len  = sink->size;
+    seg.iov  = &iov;
+    seg.cnt  = 1;
+    seg.idx  = 0;
+    seg.sink = sink;
+    net = sink->buf + sink->len;
+    sink->pin = -1;
+    sink->err = 0;
+
+    start = sink->flushed + sink->len;
+    ret = __packf_top(&net, &left_len, format, arg, &seg, NULL);
+    sink->len = (int)((char *)net - sink->buf);
+
+    /* 失败时丢弃还没有输出的部分 */
+    if (ret < 0 || sink->err)
+        sink->len = start > sink->flushed ? (int)(start - sink->flushed) : 0;
+    if (ret >= 0 && sink->err)
+        ERR_RET_PRINT(sink->err);
+
+    PRINT_ERR_FMT(ret);
+
+    return ret;
+}
+
+int packf_sink(struct packf_sink *sink, char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = packf_sinka(sink, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int packf_sink_flush(struct packf_sink *sink)
+{
+    int ret;
+
+    if (!sink || !sink->flush)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    if (sink->len > 0)
+    {
+        if ((ret = sink->flush(sink->ctx, sink->buf, sink->len)) < 0)
+            return ret;
+        sink->flushed += sink->len;
+        sink->len = 0;
+    }
+
+    return 0;
+}
+
+int packf_sink_fd(void *ctx, void const *data, int len)
+{
+    int fd = *(int *)ctx;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = write(fd, data, len)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return PACKF_IO_ERROR;
+        }
+        data = (char const *)data + n;
+        len -= (int)n;
+    }
+
+    return 0;
+}
+
+char const *packf_strerror(int ret)
+{
+    if (ret >= 0 || -ret > (int)(sizeof(err_msg) / sizeof(err_msg[0])))
+        return "unknown error";
+
+    return err_msg[-ret - 1];
+}
+
+int vpackn(void **current, int *left, void *buf, size_t n)
+{
+    if (!current || !*current || !left || !buf)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    char *__f = NULL;
+    IF_LESS(*left, n);
+    memcpy(*current, buf, n);
+    *current = (char *)*current + n;
+
+    return (int)n;
+}
+
+int vunpackn(void **current, int *left, void *buf, size_t n)
+{
+    if (!current || !*current || !left || !buf)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    char *__f = NULL;
+    IF_LESS(*left, n);
+    memcpy(buf, *current, n);
+    *current = (char *)*current + n;
+
+    return (int)n;
+}
+
+struct packf_fixed
+{
+    int                 len;
+    int                 nops;
+    struct __fixed_op   ops[];
+};
+
+struct packf_fixed *packf_fixed_new(char const *format)
+{
+    struct packf_fixed *fx = NULL, *tmp;
+    int ret, max_ops = FX_STACK_OPS;
+    char const *end;
+
+    if (!format)
+        return NULL;
+
+    for (;;)
+    {
+        tmp = realloc(fx, sizeof(*fx) + sizeof(fx->ops[0]) * max_ops);
+        if (!tmp)
+            break;
+        fx = tmp;
+        fx->nops = 0;
+
+        ret = __fixed_build(format, fx->ops, &fx->nops, max_ops, 0,
+                &fx->len, &end);
+        if (ret == FX_TOO_MANY_OPS)
+        {
+            max_ops *= 2;
+            continue;
+        }
+        if (ret < 0 || *end)
+            break;
+
+        return fx;
+    }
+
+    free(fx);
+
+    return NULL;
+}
+
+void packf_fixed_free(struct packf_fixed *fx)
+{
+    free(fx);
+}
+
+int packf_fixed_len(struct packf_fixed const *fx)
+{
+    return fx ? fx->len : 0;
+}
+
+int packf_fixed(struct packf_fixed const *fx, void *dest, size_t max,
+        void const *src, int n)
+{
+    int ret;
+
+    if (!fx || !dest || !src)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (n < 0 || (fx->len && n > INT_MAX / fx->len) ||
+            (size_t)fx->len * n > max)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    ret = __fixed_run(fx->ops, fx->nops, fx->len, dest, src, n, 0);
+    if (ret < 0)
+        ERR_RET_PRINT(ret);
+
+    return fx->len * n;
+}
+
+int unpackf_fixed(struct packf_fixed const *fx, void const *src, size_t max,
+        void *dest, int n)
+{
+    int ret;
+
+    if (!fx || !dest || !src)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (n < 0 || (fx->len && n > INT_MAX / fx->len) ||
+            (size_t)fx->len * n > max)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    ret = __fixed_run(fx->ops, fx->nops, fx->len, dest, src, n, 1);
+    if (ret < 0)
+        ERR_RET_PRINT(ret);
+
+    return fx->len * n;
+}
+
+/*
+ * 视图：不拷贝、不解包整个消息，只在访问某个字段时才转换它的字节序。
+ *
+ * 字段通过下标路径定位：结构体（包括最外层的 format）中按字段的顺序编号，
+ * 数组和 LV 数组中按元素编号，结构体数组的元素之后再跟结构体内的字段编号。
+ * 例如 format 为 "d -16s =10[w d]" 时，{ 2, 3, 1 } 表示第 3 个字段中第 4 个
+ * 元素的 d 字段。
+ *
+ * 固定布局的部分（整个 format 或者其中的结构体）不需要建立索引，访问时
+ * 直接按 format 计算偏移；其余部分在 packf_view_init 时扫描一遍数据，为
+ * 每个字段记录偏移和长度。
+ */
+struct packf_view_node
+{
+    char const *f;      /* 结构体为 '[' 之后的格式，其余为字段的格式 */
+    char        type;
+    char        lv_type;
+    char        codec;  /* 压缩编码的整数数组 */
+    int         num;
+    int         offset; /* 值在 buf 中的偏移，不含 LV 长度头 */
+    int         len;    /* 值的字节数 */
+    int         count;  /* 元素个数，字符串为字符个数 */
+    int         child;  /* 字段块或元素块的起始下标，-1 表示固定布局 */
+    int         nchild;
+};
+
+struct __view_loc
+{
+    char const *f;
+    char        type;
+    char        codec;
+    char        lv_type;
+    int         num;
+    int         offset;
+    int         len;
+    int         count;
+    int         size;   /* 元素的字节数 */
+};
+
+static int __type_size(char type)
+{
+    switch (type)
+    {
+        case 'a':
+        case 'c':
+        case 's':
+        case 'S':
+            return 1;
+        case 'w':
+            return 2;
+        case 'd':
+        case 'f':
+        case 'C':
+            return 4;
+        case 'D':
+        case 'F':
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/* 返回 '[' 之后的格式对应的 ']' 之后的位置 */
+static char const *__skip_struct(char const *f)
+{
+    int bracket_stack = 1;
+
+    while (bracket_stack)
+    {
+        if (!(*f))
+            return NULL;
+        else if (*f == '[')
+            ++bracket_stack;
+        else if (*f == ']')
+            --bracket_stack;
+
+        ++f;
+    }
+
+    return f;
+}
+
+/*
+ * 解析一个字段的 [-=][num]type[bits][.scale][codec][@], 返回字段之后的位置。
+ * 定点小数的 *codec 为 '.', 字典中的字符串为 '@', 使用者不支持时应和其他
+ * 编码一样拒绝。
+ */
+static inline char const *__parse_field(char const *f, char *lv_type, int *num,
+        char *type, char *codec)
+{
+    char const *str_num;
+
+    *lv_type = *f == '-' ? 1 : (*f == '=' ? 2 : 0);
+    if (*lv_type)
+        ++f;
+
+    str_num = f;
+    while (__ISDIGIT(*f))
+        ++f;
+    *num = str_num == f ? -1 : __atoi((char *)str_num, f - str_num);
+    *type  = *f;
+    *codec = 0;
+    if (!*f)
+        return f;
+
+    if (*f++ == 'b')
+        while (__ISDIGIT(*f))
+            ++f;
+    if (*f == '.')
+    {
+        *codec = '.';
+        for (++f; __ISDIGIT(*f); ++f)
+            ;
+    }
+    else if (__ISCODEC(*f))
+    {
+        *codec = *f++;
+    }
+    if (*f == '@')
+    {
+        *codec = '@';
+        ++f;
+    }
+
+    return f;
+}
+
+static int __view_fields(char const *format)
+{
+    char const *f = format;
+    char lv_type, type, codec;
+    int num, n = 0;
+
+    while (*f && *f != ']')
+    {
+        if (*f == ' ')
+        {
+            ++f;
+            continue;
+        }
+
+        f = __parse_field(f, &lv_type, &num, &type, &codec);
+        if (type == '[' && !(f = __skip_struct(f)))
+            return PACKF_NOT_MATCH;
+        ++n;
+    }
+
+    return n;
+}
+
+static int __view_alloc(struct packf_view *view, int n)
+{
+    struct packf_view_node *nodes;
+    int start = view->nnodes, cap = view->cap ? view->cap : 16;
+
+    while (cap < view->nnodes + n)
+        cap *= 2;
+    if (cap != view->cap)
+    {
+        nodes = realloc(view->nodes, sizeof(*nodes) * cap);
+        if (!nodes)
+            return PACKF_NO_MEMORY;
+        view->nodes = nodes;
+        view->cap   = cap;
+    }
+    view->nnodes += n;
+
+    return start;
+}
+
+/*
+ * 计算一个字段在网络上的长度头 *hdr, 元素个数 *count 和值的长度 *size,
+ * 视图和投影共用。pos 为字段（包括长度头）在 buf 中的偏移，inner 为结构体
+ * '[' 之后的格式。buf 为 NULL 时只根据格式计算，需要读取数据时返回 1;
+ * 元素不是固定布局的结构体数组也返回 1, 此时 *count 已经确定，由调用者
+ * 逐个元素计算长度。
+ */
+static int __field_wire(uint8_t const *buf, int end, int pos, char lv_type,
+        int num, char type, char codec, char const *inner, int *hdr,
+        int *count, int *size)
+{
+    int lv_len = 0, vpos, fixed_len;
+
+    if (codec && !__ISCODEC(codec))
+        return PACKF_NOT_FORMAT;
+
+    *hdr = lv_type;
+    if (lv_type)
+    {
+        if (!buf)
+            return 1;
+        if (end - pos < lv_type)
+            return PACKF_OUT_OF_BUF;
+        lv_len = lv_type == 1 ? buf[pos] : (buf[pos] << 8) | buf[pos + 1];
+    }
+    vpos = pos + lv_type;
+
+    switch (type)
+    {
+        case 'a':
+        case 'c':
+        case 'w':
+        case 'd':
+        case 'D':
+        case 'f':
+        case 'F':
+        case 'C':
+            if (lv_type && num != -1 && lv_len > num)
+                return PACKF_BE_CUT_OFF;
+            *count = lv_type ? lv_len : (num == -1 ? 1 : num);
+            if (codec)
+            {
+                if (!buf)
+                    return 1;
+                if (num == -1 && !lv_type)
+                    return PACKF_NOT_FORMAT;
+                NEG_RET(*size = __codec_size(buf + vpos, end - vpos, codec,
+                            __type_size(type), *count));
+                return 0;
+            }
+            *size = __type_size(type) * *count;
+            break;
+        case 's':
+        case 'S':
+            if (lv_type)
+            {
+                if ((num == 0 && lv_len) || (num > 0 && lv_len > num - 1))
+                    return PACKF_BE_CUT_OFF;
+                *count = *size = lv_len;
+            }
+            else if (!buf)
+            {
+                if (type != 's' || num == -1)
+                    return 1;
+                *count = 0;
+                *size  = num;
+            }
+            else if (num == -1)
+            {
+                *count = strnlen((char const *)buf + vpos, end - vpos);
+                *size  = *count + 1;
+            }
+            else
+            {
+                *size  = num < end - vpos ? num : end - vpos;
+                *count = strnlen((char const *)buf + vpos, *size);
+                if (num && *count == num)
+                    return PACKF_BE_CUT_OFF;
+                *size  = type == 's' ? num : *count + (num ? 1 : 0);
+            }
+            break;
+        case '[':
+            fixed_len = __fixed_len(inner);
+            if (lv_type && num == -1)
+            {
+                *count = 1;
+                *size  = lv_len;
+                if (fixed_len > lv_len)
+                    return PACKF_OUT_OF_BUF;
+                break;
+            }
+            if (lv_type && num != -1 && lv_len > num)
+                return PACKF_BE_CUT_OFF;
+            *count = lv_type ? lv_len : (num == -1 ? 1 : num);
+            if (fixed_len < 0)
+                return 1;
+            *size = fixed_len * *count;
+            break;
+        default:
+            return PACKF_NOT_FORMAT;
+    }
+
+    if (buf && end - vpos < *size)
+        return PACKF_OUT_OF_BUF;
+
+    return 0;
+}
+
+/*
+ * 为 format 当前层级的字段建立索引，字段节点为 nodes[block] 开始的连续
+ * 节点，*pos 为当前在 buf 中的偏移，数据不能超过 end.
+ */
+static int __view_build(struct packf_view *view, char const *format,
+        int block, int *pos, int end)
+{
+    uint8_t const *buf = view->buf;
+    char const *f = format, *__f, *inner;
+    char lv_type, type, codec;
+    int num, k, i, hdr, count, size, start, elem, nfields, ret;
+    struct packf_view_node *node;
+
+    for (k = 0; *f && *f != ']'; ++k)
+    {
+        while (*f == ' ')
+            ++f;
+        if (!*f || *f == ']')
+            break;
+
+        __f = f;
+        f = __parse_field(f, &lv_type, &num, &type, &codec);
+        if (!type)
+            return PACKF_EXPECT_FORMAT;
+        inner = f;
+        if (type == '[' && !(f = __skip_struct(f)))
+            return PACKF_NOT_MATCH;
+
+        NEG_RET(ret = __field_wire(buf, end, *pos, lv_type, num, type, codec,
+                    inner, &hdr, &count, &size));
+        *pos += hdr;
+
+        node = &view->nodes[block + k];
+        node->f       = type == '[' ? inner : __f;
+        node->type    = type;
+        node->lv_type = lv_type;
+        node->codec   = codec;
+        node->num     = num;
+        node->offset  = *pos;
+        node->child   = -1;
+        node->nchild  = 0;
+
+        if (type == '[')
+        {
+            NEG_RET(nfields = __view_fields(inner));
+
+            if (lv_type && num == -1)
+            {
+                if (__fixed_len(inner) < 0)
+                {
+                    NEG_RET(start = __view_alloc(view, nfields));
+                    view->nodes[block + k].child  = start;
+                    view->nodes[block + k].nchild = nfields;
+                    i = *pos;
+                    NEG_RET(__view_build(view, inner, start, &i,
+                                *pos + size));
+                }
+            }
+            else if (ret == 1)
+            {
+                /* 元素不是固定布局，为每个元素建立一个节点和它的字段块 */
+                NEG_RET(start = __view_alloc(view, count));
+                view->nodes[block + k].child  = start;
+                view->nodes[block + k].nchild = count;
+                i = *pos;
+                for (elem = 0; elem < count; ++elem)
+                {
+                    NEG_RET(ret = __view_alloc(view, nfields));
+                    node = &view->nodes[start + elem];
+                    node->f       = inner;
+                    node->type    = '[';
+                    node->lv_type = 0;
+                    node->codec   = 0;
+                    node->num     = -1;
+                    node->offset  = i;
+                    node->count   = 1;
+                    node->child   = ret;
+                    node->nchild  = nfields;
+                    NEG_RET(__view_build(view, inner, ret, &i, end));
+                    view->nodes[start + elem].len = i -
+                        view->nodes[start + elem].offset;
+                }
+                size = i - *pos;
+            }
+        }
+
+        node = &view->nodes[block + k];
+        node->count = count;
+        node->len   = size;
+        *pos += size;
+    }
+
+    return 0;
+}
+
+int packf_view_init(struct packf_view *view, void *buf, size_t len,
+        char const *format)
+{
+    int ret, pos = 0, n;
+
+    if (!view || !buf || !format)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    view->buf    = buf;
+    view->len    = len > INT_MAX ? INT_MAX : (int)len;
+    view->format = format;
+    view->nnodes = 0;
+    view->ntop   = 0;
+
+    if ((ret = __fixed_len(format)) >= 0)
+    {
+        if (ret > view->len)
+            ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+        view->fixed = 1;
+        view->len   = ret;
+        return ret;
+    }
+
+    view->fixed = 0;
+    if ((n = __view_fields(format)) < 0)
+        ERR_RET_PRINT(n);
+    if ((ret = __view_alloc(view, n)) < 0)
+        ERR_RET_PRINT(ret);
+    view->ntop = n;
+    if ((ret = __view_build(view, format, 0, &pos, view->len)) < 0)
+        ERR_RET_PRINT(ret);
+    view->len = pos;
+
+    return pos;
+}
+
+void packf_view_free(struct packf_view *view)
+{
+    if (view)
+    {
+        free(view->nodes);
+        view->nodes  = NULL;
+        view->nnodes = 0;
+        view->cap    = 0;
+    }
+}
+
+/*
+ * 在固定布局的结构体 format 中按 path 定位，base 为结构体在 buf 中的偏移
+ */
+static int __view_locate_fixed(struct packf_view const *view,
+        char const *format, int base, int const *path, int depth,
+        struct __view_loc *loc)
+{
+    char const *f = format;
+    char lv_type, type, codec;
+    int num, k, size, d = 0;
+
+    for (;;)
+    {
+        for (k = 0; ; ++k)
+        {
+            while (*f == ' ')
+                ++f;
+            if (!*f || *f == ']')
+                return PACKF_NOT_MATCH;
+
+            f = __parse_field(f, &lv_type, &num, &type, &codec);
+            size = type == '[' ? __fixed_len(f) : __type_size(type);
+            if (k == path[d])
+                break;
+
+            if (type == '[')
+                f = __skip_struct(f);
+            base += size * (num == -1 ? 1 : num);
+        }
+        ++d;
+
+        loc->f       = f;
+        loc->type    = type;
+        loc->codec   = 0;
+        loc->lv_type = 0;
+        loc->num     = num;
+        loc->offset  = base;
+        loc->size    = size;
+        loc->count   = num == -1 ? 1 : num;
+        loc->len     = size * loc->count;
+        if (type == 's')
+        {
+            loc->count = strnlen((char const *)view->buf + base, loc->len);
+            if (loc->len && loc->count == loc->len)
+                return PACKF_BE_CUT_OFF;
+        }
+
+        if (d == depth)
+            return 0;
+
+        if (num != -1)
+        {
+            if (type == 's' || type == 'a')
+                return PACKF_NOT_MATCH;
+            if (path[d] < 0 || path[d] >= loc->count)
+                return PACKF_NOT_MATCH;
+            base = loc->offset += size * path[d++];
+            loc->num   = -1;
+            loc->count = 1;
+            loc->len   = size;
+            if (d == depth)
+                return 0;
+        }
+
+        if (type != '[')
+            return PACKF_NOT_MATCH;
+    }
+}
+
+static int __view_locate(struct packf_view const *view, int const *path,
+        int depth, struct __view_loc *loc)
+{
+    struct packf_view_node const *node;
+    int block = 0, nfields = view->ntop, d = 0, size;
+
+    if (depth <= 0)
+        return PACKF_NOT_MATCH;
+    if (view->fixed)
+        return __view_locate_fixed(view, view->format, 0, path, depth, loc);
+
+    for (;;)
+    {
+        if (path[d] < 0 || path[d] >= nfields)
+            return PACKF_NOT_MATCH;
+        node = &view->nodes[block + path[d++]];
+
+        size = node->type == '[' ? (node->count ? node->len / node->count : 0)
+            : __type_size(node->type);
+        loc->f       = node->f;
+        loc->type    = node->type;
+        loc->codec   = node->codec;
+        loc->lv_type = node->lv_type;
+        loc->num     = node->num;
+        loc->offset  = node->offset;
+        loc->len     = node->len;
+        loc->count   = node->count;
+        loc->size    = size;
+        if (d == depth)
+            return 0;
+
+        if (node->type != '[')
+        {
+            if (node->type == 's' || node->type == 'S' || node->type == 'a' ||
+                    node->codec)
+                return PACKF_NOT_MATCH;
+            if (path[d] < 0 || path[d] >= node->count || d + 1 != depth)
+                return PACKF_NOT_MATCH;
+            loc->offset += size * path[d];
+            loc->lv_type = 0;
+            loc->num     = -1;
+            loc->count   = 1;
+            loc->len     = size;
+            return 0;
+        }
+
+        if (node->child == -1)
+        {
+            if (node->num != -1)
+            {
+                if (path[d] < 0 || path[d] >= node->count)
+                    return PACKF_NOT_MATCH;
+                loc->offset += size * path[d++];
+                loc->count   = 1;
+                loc->len     = size;
+                if (d == depth)
+                    return 0;
+            }
+
+            return __view_locate_fixed(view, node->f, loc->offset,
+                    path + d, depth - d, loc);
+        }
+
+        if (node->num != -1)
+        {
+            if (path[d] < 0 || path[d] >= node->nchild)
+                return PACKF_NOT_MATCH;
+            node = &view->nodes[node->child + path[d++]];
+            loc->offset = node->offset;
+            loc->len    = node->len;
+            loc->count  = 1;
+            if (d == depth)
+                return 0;
+        }
+
+        block   = node->child;
+        nfields = node->nchild;
+    }
+}
+
+/* 把 loc 定位的字段转换为本地序保存到 out, 返回写入的长度 */
+static int __loc_get(void const *buf, struct __view_loc const *loc, void *out)
+{
+    void *net, *locale = out;
+    char const *p = (char const *)buf + loc->offset;
+    int i, ret, left;
+
+    if (loc->codec)
+    {
+        net  = (void *)p;
+        left = loc->len;
+        NEG_RET(__codec_unpack(&net, &left, NULL, loc->codec, loc->size,
+                    out, loc->count, NULL));
+        return loc->size * loc->count;
+    }
+
+    switch (loc->type)
+    {
+        case 'c':
+            memcpy(out, p, loc->count);
+            break;
+        case 'w':
+            for (i = 0; i < loc->count; ++i)
+                ((int16_t *)out)[i] = be16toh(((int16_t *)p)[i]);
+            break;
+        case 'd':
+        case 'C':
+            for (i = 0; i < loc->count; ++i)
+                ((int32_t *)out)[i] = be32toh(((int32_t *)p)[i]);
+            break;
+        case 'D':
+            for (i = 0; i < loc->count; ++i)
+                ((int64_t *)out)[i] = be64toh(((int64_t *)p)[i]);
+            break;
+        case 'f':
+            for (i = 0; i < loc->count; ++i)
+                ((float *)out)[i] = beftoh(((float *)p)[i]);
+            break;
+        case 'F':
+            for (i = 0; i < loc->count; ++i)
+                ((double *)out)[i] = bedtoh(((double *)p)[i]);
+            break;
+        case 'a':
+            memset(out, 0, loc->len);
+            return loc->len;
+        case 's':
+        case 'S':
+            memcpy(out, p, loc->count);
+            ((char *)out)[loc->count] = '\0';
+            return loc->count;
+        case '[':
+            net  = (void *)p;
+            left = loc->len;
+            for (i = 0; i < loc->count; ++i)
+                if ((ret = __unpackf(&net, &left, loc->f, FROM_PTR, NULL,
+                                &locale, NULL, NULL)) < 0)
+                    return ret;
+            return (char *)locale - (char *)out;
+    }
+
+    return loc->len;
+}
+
+int packf_view_get(struct packf_view const *view, int const *path, int depth,
+        void *out)
+{
+    struct __view_loc loc;
+    int ret;
+
+    if (!view || !path || !out)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if ((ret = __view_locate(view, path, depth, &loc)) < 0)
+        ERR_RET_PRINT(ret);
+    if ((ret = __loc_get(view->buf, &loc, out)) < 0)
+        ERR_RET_PRINT(ret);
+
+    return ret;
+}
+
+int packf_view_ref(struct packf_view const *view, int const *path, int depth,
+        void **ptr, int *len)
+{
+    struct __view_loc loc;
+    int ret;
+
+    if (!view || !path || !ptr || !len)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if ((ret = __view_locate(view, path, depth, &loc)) < 0)
+        ERR_RET_PRINT(ret);
+
+    *ptr = (char *)view->buf + loc.offset;
+    *len = loc.type == 's' || loc.type == 'S' ? loc.count : loc.len;
+
+    return 0;
+}
+
+int packf_view_count(struct packf_view const *view, int const *path,
+        int depth)
+{
+    struct __view_loc loc;
+    int ret;
+
+    if (!view || !path)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if ((ret = __view_locate(view, path, depth, &loc)) < 0)
+        ERR_RET_PRINT(ret);
+
+    return loc.count;
+}
+
+int packf_tmpl_init(struct packf_tmpl *tmpl, void *buf, size_t max,
+        char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = (int)max;
+    void *net = buf;
+
+    if (!tmpl || !buf || !format)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    va_start(va, format);
+    ret = __packf_top(&net, &left_len, format, va, NULL, NULL);
+    va_end(va);
+    if (ret < 0)
+    {
+        PRINT_ERR_FMT(ret);
+        return ret;
+    }
+
+    NEG_RET(ret = packf_view_init(&tmpl->view, buf, ret, format));
+    tmpl->crc = strchr(format, 'C') != NULL;
+
+    return ret;
+}
+
+void packf_tmpl_free(struct packf_tmpl *tmpl)
+{
+    if (tmpl)
+        packf_view_free(&tmpl->view);
+}
+
+int packf_tmpl_field(struct packf_tmpl const *tmpl, int const *path,
+        int depth, struct packf_tmpl_field *field)
+{
+    struct __view_loc loc;
+    int ret;
+
+    if (!tmpl || !path || !field)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if ((ret = __view_locate(&tmpl->view, path, depth, &loc)) < 0)
+        ERR_RET_PRINT(ret);
+
+    /* 只有修改后长度不变的字段才能原地修改 */
+    switch (loc.type)
+    {
+        case 'c':
+        case 'w':
+        case 'd':
+        case 'D':
+        case 'f':
+        case 'F':
+            if (loc.codec)
+                ERR_RET_PRINT(PACKF_NOT_MATCH);
+            break;
+        case 's':
+            if (loc.lv_type || loc.num <= 0)
+                ERR_RET_PRINT(PACKF_NOT_MATCH);
+            loc.size  = loc.len;
+            loc.count = 1;
+            break;
+        default:
+            ERR_RET_PRINT(PACKF_NOT_MATCH);
+    }
+
+    field->offset = loc.offset;
+    field->size   = loc.size;
+    field->count  = loc.count;
+    field->type   = loc.type;
+    field->array  = loc.num != -1 || loc.lv_type;
+
+    return 0;
+}
+
+/* 重新计算 off 之后的 C 字段 */
+static void __tmpl_crc(struct packf_tmpl *tmpl, int off)
+{
+    struct __view_loc loc;
+    uint8_t *buf = tmpl->view.buf;
+    uint32_t crc = 0;
+    int k, n, done = 0;
+
+    n = tmpl->view.fixed ? __view_fields(tmpl->view.format) : tmpl->view.ntop;
+    for (k = 0; k < n; ++k)
+    {
+        if (__view_locate(&tmpl->view, &k, 1, &loc) < 0 || loc.type != 'C')
+            continue;
+        crc  = packf_crc32c(crc, buf + done, loc.offset - done);
+        done = loc.offset;
+        if (loc.offset < off)
+            continue;
+        buf[loc.offset]     = (uint8_t)(crc >> 24);
+        buf[loc.offset + 1] = (uint8_t)(crc >> 16);
+        buf[loc.offset + 2] = (uint8_t)(crc >> 8);
+        buf[loc.offset + 3] = (uint8_t)crc;
+    }
+}
+
+int packf_tmpl_set(struct packf_tmpl *tmpl,
+        struct packf_tmpl_field const *field, ...)
+{
+    va_list va;
+    char *p, *src;
+    int i, len;
+
+    if (!tmpl || !field)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    p = (char *)tmpl->view.buf + field->offset;
+    va_start(va, field);
+    if (!field->array && field->type != 's')
+    {
+        switch (field->type)
+        {
+            case 'c':
+                *((int8_t *)p) = (int8_t)va_arg(va, int);
+                break;
+            case 'w':
+                *((int16_t *)p) = htobe16((int16_t)va_arg(va, int));
+                break;
+            case 'd':
+                *((int32_t *)p) = htobe32((int32_t)va_arg(va, int));
+                break;
+            case 'D':
+                *((int64_t *)p) = htobe64(va_arg(va, int64_t));
+                break;
+            case 'f':
+                *((float *)p) = htobef((float)va_arg(va, double));
+                break;
+            case 'F':
+                *((double *)p) = htobed(va_arg(va, double));
+                break;
+        }
+    }
+    else
+    {
+        src = va_arg(va, char *);
+        if (!src)
+        {
+            va_end(va);
+            ERR_RET_PRINT(PACKF_NULL_POINTER);
+        }
+        switch (field->type)
+        {
+            case 'c':
+                memcpy(p, src, field->count);
+                break;
+            case 'w':
+                for (i = 0; i < field->count; ++i)
+                    ((int16_t *)p)[i] = htobe16(((int16_t *)src)[i]);
+                break;
+            case 'd':
+                for (i = 0; i < field->count; ++i)
+                    ((int32_t *)p)[i] = htobe32(((int32_t *)src)[i]);
+                break;
+            case 'D':
+                for (i = 0; i < field->count; ++i)
+                    ((int64_t *)p)[i] = htobe64(((int64_t *)src)[i]);
+                break;
+            case 'f':
+                for (i = 0; i < field->count; ++i)
+                    ((float *)p)[i] = htobef(((float *)src)[i]);
+                break;
+            case 'F':
+                for (i = 0; i < field->count; ++i)
+                    ((double *)p)[i] = htobed(((double *)src)[i]);
+                break;
+            case 's':
+                len = strnlen(src, field->size);
+                if (len == field->size)
+                {
+                    va_end(va);
+                    ERR_RET_PRINT(PACKF_BE_CUT_OFF);
+                }
+                memcpy(p, src, len);
+                memset(p + len, 0, field->size - len);
+                break;
+        }
+    }
+    va_end(va);
+
+    if (tmpl->crc)
+        __tmpl_crc(tmpl, field->offset);
+
+    return 0;
+}
+
+/*
+ * 投影：只取出消息中的少数字段。按 path 定位字段时，前面的字段根据长度
+ * 头或格式直接跳过，不拷贝。packf_proj_new 时先按格式计算到第一个需要
+ * 读取数据才能确定偏移的位置，固定布局的前缀只计算一次。
+ */
+struct __proj_state
+{
+    char const *f;      /* 当前层级下一个字段的格式 */
+    int         pos;    /* 下一个字段在 buf 中的偏移 */
+    int         d;      /* 正在定位的 path 下标 */
+    int         k;      /* 当前层级已经跳过的字段数 */
+};
+
+struct __proj_path
+{
+    int const          *path;
+    int                 depth;
+    int                 ready;  /* loc 已经确定，不需要读取数据 */
+    int                 need;   /* ready 时需要的数据长度 */
+    struct __proj_state st;
+    struct __view_loc   loc;
+};
+
+struct packf_proj
+{
+    int                 n;
+    struct __proj_path  paths[];
+};
+
+static int __proj_skip(uint8_t const *buf, int end, char const *format,
+        int *pos);
+
+/* 同 __field_wire, 元素不是固定布局的结构体数组逐个元素跳过 */
+static int __proj_field(uint8_t const *buf, int end, int pos, char lv_type,
+        int num, char type, char codec, char const *inner, int *hdr,
+        int *count, int *size)
+{
+    int ret, i, p;
+
+    ret = __field_wire(buf, end, pos, lv_type, num, type, codec, inner, hdr,
+            count, size);
+    if (ret != 1 || !buf)
+        return ret;
+
+    for (i = 0, p = pos + *hdr; i < *count; ++i)
+        NEG_RET(__proj_skip(buf, end, inner, &p));
+    *size = p - (pos + *hdr);
+
+    return 0;
+}
+
+/* 跳过一个结构体（或整个 format）的数据 */
+static int __proj_skip(uint8_t const *buf, int end, char const *format,
+        int *pos)
+{
+    char const *f = format, *inner;
+    char lv_type, type, codec;
+    int num, hdr, count, size;
+
+    while (*f && *f != ']')
+    {
+        if (*f == ' ')
+        {
+            ++f;
+            continue;
+        }
+
+        f = __parse_field(f, &lv_type, &num, &type, &codec);
+        inner = f;
+        if (type == '[' && !(f = __skip_struct(f)))
+            return PACKF_NOT_MATCH;
+        NEG_RET(__proj_field(buf, end, *pos, lv_type, num, type, codec, inner,
+                    &hdr, &count, &size));
+        *pos += hdr + size;
+    }
+
+    return 0;
+}
+
+/*
+ * 从 st 开始按 path 定位字段。buf 为 NULL 时遇到需要读取数据的字段就
+ * 返回 1, st 保存当时的位置，之后可以从 st 继续定位。
+ */
+static int __proj_walk(uint8_t const *buf, int end, int const *path,
+        int depth, struct __proj_state *st, struct __view_loc *loc)
 {
-    int buf_len = *left_len;
-    int num, i, array_size, offset, bracket_stack, lv_len = 0;
-    char *f = (char *)format, *__f, *str_num, *src, *des;
-    char type, lv_type;
-    int struct_len_locale = 0;
-    void *struct_start_locale, *struct_start_net, *p_struct_len;
+    char const *f, *inner;
+    char lv_type, type, codec;
+    int num, hdr, count, size, idx, off, len, i, ret;
 
-    while (*f)
+    for (;;)
+    {
+        while (*st->f == ' ')
+            ++st->f;
+        if (!*st->f || *st->f == ']' || path[st->d] < st->k)
+            return PACKF_NOT_MATCH;
+
+        f = __parse_field(st->f, &lv_type, &num, &type, &codec);
+        inner = f;
+        if (type == '[' && !(f = __skip_struct(f)))
+            return PACKF_NOT_MATCH;
+        if (!buf && st->k == path[st->d] && (type == 's' || type == 'S'))
+            return 1;
+        if ((ret = __proj_field(buf, end, st->pos, lv_type, num, type, codec,
+                        inner, &hdr, &count, &size)) != 0)
+            return ret;
+
+        if (st->k != path[st->d])
+        {
+            st->f    = f;
+            st->pos += hdr + size;
+            ++st->k;
+            continue;
+        }
+
+        loc->f       = inner;
+        loc->type    = type;
+        loc->codec   = codec;
+        loc->lv_type = lv_type;
+        loc->num     = num;
+        loc->offset  = st->pos + hdr;
+        loc->len     = size;
+        loc->count   = count;
+        loc->size    = type == '[' ? (count ? size / count : 0) :
+            __type_size(type);
+        if (st->d + 1 == depth)
+            return 0;
+
+        idx = st->d + 1;
+        if (num != -1 || (lv_type && type != '['))
+        {
+            /* 数组元素 */
+            if (type == 's' || type == 'S' || type == 'a' || codec)
+                return PACKF_NOT_MATCH;
+            if (path[idx] < 0 || path[idx] >= count)
+                return PACKF_NOT_MATCH;
+            if (type != '[' || __fixed_len(inner) >= 0)
+            {
+                off = loc->offset + loc->size * path[idx];
+                len = loc->size;
+            }
+            else
+            {
+                if (!buf)
+                    return 1;
+                for (i = 0, off = loc->offset; i < path[idx]; ++i)
+                    NEG_RET(__proj_skip(buf, end, inner, &off));
+                len = off;
+                NEG_RET(__proj_skip(buf, end, inner, &len));
+                len -= off;
+            }
+            if (idx + 1 == depth)
+            {
+                loc->offset = off;
+                loc->count  = 1;
+                loc->len    = len;
+                return 0;
+            }
+            if (type != '[')
+                return PACKF_NOT_MATCH;
+            st->pos = off;
+            ++idx;
+        }
+        else
+        {
+            if (type != '[')
+                return PACKF_NOT_MATCH;
+            st->pos = loc->offset;
+        }
+
+        st->f = inner;
+        st->d = idx;
+        st->k = 0;
+    }
+}
+
+/* 与视图相同，不支持定点小数、h、b<n>、s@ 和 ?[...] 等字段 */
+static int __proj_check(char const *format)
+{
+    char const *f = format;
+    char lv_type, type, codec;
+    int num;
+
+    while (*f && *f != ']')
     {
         if (*f == ' ')
         {
@@ -311,282 +6050,1106 @@ static int __packf(void **net, int *left_len, char const *format, \
             continue;
         }
 
-        __f = f;
+        f = __parse_field(f, &lv_type, &num, &type, &codec);
+        if (!type || !strchr("acwdDfFCsS[", type) ||
+                (codec && !__ISCODEC(codec)))
+            return PACKF_NOT_FORMAT;
+        if (type == '[')
+        {
+            NEG_RET(__proj_check(f));
+            if (!(f = __skip_struct(f)))
+                return PACKF_NOT_MATCH;
+        }
+    }
 
-        if (*f == '-')
+    return 0;
+}
+
+struct packf_proj *packf_proj_new(char const *format,
+        struct packf_path const *paths, int n)
+{
+    struct packf_proj *proj;
+    struct __proj_path *pp;
+    int i, ret, total = 0, *ints;
+
+    if (!format || !paths || n <= 0 || __proj_check(format) < 0)
+        return NULL;
+    for (i = 0; i < n; ++i)
+    {
+        if (!paths[i].path || paths[i].depth <= 0)
+            return NULL;
+        total += paths[i].depth;
+    }
+
+    /* path 保存在 paths[] 之后 */
+    proj = malloc(sizeof(*proj) + sizeof(proj->paths[0]) * n +
+            sizeof(int) * total);
+    if (!proj)
+        return NULL;
+    proj->n = n;
+    ints = (int *)&proj->paths[n];
+
+    for (i = 0; i < n; ++i)
+    {
+        pp = &proj->paths[i];
+        memcpy(ints, paths[i].path, sizeof(int) * paths[i].depth);
+        pp->path     = ints;
+        pp->depth    = paths[i].depth;
+        ints += paths[i].depth;
+        pp->st.f     = format;
+        pp->st.pos   = 0;
+        pp->st.d     = 0;
+        pp->st.k     = 0;
+        if ((ret = __proj_walk(NULL, 0, pp->path, pp->depth, &pp->st,
+                        &pp->loc)) < 0)
+            break;
+        pp->ready = ret == 0;
+        pp->need  = pp->ready ? pp->loc.offset + pp->loc.len : 0;
+    }
+
+    if (i < n)
+    {
+        free(proj);
+        return NULL;
+    }
+
+    return proj;
+}
+
+void packf_proj_free(struct packf_proj *proj)
+{
+    free(proj);
+}
+
+int packf_proj(struct packf_proj const *proj, void const *buf, size_t len,
+        ...)
+{
+    struct __proj_path const *pp;
+    struct __proj_state st;
+    struct __view_loc loc;
+    va_list va;
+    void *out;
+    int i, ret = 0, end = len > INT_MAX ? INT_MAX : (int)len;
+
+    if (!proj || !buf)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    va_start(va, len);
+    for (i = 0; i < proj->n && ret >= 0; ++i)
+    {
+        pp  = &proj->paths[i];
+        out = va_arg(va, void *);
+        if (!out)
         {
-            lv_type = 1;
-            ++f;
+            ret = PACKF_NULL_POINTER;
         }
-        else if (*f == '=')
+        else if (pp->ready)
         {
-            lv_type = 2;
-            ++f;
+            ret = pp->need > end ? PACKF_OUT_OF_BUF :
+                __loc_get(buf, &pp->loc, out);
         }
         else
         {
-            lv_type = 0;
+            st = pp->st;
+            if ((ret = __proj_walk(buf, end, pp->path, pp->depth, &st,
+                            &loc)) == 0)
+                ret = __loc_get(buf, &loc, out);
+        }
+    }
+    va_end(va);
+
+    if (ret < 0)
+        ERR_RET_PRINT(ret);
+
+    return proj->n;
+}
+
+/*
+ * 可比较的键编码：打包的结果可以直接用 memcmp 比较，顺序与依次比较每个
+ * 字段的原始值相同。
+ *      cwdD: 有符号整数，翻转符号位后按网络序保存
+ *      fF:   符号位为 0 时翻转符号位，为 1 时翻转所有位
+ *      sS:   字符串本身加结尾的 '\0', 没有长度头
+ *      LV 数组: 没有长度头，c 数组中的 0x00 转义为 0x00 0xff, 以 0x00 0x01
+ *               结尾；其余类型（包括结构体）每个元素前加 0x01, 以 0x00 结尾
+ * 较短的字符串和数组排在以它为前缀的更长的字符串和数组之前。
+ */
+static void __key_enc(uint8_t *p, uint64_t v, int size, int is_float)
+{
+    uint64_t sign = (uint64_t)1 << (size * 8 - 1);
+    int i;
+
+    if (is_float)
+        v = v & sign ? ~v : v | sign;
+    else
+        v ^= sign;
+
+    for (i = size - 1; i >= 0; --i, v >>= 8)
+        p[i] = (uint8_t)v;
+}
+
+static uint64_t __key_dec(uint8_t const *p, int size, int is_float)
+{
+    uint64_t sign = (uint64_t)1 << (size * 8 - 1), v = 0;
+    int i;
+
+    for (i = 0; i < size; ++i)
+        v = (v << 8) | p[i];
+
+    if (is_float)
+        v = v & sign ? v ^ sign : ~v;
+    else
+        v ^= sign;
+
+    return v;
+}
+
+static uint64_t __key_load(void const *p, int size)
+{
+    uint8_t v8;
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+
+    switch (size)
+    {
+        case 1:
+            memcpy(&v8, p, 1);
+            return v8;
+        case 2:
+            memcpy(&v16, p, 2);
+            return v16;
+        case 4:
+            memcpy(&v32, p, 4);
+            return v32;
+        default:
+            memcpy(&v64, p, 8);
+            return v64;
+    }
+}
+
+static void __key_store(void *p, uint64_t v, int size)
+{
+    uint8_t v8 = (uint8_t)v;
+    uint16_t v16 = (uint16_t)v;
+    uint32_t v32 = (uint32_t)v;
+
+    switch (size)
+    {
+        case 1:
+            memcpy(p, &v8, 1);
+            break;
+        case 2:
+            memcpy(p, &v16, 2);
+            break;
+        case 4:
+            memcpy(p, &v32, 4);
+            break;
+        default:
+            memcpy(p, &v, 8);
+            break;
+    }
+}
+
+static int __key_pack_array(uint8_t **net, int *left_len, char const *src,
+        int n, int size, char type, int lv)
+{
+    int i, is_float = type == 'f' || type == 'F';
+    uint8_t b;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (lv && type == 'c')
+        {
+            b = (uint8_t)src[i] ^ 0x80;
+            if (*left_len < (b ? 1 : 2))
+                return PACKF_OUT_OF_BUF;
+            *left_len -= b ? 1 : 2;
+            *((*net)++) = b;
+            if (!b)
+                *((*net)++) = 0xff;
+            continue;
         }
 
-        str_num = f;
-        while (__ISDIGIT(*f))
+        if (*left_len < size + lv)
+            return PACKF_OUT_OF_BUF;
+        *left_len -= size + lv;
+        if (lv)
+            *((*net)++) = 0x01;
+        __key_enc(*net, __key_load(src + i * size, size), size, is_float);
+        *net += size;
+    }
+
+    if (lv)
+    {
+        if (*left_len < (type == 'c' ? 2 : 1))
+            return PACKF_OUT_OF_BUF;
+        *left_len -= type == 'c' ? 2 : 1;
+        *((*net)++) = 0x00;
+        if (type == 'c')
+            *((*net)++) = 0x01;
+    }
+
+    return 0;
+}
+
+/* n < 0 时为 LV 数组，最多 max 个元素，返回元素个数 */
+static int __key_unpack_array(uint8_t const **net, int *left_len, char *des,
+        int n, int max, int size, char type)
+{
+    int count = 0, is_float = type == 'f' || type == 'F';
+    uint8_t const *p;
+
+    for (;;)
+    {
+        if (n >= 0 && count == n)
+            return count;
+
+        if (n < 0)
+        {
+            if (*left_len < 1)
+                return PACKF_OUT_OF_BUF;
+            p = *net;
+            if (type == 'c' && p[0])
+            {
+                if (count == max)
+                    return PACKF_BE_CUT_OFF;
+                des[count++] = (char)(p[0] ^ 0x80);
+                --(*left_len);
+                ++(*net);
+                continue;
+            }
+            if (type == 'c')
+            {
+                if (*left_len < 2)
+                    return PACKF_OUT_OF_BUF;
+                *left_len -= 2;
+                *net += 2;
+                if (p[1] == 0x01)
+                    return count;
+                if (p[1] != 0xff)
+                    return PACKF_BAD_DATA;
+                if (count == max)
+                    return PACKF_BE_CUT_OFF;
+                des[count++] = (char)0x80;
+                continue;
+            }
+            --(*left_len);
+            ++(*net);
+            if (p[0] == 0x00)
+                return count;
+            if (p[0] != 0x01)
+                return PACKF_BAD_DATA;
+            if (count == max)
+                return PACKF_BE_CUT_OFF;
+        }
+
+        if (*left_len < size)
+            return PACKF_OUT_OF_BUF;
+        *left_len -= size;
+        __key_store(des + count * size, __key_dec(*net, size, is_float), size);
+        *net += size;
+        ++count;
+    }
+}
+
+# define KEY_PUT_BYTE(b) do {                                           \
+    IF_LESS(*left_len, 1);                                              \
+    *((*net)++) = (b);                                                  \
+} while (0)
+
+# define KEY_GET_LV() do {                                              \
+    if (lv_type)                                                        \
+    {                                                                   \
+        if (from == FROM_ARG) lv_len = va_arg(va, int);                 \
+        else                                                            \
+        {                                                               \
+            if (lv_type == 1) lv_len = *((uint8_t *)(*locale));         \
+            else lv_len = *((uint16_t *)(*locale));                     \
+            *locale = (char *)*locale + lv_type;                        \
+        }                                                               \
+        if (num != -1 && lv_len > num) ERR_RET_FMT(PACKF_BE_CUT_OFF);   \
+        CHECK_LV_LEN();                                                 \
+    }                                                                   \
+} while (0)
+
+static int __packk(uint8_t **net, int *left_len, char const *format,
+        int from, va_list va, void **locale)
+{
+    char const *f = format, *inner;
+    char *__f, *src, lv_type, type, codec;
+    int num, lv_len = 0, count, size, i, struct_len_locale = 0;
+    void *struct_start_locale;
+    uint64_t v;
+    float fv;
+    double dv;
+
+    while (*f && *f != ']')
+    {
+        if (*f == ' ')
+        {
             ++f;
-        if (str_num == f)
-            num = -1;
-        else
-            num = __atoi(str_num, f - str_num);
+            continue;
+        }
 
-        type = *(f++);
+        __f = (char *)f;
+        f = __parse_field(f, &lv_type, &num, &type, &codec);
         if (!type)
             ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+        if (codec)
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        inner = f;
+        if (type == '[' && !(f = __skip_struct(f)))
+            ERR_RET_FMT(PACKF_NOT_MATCH);
+        size = __type_size(type);
 
         switch (type)
         {
-            case '[':
-                if (lv_type && num == -1)
+            case 'c':
+            case 'w':
+            case 'd':
+            case 'D':
+            case 'f':
+            case 'F':
+                if (num == -1 && !lv_type)
                 {
-                    if (from == FROM_ARG)
-                        *locale = va_arg(va, char *);
-
-                    p_struct_len = *net;
-                    struct_start_net = *net = (char *)*net + lv_type;
                     if (from == FROM_PTR)
-                        *locale = (char *)*locale + lv_type;
-                    NEG_RET(__packf(net, left_len, f, FROM_PTR, NULL, locale));
-                    lv_len = (char *)*net - (char *)struct_start_net;
-                    SET_LV_LEN(p_struct_len);
+                    {
+                        v = __key_load(*locale, size);
+                        *locale = (char *)*locale + size;
+                    }
+                    else if (type == 'D')
+                    {
+                        v = (uint64_t)va_arg(va, int64_t);
+                    }
+                    else if (type == 'f')
+                    {
+                        fv = (float)va_arg(va, double);
+                        v  = __key_load(&fv, 4);
+                    }
+                    else if (type == 'F')
+                    {
+                        dv = va_arg(va, double);
+                        v  = __key_load(&dv, 8);
+                    }
+                    else
+                    {
+                        v = (uint64_t)va_arg(va, int);
+                    }
+                    IF_LESS(*left_len, size);
+                    __key_enc(*net, v, size, type == 'f' || type == 'F');
+                    *net += size;
+                    break;
+                }
+
+                KEY_GET_LV();
+                if (from == FROM_ARG)
+                    src = va_arg(va, char *);
+                else
+                    src = *locale;
+                count = lv_type ? lv_len : num;
+                NEG_FMT(__key_pack_array(net, left_len, src, count, size,
+                            type, lv_type != 0));
+                if (from == FROM_PTR)
+                    *locale = (char *)*locale + size *
+                        (lv_type && num != -1 ? num : count);
+                break;
+            case 'a':
+                if (lv_type)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                if (from == FROM_PTR)
+                    *locale = (char *)*locale + (num == -1 ? 1 : num);
+                break;
+            case 's':
+            case 'S':
+                if (from == FROM_ARG)
+                    src = va_arg(va, char *);
+                else
+                    src = (char *)*locale + lv_type;
+
+                if (lv_type && num == -1)
+                {
+                    lv_len = strlen(src);
+                }
+                else if (lv_type)
+                {
+                    lv_len = num ? strnlen(src, num - 1) : 0;
+                    if (num && src[lv_len])
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                }
+                else if (num == -1)
+                {
+                    lv_len = strlen(src);
                 }
                 else
                 {
-                    SET_LV(*net, *locale);
+                    lv_len = strnlen(src, num);
+                    if (num && lv_len == num)
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                }
+                if (lv_type)
+                    CHECK_LV_LEN();
+
+                IF_LESS(*left_len, lv_len + 1);
+                memcpy(*net, src, lv_len);
+                *net += lv_len;
+                *((*net)++) = 0;
+
+                if (from == FROM_PTR)
+                {
+                    if (num == -1)
+                        *locale = (char *)*locale + lv_type + lv_len + 1;
+                    else
+                        *locale = (char *)*locale + lv_type + num;
+                }
+                break;
+            case '[':
+                if (lv_type && num == -1)
+                {
                     if (from == FROM_ARG)
                         *locale = va_arg(va, char *);
+                    else
+                        *locale = (char *)*locale + lv_type;
+                    NEG_RET(__packk(net, left_len, inner, FROM_PTR, NULL,
+                                locale));
+                    break;
+                }
 
-                    array_size = lv_type ? lv_len : (num == -1 ? 1 : num);
-                    for (i = 0; i < array_size; i++)
-                    {
-                        struct_start_locale = *locale;
-                        NEG_RET(__packf(net, left_len, f, FROM_PTR,
-                                    NULL, locale));
-                        struct_len_locale = (char *)*locale -
-                            (char *)struct_start_locale;
-                    }
-                    if (lv_type && from == FROM_PTR)
+                KEY_GET_LV();
+                if (from == FROM_ARG)
+                    *locale = va_arg(va, char *);
+                count = lv_type ? lv_len : (num == -1 ? 1 : num);
+                for (i = 0; i < count; ++i)
+                {
+                    if (lv_type)
+                        KEY_PUT_BYTE(0x01);
+                    struct_start_locale = *locale;
+                    NEG_RET(__packk(net, left_len, inner, FROM_PTR, NULL,
+                                locale));
+                    struct_len_locale = (char *)*locale -
+                        (char *)struct_start_locale;
+                }
+                if (lv_type)
+                {
+                    KEY_PUT_BYTE(0x00);
+                    if (from == FROM_PTR)
                     {
-                        if (array_size == 0)
-                            NEG_RET(struct_len_locale = __struct_len_locale(f));
+                        if (count == 0)
+                            NEG_RET(struct_len_locale =
+                                    __struct_len_locale(inner, 0));
                         *locale = (char *)*locale + struct_len_locale *
                             (num - lv_len);
                     }
                 }
+                break;
+            default:
+                ERR_RET_FMT(PACKF_NOT_FORMAT);
+        }
+    }
+
+    return 0;
+}
+
+static int __key_set_len(void *des, int lv_type, int len)
+{
+    uint8_t u8 = (uint8_t)len;
+    uint16_t u16 = (uint16_t)len;
+
+    if ((unsigned)len >> (lv_type * 8))
+        return PACKF_BE_CUT_OFF;
+    if (lv_type == 1)
+        memcpy(des, &u8, 1);
+    else
+        memcpy(des, &u16, 2);
+
+    return 0;
+}
+
+static int __unpackk(uint8_t const **net, int *left_len, char const *format,
+        int from, va_list va, void **locale)
+{
+    char const *f = format, *inner;
+    char *__f, *des, *p_len, lv_type, type, codec;
+    int num, count, size, max, len, struct_len_locale = 0;
+    void *struct_start_locale;
+    uint8_t mark;
+    uint64_t v;
+
+    while (*f && *f != ']')
+    {
+        if (*f == ' ')
+        {
+            ++f;
+            continue;
+        }
+
+        __f = (char *)f;
+        f = __parse_field(f, &lv_type, &num, &type, &codec);
+        if (!type)
+            ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+        if (codec)
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        inner = f;
+        if (type == '[' && !(f = __skip_struct(f)))
+            ERR_RET_FMT(PACKF_NOT_MATCH);
+        size = __type_size(type);
+
+        p_len = NULL;
+        if (lv_type && type != 's' && type != 'S' &&
+                !(type == '[' && num == -1))
+        {
+            if (from == FROM_ARG)
+                p_len = va_arg(va, char *);
+            else
+            {
+                p_len = *locale;
+                *locale = (char *)*locale + lv_type;
+            }
+        }
+
+        switch (type)
+        {
+            case 'c':
+            case 'w':
+            case 'd':
+            case 'D':
+            case 'f':
+            case 'F':
+                if (from == FROM_ARG)
+                    des = va_arg(va, char *);
+                else
+                    des = *locale;
 
-                bracket_stack = 1;
-                while (bracket_stack)
+                if (num == -1 && !lv_type)
                 {
-                    if (!(*f))
-                        ERR_RET_FMT(PACKF_NOT_MATCH);
-                    else if (*f == '[')
-                        ++bracket_stack;
-                    else if (*f == ']')
-                        --bracket_stack;
-
-                    ++f;
+                    IF_LESS(*left_len, size);
+                    v = __key_dec(*net, size, type == 'f' || type == 'F');
+                    *net += size;
+                    __key_store(des, v, size);
+                    if (from == FROM_PTR)
+                        *locale = (char *)*locale + size;
+                    break;
                 }
 
+                max = num != -1 ? num : (lv_type == 1 ? 0xff : 0xffff);
+                NEG_FMT(count = __key_unpack_array(net, left_len, des,
+                            lv_type ? -1 : num, max, size, type));
+                if (lv_type)
+                    NEG_FMT(__key_set_len(p_len, lv_type, count));
+                if (from == FROM_PTR)
+                    *locale = (char *)*locale + size *
+                        (lv_type && num != -1 ? num : count);
+                break;
+            case 'a':
+                if (lv_type)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                if (from == FROM_PTR)
+                {
+                    memset(*locale, 0, num == -1 ? 1 : num);
+                    *locale = (char *)*locale + (num == -1 ? 1 : num);
+                }
                 break;
-            case ']':
-                return 0;
             case 's':
             case 'S':
-                des = *net;
                 if (from == FROM_ARG)
-                    src = va_arg(va, char *);
+                    des = va_arg(va, char *);
                 else
-                    src = (char *)*locale + lv_type;
+                    des = *locale;
+
+                len = strnlen((char const *)*net, *left_len);
+                if (len == *left_len)
+                    ERR_RET_FMT(PACKF_OUT_OF_BUF);
+                if ((num == 0 && len) || (num > 0 && len > num - 1))
+                    ERR_RET_FMT(PACKF_BE_CUT_OFF);
 
                 if (lv_type)
                 {
-                    lv_len = 0;
-                    if (num == -1)
-                        lv_len = strlen(src);
-                    else if (num)
+                    if (from == FROM_PTR)
                     {
-                        lv_len = strnlen(src, num - 1);
-                        if (src[lv_len])
-                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                        NEG_FMT(__key_set_len(des, lv_type, len));
+                        des += lv_type;
                     }
-
-                    SET_LV_LEN(des);
-
-                    if (lv_len)
+                    else if ((unsigned)len >> (lv_type * 8))
                     {
-                        IF_LESS(*left_len, lv_len);
-                        memcpy(des, src, lv_len);
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
                     }
+                }
+                memcpy(des, *net, len);
+                if (num != 0)
+                    des[len] = '\0';
+                *net += len + 1;
+                *left_len -= len + 1;
 
-                    offset = lv_type + lv_len;
-                    *net = (char *)*net + offset;
-                    if (from == FROM_PTR)
+                if (from == FROM_PTR)
+                {
+                    if (num == -1)
+                        *locale = (char *)*locale + lv_type + len + 1;
+                    else
+                        *locale = (char *)*locale + lv_type + num;
+                }
+                break;
+            case '[':
+                if (lv_type && num == -1)
+                {
+                    if (from == FROM_ARG)
+                        *locale = va_arg(va, char *);
+                    p_len = *locale;
+                    *locale = (char *)*locale + lv_type;
+                    len = *left_len;
+                    NEG_RET(__unpackk(net, left_len, inner, FROM_PTR, NULL,
+                                locale));
+                    NEG_FMT(__key_set_len(p_len, lv_type, len - *left_len));
+                    break;
+                }
+
+                if (from == FROM_ARG)
+                    *locale = va_arg(va, char *);
+                max = num != -1 ? num : (lv_type == 1 ? 0xff : 0xffff);
+                for (count = 0; ; ++count)
+                {
+                    if (!lv_type && count == (num == -1 ? 1 : num))
+                        break;
+                    if (lv_type)
                     {
-                        if (num == -1)
-                            *locale = (char *)*locale + offset + 1;
-                        else
-                            *locale = (char *)*locale + lv_type + num;
+                        IF_LESS(*left_len, 1);
+                        mark = *((*net)++);
+                        if (mark == 0x00)
+                            break;
+                        if (mark != 0x01)
+                            ERR_RET_FMT(PACKF_BAD_DATA);
+                        if (count == max)
+                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
                     }
+                    struct_start_locale = *locale;
+                    NEG_RET(__unpackk(net, left_len, inner, FROM_PTR, NULL,
+                                locale));
+                    struct_len_locale = (char *)*locale -
+                        (char *)struct_start_locale;
                 }
-                else
+                if (lv_type)
                 {
-                    if (num == -1)
+                    NEG_FMT(__key_set_len(p_len, lv_type, count));
+                    if (from == FROM_PTR)
                     {
-                        offset = strlen(src) + 1;
-                        IF_LESS(*left_len, offset);
-                        strcpy(des, src);
+                        if (count == 0)
+                            NEG_RET(struct_len_locale =
+                                    __struct_len_locale(inner, 0));
+                        *locale = (char *)*locale + struct_len_locale *
+                            (num - count);
                     }
-                    else if (type == 's')
-                    {
-                        offset = num;
-                        IF_LESS(*left_len, offset);
+                }
+                break;
+            default:
+                ERR_RET_FMT(PACKF_NOT_FORMAT);
+        }
+    }
 
-                        for (i = 0; i < offset; ++i)
-                            if (!(des[i] = src[i]))
-                                break;
+    return 0;
+}
 
-                        if (offset && i == offset)
-                        {
-                            des[i - 1] = '\0';
-                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
-                        }
+int packf_key(void *dest, size_t max, char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = (int)max;
+    uint8_t *net = dest;
+    void *locale = NULL;
 
-                        for (++i; i < offset; ++i)
-                            des[i] = '\0';
-                    }
-                    else
-                    {
-                        offset = strnlen(src, num);
-                        if (num && offset == num)
-                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
-                        offset += num ? 1 : 0;
-                        IF_LESS(*left_len, offset);
+    if (!dest || !format)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
 
-                        for (i = 0; i < offset; ++i)
-                            if (!(des[i] = src[i]))
-                                break;
-                    }
+    va_start(va, format);
+    ret = __packk(&net, &left_len, format, FROM_ARG, va, &locale);
+    va_end(va);
 
-                    *net = (char *)*net + offset;
-                    if (from == FROM_PTR)
-                    {
-                        if (num >= 0 && type == 'S')
-                            *locale = (char *)*locale + num;
-                        else
-                            *locale = (char *)*locale + offset;
-                    }
-                }
+    if (ret < 0)
+    {
+        PRINT_ERR_FMT(ret);
+        return ret;
+    }
 
-                break;
-            case 'a':
-                SET_LV(*net, *locale);
+    return (int)max - left_len;
+}
 
-                offset = lv_type ? lv_len : (num == -1 ? 1 : num);
-                IF_LESS(*left_len, offset);
-                memset(*net, 0, offset);
-                *net = (char *)*net + offset;
-                if (from == FROM_PTR)
-                {
-                    if (lv_type && num)
-                        *locale = (char *)*locale + num;
-                    else
-                        *locale = (char *)*locale + offset;
-                }
+int unpackf_key(void const *src, size_t max, char const *format, ...)
+{
+    va_list va;
+    int ret, left_len = (int)max;
+    uint8_t const *net = src;
+    void *locale = NULL;
 
-                break;
-            case 'c':
-                DO_PACKF(int8_t, int, NO_SWAP, 0);
+    if (!src || !format)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
 
-                break;
-            case 'w':
-                DO_PACKF(int16_t, int, htobe16, 1);
+    va_start(va, format);
+    ret = __unpackk(&net, &left_len, format, FROM_ARG, va, &locale);
+    va_end(va);
 
-                break;
-            case 'd':
-                DO_PACKF(int32_t, int, htobe32, 1);
+    if (ret < 0)
+    {
+        PRINT_ERR_FMT(ret);
+        return ret;
+    }
 
-                break;
-            case 'D':
-                DO_PACKF(int64_t, int64_t, htobe64, 1);
+    return (int)max - left_len;
+}
+
+/*
+ * 回调方式的解包：按 format 依次解析每个字段，通过回调函数把值交给调用者，
+ * 不需要本地的结构体。字符串和 c 数组直接返回在 buf 中的位置。
+ */
+struct __visit
+{
+    uint8_t const                  *buf;
+    int                             end;
+    int                             pos;
+    struct packf_visitor const     *v;
+    void                           *ctx;
+};
+
+# define VISIT_CB(cb, ...) do {                                         \
+    if (vs->v->cb)                                                      \
+    {                                                                   \
+        int __ret = vs->v->cb(vs->ctx, __VA_ARGS__);                    \
+        if (__ret < 0) return __ret;                                    \
+    }                                                                   \
+} while (0)
+
+# define VISIT_NEED(n) do {                                             \
+    if (vs->end - vs->pos < (int)(n)) ERR_RET_FMT(PACKF_OUT_OF_BUF);    \
+} while (0)
+
+static void __visit_value(uint8_t const *p, char type,
+        struct packf_value *value)
+{
+    uint64_t v = __key_load(p, __type_size(type));
+    float fv;
+    double dv;
+
+    switch (type)
+    {
+        case 'c':
+            value->i = (int8_t)v;
+            value->u = (uint8_t)v;
+            break;
+        case 'w':
+            v = be16toh((uint16_t)v);
+            value->i = (int16_t)v;
+            value->u = (uint16_t)v;
+            break;
+        case 'd':
+            v = be32toh((uint32_t)v);
+            value->i = (int32_t)v;
+            value->u = (uint32_t)v;
+            break;
+        case 'D':
+            value->u = be64toh(v);
+            value->i = (int64_t)value->u;
+            break;
+        case 'f':
+            memcpy(&fv, p, 4);
+            value->f = beftoh(fv);
+            break;
+        case 'F':
+            memcpy(&dv, p, 8);
+            value->f = bedtoh(dv);
+            break;
+    }
+}
 
+/*
+ * 压缩编码的数组按块解码到栈上，第一块多一个开头的原始值。缓冲区不放在
+ * 递归的 __visit 的栈帧中
+ */
+__attribute__((noinline))
+static int __visit_codec(struct __visit *vs, struct packf_visit_field *fld,
+        char codec, int size, int count, char *__f)
+{
+    struct __codec_carry carry;
+    struct packf_value value;
+    uint64_t chunk[BP_BLOCK + 1];
+    int len, i, j, k;
+    void *net;
+
+    carry.prev  = 0;
+    carry.delta = 0;
+    carry.head  = 1;
+    net = (void *)(vs->buf + vs->pos);
+    len = vs->end - vs->pos;
+    for (i = 0; i < count; i += k)
+    {
+        k = BP_BLOCK + (i == 0 && codec != '%');
+        k = count - i < k ? count - i : k;
+        NEG_FMT(__codec_unpack(&net, &len, NULL, codec, size, chunk, k,
+                    &carry));
+        vs->pos = vs->end - len;
+        for (j = 0; j < k; ++j)
+        {
+            value.u = __key_load((uint8_t *)chunk + j * size, size);
+            value.i = size == 2 ? (int16_t)value.u :
+                size == 4 ? (int32_t)value.u : (int64_t)value.u;
+            fld->elem = i + j;
+            VISIT_CB(value, fld, &value);
+        }
+    }
+
+    return 0;
+}
+
+static int __visit(struct __visit *vs, char const *format, int depth)
+{
+    struct packf_visit_field fld;
+    struct packf_value value;
+    char const *f = format, *inner;
+    char *__f, lv_type, type, codec;
+    int num, lv_len = 0, count, size, end, i;
+    uint8_t const *p;
+
+    for (fld.index = 0; *f && *f != ']'; )
+    {
+        if (*f == ' ')
+        {
+            ++f;
+            continue;
+        }
+
+        __f = (char *)f;
+        f = __parse_field(f, &lv_type, &num, &type, &codec);
+        if (!type)
+            ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+        if (codec && (!__ISCODEC(codec) || (type != 'w' && type != 'd' &&
+                        type != 'D')))
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        inner = f;
+        if (type == '[' && !(f = __skip_struct(f)))
+            ERR_RET_FMT(PACKF_NOT_MATCH);
+
+        fld.format = __f;
+        fld.type   = type;
+        fld.depth  = depth;
+        fld.elem   = -1;
+        size = __type_size(type);
+
+        if (lv_type)
+        {
+            VISIT_NEED(lv_type);
+            p = vs->buf + vs->pos;
+            lv_len = lv_type == 1 ? p[0] : (p[0] << 8) | p[1];
+            vs->pos += lv_type;
+        }
+        count = lv_type ? lv_len : (num == -1 ? 1 : num);
+        if (lv_type && num != -1 && type != 's' && type != 'S' &&
+                lv_len > num)
+            ERR_RET_FMT(PACKF_BE_CUT_OFF);
+
+        switch (type)
+        {
+            case 'a':
+                VISIT_NEED(count);
+                vs->pos += count;
                 break;
+            case 'C':
+                if (depth || lv_type || num != -1)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                VISIT_NEED(4);
+                p = vs->buf + vs->pos;
+                if (packf_crc32c(0, vs->buf, vs->pos) != ((uint32_t)p[0] << 24 |
+                            (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]))
+                    ERR_RET_FMT(PACKF_BAD_CHECKSUM);
+                vs->pos += 4;
+                break;
+            case 'c':
+            case 'w':
+            case 'd':
+            case 'D':
             case 'f':
-                DO_PACKF(float, double, htobef, 1);
+            case 'F':
+                if (num == -1 && !lv_type)
+                {
+                    if (codec)
+                        ERR_RET_FMT(PACKF_NOT_FORMAT);
+                    VISIT_NEED(size);
+                    __visit_value(vs->buf + vs->pos, type, &value);
+                    vs->pos += size;
+                    VISIT_CB(value, &fld, &value);
+                    break;
+                }
+
+                if (type == 'c')
+                {
+                    VISIT_NEED(count);
+                    VISIT_CB(bytes, &fld, vs->buf + vs->pos, count);
+                    vs->pos += count;
+                    break;
+                }
 
+                VISIT_CB(array_begin, &fld, count);
+                if (codec)
+                {
+                    NEG_RET(__visit_codec(vs, &fld, codec, size, count, __f));
+                }
+                else
+                {
+                    VISIT_NEED(size * count);
+                    for (i = 0; i < count; ++i)
+                    {
+                        __visit_value(vs->buf + vs->pos, type, &value);
+                        vs->pos += size;
+                        fld.elem = i;
+                        VISIT_CB(value, &fld, &value);
+                    }
+                }
+                fld.elem = -1;
+                VISIT_CB(array_end, &fld);
                 break;
-            case 'F':
-                DO_PACKF(double, double, htobed, 1);
+            case 's':
+            case 'S':
+                p = vs->buf + vs->pos;
+                if (lv_type)
+                {
+                    if ((num == 0 && lv_len) || (num > 0 && lv_len > num - 1))
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                    count = size = lv_len;
+                }
+                else if (num == -1)
+                {
+                    count = strnlen((char const *)p, vs->end - vs->pos);
+                    size  = count + 1;
+                }
+                else
+                {
+                    size  = num < vs->end - vs->pos ? num : vs->end - vs->pos;
+                    count = strnlen((char const *)p, size);
+                    if (num && count == num)
+                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
+                    size  = type == 's' ? num : count + (num ? 1 : 0);
+                }
+                VISIT_NEED(size);
+                VISIT_CB(bytes, &fld, p, count);
+                vs->pos += size;
+                break;
+            case '[':
+                if (lv_type && num == -1)
+                {
+                    VISIT_NEED(lv_len);
+                    VISIT_CB(struct_begin, &fld);
+                    end     = vs->end;
+                    vs->end = vs->pos + lv_len;
+                    NEG_RET(__visit(vs, inner, depth + 1));
+                    vs->pos = vs->end;
+                    vs->end = end;
+                    VISIT_CB(struct_end, &fld);
+                    break;
+                }
 
+                if (num != -1 || lv_type)
+                    VISIT_CB(array_begin, &fld, count);
+                for (i = 0; i < count; ++i)
+                {
+                    fld.elem = num != -1 || lv_type ? i : -1;
+                    VISIT_CB(struct_begin, &fld);
+                    NEG_RET(__visit(vs, inner, depth + 1));
+                    VISIT_CB(struct_end, &fld);
+                }
+                fld.elem = -1;
+                if (num != -1 || lv_type)
+                    VISIT_CB(array_end, &fld);
                 break;
             default:
                 ERR_RET_FMT(PACKF_NOT_FORMAT);
         }
+
+        ++fld.index;
     }
 
-    return buf_len - *left_len;
+    return 0;
 }
 
-# define SET_LEN(des, len) do {                                         \
-    if (lv_type == 1) *((uint8_t *)(des)) = (uint8_t)len;               \
-    else *((uint16_t *)(des)) = (uint16_t)lv_len;                       \
+int packf_visit(void const *buf, size_t len, char const *format,
+        struct packf_visitor const *visitor, void *ctx)
+{
+    struct __visit vs;
+    int ret;
+
+    if (!buf || !format || !visitor)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    vs.buf = buf;
+    vs.end = len > INT_MAX ? INT_MAX : (int)len;
+    vs.pos = 0;
+    vs.v   = visitor;
+    vs.ctx = ctx;
+
+    if ((ret = __visit(&vs, format, 0)) < 0)
+    {
+        /* 回调返回的值不是错误码 */
+        if (-ret <= (int)(sizeof(err_msg) / sizeof(err_msg[0])))
+            PRINT_ERR_FMT(ret);
+        return ret;
+    }
+
+    return vs.pos;
+}
+
+/*
+ * 可信数据的解包：数据由 packf 按同样的 format 打包并且已经校验过（例如自己
+ * 写的记录文件、共享内存），不再检查 LV 长度是否超过 num 以及定长字符串的
+ * 结尾。读取长度头和拷贝数据之前只与 end 比较一次，不会越界读。
+ */
+# define TRUST_NEED(n) do {                                             \
+    if (end - p < (long)(n))                                            \
+        ERR_RET_FMT(PACKF_OUT_OF_BUF);                                  \
 } while (0)
 
-# define GET_LV_LEN(src) do {                                           \
-    IF_LESS(*left_len, lv_type);                                        \
-    if (lv_type == 1) lv_len = *((uint8_t *)(src));                     \
-    else lv_len = be16toh(*((uint16_t *)(src)));                        \
-    (src) = (char *)(src) + lv_type;                                    \
+# define TRUST_LV_LEN() do {                                            \
+    TRUST_NEED(lv_type);                                                \
+    lv_len = lv_type == 1 ? p[0] : (p[0] << 8) | p[1];                  \
+    p += lv_type;                                                       \
 } while (0)
 
-# define GET_LV(des, src) do {                                          \
+# define TRUST_LV() do {                                                \
     if (lv_type)                                                        \
     {                                                                   \
-        GET_LV_LEN(src);                                                \
-        if (num != -1 && lv_len > num) ERR_RET_FMT(PACKF_BE_CUT_OFF);   \
+        TRUST_LV_LEN();                                                 \
         if (from == FROM_ARG) SET_LEN(va_arg(va, char *), lv_len);      \
-        else { SET_LEN(des, lv_len); (des) = (char *)des + lv_type; }   \
+        else                                                            \
+        {                                                               \
+            SET_LEN(*locale, lv_len);                                   \
+            *locale = (char *)*locale + lv_type;                        \
+        }                                                               \
     }                                                                   \
 } while (0)
 
-# define DO_UNPACKF(type, swap, swap_flag) do {                         \
-    GET_LV(*locale, *net);                                              \
+# define TRUST_DES() do {                                               \
+    if (from == FROM_ARG)                                               \
+        des = va_arg(va, char *);                                       \
+    else                                                                \
+        des = *locale;                                                  \
+} while (0)
+
+# define DO_UNPACKT(type, swap, swap_flag) do {                         \
+    TRUST_LV();                                                         \
+    TRUST_DES();                                                        \
     if (num == -1 && !lv_type)                                          \
     {                                                                   \
-        IF_LESS(*left_len, sizeof(type));                               \
-        if (from == FROM_ARG)                                           \
-            *((type *)(va_arg(va, char *))) = swap(*((type *)(*net)));  \
-        else                                                            \
-        {                                                               \
-            *((type *)(*locale)) = swap(*((type *)(*net)));             \
+        type __v;                                                       \
+        TRUST_NEED(sizeof(type));                                       \
+        memcpy(&__v, p, sizeof(type));                                  \
+        __v = swap(__v);                                                \
+        memcpy(des, &__v, sizeof(type));                                \
+        p += sizeof(type);                                              \
+        if (from == FROM_PTR)                                           \
             *locale = (char *)*locale + sizeof(type);                   \
-        }                                                               \
-        *net = (char *)*net + sizeof(type);                             \
     }                                                                   \
     else                                                                \
     {                                                                   \
-        if (from == FROM_ARG)                                           \
-            des = va_arg(va, char *);                                   \
-        else                                                            \
-            des = *locale;                                              \
-        src = *net;                                                     \
         array_size = lv_type ? lv_len : num;                            \
         offset = sizeof(type) * array_size;                             \
-        if (offset)                                                     \
-        {                                                               \
-            IF_LESS(*left_len, offset);                                 \
-            if (swap_flag)                                              \
-                for (i = 0; i < array_size; i++)                        \
-                    ((type *)des)[i] = swap(((type *)src)[i]);          \
-            else                                                        \
-                memcpy(des, src, offset);                               \
-            *net = (char *)*net + offset;                               \
-        }                                                               \
+        TRUST_NEED(offset);                                             \
+        if (swap_flag)                                                  \
+            __swap_copy(des, p, sizeof(type), array_size);              \
+        else                                                            \
+            memcpy(des, p, offset);                                     \
+        p += offset;                                                    \
         if (from == FROM_PTR)                                           \
         {                                                               \
             if (lv_type && num)                                         \
@@ -597,15 +7160,32 @@ static int __packf(void **net, int *left_len, char const *format, \
     }                                                                   \
 } while (0)
 
-static int __unpackf(void **net, int *left_len, char const *format, \
-        int from, va_list va, void **locale)
+# define DO_UNPACKT_CODEC(size) do {                                    \
+    TRUST_LV();                                                         \
+    TRUST_DES();                                                        \
+    array_size = lv_type ? lv_len : num;                                \
+    left = (int)(end - p);                                              \
+    net  = (void *)p;                                                   \
+    NEG_FMT(__codec_unpack(&net, &left, NULL, codec, size, des,         \
+                array_size, NULL));                                     \
+    p = net;                                                            \
+    if (from == FROM_PTR)                                               \
+        *locale = (char *)*locale + (size) *                            \
+            (lv_type && num != -1 ? num : array_size);                  \
+} while (0)
+
+# define TRUST_SWAP (__BYTE_ORDER == __LITTLE_ENDIAN)
+# define TRUST_SWAP_FLOAT (__FLOAT_WORD_ORDER == __LITTLE_ENDIAN)
+
+static int __unpackt(uint8_t const **net_p, uint8_t const *end,
+        char const *format, int from, va_list va, void **locale)
 {
-    int buf_len = *left_len;
-    int num, i, array_size, offset, bracket_stack, lv_len = 0;
-    char *f = (char *)format, *__f, *str_num, *src, *des;
-    char type, lv_type;
-    int struct_len_locale = 0, struct_len_net = 0;
-    void *struct_start_locale, *struct_start_net;
+    uint8_t const *p = *net_p, *start;
+    char *f = (char *)format, *__f, *des;
+    char lv_type, type, codec;
+    int num, i, array_size, offset, lv_len = 0, left, fixed;
+    int struct_len_locale = 0;
+    void *struct_start_locale, *net;
 
     while (*f)
     {
@@ -616,33 +7196,14 @@ static int __unpackf(void **net, int *left_len, char const *format, \
         }
 
         __f = f;
-
-        if (*f == '-')
-        {
-            lv_type = 1;
-            ++f;
-        }
-        else if (*f == '=')
-        {
-            lv_type = 2;
-            ++f;
-        }
-        else
-        {
-            lv_type = 0;
-        }
-
-        str_num = f;
-        while (__ISDIGIT(*f))
-            ++f;
-        if (str_num == f)
-            num = -1;
-        else
-            num = __atoi(str_num, f - str_num);
-
-        type = *(f++);
+        f = (char *)__parse_field(f, &lv_type, &num, &type, &codec);
         if (!type)
             ERR_RET_FMT(PACKF_EXPECT_FORMAT);
+        if (codec && (!__ISCODEC(codec) || (type != 'w' && type != 'd' &&
+                        type != 'D')))
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
+        if (codec && num == -1 && !lv_type)
+            ERR_RET_FMT(PACKF_NOT_FORMAT);
 
         switch (type)
         {
@@ -651,152 +7212,115 @@ static int __unpackf(void **net, int *left_len, char const *format, \
                 {
                     if (from == FROM_ARG)
                         *locale = va_arg(va, char *);
-
-                    GET_LV_LEN(*net);
-                    struct_len_net = lv_len;
-                    struct_start_net = *net;
+                    TRUST_LV_LEN();
                     if (from == FROM_PTR)
                     {
                         SET_LEN(*locale, lv_len);
                         *locale = (char *)*locale + lv_type;
                     }
-                    NEG_RET(__unpackf(net, &struct_len_net, f, FROM_PTR,
-                                NULL, locale));
-                    *net = (char *)struct_start_net + lv_len;
+                    TRUST_NEED(lv_len);
+                    start = p;
+                    NEG_RET(__unpackt(&p, start + lv_len, f, FROM_PTR, NULL,
+                                locale));
+                    p = start + lv_len;
                 }
                 else
                 {
-                    GET_LV(*locale, *net);
+                    TRUST_LV();
                     if (from == FROM_ARG)
                         *locale = va_arg(va, char *);
 
                     array_size = lv_type ? lv_len : (num == -1 ? 1 : num);
-                    for (i = 0; i < array_size; i++)
+                    fixed = 0;
+                    if (array_size > 1)
+                    {
+                        left = (int)(end - p);
+                        net  = (void *)p;
+                        NEG_RET(fixed = __fixed_array(&net, &left, f, locale,
+                                    array_size, NULL, 1, &struct_len_locale,
+                                    __f));
+                        p = net;
+                    }
+                    for (i = 0; !fixed && i < array_size; i++)
                     {
                         struct_start_locale = *locale;
-                        NEG_RET(__unpackf(net, left_len, f, FROM_PTR,
-                                    NULL, locale));
+                        NEG_RET(__unpackt(&p, end, f, FROM_PTR, NULL,
+                                    locale));
                         struct_len_locale = (char *)*locale -
                             (char *)struct_start_locale;
                     }
                     if (lv_type && from == FROM_PTR)
                     {
                         if (array_size == 0)
-                            NEG_RET(struct_len_locale = __struct_len_locale(f));
+                            NEG_RET(struct_len_locale =
+                                    __struct_len_locale(f, 0));
                         *locale = (char *)*locale + struct_len_locale *
                             (num - lv_len);
                     }
                 }
 
-                bracket_stack = 1;
-                while (bracket_stack)
-                {
-                    if (!(*f))
-                        ERR_RET_FMT(PACKF_NOT_MATCH);
-                    else if (*f == '[')
-                        ++bracket_stack;
-                    else if (*f == ']')
-                        --bracket_stack;
-
-                    ++f;
-                }
+                if (!(f = (char *)__skip_struct(f)))
+                    ERR_RET_FMT(PACKF_NOT_MATCH);
 
                 break;
             case ']':
+                *net_p = p;
                 return 0;
             case 's':
             case 'S':
-                src = *net;
-                if (from == FROM_ARG)
-                    des = va_arg(va, char *);
-                else
-                    des = (char *)*locale;
-
+                TRUST_DES();
                 if (lv_type)
                 {
-                    GET_LV_LEN(src);
-
-                    if ((num == 0 && lv_len) || (num > 0 && lv_len > num - 1))
-                        ERR_RET_FMT(PACKF_BE_CUT_OFF);
-
+                    TRUST_LV_LEN();
                     if (from == FROM_PTR)
                     {
                         SET_LEN(des, lv_len);
                         des += lv_type;
                     }
-
-                    if (lv_len)
-                    {
-                        IF_LESS(*left_len, lv_len);
-                        memcpy(des, src, lv_len);
-                    }
-
+                    TRUST_NEED(lv_len);
+                    memcpy(des, p, lv_len);
+                    p += lv_len;
                     if (num != 0)
-                        *(des + lv_len) = '\0';
+                        des[lv_len] = '\0';
 
-                    offset = lv_type + lv_len;
-                    *net = (char *)*net + offset;
                     if (from == FROM_PTR)
                     {
                         if (num == -1)
-                            *locale = (char *)*locale + offset + 1;
+                            *locale = (char *)*locale + lv_type + lv_len + 1;
                         else
                             *locale = (char *)*locale + lv_type + num;
                     }
+                    break;
                 }
-                else
-                {
-                    if (num == -1)
-                    {
-                        offset = strlen(src) + 1;
-                        IF_LESS(*left_len, offset);
-                        strcpy(des, src);
-                    }
-                    else if (type == 's')
-                    {
-                        offset = num;
-                        IF_LESS(*left_len, offset);
 
-                        for (i = 0; i < offset; ++i)
-                            if (!(des[i] = src[i]))
-                                break;
+                /* 定长的 s 打包时已经补 '\0', 整体拷贝 */
+                if (type == 's' && num != -1)
+                    offset = num;
+                else if (num == 0)
+                    offset = 0;
+                else if ((offset = strnlen((char const *)p, end - p)) <
+                        end - p)
+                    ++offset;
+                else
+                    ERR_RET_FMT(PACKF_OUT_OF_BUF);
+                TRUST_NEED(offset);
+                memcpy(des, p, offset);
+                p += offset;
 
-                        if (offset && i == offset)
-                        {
-                            des[i - 1] = 0;
-                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
-                        }
-                    }
+                if (from == FROM_PTR)
+                {
+                    if (num >= 0 && type == 'S')
+                        *locale = (char *)*locale + num;
                     else
-                    {
-                        offset = strnlen(src, num);
-                        if (num && offset == num)
-                            ERR_RET_FMT(PACKF_BE_CUT_OFF);
-                        offset += num ? 1 : 0;
-                        IF_LESS(*left_len, offset);
-
-                        for (i = 0; i < offset; ++i)
-                            if (!(des[i] = src[i]))
-                                break;
-                    }
-
-                    *net = (char *)*net + offset;
-                    if (from == FROM_PTR)
-                    {
-                        if (num >= 0 && type == 'S')
-                            *locale = (char *)*locale + num;
-                        else
-                            *locale = (char *)*locale + offset;
-                    }
+                        *locale = (char *)*locale + offset;
                 }
 
                 break;
             case 'a':
-                GET_LV(*locale, *net);
-
+                TRUST_LV();
                 offset = lv_type ? lv_len : (num == -1 ? 1 : num);
-                IF_LESS(*left_len, offset);
-                *net = (char *)*net + offset;
+                TRUST_NEED(offset);
+                p += offset;
                 if (from == FROM_PTR)
                 {
                     memset(*locale, 0, offset);
@@ -808,27 +7332,44 @@ static int __unpackf(void **net, int *left_len, char const *format, \
 
                 break;
             case 'c':
-                DO_UNPACKF(int8_t, NO_SWAP, 0);
+                DO_UNPACKT(int8_t, NO_SWAP, 0);
 
                 break;
             case 'w':
-                DO_UNPACKF(int16_t, be16toh, 1);
+                if (codec)
+                    DO_UNPACKT_CODEC(2);
+                else
+                    DO_UNPACKT(int16_t, be16toh, TRUST_SWAP);
 
                 break;
             case 'd':
-                DO_UNPACKF(int32_t, be32toh, 1);
+                if (codec)
+                    DO_UNPACKT_CODEC(4);
+                else
+                    DO_UNPACKT(int32_t, be32toh, TRUST_SWAP);
 
                 break;
             case 'D':
-                DO_UNPACKF(int64_t, be64toh, 1);
+                if (codec)
+                    DO_UNPACKT_CODEC(8);
+                else
+                    DO_UNPACKT(int64_t, be64toh, TRUST_SWAP);
 
                 break;
             case 'f':
-                DO_UNPACKF(float, beftoh, 1);
+                DO_UNPACKT(float, beftoh, TRUST_SWAP_FLOAT);
 
                 break;
             case 'F':
-                DO_UNPACKF(double, bedtoh, 1);
+                DO_UNPACKT(double, bedtoh, TRUST_SWAP_FLOAT);
+
+                break;
+            case 'C':
+                /* 数据已经校验过 */
+                if (lv_type || num != -1 || from != FROM_ARG)
+                    ERR_RET_FMT(PACKF_NOT_FORMAT);
+                TRUST_NEED(4);
+                p += 4;
 
                 break;
             default:
@@ -836,34 +7377,17 @@ static int __unpackf(void **net, int *left_len, char const *format, \
         }
     }
 
-    return buf_len - *left_len;
-}
-
-int packf(void *dest, size_t max, char const *format, ...)
-{
-    va_list va;
-    int ret, left_len = (int)max;
-    void *net = dest, *locale = NULL;
-
-    if (!dest)
-        ERR_RET_PRINT(PACKF_NULL_POINTER);
-    if (!format)
-        return 0;
-
-    va_start(va, format);
-    ret = __packf(&net, &left_len, format, FROM_ARG, va, &locale);
-    va_end(va);
-
-    PRINT_ERR_FMT(ret);
+    *net_p = p;
 
-    return ret;
+    return 0;
 }
 
-int unpackf(void *src, size_t max, char const *format, ...)
+int unpackf_trusted(void *src, size_t max, char const *format, ...)
 {
+    uint8_t const *p = src;
     va_list va;
-    int ret, left_len = (int)max;
-    void *net = src, *locale = NULL;
+    int ret;
+    void *locale = NULL;
 
     if (!src)
         ERR_RET_PRINT(PACKF_NULL_POINTER);
@@ -871,135 +7395,14 @@ int unpackf(void *src, size_t max, char const *format, ...)
         return 0;
 
     va_start(va, format);
-    ret = __unpackf(&net, &left_len, format, FROM_ARG, va, &locale);
-    va_end(va);
-
-    PRINT_ERR_FMT(ret);
-
-    return ret;
-}
-
-int vpackf(void **current, int *left, char const *format, ...)
-{
-    va_list va;
-    int ret, left_len = *left;
-    void *net = *current, *locale = NULL;
-
-    if (!current || !*current || !left)
-        ERR_RET_PRINT(PACKF_NULL_POINTER);
-    if (!format)
-        return 0;
-
-    va_start(va, format);
-    ret = __packf(&net, &left_len, format, FROM_ARG, va, &locale);
-    va_end(va);
-
-    if (ret > 0)
-    {
-        *current = net;
-        *left    = left_len;
-    }
-
-    PRINT_ERR_FMT(ret);
-
-    return ret;
-}
-
-int vunpackf(void **current, int *left, char const *format, ...)
-{
-    va_list va;
-    int ret, left_len = *left;
-    void *net = *current, *locale = NULL;
-
-    if (!current || !*current || !left)
-        ERR_RET_PRINT(PACKF_NULL_POINTER);
-    if (!format)
-        return 0;
-
-    va_start(va, format);
-    ret = __unpackf(&net, &left_len, format, FROM_ARG, va, &locale);
+    ret = __unpackt(&p, p + (max > INT_MAX ? INT_MAX : max), format,
+            FROM_ARG, va, &locale);
     va_end(va);
 
-    if (ret > 0)
-    {
-        *current = net;
-        *left    = left_len;
-    }
-
-    PRINT_ERR_FMT(ret);
-
-    return ret;
-}
-
-int vpacka(void **current, int *left, char const *format, va_list arg)
-{
-    int ret, left_len = *left;
-    void *net = *current, *locale = NULL;
-
-    if (!current || !*current || !left)
-        ERR_RET_PRINT(PACKF_NULL_POINTER);
-    if (!format)
-        return 0;
-
-    ret = __packf(&net, &left_len, format, FROM_ARG, arg, &locale);
-
-    if (ret > 0)
-    {
-        *current = net;
-        *left    = left_len;
-    }
-
-    PRINT_ERR_FMT(ret);
-
-    return ret;
-}
-
-int vunpacka(void **current, int *left, char const *format, va_list arg)
-{
-    int ret, left_len = *left;
-    void *net = *current, *locale = NULL;
-
-    if (!current || !*current || !left)
-        ERR_RET_PRINT(PACKF_NULL_POINTER);
-    if (!format)
-        return 0;
-
-    ret = __unpackf(&net, &left_len, format, FROM_ARG, arg, &locale);
-
-    if (ret > 0)
-    {
-        *current = net;
-        *left    = left_len;
-    }
+    if (ret >= 0)
+        ret = (int)(p - (uint8_t const *)src);
 
     PRINT_ERR_FMT(ret);
 
     return ret;
 }
-
-int vpackn(void **current, int *left, void *buf, size_t n)
-{
-    if (!current || !*current || !left || !buf)
-        ERR_RET_PRINT(PACKF_NULL_POINTER);
-
-    char *__f = NULL;
-    IF_LESS(*left, n);
-    memcpy(*current, buf, n);
-    *current = (char *)*current + n;
-
-    return (int)n;
-}
-
-int vunpackn(void **current, int *left, void *buf, size_t n)
-{
-    if (!current || !*current || !left || !buf)
-        ERR_RET_PRINT(PACKF_NULL_POINTER);
-
-    char *__f = NULL;
-    IF_LESS(*left, n);
-    memcpy(buf, *current, n);
-    *current = (char *)*current + n;
-
-    return (int)n;
-}
-
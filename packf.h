@@ -14,6 +14,7 @@
 # include <stdint.h>
 # include <stddef.h>
 # include <stdarg.h>
+# include <sys/uio.h>
 
 # ifdef  __cplusplus
 extern "C"
@@ -26,7 +27,7 @@ extern "C"
  * 字符串，即可方便的将各种数据类型（包括结构体和数组）转换为本地序或网络
  * 序，用于网络传输。
  *
- * format: [-=][num]type     [] 表示可选
+ * format: [-=][num]type[.n][codec]     [] 表示可选
  *
  * ---------------------------------------------------------------
  *  type   |    means
@@ -39,9 +40,16 @@ extern "C"
  *    D    |    ddword (int64_t | uint64_t) (c99)
  *    f    |    float  (4 bytes)
  *    F    |    double (8 bytes)
+ *    C    |    CRC32C 校验和 (4 bytes)，见 note 4
+ *  b<n>   |    n 位的无符号整数 (1 <= n <= 63)，见 note 7
+ *    h    |    半精度浮点 (本地 float, 网络上 2 bytes)，见 note 8
  *    [    |    结构体开始
+ *   ?[    |    可选字段的结构体开始，见 note 6
  * --------------------------------------------------------------
  *    ]    |    结构体结束
+ *  % + ^  |    整数数组的压缩编码，跟在 wdD 之后，见 note 5
+ *  .<n>   |    定点小数，跟在 cwdD 之后 (本地 double)，见 note 8
+ *    @    |    字符串字典，跟在 s/S 之后，见 note 9
  *   空格  |    使用空格让格式串更美观，不能用在 -/= num 和 type 之间
  * --------------------------------------------------------------
  *
@@ -79,6 +87,82 @@ extern "C"
  *      1): 结构体必须在 # pragma pack(1) 与 # pragma pack() 之间定义！
  *
  *      2): 结构体支持嵌套，即结构体中包含结构体。
+ *
+ * 4、C 表示 CRC32C 校验和，只能出现在最外层的 format 中（不能在结构体中），
+ *    不对应任何参数，也不能有 -/= 和 num.
+ *      1): 打包时，写入从消息开始到 C 之前所有数据的 CRC32C (4 字节，网络序)。
+ *      2): 解包时，计算同样范围的 CRC32C 并与数据中的值比较，不一致时返回
+ *          PACKF_BAD_CHECKSUM.
+ *      3): CRC 在打包/解包每个字段之后立即计算，数据只需要被访问一次。
+ *          example: packf(buf, sizeof(buf), "d -32s =100d C", ...);
+ *
+ * 5、w/d/D 数组（包括 LV 数组）的 type 之后可以加上压缩编码方式，参数和不压缩
+ *    时完全相同，只是网络上的数据变短：
+ *      1): % frame-of-reference: 每 128 个元素为一块，块内的值减去最小值后，
+ *          按最大差值需要的位数打包。适合取值集中的数组。
+ *      2): + delta: 保存相邻元素的差值，适合单调的数组（序号、时间戳等）。
+ *      3): ^ delta-of-delta: 保存相邻差值的差值，适合间隔基本固定的时间戳。
+ *      4): 编码后的长度与数据有关，LV 字段的长度仍然是元素的个数。
+ *          example: packf(buf, sizeof(buf), "=4096D^", n, timestamps);
+ *      5): 解包时数据不合法（例如位宽超过元素的位数）返回 PACKF_BAD_DATA.
+ *      6): 视图可以通过 packf_view_get 取出整个数组，但不能按下标访问元素。
+ *
+ * 6、?[...] 表示可选字段的结构体，其中每个字段（最多 64 个）都可以不存在，
+ *    只打包存在的字段。不能有 -/= 和 num, 需要数组时放在结构体数组中，例如
+ *    "=100[?[...]]".
+ *      1): 参数为 uint64_t 的掩码和结构体指针，第 i 位为 1 表示第 i 个字段
+ *          存在（从 0 开始）。解包时参数为 uint64_t * 和结构体指针，掩码中
+ *          不存在的字段在结构体中保持不变。在结构体中时，前面需要定义
+ *          uint64_t 的掩码。
+ *      2): 网络上先是 (字段数 + 7) / 8 字节的位图，第 i 个字段为第 i / 8
+ *          字节的第 i % 8 位，之后按顺序只有存在的字段。掩码中有超过字段数
+ *          的位时返回 PACKF_BAD_DATA.
+ *          example: uint64_t mask = 1 << 0 | 1 << 7;
+ *          packf(buf, sizeof(buf), "?[D -32s d d d d d F]", mask, &account);
+ *          只打包 D 和 F, 共 1 + 8 + 8 = 17 字节。
+ *      3): 视图、packf_visit 和 unpackf_trusted 不支持 ?[...].
+ *
+ * 7、b<n> 表示 n 位的位域，用于布尔值、标志和取值很少的枚举，可以有 num
+ *    表示数组，不能有 -/=.
+ *      1): 同一层中连续的位域组成一个位流，按 MSB 优先依次存放，位流结束时
+ *          （下一个不是位域的字段之前）补 0 到整字节。
+ *      2): 本地为能放下 n 位的最小无符号整数：n <= 8 为 uint8_t, <= 16 为
+ *          uint16_t, <= 32 为 uint32_t, 其余为 uint64_t. 变参中 n <= 32 时
+ *          为 unsigned int, 其余为 uint64_t; 数组和解包时为指针。
+ *      3): 打包时值超过 n 位返回 PACKF_BE_CUT_OFF.
+ *          example: packf(buf, sizeof(buf), "b1 b3 b12 16b2", 1, 5, 4000,
+ *                  modes);
+ *          共 1 + 3 + 12 + 32 = 48 位，6 字节。
+ *      4): ?[...] 中的每个位域单独补齐到整字节。视图、packf_visit 和
+ *          unpackf_trusted 不支持位域。
+ *
+ * 8、数值的窄编码，用于价格、数量和传感器数据等不需要 F/f 的全部精度的数组。
+ *      1): c/w/d/D 之后加 .<n> 表示有 n 位小数的定点小数 (0 <= n <= 18)。
+ *          本地为 double, 网络上为 v * 10^n 四舍五入后的有符号整数，长度与
+ *          整数类型相同。超出整数的范围（包括 NaN 和无穷大）时返回
+ *          PACKF_BE_CUT_OFF. 解包时为整数 / 10^n. 不能和 codec 一起使用。
+ *          example: double px[64];
+ *          packf(buf, sizeof(buf), "D.4 =64d.4", 123.4567, n, px);
+ *          价格为 8 字节，每个数组元素 4 字节。
+ *      2): h 为 IEEE 754 半精度浮点，本地为 float, 网络上为 2 字节，舍入到
+ *          最近的偶数，超出范围时为无穷大。编译时启用 F16C (-mf16c) 时数组
+ *          使用 F16C 指令转换。
+ *      3): 变参中的单个值为 double (float 按 double 传递)，数组和解包时为
+ *          指针。视图、packf_visit 和 unpackf_trusted 不支持这两种编码。
+ *
+ * 9、s/S 之后加 @ 表示通过字典打包，用于一批消息中反复出现的字符串（代码、
+ *    交易所等），参数和本地布局与不加 @ 时完全相同。
+ *      1): 网络上字段前有一个 LEB128 的标记：0 为字面量，之后是和不加 @ 时
+ *          相同的数据；1 为加入字典的字面量，按加入的顺序编号；n >= 2 为
+ *          引用编号为 n - 2 的字面量，之后没有数据。
+ *      2): 字典保存的是字面量字段的网络数据，所以 "-16s@" 和 "-32s@" 可以
+ *          共用，"16s@" 则不同。引用不比字面量短时仍然打包字面量。
+ *      3): 只有 packf_dict/unpackf_dict 使用字典，其余函数打包的都是标记为
+ *          0 的字面量，解包时遇到引用返回 PACKF_BAD_DATA.
+ *          example: packf_dict(buf, sizeof(buf), dict, "-16s@ -8s@ D d",
+ *                  "600000", "SSE", qty, price);
+ *          同一个 dict 中第二次出现时两个字符串各只占 1 字节。
+ *      4): 视图、packf_visit、packf_key 和 unpackf_trusted 不支持 @.
  */
 
 enum
@@ -89,6 +173,11 @@ enum
     PACKF_EXPECT_FORMAT = -4,
     PACKF_BE_CUT_OFF    = -5,
     PACKF_NULL_POINTER  = -6,
+    PACKF_NO_MEMORY     = -7,
+    PACKF_BAD_CHECKSUM  = -8,
+    PACKF_BAD_DATA      = -9,
+    PACKF_IO_ERROR      = -10,
+    PACKF_OVER_LIMIT    = -11,
 };
 
 /*
@@ -97,11 +186,32 @@ enum
  */
 extern char *packf_error_format;
 
+/*
+ * 计算 buf 的 CRC32C, crc 为之前数据的 CRC32C (第一次调用时为 0)
+ */
+extern uint32_t packf_crc32c(uint32_t crc, void const *buf, size_t len);
+
+/*
+ * 返回错误码对应的错误信息
+ */
+extern char const *packf_strerror(int ret);
+
 /*
  * 如果 packf_print_error 为非 0 值，则在发生错误时，在标准出错打印错误信息
  */
 extern int packf_print_error;
 
+/*
+ * 大块数据的阈值：cwdDfF 数组和 LV 数组（包括 N c 和 =N c）的数据不小于
+ * packf_bulk_threshold 字节时，打包和解包使用非临时的存储写出（编译时开启
+ * SSE2 时），避免大块的数据把调用者正在使用的数据挤出 cache. 源数据仍然
+ * 经过 cache 读取，不做软件预取。
+ * 程序启动时设为最后一级 cache 的 3/4（不知道时为 4M），为 0 时不使用。
+ * 写出的数据不在 cache 中，之后马上要读取这些数据时应提高阈值；和其他
+ * 线程共享 cache, 需要更早绕过 cache 时可以降低阈值。
+ */
+extern size_t packf_bulk_threshold;
+
 /*
  * 函数：packf : pack format
  * 功能: 打包，按照 format 定义的格式将变参中数据转换为网络字节序的二进制数据
@@ -199,6 +309,603 @@ extern int vunpackn(void **current, int *left, void *buf, size_t n);
 extern int vpacka(void **current, int *left, char const *format, va_list arg);
 extern int vunpacka(void **current, int *left, char const *format, va_list arg);
 
+/*
+ * 函数：packf_iov : pack format to io vector
+ * 功能：类似 packf, 但目标缓冲区由 iovcnt 个不连续的段组成，按顺序依次使用。
+ *       例如环形缓冲区回绕时，可以直接打包到缓冲区末尾和起始处的两段中，
+ *       而不需要先打包到临时缓冲区再拷贝。跨越段边界的字段会被自动拆分，
+ *       其余字段与 packf 的处理方式相同。
+ * 参数：
+ *      iov:     段数组
+ *      iovcnt:  段的个数
+ *      format:  格式字符串，和后面的变参对应
+ *      ...:     变参，和 format 对应
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度
+ *      < 0  : 失败
+ */
+extern int packf_iov(struct iovec const *iov, int iovcnt,
+        char const *format, ...);
+
+/*
+ * 函数：unpackf_iov : unpack format from io vector
+ * 功能：类似 unpackf, 但网络序二进制数据由 iovcnt 个不连续的段组成
+ * 参数：
+ *      iov:     段数组
+ *      iovcnt:  段的个数
+ *      format:  描述网络序二进制数据的格式字符串
+ *      ...:     变参，参数应为指针
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败
+ */
+extern int unpackf_iov(struct iovec const *iov, int iovcnt,
+        char const *format, ...);
+
+extern int packf_iova(struct iovec const *iov, int iovcnt,
+        char const *format, va_list arg);
+extern int unpackf_iova(struct iovec const *iov, int iovcnt,
+        char const *format, va_list arg);
+
+/*
+ * 固定布局的格式：不含 -/= 的 LV 字段，也不含不定长的 s/S (定长的 s 可以)，
+ * 此时网络序数据的长度和布局与 # pragma pack(1) 的本地结构体完全相同。
+ *
+ * 对于这种格式，packf_fixed_new 预先计算出需要转换字节序的位置，之后打包
+ * 和解包只需要一次长度检查，其余部分整体拷贝，需要转换的部分批量翻转字节
+ * 序（编译时开启 SSSE3 或 NEON 时使用 SIMD 指令）。
+ *
+ * 另外，packf/unpackf 在处理结构体数组 N[...] 和 =N[...] 时，如果结构体
+ * 为固定布局，会自动使用同样的方式一次处理所有元素。
+ */
+struct packf_fixed;
+
+/*
+ * 函数：packf_fixed_new
+ * 功能：为固定布局的格式生成 swap map
+ * 参数：
+ *      format: 描述一个记录（结构体）的格式字符串，如 "d w 16s 4[c D]"
+ * 返回值：
+ *      成功返回 swap map, 使用完后应调用 packf_fixed_free 释放；
+ *      format 不是固定布局或者格式错误时返回 NULL
+ */
+extern struct packf_fixed *packf_fixed_new(char const *format);
+
+extern void packf_fixed_free(struct packf_fixed *fx);
+
+/* 返回一个记录的长度（本地与网络序相同） */
+extern int packf_fixed_len(struct packf_fixed const *fx);
+
+/*
+ * 函数：packf_fixed
+ * 功能：打包 n 个连续存放的记录
+ * 参数：
+ *      fx:     packf_fixed_new 返回的 swap map
+ *      dest:   目标缓冲区地址
+ *      max:    dest 指向的缓冲区长度
+ *      src:    记录数组的地址
+ *      n:      记录的个数
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度
+ *      < 0  : 失败
+ */
+extern int packf_fixed(struct packf_fixed const *fx, void *dest, size_t max,
+        void const *src, int n);
+
+/*
+ * 函数：unpackf_fixed
+ * 功能：解包 n 个连续存放的记录
+ * 参数：
+ *      fx:     packf_fixed_new 返回的 swap map
+ *      src:    网络序二进制数据起始地址
+ *      max:    src 指向的网络序二进制数据长度
+ *      dest:   记录数组的地址
+ *      n:      记录的个数
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败
+ */
+extern int unpackf_fixed(struct packf_fixed const *fx, void const *src,
+        size_t max, void *dest, int n);
+
+/*
+ * 视图：在不拷贝、不解包整个消息的情况下访问其中的单个字段，只有被访问的
+ * 字段才会被转换为本地序。
+ *
+ * 字段通过下标路径 path 定位：结构体（包括最外层的 format）中的字段按顺序
+ * 从 0 开始编号，数组（包括 LV 数组）中的元素从 0 开始编号，结构体数组的
+ * 元素之后再跟结构体中的字段编号。
+ * example: format 为 "d -16s =10[w d]" 时
+ *      { 0 }       表示 d
+ *      { 1 }       表示字符串
+ *      { 2, 3 }    表示结构体数组的第 4 个元素
+ *      { 2, 3, 1 } 表示结构体数组第 4 个元素中的 d
+ *
+ * packf_view_init 扫描一遍数据，为每个字段记录偏移，之后每次访问都是 O(1)
+ * 的查找（固定布局的部分不需要索引，访问时按 format 直接计算偏移）。
+ * 视图只保存 buf 的地址，buf 在视图使用期间必须保持有效且不能被修改。
+ */
+struct packf_view_node;
+
+struct packf_view
+{
+    void                   *buf;
+    int                     len;
+    char const             *format;
+    int                     fixed;
+    int                     ntop;
+    struct packf_view_node *nodes;
+    int                     nnodes;
+    int                     cap;
+};
+
+/*
+ * 函数：packf_view_init
+ * 功能：为 buf 中按 format 打包的消息建立视图
+ * 参数：
+ *      view:   视图，第一次使用前应清零，重复使用时会复用已分配的索引空间
+ *      buf:    网络序二进制数据起始地址
+ *      len:    buf 中数据的长度
+ *      format: 描述网络序二进制数据的格式字符串
+ * 返回值：
+ *      >= 0 : 成功，返回消息的长度
+ *      < 0  : 失败
+ */
+extern int packf_view_init(struct packf_view *view, void *buf, size_t len,
+        char const *format);
+
+/* 释放视图的索引空间 */
+extern void packf_view_free(struct packf_view *view);
+
+/*
+ * 函数：packf_view_get
+ * 功能：将 path 指定的字段转换为本地序，保存到 out 中
+ *       对于数组字段，转换全部元素；对于字符串，以 '\0' 结尾；对于结构体，
+ *       out 的布局与 unpackf 相同。
+ * 参数：
+ *      view:   视图
+ *      path:   字段的下标路径
+ *      depth:  path 的长度
+ *      out:    保存结果的地址
+ * 返回值：
+ *      >= 0 : 成功，返回写入 out 的长度（字符串为字符串长度）
+ *      < 0  : 失败
+ */
+extern int packf_view_get(struct packf_view const *view, int const *path,
+        int depth, void *out);
+
+/*
+ * 函数：packf_view_ref
+ * 功能：返回 path 指定的字段在 buf 中的地址和长度（网络序，不拷贝），
+ *       主要用于字符串和字节数组
+ * 返回值：
+ *      0   : 成功，*ptr 为字段的地址，*len 为字段的长度（字符串不含 '\0'）
+ *      < 0 : 失败
+ */
+extern int packf_view_ref(struct packf_view const *view, int const *path,
+        int depth, void **ptr, int *len);
+
+/*
+ * 函数：packf_view_count
+ * 功能：返回 path 指定的字段的元素个数（字符串为字符个数）
+ */
+extern int packf_view_count(struct packf_view const *view, int const *path,
+        int depth);
+
+/*
+ * 消息模板：同一条消息需要反复发送，每次只有少数字段（价格、数量、序号等）
+ * 改变时，先用 packf_tmpl_init 打包一次，之后只修改这些字段在 buf 中的
+ * 数据，不需要重新打包整条消息。
+ *
+ * 只有修改后长度不变的字段可以修改：cwdDfF 及其数组（不能是压缩编码的数组），
+ * 以及有 num 且不是 LV 的 s. 字段的路径与视图相同。format 中有 C 时，修改
+ * 字段后会重新计算其后的 C.
+ */
+struct packf_tmpl
+{
+    struct packf_view       view;
+    int                     crc;
+};
+
+struct packf_tmpl_field
+{
+    int                     offset; /* 字段在 buf 中的偏移 */
+    int                     size;   /* 元素的字节数 */
+    int                     count;  /* 元素个数 */
+    char                    type;
+    char                    array;  /* 整个数组，值的参数为指针 */
+};
+
+/*
+ * 函数：packf_tmpl_init
+ * 功能：类似 packf, 打包后为 buf 中的消息建立模板
+ * 参数：
+ *      tmpl:   模板，第一次使用前应清零
+ *      其余参数同 packf, buf 在模板使用期间必须保持有效
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度
+ *      < 0  : 失败
+ */
+extern int packf_tmpl_init(struct packf_tmpl *tmpl, void *buf, size_t max,
+        char const *format, ...);
+
+/* 释放模板的索引空间 */
+extern void packf_tmpl_free(struct packf_tmpl *tmpl);
+
+/*
+ * 函数：packf_tmpl_field
+ * 功能：查找 path 指定的字段，结果可以保存下来反复用于 packf_tmpl_set
+ * 返回值：
+ *      0   : 成功
+ *      < 0 : 失败，字段不存在或者不能原地修改时返回 PACKF_NOT_MATCH
+ */
+extern int packf_tmpl_field(struct packf_tmpl const *tmpl, int const *path,
+        int depth, struct packf_tmpl_field *field);
+
+/*
+ * 函数：packf_tmpl_set
+ * 功能：修改模板中的一个字段，值的参数与 packf 相同：单个的 cwd 为 int,
+ *       D 为 int64_t, fF 为 double; 数组和字符串为指针
+ * 返回值：
+ *      0   : 成功
+ *      < 0 : 失败
+ */
+extern int packf_tmpl_set(struct packf_tmpl *tmpl,
+        struct packf_tmpl_field const *field, ...);
+
+/*
+ * 投影：只从消息中取出少数几个字段（例如路由只需要消息类型和账号），
+ * 不需要把整条消息解包到临时结构体中。字段的路径与视图相同。
+ *
+ * 定位字段时，前面的 LV 字段和字符串根据长度头跳过，不拷贝。
+ * 位置固定的前缀（前面没有长度可变的字段）在 packf_proj_new 时计算一次，
+ * 之后每次调用直接使用。
+ */
+struct packf_path
+{
+    int const  *path;
+    int         depth;
+};
+
+struct packf_proj;
+
+/*
+ * 函数：packf_proj_new
+ * 功能：为 format 和 n 个字段路径建立投影，path 会被复制，
+ *       format 在投影使用期间必须保持有效
+ * 返回值：
+ *      成功返回投影，format 或路径不合法、内存不足时返回 NULL
+ */
+extern struct packf_proj *packf_proj_new(char const *format,
+        struct packf_path const *paths, int n);
+
+extern void packf_proj_free(struct packf_proj *proj);
+
+/*
+ * 函数：packf_proj
+ * 功能：从 buf 中取出投影的字段，按路径的顺序保存到变参的指针中，
+ *       每个字段的结果与 packf_view_get 相同
+ * 返回值：
+ *      >= 0 : 成功，返回字段的个数
+ *      < 0  : 失败
+ */
+extern int packf_proj(struct packf_proj const *proj, void const *buf,
+        size_t len, ...);
+
+/*
+ * 可比较的键编码：打包的结果可以直接用 memcmp 比较（例如作为 B 树或有序表
+ * 的键），顺序与依次比较每个字段的原始值相同。参数与 packf/unpackf 相同，
+ * 只是数据的编码不同，不能与 packf 的数据混用。
+ *      1): cwdD 按有符号整数比较；fF 按数值比较（-0.0 在 0.0 之前）。
+ *      2): 字符串按字节比较，较短的字符串在以它为前缀的字符串之前，
+ *          数据中没有长度头，而是以 '\0' 结尾。
+ *      3): LV 数组和 LV 结构体数组按元素依次比较，较短的在前。
+ *      4): 不支持 C, 压缩编码和 LV 的 a.
+ * 对键编码的数据，packf_key 返回打包的长度，unpackf_key 返回解包的长度。
+ */
+extern int packf_key(void *dest, size_t max, char const *format, ...);
+extern int unpackf_key(void const *src, size_t max, char const *format, ...);
+
+/*
+ * 回调方式的解包：按 format 依次解析 buf 中的字段，每个字段通过回调交给
+ * 调用者，不需要本地结构体，适合字段很多而只需要流式处理的场合（例如转换
+ * 成其他格式、计算统计值）。
+ *      1): 单个的 cwdDfF 调用 value; 它们的数组（包括压缩编码的数组）在
+ *          array_begin 和 array_end 之间对每个元素调用 value.
+ *      2): s/S 和 c 数组调用 bytes, data 指向 buf 中的数据，不拷贝，
+ *          也不保证以 '\0' 结尾。
+ *      3): 结构体在 struct_begin 和 struct_end 之间解析它的字段，结构体数组
+ *          在 array_begin 和 array_end 之间对每个元素调用一次。
+ *      4): a 直接跳过；C 校验失败时返回 PACKF_BAD_CHECKSUM.
+ * 回调可以为 NULL. 回调返回 0 继续解析，返回负值时立即停止，
+ * packf_visit 返回该值。
+ */
+struct packf_value
+{
+    int64_t                 i;      /* cwdD: 有符号的值 */
+    uint64_t                u;      /* cwdD: 无符号的值 */
+    double                  f;      /* fF */
+};
+
+struct packf_visit_field
+{
+    char const             *format; /* 字段在 format 中的位置 */
+    char                    type;
+    int                     depth;  /* 结构体嵌套的层数，最外层为 0 */
+    int                     index;  /* 字段在所在结构体中的序号 */
+    int                     elem;   /* 数组元素的下标，不是数组元素时为 -1 */
+};
+
+struct packf_visitor
+{
+    int (*value)(void *ctx, struct packf_visit_field const *field,
+            struct packf_value const *value);
+    int (*bytes)(void *ctx, struct packf_visit_field const *field,
+            void const *data, int len);
+    int (*array_begin)(void *ctx, struct packf_visit_field const *field,
+            int count);
+    int (*array_end)(void *ctx, struct packf_visit_field const *field);
+    int (*struct_begin)(void *ctx, struct packf_visit_field const *field);
+    int (*struct_end)(void *ctx, struct packf_visit_field const *field);
+};
+
+/*
+ * 函数：packf_visit
+ * 功能：按 format 解析 buf, 对每个字段调用 visitor 中的回调
+ * 参数：
+ *      buf:     打包的数据
+ *      len:     buf 的长度
+ *      format:  格式字符串
+ *      visitor: 回调函数
+ *      ctx:     传给回调函数的参数
+ * 返回值：
+ *      >= 0 : 成功，返回解析的数据总长度
+ *      < 0  : 失败，或者回调返回的负值
+ */
+extern int packf_visit(void const *buf, size_t len, char const *format,
+        struct packf_visitor const *visitor, void *ctx);
+
+/*
+ * arena 解包：unpackf 的本地结构体中，LV 字段要按 num 预留最大的空间，
+ * 大量缓存解包后的消息时，实际数据通常远小于最大值。unpackf_arena 把 LV
+ * 字段的数据放到调用者提供的 arena 中，结构体中只保存长度和指针，整批消息
+ * 可以通过 packf_arena_init 或把 used 置为 0 一次释放。
+ *      1): -/= 的 cwdDfF 数组（包括压缩编码的数组）和 LV 结构体数组，本地为
+ *          长度（1 或 2 字节）+ 指向 arena 中 lv_len 个元素的指针。
+ *      2): -/= 的 s/S, 本地为长度 + 指向 arena 中以 '\0' 结尾的字符串的指针。
+ *      3): LV 结构体（-[...] 或 =[...]）和 LV 的 a 与 unpackf 相同。
+ *      4): 最外层的 LV 字段，变参为 char ** 等指针的地址，数组的长度参数同
+ *          unpackf. 结构体数组的元素也按 arena 的布局保存。
+ * 指针在本地结构体中不保证对齐（# pragma pack(1)）。arena 中的数据按 8 字节
+ * 对齐。
+ */
+struct packf_arena
+{
+    void                   *base;
+    size_t                  size;
+    size_t                  used;
+};
+
+extern void packf_arena_init(struct packf_arena *arena, void *buf,
+        size_t size);
+
+/*
+ * 函数：unpackf_arena
+ * 功能：类似 unpackf, 但 LV 字段的数据保存在 arena 中
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败，arena 空间不足时返回 PACKF_NO_MEMORY, 失败时本次
+ *             分配的空间会被释放
+ */
+extern int unpackf_arena(void *src, size_t max, struct packf_arena *arena,
+        char const *format, ...);
+
+/*
+ * 解包的限制：解包的工作量与解析的数据长度加 format 长度成正比，但结构体
+ * 数组的元素在网络上可以为 0 字节（例如 "=[0d]"），解出的元素个数只受 LV
+ * 长度限制；本地缓冲区或 arena 也可能被很小的数据要求很大的空间。解包不可信
+ * 的数据时可以通过 unpackf_limited 限制这些量，超过时返回 PACKF_OVER_LIMIT.
+ * 为 0 的字段表示不限制。
+ */
+struct packf_limits
+{
+    int                     max_depth;  /* 结构体的最大嵌套层数 */
+    int                     max_elems;  /* 数组元素、结构体和 LV 字符串的总个数 */
+    int64_t                 max_out;    /* 数组和 LV 字符串解出的总字节数 */
+};
+
+/*
+ * 函数：unpackf_limited
+ * 功能：类似 unpackf, 但按 limits 限制解包
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败，超过限制时返回 PACKF_OVER_LIMIT
+ */
+extern int unpackf_limited(void *src, size_t max,
+        struct packf_limits const *limits, char const *format, ...);
+
+/*
+ * sink 打包：消息很大（例如很长的 =N[...] 数组）时，不需要能放下整条消息的
+ * 缓冲区。打包的数据先写入 sink 的缓冲区，缓冲区满时调用 flush 输出，
+ * 占用的内存只有这个缓冲区。
+ *      1): LV 结构体的长度在打包完它的所有字段后才回填，在此之前长度头及其
+ *          后面的数据会留在缓冲区中，因此缓冲区必须能放下最大的 LV 结构体
+ *          （不超过 65537 字节），否则返回 PACKF_OUT_OF_BUF.
+ *      2): 不支持 C.
+ *      3): 可以连续打包多条消息，每条消息结束时缓冲区中可能还有数据，
+ *          需要调用 packf_sink_flush 输出。
+ *      4): flush 返回负值表示失败，打包函数返回该值，已经输出的数据不能
+ *          撤回。packf_sink_fd 是写文件描述符的 flush, ctx 为 int *.
+ */
+struct packf_sink
+{
+    int                   (*flush)(void *ctx, void const *data, int len);
+    void                   *ctx;
+    char                   *buf;
+    int                     size;
+    int                     len;        /* buf 中还没有输出的字节数 */
+    int64_t                 flushed;    /* 已经输出的字节数 */
+    int64_t                 pin;        /* 内部使用 */
+    int                     err;        /* 内部使用 */
+};
+
+extern void packf_sink_init(struct packf_sink *sink, void *buf, int size,
+        int (*flush)(void *ctx, void const *data, int len), void *ctx);
+
+/*
+ * 函数：packf_sink
+ * 功能：类似 packf, 但打包到 sink 中
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度
+ *      < 0  : 失败
+ */
+extern int packf_sink(struct packf_sink *sink, char const *format, ...);
+extern int packf_sinka(struct packf_sink *sink, char const *format,
+        va_list arg);
+
+/* 输出缓冲区中剩余的数据，成功返回 0 */
+extern int packf_sink_flush(struct packf_sink *sink);
+
+extern int packf_sink_fd(void *ctx, void const *data, int len);
+
+/*
+ * 函数：unpackf_trusted
+ * 功能：类似 unpackf, 用于解包可信的数据：由 packf 按同样的 format 打包，
+ *       并且已经校验过（例如自己写的记录文件、共享内存中的数据）。
+ *       读取长度头和拷贝数据之前只检查剩余长度，不会读到 max 之外；
+ *       不检查 LV 长度是否超过 num 和定长字符串的结尾，也不校验 C.
+ *       数据不可信时（例如 LV 长度超过 num）可能越界写，此时应使用
+ *       unpackf.
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败
+ */
+extern int unpackf_trusted(void *src, size_t max, char const *format, ...);
+
+/*
+ * 字符串字典，见 note 9. 一个字典属于一批消息（例如一个 packf_lz 块）或一个
+ * 连接上的消息流，打包端和解包端各有一个，按同样的顺序处理同样的消息，
+ * 并在同样的位置调用 packf_dict_reset. 一个字典只用于打包或只用于解包。
+ *      1): 打包端用散列表查找字面量，字面量拷贝到字典中；字典已满（max 个
+ *          字面量或 mem 字节）后新的字符串只打包字面量。
+ *      2): 解包端按编号直接查表。PACKF_DICT_SHARED 时字典只保存指向解包
+ *          数据中字面量的指针，不拷贝，调用者需要保证这些数据在 reset 之前
+ *          有效（例如整批消息在同一个缓冲区中）；否则字面量拷贝到字典中，
+ *          max 和 mem 应不小于打包端。
+ *      3): 打包或解包失败时，本条消息加入的字面量被撤销。
+ */
+# define PACKF_DICT_MAX     16381   /* 引用的标记不超过 2 字节 */
+# define PACKF_DICT_SHARED  1
+
+struct packf_dict;
+
+/*
+ * 函数：packf_dict_new
+ * 功能：创建字典，最多 max 个字面量，共 mem 字节
+ * 返回值：
+ *      成功返回字典，参数错误或内存不足时返回 NULL
+ */
+extern struct packf_dict *packf_dict_new(int max, size_t mem, int flags);
+
+extern void packf_dict_free(struct packf_dict *dict);
+
+/* 清空字典，开始新的一批消息 */
+extern void packf_dict_reset(struct packf_dict *dict);
+
+/* 返回字典中字面量的个数 */
+extern int packf_dict_count(struct packf_dict const *dict);
+
+/*
+ * 函数：packf_dict
+ * 功能：类似 packf, 但 s@/S@ 字段通过 dict 打包
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度
+ *      < 0  : 失败
+ */
+extern int packf_dict(void *dest, size_t max, struct packf_dict *dict,
+        char const *format, ...);
+extern int packf_dicta(void *dest, size_t max, struct packf_dict *dict,
+        char const *format, va_list arg);
+
+/*
+ * 函数：unpackf_dict
+ * 功能：类似 unpackf, 但 s@/S@ 字段通过 dict 解包
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败，引用的编号不存在时返回 PACKF_BAD_DATA, 字典已满时返回
+ *             PACKF_NO_MEMORY
+ */
+extern int unpackf_dict(void *src, size_t max, struct packf_dict *dict,
+        char const *format, ...);
+extern int unpackf_dicta(void *src, size_t max, struct packf_dict *dict,
+        char const *format, va_list arg);
+
+/*
+ * 增量编码：周期性发送的状态（行情快照、游戏实体、监控指标）相邻两条之间
+ * 通常只有少数字段变化。packf_delta 把当前的结构体与上一条比较，只打包有
+ * 变化的字段；unpackf_delta 把它们写入接收端保存的上一条结构体。
+ *      1): 网络格式与 "?[" format "]" 完全相同，位图为有变化的字段，同样
+ *          最多 64 个字段（最外层），也可以直接用 unpackf 解包。
+ *      2): 本地结构体应为 # pragma pack(1), 按整个结构体的内存逐块比较；
+ *          字段中不影响取值的字节（例如字符串 '\0' 之后的内容）不同时也会
+ *          被打包，结果仍然正确。
+ *      3): 两端从同一个状态开始，例如第一条消息的 prev 为 NULL, 此时打包所有
+ *          字段，解包端的结构体全部被覆盖。丢失消息后应重新发送全部字段。
+ *          example: packf_delta(buf, sizeof(buf), d, &last, &now);
+ *                   last = now;
+ */
+struct packf_delta;
+
+/*
+ * 函数：packf_delta_new
+ * 功能：为一个记录的格式建立增量编码器
+ * 参数：
+ *      format: 描述一个记录（结构体）的格式字符串，如 "D d d -16s F"
+ * 返回值：
+ *      成功返回编码器，使用完后应调用 packf_delta_free 释放；格式错误、
+ *      没有字段或超过 64 个字段时返回 NULL
+ */
+extern struct packf_delta *packf_delta_new(char const *format);
+
+extern void packf_delta_free(struct packf_delta *d);
+
+/* 返回本地结构体的长度 */
+extern int packf_delta_len(struct packf_delta const *d);
+
+/* 返回 cur 与 prev 相比有变化的字段的掩码，prev 为 NULL 时为所有字段 */
+extern uint64_t packf_delta_mask(struct packf_delta const *d,
+        void const *prev, void const *cur);
+
+/*
+ * 函数：packf_delta
+ * 功能：打包 cur 中与 prev 不同的字段
+ * 参数：
+ *      dest:   目标缓冲区地址
+ *      max:    dest 指向的缓冲区长度
+ *      prev:   上一条消息的结构体，为 NULL 时打包所有字段
+ *      cur:    当前的结构体
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度，没有变化时只有位图
+ *      < 0  : 失败
+ */
+extern int packf_delta(struct packf_delta const *d, void *dest, size_t max,
+        void const *prev, void const *cur);
+
+/*
+ * 函数：unpackf_delta
+ * 功能：解包 packf_delta 打包的数据，有变化的字段写入 prev, 其余字段不变
+ * 参数：
+ *      src:    网络序二进制数据起始地址
+ *      max:    src 指向的网络序二进制数据长度
+ *      prev:   上一条消息的结构体，解包后为当前的结构体
+ *      mask:   不为 NULL 时返回有变化的字段的掩码
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败，此时 prev 中可能已经写入了部分字段
+ */
+extern int unpackf_delta(struct packf_delta const *d, void *src, size_t max,
+        void *prev, uint64_t *mask);
+
 /* 如果结果为负值则返回负的行号 */
 # ifndef NEG_RET_LN
 # define NEG_RET_LN(x) do { if ((x) < 0) return -__LINE__; } while (0)
@@ -0,0 +1,217 @@
+/*
+ * Message framing for stream sockets, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# include <stdio.h>
+# include <string.h>
+# include <stdarg.h>
+# include <stdint.h>
+
+# include "packf_frame.h"
+
+# define ERR_RET_PRINT(ret) do {                                        \
+    if (packf_print_error)                                              \
+        fprintf(stderr, "%s: %s\n", __func__, packf_strerror(ret));     \
+    return ret;                                                         \
+} while (0)
+
+# define HDR_VALID(hdr_len) \
+    ((hdr_len) == 1 || (hdr_len) == 2 || (hdr_len) == 4)
+
+static void __set_hdr(uint8_t *p, int hdr_len, uint32_t len)
+{
+    int i;
+
+    for (i = hdr_len - 1; i >= 0; --i)
+    {
+        p[i] = (uint8_t)len;
+        len >>= 8;
+    }
+}
+
+static uint32_t __get_hdr(uint8_t const *p, int hdr_len)
+{
+    uint32_t len = 0;
+    int i;
+
+    for (i = 0; i < hdr_len; ++i)
+        len = (len << 8) | p[i];
+
+    return len;
+}
+
+int vpackf_framea(void **current, int *left, int hdr_len,
+        char const *format, va_list arg)
+{
+    void *body;
+    int ret, body_left;
+
+    if (!current || !*current || !left)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!HDR_VALID(hdr_len))
+        ERR_RET_PRINT(PACKF_NOT_FORMAT);
+    if (*left < hdr_len)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    body = (char *)*current + hdr_len;
+    body_left = *left - hdr_len;
+    if (format)
+    {
+        ret = vpacka(&body, &body_left, format, arg);
+        if (ret < 0)
+            return ret;
+    }
+    else
+    {
+        ret = 0;
+    }
+
+    if (hdr_len < 4 && ret >> (hdr_len * 8))
+        ERR_RET_PRINT(PACKF_BE_CUT_OFF);
+
+    __set_hdr(*current, hdr_len, (uint32_t)ret);
+
+    *current = body;
+    *left    = body_left;
+
+    return hdr_len + ret;
+}
+
+int vpackf_frame(void **current, int *left, int hdr_len,
+        char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = vpackf_framea(current, left, hdr_len, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int packf_frame(void *dest, size_t max, int hdr_len, char const *format, ...)
+{
+    va_list va;
+    int ret, left = (int)max;
+    void *current = dest;
+
+    va_start(va, format);
+    ret = vpackf_framea(&current, &left, hdr_len, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int packf_frame_scan(void *buf, size_t len, int hdr_len,
+        struct packf_frame *frames, int max, size_t *used)
+{
+    uint8_t *p = buf;
+    size_t pos = 0, body_len;
+    int n = 0;
+
+    if (!buf || !frames || !used)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!HDR_VALID(hdr_len))
+        ERR_RET_PRINT(PACKF_NOT_FORMAT);
+
+    while (n < max && len - pos >= (size_t)hdr_len)
+    {
+        body_len = __get_hdr(p + pos, hdr_len);
+        if (len - pos - hdr_len < body_len)
+            break;
+
+        frames[n].data     = p + pos + hdr_len;
+        frames[n].len      = (int)body_len;
+        frames[n].wrap     = NULL;
+        frames[n].wrap_len = 0;
+        ++n;
+
+        pos += hdr_len + body_len;
+    }
+
+    *used = pos;
+
+    return n;
+}
+
+int packf_frame_scan_ring(void *ring, size_t size, size_t start,
+        size_t count, int hdr_len, struct packf_frame *frames, int max,
+        size_t *used)
+{
+    uint8_t *p = ring, hdr[4];
+    size_t pos = start, done = 0, body_len, first;
+    int i, n = 0;
+
+    if (!ring || !frames || !used)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (!HDR_VALID(hdr_len))
+        ERR_RET_PRINT(PACKF_NOT_FORMAT);
+    if (start >= size || count > size)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    while (n < max && count - done >= (size_t)hdr_len)
+    {
+        if (size - pos >= (size_t)hdr_len)
+        {
+            body_len = __get_hdr(p + pos, hdr_len);
+        }
+        else
+        {
+            for (i = 0; i < hdr_len; ++i)
+                hdr[i] = p[(pos + i) % size];
+            body_len = __get_hdr(hdr, hdr_len);
+        }
+        if (count - done - hdr_len < body_len)
+            break;
+
+        pos = (pos + hdr_len) % size;
+        first = size - pos;
+        frames[n].data = p + pos;
+        if (body_len > first)
+        {
+            frames[n].len      = (int)first;
+            frames[n].wrap     = p;
+            frames[n].wrap_len = (int)(body_len - first);
+        }
+        else
+        {
+            frames[n].len      = (int)body_len;
+            frames[n].wrap     = NULL;
+            frames[n].wrap_len = 0;
+        }
+        ++n;
+
+        pos = (pos + body_len) % size;
+        done += hdr_len + body_len;
+    }
+
+    *used = done;
+
+    return n;
+}
+
+int unpackf_frame(struct packf_frame const *frame, char const *format, ...)
+{
+    struct iovec iov[2];
+    va_list va;
+    int ret;
+
+    if (!frame || !frame->data)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    iov[0].iov_base = frame->data;
+    iov[0].iov_len  = frame->len;
+    iov[1].iov_base = frame->wrap;
+    iov[1].iov_len  = frame->wrap_len;
+
+    va_start(va, format);
+    ret = unpackf_iova(iov, frame->wrap ? 2 : 1, format, va);
+    va_end(va);
+
+    return ret;
+}
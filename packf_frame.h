@@ -0,0 +1,129 @@
+/*
+ * Message framing for stream sockets, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# ifndef _PACKF_FRAME_H_
+# define _PACKF_FRAME_H_
+
+# include <stddef.h>
+
+# include "packf.h"
+
+# ifdef  __cplusplus
+extern "C"
+{
+# endif
+
+/*
+ * 流式套接字（如 TCP）的消息分帧。
+ *
+ * 每条消息在网络上的格式为：hdr_len 字节的长度头（网络序）+ 消息体，
+ * 长度头中保存的是消息体的长度，不包含长度头本身，与 format 中 -/= 的
+ * LV 字段含义一致。hdr_len 可以为 1、2 或 4。
+ *
+ * 发送端使用 packf_frame/vpackf_frame 一次完成打包：先预留长度头，
+ * 打包消息体后再回填长度，不需要额外的拷贝。
+ *
+ * 接收端使用 packf_frame_scan 或 packf_frame_scan_ring 扫描一次 recv 得到
+ * 的数据，批量返回其中所有完整消息的位置，调用者可以直接对其 unpackf,
+ * 剩余的不完整数据留待下次 recv 后继续扫描。
+ */
+
+struct packf_frame
+{
+    void   *data;       /* 消息体起始地址 */
+    int     len;        /* data 处连续的消息体长度 */
+    void   *wrap;       /* 环形缓冲区中回绕到起始处的部分，不回绕时为 NULL */
+    int     wrap_len;   /* wrap 处的消息体长度，消息体总长度为 len + wrap_len */
+};
+
+/*
+ * 函数：packf_frame : pack frame
+ * 功能：类似 packf, 但在打包的数据前加上 hdr_len 字节的长度头
+ * 参数：
+ *      dest:    目标缓冲区地址
+ *      max:     dest 指向的缓冲区长度
+ *      hdr_len: 长度头的字节数，可以为 1、2 或 4
+ *      format:  格式字符串，和后面的变参对应
+ *      ...:     变参，和 format 对应
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度（包含长度头）
+ *      < 0  : 失败
+ */
+extern int packf_frame(void *dest, size_t max, int hdr_len,
+        char const *format, ...);
+
+/*
+ * 函数：vpackf_frame : variable pack frame
+ * 功能：类似 vpackf, 但在打包的数据前加上 hdr_len 字节的长度头，
+ *       可以用于向同一个发送缓冲区中连续打包多条消息
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度（包含长度头）
+ *             *current: 指向缓冲区接下来可用地址
+ *             *left:    缓冲区剩余长度
+ *      < 0  : 失败
+ */
+extern int vpackf_frame(void **current, int *left, int hdr_len,
+        char const *format, ...);
+
+extern int vpackf_framea(void **current, int *left, int hdr_len,
+        char const *format, va_list arg);
+
+/*
+ * 函数：packf_frame_scan
+ * 功能：扫描一段连续的接收缓冲区，找出其中所有完整的消息
+ * 参数：
+ *      buf:     接收缓冲区地址
+ *      len:     buf 中有效数据的长度
+ *      hdr_len: 长度头的字节数，可以为 1、2 或 4
+ *      frames:  用于保存消息位置的数组
+ *      max:     frames 数组的长度
+ *      used:    返回被完整消息占用的字节数，调用者应丢弃这部分数据，
+ *               并保留剩余的 len - *used 字节
+ * 返回值：
+ *      >= 0 : 成功，返回找到的完整消息数量，最多为 max
+ *      < 0  : 失败
+ */
+extern int packf_frame_scan(void *buf, size_t len, int hdr_len,
+        struct packf_frame *frames, int max, size_t *used);
+
+/*
+ * 函数：packf_frame_scan_ring
+ * 功能：类似 packf_frame_scan, 但扫描的是环形缓冲区，跨越缓冲区末尾的
+ *       消息通过 packf_frame 的 wrap/wrap_len 返回，不需要拷贝
+ * 参数：
+ *      ring:    环形缓冲区地址
+ *      size:    环形缓冲区的总长度
+ *      start:   有效数据在环形缓冲区中的起始偏移
+ *      count:   有效数据的长度
+ *      其余参数同 packf_frame_scan, *used 为从 start 开始被消费的字节数
+ */
+extern int packf_frame_scan_ring(void *ring, size_t size, size_t start,
+        size_t count, int hdr_len, struct packf_frame *frames, int max,
+        size_t *used);
+
+/*
+ * 函数：unpackf_frame
+ * 功能：解包 packf_frame_scan/packf_frame_scan_ring 返回的一条消息，
+ *       对于跨越环形缓冲区末尾的消息，直接从两段数据中解包，不需要拷贝
+ * 参数：
+ *      frame:  消息位置
+ *      format: 描述消息体的格式字符串
+ *      ...:    变参，参数应为指针
+ * 返回值：
+ *      >= 0 : 成功，返回解包的数据总长度
+ *      < 0  : 失败
+ */
+extern int unpackf_frame(struct packf_frame const *frame,
+        char const *format, ...);
+
+# ifdef  __cplusplus
+}
+# endif
+
+# endif
+
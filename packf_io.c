@@ -0,0 +1,831 @@
+/*
+ * Batched socket I/O for packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdarg.h>
+# include <stdint.h>
+# include <limits.h>
+# include <errno.h>
+# include <unistd.h>
+# include <poll.h>
+# include <sys/uio.h>
+
+# include "packf_io.h"
+
+/* provided buffer ring 需要 5.19 以后的头文件 */
+# if defined(__linux__) && !defined(PACKF_NO_URING) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   include <linux/io_uring.h>
+#   ifdef IORING_RECV_MULTISHOT
+#    define IO_URING
+#   endif
+#  endif
+# endif
+
+# ifdef IO_URING
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+# endif
+
+# define ERR_RET_PRINT(ret) do {                                        \
+    if (packf_print_error)                                              \
+        fprintf(stderr, "%s: %s\n", __func__, packf_strerror(ret));     \
+    return ret;                                                         \
+} while (0)
+
+# define IO_HDR         2
+# define IO_PART        (IO_HDR + 65535)    /* 跨越缓冲区的最长消息 */
+# define IO_BGID        0
+# define IO_RX_TAG      ((uint64_t)1 << 32) /* 接收的 user_data */
+# define IO_IOV_MAX     64
+
+struct __io_buf
+{
+    char       *data;
+    int         len;    /* 发送：已经打包的长度；接收：读入的长度 */
+    int         off;    /* 发送：已经写出的长度；接收：已经返回的长度 */
+    int         busy;   /* 发送：已经提交还没有完成 */
+};
+
+# ifdef IO_URING
+struct __ring
+{
+    int                     fd;
+    unsigned               *sq_head;
+    unsigned               *sq_tail;
+    unsigned               *sq_mask;
+    unsigned               *sq_array;
+    unsigned               *cq_head;
+    unsigned               *cq_tail;
+    unsigned               *cq_mask;
+    struct io_uring_sqe    *sqes;
+    struct io_uring_cqe    *cqes;
+    void                   *sq_ptr;
+    void                   *cq_ptr;
+    size_t                  sq_len;
+    size_t                  cq_len;
+    size_t                  sqes_len;
+    unsigned                entries;
+    unsigned                tail;       /* 还没有发布的 sq 尾部 */
+    unsigned                pending;    /* 已经填写还没有提交的 sqe */
+    uint64_t                off;        /* 读写的偏移，-1 为当前位置 */
+};
+# endif
+
+struct packf_io
+{
+    int                     fd;
+    int                     backend;
+    int                     nbufs;
+    int                     size;
+    char                   *mem;
+    struct __io_buf        *tx;
+    struct __io_buf        *rx;
+    int                    *tx_free;
+    int                     nfree;
+    int                    *txq;        /* 排队和提交的发送缓冲区，按顺序 */
+    int                     txq_head;
+    int                     txq_len;
+    int                     cur;        /* 正在打包的发送缓冲区，-1 表示没有 */
+    int                     inflight;
+    int                    *rxq;        /* 读入数据的接收缓冲区，按顺序 */
+    int                     rxq_head;
+    int                     rxq_len;
+    int                     rx_on;      /* 调用过 packf_io_recv */
+    int                     rx_armed;
+    int                     rx_starved; /* 没有可用的接收缓冲区 */
+    int                     eof;
+    int                     err;
+    char                   *part;       /* 跨越接收缓冲区的消息 */
+    int                     part_len;
+# ifdef IO_URING
+    struct __ring           ring;
+    struct io_uring_buf_ring *br;
+    size_t                  br_len;
+    unsigned                br_mask;
+    uint16_t                br_tail;
+    int                     fixed;      /* 发送缓冲区已经注册 */
+# endif
+};
+
+static void __io_tx_pop(struct packf_io *io)
+{
+    struct __io_buf *b;
+    int idx;
+
+    while (io->txq_len)
+    {
+        idx = io->txq[io->txq_head];
+        b = &io->tx[idx];
+        if (b->busy || b->off != b->len)
+            break;
+
+        b->len = b->off = 0;
+        io->tx_free[io->nfree++] = idx;
+        io->txq_head = (io->txq_head + 1) % io->nbufs;
+        --io->txq_len;
+    }
+}
+
+# ifdef IO_URING
+
+static void __ring_free(struct __ring *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->fd >= 0)
+        close(r->fd);
+}
+
+static void *__ring_map(struct __ring *r, size_t len, off_t off)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, off);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static int __ring_init(struct __ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    if ((r->fd = (int)syscall(__NR_io_uring_setup, entries, &p)) < 0)
+        return -1;
+
+    r->sq_len   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_len > r->sq_len)
+            r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+
+    if (!(r->sq_ptr = __ring_map(r, r->sq_len, IORING_OFF_SQ_RING)))
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else if (!(r->cq_ptr = __ring_map(r, r->cq_len, IORING_OFF_CQ_RING)))
+        goto fail;
+    if (!(r->sqes = __ring_map(r, r->sqes_len, IORING_OFF_SQES)))
+        goto fail;
+
+    r->sq_head  = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail  = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head  = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    r->entries  = p.sq_entries;
+    r->tail     = *r->sq_tail;
+    r->off      = p.features & IORING_FEAT_RW_CUR_POS ? (uint64_t)-1 : 0;
+
+    return 0;
+
+fail:
+    __ring_free(r);
+
+    return -1;
+}
+
+/* 取一个空的 sqe, sq 满时返回 NULL */
+static struct io_uring_sqe *__ring_sqe(struct __ring *r)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >=
+            r->entries)
+        return NULL;
+
+    idx = r->tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    ++r->tail;
+    ++r->pending;
+
+    return sqe;
+}
+
+/* 提交已经填写的 sqe, wait 不为 0 时等待至少 wait 个完成 */
+static int __ring_enter(struct __ring *r, unsigned wait)
+{
+    int ret;
+
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+    do
+    {
+        ret = (int)syscall(__NR_io_uring_enter, r->fd, r->pending, wait,
+                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        return PACKF_IO_ERROR;
+    r->pending -= ret;
+
+    return 0;
+}
+
+/* 把接收缓冲区归还到 provided buffer ring */
+static void __io_rx_give(struct packf_io *io, int idx)
+{
+    struct io_uring_buf *buf = &io->br->bufs[io->br_tail & io->br_mask];
+
+    buf->addr = (uint64_t)(uintptr_t)io->rx[idx].data;
+    buf->len  = io->size;
+    buf->bid  = idx;
+    __atomic_store_n(&io->br->tail, ++io->br_tail, __ATOMIC_RELEASE);
+    io->rx_starved = 0;
+}
+
+static void __io_rx_arm(struct packf_io *io)
+{
+    struct io_uring_sqe *sqe;
+
+    if (io->rx_armed || io->rx_starved || io->eof || io->err ||
+            !(sqe = __ring_sqe(&io->ring)))
+        return;
+
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = io->fd;
+    sqe->off       = io->ring.off;
+    sqe->len       = io->size;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IO_BGID;
+    sqe->user_data = IO_RX_TAG;
+    io->rx_armed = 1;
+}
+
+static void __io_rx_done(struct packf_io *io, int res, unsigned flags)
+{
+    int idx = flags >> IORING_CQE_BUFFER_SHIFT;
+
+    io->rx_armed = 0;
+    if (res > 0)
+    {
+        io->rx[idx].len = res;
+        io->rx[idx].off = 0;
+        io->rxq[(io->rxq_head + io->rxq_len) % io->nbufs] = idx;
+        ++io->rxq_len;
+        return;
+    }
+
+    if (flags & IORING_CQE_F_BUFFER)
+        __io_rx_give(io, idx);
+    if (res == 0)
+        io->eof = 1;
+    else if (res == -ENOBUFS)
+        io->rx_starved = 1;
+    else if (res != -EINTR && res != -EAGAIN)
+        io->err = PACKF_IO_ERROR;
+}
+
+static void __io_tx_done(struct packf_io *io, int idx, int res)
+{
+    struct __io_buf *b = &io->tx[idx];
+
+    b->busy = 0;
+    --io->inflight;
+    if (res > 0)
+        b->off += res;
+    else if (res != -ECANCELED && res != -EINTR && res != -EAGAIN)
+        io->err = PACKF_IO_ERROR;
+}
+
+/* 处理所有的完成事件，短写之后被取消的发送留在队列中重新提交 */
+static void __io_reap(struct packf_io *io)
+{
+    struct __ring *r = &io->ring;
+    struct io_uring_cqe *cqe;
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head)
+    {
+        cqe = &r->cqes[head & *r->cq_mask];
+        if (cqe->user_data & IO_RX_TAG)
+            __io_rx_done(io, cqe->res, cqe->flags);
+        else
+            __io_tx_done(io, (int)cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+    __io_tx_pop(io);
+    if (io->rx_on)
+        __io_rx_arm(io);
+}
+
+/*
+ * 前一批发送全部完成后，把排队的缓冲区用链接的 sqe 一次提交。链接的请求
+ * 按顺序执行，短写时之后的请求被取消，不会乱序。
+ */
+static int __io_uring_kick(struct packf_io *io)
+{
+    struct io_uring_sqe *sqe, *last = NULL;
+    struct __io_buf *b;
+    int i, idx;
+
+    __io_reap(io);
+    if (io->err)
+        return io->err;
+
+    for (i = 0; !io->inflight && i < io->txq_len; ++i)
+    {
+        idx = io->txq[(io->txq_head + i) % io->nbufs];
+        b = &io->tx[idx];
+        if (!(sqe = __ring_sqe(&io->ring)))
+            break;
+
+        sqe->opcode    = io->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd        = io->fd;
+        sqe->off       = io->ring.off;
+        sqe->addr      = (uint64_t)(uintptr_t)(b->data + b->off);
+        sqe->len       = b->len - b->off;
+        sqe->flags     = IOSQE_IO_LINK;
+        sqe->user_data = idx;
+        b->busy = 1;
+        last = sqe;
+    }
+    if (last)
+    {
+        last->flags = 0;
+        io->inflight = i;
+    }
+
+    if (io->ring.pending && __ring_enter(&io->ring, 0) < 0)
+        io->err = PACKF_IO_ERROR;
+
+    return io->err;
+}
+
+static int __io_uring_init(struct packf_io *io)
+{
+    struct io_uring_buf_reg reg;
+    struct iovec iov;
+    unsigned entries = 1;
+    int i;
+
+    while (entries < (unsigned)io->nbufs)
+        entries <<= 1;
+    if (__ring_init(&io->ring, entries * 2) < 0)
+        return -1;
+
+    io->br_len = (entries * sizeof(struct io_uring_buf) + 4095) & ~4095ul;
+    io->br = mmap(NULL, io->br_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (io->br == MAP_FAILED)
+    {
+        io->br = NULL;
+        __ring_free(&io->ring);
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)io->br;
+    reg.ring_entries = entries;
+    reg.bgid         = IO_BGID;
+    if (syscall(__NR_io_uring_register, io->ring.fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        munmap(io->br, io->br_len);
+        io->br = NULL;
+        __ring_free(&io->ring);
+        return -1;
+    }
+    io->br_mask = entries - 1;
+    io->br_tail = 0;
+    for (i = 0; i < io->nbufs; ++i)
+        __io_rx_give(io, i);
+
+    /* 锁定内存不足时不使用固定缓冲区 */
+    iov.iov_base = io->mem;
+    iov.iov_len  = (size_t)io->nbufs * io->size;
+    io->fixed = syscall(__NR_io_uring_register, io->ring.fd,
+            IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    return 0;
+}
+
+# endif
+
+static int __io_writev(struct packf_io *io)
+{
+    struct iovec iov[IO_IOV_MAX];
+    struct __io_buf *b;
+    ssize_t n;
+    int i, k;
+
+    while (io->txq_len)
+    {
+        for (i = 0; i < io->txq_len && i < IO_IOV_MAX; ++i)
+        {
+            b = &io->tx[io->txq[(io->txq_head + i) % io->nbufs]];
+            iov[i].iov_base = b->data + b->off;
+            iov[i].iov_len  = b->len - b->off;
+        }
+
+        if ((n = writev(io->fd, iov, i)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return io->err = PACKF_IO_ERROR;
+        }
+
+        for (i = 0; n > 0; ++i)
+        {
+            b = &io->tx[io->txq[(io->txq_head + i) % io->nbufs]];
+            k = n < b->len - b->off ? (int)n : b->len - b->off;
+            b->off += k;
+            n -= k;
+        }
+        __io_tx_pop(io);
+    }
+
+    return 0;
+}
+
+static int __io_kick(struct packf_io *io)
+{
+    if (io->err)
+        return io->err;
+# ifdef IO_URING
+    if (io->backend == PACKF_IO_URING)
+        return __io_uring_kick(io);
+# endif
+
+    return __io_writev(io);
+}
+
+/* 等待之前提交的发送有进展 */
+static int __io_tx_wait(struct packf_io *io)
+{
+    struct pollfd pfd;
+
+    if (__io_kick(io) < 0 || !io->txq_len)
+        return io->err;
+
+# ifdef IO_URING
+    if (io->backend == PACKF_IO_URING)
+    {
+        if (!io->inflight)
+            return io->err = PACKF_IO_ERROR;
+        if (__ring_enter(&io->ring, 1) < 0)
+            return io->err = PACKF_IO_ERROR;
+
+        return __io_kick(io);
+    }
+# endif
+
+    pfd.fd     = io->fd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        return io->err = PACKF_IO_ERROR;
+
+    return __io_kick(io);
+}
+
+static int __io_queue(struct packf_io *io)
+{
+    if (io->cur < 0 || !io->tx[io->cur].len)
+        return 0;
+
+    io->txq[(io->txq_head + io->txq_len) % io->nbufs] = io->cur;
+    ++io->txq_len;
+    io->cur = -1;
+
+    return __io_kick(io);
+}
+
+struct packf_io *packf_io_open(int fd, int nbufs, int size, int flags)
+{
+    struct packf_io *io;
+    void *mem;
+    int i;
+
+    if (fd < 0 || nbufs < 1 || nbufs > PACKF_IO_MAX_BUFS ||
+            size <= IO_HDR || size > INT_MAX / 2 / nbufs)
+        return NULL;
+    if (!(io = calloc(1, sizeof(*io))))
+        return NULL;
+    if (posix_memalign(&mem, 4096, (size_t)nbufs * size * 2) != 0)
+    {
+        free(io);
+        return NULL;
+    }
+
+    io->fd      = fd;
+    io->backend = PACKF_IO_POLL;
+    io->nbufs   = nbufs;
+    io->size    = size;
+    io->mem     = mem;
+    io->cur     = -1;
+    io->tx      = calloc(nbufs, sizeof(struct __io_buf));
+    io->rx      = calloc(nbufs, sizeof(struct __io_buf));
+    io->tx_free = malloc(nbufs * sizeof(int));
+    io->txq     = malloc(nbufs * sizeof(int));
+    io->rxq     = malloc(nbufs * sizeof(int));
+    io->part    = malloc(IO_PART);
+    if (!io->tx || !io->rx || !io->tx_free || !io->txq || !io->rxq ||
+            !io->part)
+    {
+        packf_io_close(io);
+        return NULL;
+    }
+
+    for (i = 0; i < nbufs; ++i)
+    {
+        io->tx[i].data = io->mem + (size_t)i * size;
+        io->rx[i].data = io->mem + (size_t)(nbufs + i) * size;
+        io->tx_free[i] = nbufs - 1 - i;
+    }
+    io->nfree = nbufs;
+
+# ifdef IO_URING
+    io->ring.fd = -1;
+    if (!(flags & PACKF_IO_POLL) && __io_uring_init(io) == 0)
+        io->backend = PACKF_IO_URING;
+# else
+    (void)flags;
+# endif
+
+    return io;
+}
+
+int packf_io_backend(struct packf_io const *io)
+{
+    return io->backend;
+}
+
+void packf_io_close(struct packf_io *io)
+{
+    if (!io)
+        return;
+
+# ifdef IO_URING
+    if (io->backend == PACKF_IO_URING)
+    {
+        __ring_free(&io->ring);
+        munmap(io->br, io->br_len);
+    }
+# endif
+
+    free(io->tx);
+    free(io->rx);
+    free(io->tx_free);
+    free(io->txq);
+    free(io->rxq);
+    free(io->part);
+    free(io->mem);
+    free(io);
+}
+
+int packf_io_senda(struct packf_io *io, char const *format, va_list arg)
+{
+    struct __io_buf *b;
+    va_list va;
+    void *current;
+    int ret, left;
+
+    if (!io || !format)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    while (1)
+    {
+        if (io->err)
+            return io->err;
+        while (io->cur < 0 && !io->nfree)
+            if ((ret = __io_tx_wait(io)) < 0)
+                return ret;
+        if (io->cur < 0)
+            io->cur = io->tx_free[--io->nfree];
+
+        b = &io->tx[io->cur];
+        current = b->data + b->len;
+        left = io->size - b->len;
+        va_copy(va, arg);
+        ret = vpackf_framea(&current, &left, IO_HDR, format, va);
+        va_end(va);
+
+        /* 当前缓冲区放不下时排队提交，在空的缓冲区中重新打包 */
+        if (ret != PACKF_OUT_OF_BUF || !b->len)
+            break;
+        if ((ret = __io_queue(io)) < 0)
+            return ret;
+    }
+
+    if (ret < 0)
+        return ret;
+    b->len += ret;
+
+    return ret;
+}
+
+int packf_io_send(struct packf_io *io, char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = packf_io_senda(io, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int packf_io_submit(struct packf_io *io)
+{
+    if (!io)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (io->err)
+        return io->err;
+
+    if (io->cur >= 0 && io->tx[io->cur].len)
+        return __io_queue(io);
+
+    return __io_kick(io);
+}
+
+int packf_io_flush(struct packf_io *io)
+{
+    int ret;
+
+    if ((ret = packf_io_submit(io)) < 0)
+        return ret;
+    while (io->txq_len)
+        if ((ret = __io_tx_wait(io)) < 0)
+            return ret;
+
+    return 0;
+}
+
+/* 等待至少一个接收缓冲区读入数据或者对端关闭 */
+static int __io_rx_wait(struct packf_io *io)
+{
+    struct pollfd pfd;
+    ssize_t n;
+
+# ifdef IO_URING
+    if (io->backend == PACKF_IO_URING)
+    {
+        __io_rx_arm(io);
+        if (!io->rx_armed && !io->inflight)
+            return io->err = PACKF_IO_ERROR;
+        if (__ring_enter(&io->ring, 1) < 0)
+            return io->err = PACKF_IO_ERROR;
+
+        return __io_kick(io);
+    }
+# endif
+
+    while ((n = read(io->fd, io->rx[0].data, io->size)) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return io->err = PACKF_IO_ERROR;
+
+        pfd.fd     = io->fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return io->err = PACKF_IO_ERROR;
+    }
+
+    if (n == 0)
+    {
+        io->eof = 1;
+        return 0;
+    }
+
+    io->rx[0].len = (int)n;
+    io->rx[0].off = 0;
+    io->rxq[io->rxq_head] = 0;
+    io->rxq_len = 1;
+
+    return 0;
+}
+
+static void __io_rx_pop(struct packf_io *io)
+{
+    int idx = io->rxq[io->rxq_head];
+
+    io->rxq_head = (io->rxq_head + 1) % io->nbufs;
+    --io->rxq_len;
+# ifdef IO_URING
+    if (io->backend == PACKF_IO_URING)
+        __io_rx_give(io, idx);
+# else
+    (void)idx;
+# endif
+}
+
+int packf_io_recv(struct packf_io *io, struct packf_frame *frame)
+{
+    struct __io_buf *b;
+    size_t used;
+    char *p;
+    int avail, need, k, ret;
+
+    if (!io || !frame)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    io->rx_on = 1;
+    frame->wrap     = NULL;
+    frame->wrap_len = 0;
+    while (1)
+    {
+        if (io->err)
+            return io->err;
+
+        /* 上一次返回的消息所在的缓冲区读完后才归还 */
+        if (io->rxq_len && io->rx[io->rxq[io->rxq_head]].off ==
+                io->rx[io->rxq[io->rxq_head]].len)
+            __io_rx_pop(io);
+
+        if (!io->rxq_len)
+        {
+            if (io->eof)
+            {
+                if (io->part_len)
+                    ERR_RET_PRINT(PACKF_BAD_DATA);
+                return 0;
+            }
+            if ((ret = __io_rx_wait(io)) < 0)
+                return ret;
+            continue;
+        }
+
+        b = &io->rx[io->rxq[io->rxq_head]];
+        p = b->data + b->off;
+        avail = b->len - b->off;
+
+        /* 跨越缓冲区的消息先补齐长度头，再补齐消息体 */
+        if (io->part_len)
+        {
+            need = io->part_len < IO_HDR ? IO_HDR - io->part_len :
+                IO_HDR + ((uint8_t)io->part[0] << 8 | (uint8_t)io->part[1]) -
+                io->part_len;
+            k = avail < need ? avail : need;
+            memcpy(io->part + io->part_len, p, k);
+            io->part_len += k;
+            b->off += k;
+            if (io->part_len >= IO_HDR && io->part_len == IO_HDR +
+                    ((uint8_t)io->part[0] << 8 | (uint8_t)io->part[1]))
+            {
+                frame->data = io->part + IO_HDR;
+                frame->len  = io->part_len - IO_HDR;
+                io->part_len = 0;
+                return 1;
+            }
+            continue;
+        }
+
+        if ((ret = packf_frame_scan(p, avail, IO_HDR, frame, 1, &used)) < 0)
+            return ret;
+        if (ret == 1)
+        {
+            b->off += (int)used;
+            return 1;
+        }
+
+        memcpy(io->part, p, avail);
+        io->part_len = avail;
+        b->off = b->len;
+    }
+}
+
+int packf_io_unpack(struct packf_io *io, char const *format, ...)
+{
+    struct packf_frame frame;
+    va_list va;
+    void *current;
+    int left, ret;
+
+    if ((ret = packf_io_recv(io, &frame)) <= 0)
+        return ret;
+
+    current = frame.data;
+    left = frame.len;
+    va_start(va, format);
+    ret = vunpacka(&current, &left, format, va);
+    va_end(va);
+
+    return ret < 0 ? ret : 1;
+}
@@ -0,0 +1,108 @@
+/*
+ * Batched socket I/O for packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# ifndef _PACKF_IO_H_
+# define _PACKF_IO_H_
+
+# include <stddef.h>
+# include <stdarg.h>
+
+# include "packf.h"
+# include "packf_frame.h"
+
+# ifdef  __cplusplus
+extern "C"
+{
+# endif
+
+/*
+ * 批量的收发：一个文件描述符（socket 或 pipe）上按 packf_frame 的 2 字节
+ * 长度头分帧收发消息，每次系统调用发送或接收多条消息。
+ *
+ * 发送时消息直接打包到发送缓冲区中，一个缓冲区满或调用 packf_io_submit 时
+ * 排队，排队的缓冲区一次提交。提交后可以继续向其他空闲缓冲区打包，没有
+ * 空闲缓冲区时等待之前的发送完成。
+ *
+ * 接收时每次读入一个接收缓冲区，按顺序返回其中的消息；完整的消息直接指向
+ * 接收缓冲区，跨越两个缓冲区的消息拷贝到一个单独的缓冲区中。
+ *
+ * 内核支持时使用 io_uring（不依赖 liburing）：发送缓冲区注册为固定缓冲区，
+ * 一批缓冲区用链接的 WRITE_FIXED 一次提交（保证顺序，短写时从断开处重新
+ * 提交）；接收缓冲区注册为 provided buffer ring, 读完的缓冲区归还到 ring
+ * 中。io_uring 不可用（内核太旧、被禁止或编译时定义了 PACKF_NO_URING）
+ * 或指定 PACKF_IO_POLL 时使用 writev/read/poll.
+ *
+ * 一个 packf_io 只能在一个线程中使用，多个发送线程各自使用自己的
+ * packf_io. 向已关闭的 socket 发送时和 write 一样会产生 SIGPIPE.
+ */
+# define PACKF_IO_URING     1
+# define PACKF_IO_POLL      2
+
+# define PACKF_IO_MAX_BUFS  1024
+
+struct packf_io;
+
+/*
+ * 函数：packf_io_open
+ * 功能：在 fd 上建立批量收发，fd 可以是阻塞或非阻塞的
+ * 参数：
+ *      nbufs: 发送和接收缓冲区的个数，各 nbufs 个，不超过 PACKF_IO_MAX_BUFS
+ *      size:  每个缓冲区的长度，一条消息（包含长度头）不能超过 size
+ *      flags: 0 或 PACKF_IO_POLL（不使用 io_uring）
+ * 返回值：
+ *      成功返回 packf_io, 参数错误或内存不足时返回 NULL
+ */
+extern struct packf_io *packf_io_open(int fd, int nbufs, int size, int flags);
+
+/* 返回使用的方式，PACKF_IO_URING 或 PACKF_IO_POLL */
+extern int packf_io_backend(struct packf_io const *io);
+
+/* 释放 packf_io, 不会发送未提交的数据，也不关闭 fd */
+extern void packf_io_close(struct packf_io *io);
+
+/*
+ * 函数：packf_io_send
+ * 功能：按 format 打包一条消息放入当前的发送缓冲区，缓冲区满时排队并提交
+ * 返回值：
+ *      >= 0 : 成功，返回消息的长度（包含长度头）
+ *      < 0  : 失败，消息超过一个缓冲区时返回 PACKF_OUT_OF_BUF, 发送失败时
+ *             返回 PACKF_IO_ERROR（之后的调用都会失败）
+ */
+extern int packf_io_send(struct packf_io *io, char const *format, ...);
+extern int packf_io_senda(struct packf_io *io, char const *format,
+        va_list arg);
+
+/* 把当前的发送缓冲区排队，提交所有排队的缓冲区，不等待完成，成功返回 0 */
+extern int packf_io_submit(struct packf_io *io);
+
+/* 提交并等待所有数据发送完成，成功返回 0 */
+extern int packf_io_flush(struct packf_io *io);
+
+/*
+ * 函数：packf_io_recv
+ * 功能：返回下一条收到的消息，没有完整的消息时阻塞
+ * 参数：
+ *      frame: 返回消息体的位置，可以直接 unpackf_frame 或对 data/len unpackf,
+ *             在下一次 packf_io_recv/packf_io_unpack 调用前有效
+ * 返回值：
+ *      1    : 成功
+ *      0    : 对端已经关闭
+ *      < 0  : 失败，关闭时有不完整的消息返回 PACKF_BAD_DATA, 接收失败时返回
+ *             PACKF_IO_ERROR
+ */
+extern int packf_io_recv(struct packf_io *io, struct packf_frame *frame);
+
+/* 接收下一条消息并按 format 解包，返回值同 packf_io_recv */
+extern int packf_io_unpack(struct packf_io *io, char const *format, ...);
+
+# ifdef  __cplusplus
+}
+# endif
+
+# endif
+
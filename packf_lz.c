@@ -0,0 +1,385 @@
+/*
+ * LZ compressed batches of packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# include <stdio.h>
+# include <string.h>
+# include <stdarg.h>
+# include <stdint.h>
+
+# include "packf_lz.h"
+
+# define ERR_RET_PRINT(ret) do {                                        \
+    if (packf_print_error)                                              \
+        fprintf(stderr, "%s: %s\n", __func__, packf_strerror(ret));     \
+    return ret;                                                         \
+} while (0)
+
+# define LZ_MIN_MATCH   4
+# define LZ_MAX_OFFSET  0xFFFF
+# define LZ_HASH_BITS   12
+# define LZ_BLOCK_HDR   5       /* "c w =" */
+
+# define BLOCK_RAW      0
+# define BLOCK_LZ       1
+
+static inline uint32_t __lz_load32(uint8_t const *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static inline int __lz_hash(uint32_t v)
+{
+    return (int)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+/* 写入长度为 15 及以上时的扩展字节 */
+static uint8_t *__lz_put_len(uint8_t *op, int len)
+{
+    for (len -= 15; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)len;
+
+    return op;
+}
+
+/* 写入一个序列的标记字节和字面量，match 为匹配长度 - LZ_MIN_MATCH */
+static uint8_t *__lz_put_literal(uint8_t *op, uint8_t const *lit, int lit_len,
+        int match)
+{
+    *op++ = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) |
+            (match < 15 ? match : 15));
+    if (lit_len >= 15)
+        op = __lz_put_len(op, lit_len);
+    memcpy(op, lit, lit_len);
+
+    return op + lit_len;
+}
+
+int packf_lz_compress(void const *src, int len, void *dst, int max)
+{
+    uint8_t const *base = src, *ip = base, *anchor = base, *end, *ref;
+    uint8_t *op = dst, *oend = op + max;
+    int table[1 << LZ_HASH_BITS];
+    int h, lit, match, miss = 0;
+
+    if (!src || !dst)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (len < 0 || max < 0)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    end = base + len;
+    memset(table, 0xFF, sizeof(table));
+    while (end - ip >= LZ_MIN_MATCH)
+    {
+        h = __lz_hash(__lz_load32(ip));
+        ref = table[h] < 0 ? NULL : base + table[h];
+        table[h] = (int)(ip - base);
+        if (!ref || ip - ref > LZ_MAX_OFFSET ||
+                __lz_load32(ref) != __lz_load32(ip))
+        {
+            /* 连续找不到匹配时加大步长，不可压缩的数据很快跳过 */
+            ip += 1 + (miss++ >> 5);
+            continue;
+        }
+
+        miss  = 0;
+        match = LZ_MIN_MATCH;
+        while (ip + match < end && ref[match] == ip[match])
+            ++match;
+
+        lit = (int)(ip - anchor);
+        if (oend - op < lit + lit / 255 + match / 255 + 8)
+            ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+        op = __lz_put_literal(op, anchor, lit, match - LZ_MIN_MATCH);
+        *op++ = (uint8_t)((ip - ref) >> 8);
+        *op++ = (uint8_t)(ip - ref);
+        if (match - LZ_MIN_MATCH >= 15)
+            op = __lz_put_len(op, match - LZ_MIN_MATCH);
+
+        ip += match;
+        anchor = ip;
+        if (end - ip >= LZ_MIN_MATCH + 2)
+            table[__lz_hash(__lz_load32(ip - 2))] = (int)(ip - 2 - base);
+    }
+
+    lit = (int)(end - anchor);
+    if (oend - op < lit + lit / 255 + 2)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+    op = __lz_put_literal(op, anchor, lit, 0);
+
+    return (int)(op - (uint8_t *)dst);
+}
+
+/* 读取扩展的长度字节，加到 *len 上，不超过 max */
+static int __lz_get_len(uint8_t const **ip, uint8_t const *iend, int *len,
+        int max)
+{
+    uint8_t b;
+
+    do
+    {
+        if (*ip >= iend)
+            return PACKF_BAD_DATA;
+        b = *(*ip)++;
+        *len += b;
+        if (*len > max)
+            return PACKF_BAD_DATA;
+    } while (b == 255);
+
+    return 0;
+}
+
+int packf_lz_decompress(void const *src, int len, void *dst, int max)
+{
+    uint8_t const *ip = src, *iend, *ref;
+    uint8_t *op = dst, *oend = op + max;
+    int token, lit, match, offset, i, ret;
+
+    if (!src || !dst)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (len < 0 || max < 0)
+        ERR_RET_PRINT(PACKF_BAD_DATA);
+
+    iend = ip + len;
+    while (ip < iend)
+    {
+        token = *ip++;
+
+        lit = token >> 4;
+        if (lit == 15 && (ret = __lz_get_len(&ip, iend, &lit, len)) < 0)
+            ERR_RET_PRINT(ret);
+        if (iend - ip < lit)
+            ERR_RET_PRINT(PACKF_BAD_DATA);
+        if (oend - op < lit)
+            ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        /* 最后一个序列只有字面量 */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            ERR_RET_PRINT(PACKF_BAD_DATA);
+        offset = (ip[0] << 8) | ip[1];
+        ip += 2;
+        if (offset == 0 || offset > op - (uint8_t *)dst)
+            ERR_RET_PRINT(PACKF_BAD_DATA);
+
+        match = token & 15;
+        if (match == 15 && (ret = __lz_get_len(&ip, iend, &match, max)) < 0)
+            ERR_RET_PRINT(ret);
+        match += LZ_MIN_MATCH;
+        if (oend - op < match)
+            ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+        ref = op - offset;
+        if (offset >= match)
+        {
+            memcpy(op, ref, match);
+        }
+        else
+        {
+            /* 重叠的匹配（例如连续的 0）逐字节复制 */
+            for (i = 0; i < match; ++i)
+                op[i] = ref[i];
+        }
+        op += match;
+    }
+
+    return (int)(op - (uint8_t *)dst);
+}
+
+void packf_lz_writer_init(struct packf_lz_writer *w, struct packf_sink *sink,
+        void *raw, int size, void *tmp)
+{
+    w->sink      = sink;
+    w->raw       = raw;
+    w->size      = size > PACKF_LZ_BLOCK ? PACKF_LZ_BLOCK : size;
+    w->len       = 0;
+    w->tmp       = tmp;
+    w->raw_total = 0;
+    w->lz_total  = 0;
+}
+
+/* 压缩当前块并输出到 sink */
+static int __lz_emit(struct packf_lz_writer *w)
+{
+    int ret, n;
+
+    if (!w->len)
+        return 0;
+
+    n = packf_lz_compress(w->raw, w->len, w->tmp, PACKF_LZ_BOUND(w->len));
+    if (n >= 0 && n < w->len)
+        ret = packf_sink(w->sink, "c w =c", BLOCK_LZ, w->len, n, w->tmp);
+    else
+        ret = packf_sink(w->sink, "c w =c", BLOCK_RAW, w->len, w->len,
+                w->raw);
+    if (ret < 0)
+        return ret;
+
+    w->raw_total += w->len;
+    w->lz_total  += ret;
+    w->len = 0;
+
+    return 0;
+}
+
+int packf_lz_writea(struct packf_lz_writer *w, char const *format,
+        va_list arg)
+{
+    va_list va;
+    void *current;
+    int ret, left;
+
+    if (!w || !w->sink || !w->raw || !w->tmp)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    current = w->raw + w->len;
+    left = w->size - w->len;
+    va_copy(va, arg);
+    ret = vpackf_framea(&current, &left, 2, format, va);
+    va_end(va);
+
+    /* 当前块放不下时输出当前块，在空块中重新打包 */
+    if (ret == PACKF_OUT_OF_BUF && w->len > 0)
+    {
+        if ((ret = __lz_emit(w)) < 0)
+            return ret;
+
+        current = w->raw;
+        left = w->size;
+        va_copy(va, arg);
+        ret = vpackf_framea(&current, &left, 2, format, va);
+        va_end(va);
+    }
+
+    if (ret < 0)
+        return ret;
+    w->len += ret;
+
+    return ret;
+}
+
+int packf_lz_write(struct packf_lz_writer *w, char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = packf_lz_writea(w, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int packf_lz_writer_flush(struct packf_lz_writer *w)
+{
+    int ret;
+
+    if (!w || !w->sink)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    if ((ret = __lz_emit(w)) < 0)
+        return ret;
+
+    return packf_sink_flush(w->sink);
+}
+
+void packf_lz_reader_init(struct packf_lz_reader *r, void const *src,
+        size_t len, void *raw, int size)
+{
+    r->src     = src;
+    r->len     = len;
+    r->pos     = 0;
+    r->raw     = raw;
+    r->size    = size;
+    r->block   = NULL;
+    r->raw_len = 0;
+    r->raw_pos = 0;
+}
+
+/* 读取下一个块，未压缩的块直接使用 src 中的数据 */
+static int __lz_block(struct packf_lz_reader *r)
+{
+    uint8_t const *p = r->src + r->pos;
+    size_t left = r->len - r->pos;
+    uint8_t kind;
+    uint16_t raw_len, n;
+    int ret;
+
+    if (left < LZ_BLOCK_HDR)
+        ERR_RET_PRINT(PACKF_BAD_DATA);
+    if ((ret = unpackf((void *)p, LZ_BLOCK_HDR, "c w w", &kind, &raw_len,
+                    &n)) < 0)
+        return ret;
+    p += LZ_BLOCK_HDR;
+    if (left - LZ_BLOCK_HDR < n)
+        ERR_RET_PRINT(PACKF_BAD_DATA);
+
+    if (kind == BLOCK_RAW)
+    {
+        if (n != raw_len)
+            ERR_RET_PRINT(PACKF_BAD_DATA);
+        r->block = p;
+    }
+    else if (kind == BLOCK_LZ)
+    {
+        if (!r->raw)
+            ERR_RET_PRINT(PACKF_NULL_POINTER);
+        if (raw_len > r->size)
+            ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+        if ((ret = packf_lz_decompress(p, n, r->raw, r->size)) < 0)
+            return ret;
+        if (ret != raw_len)
+            ERR_RET_PRINT(PACKF_BAD_DATA);
+        r->block = (uint8_t const *)r->raw;
+    }
+    else
+    {
+        ERR_RET_PRINT(PACKF_BAD_DATA);
+    }
+
+    r->pos    += LZ_BLOCK_HDR + n;
+    r->raw_len = raw_len;
+    r->raw_pos = 0;
+
+    return 0;
+}
+
+int packf_lz_next(struct packf_lz_reader *r, struct packf_frame *frame)
+{
+    size_t used;
+    int ret;
+
+    if (!r || !frame)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    while (r->raw_pos == r->raw_len)
+    {
+        if (r->pos == r->len)
+            return 0;
+        if ((ret = __lz_block(r)) < 0)
+            return ret;
+    }
+
+    if ((ret = packf_frame_scan((void *)(r->block + r->raw_pos),
+                    r->raw_len - r->raw_pos, 2, frame, 1, &used)) < 0)
+        return ret;
+    if (ret == 0)
+        ERR_RET_PRINT(PACKF_BAD_DATA);
+    r->raw_pos += (int)used;
+
+    return 1;
+}
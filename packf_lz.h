@@ -0,0 +1,136 @@
+/*
+ * LZ compressed batches of packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# ifndef _PACKF_LZ_H_
+# define _PACKF_LZ_H_
+
+# include <stddef.h>
+# include <stdint.h>
+
+# include "packf.h"
+# include "packf_frame.h"
+
+# ifdef  __cplusplus
+extern "C"
+{
+# endif
+
+/*
+ * 压缩的消息批：多条消息连续打包后按块压缩，用于回放文件和批量发送。
+ *
+ * 每条消息和 packf_frame 相同，为 2 字节长度头 + 消息体。消息按顺序放入
+ * 块中，一条消息不会跨越两个块，块的原始长度不超过 PACKF_LZ_BLOCK.
+ * 每个块在网络上为 "c w =c"：
+ *      c:  块的类型，0 为未压缩，1 为 LZ 压缩
+ *      w:  块的原始长度
+ *      =c: 块的数据，压缩后不比原始数据短时保存原始数据
+ *
+ * 压缩为 LZ77 类的字节编码，每个序列为一个标记字节（高 4 位为字面量长度，
+ * 低 4 位为匹配长度 - 4，为 15 时后面跟扩展的长度字节）、字面量、2 字节的
+ * 匹配偏移（网络序）。块的最后一个序列只有字面量。
+ *
+ * 写入端通过 packf_sink 输出，占用的内存为一个块的原始数据和压缩缓冲区；
+ * 读取端每次只解压一个块，按消息返回，不需要解压整个批。
+ */
+# define PACKF_LZ_BLOCK     65535
+
+/* 压缩 len 字节需要的最大输出长度 */
+# define PACKF_LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+/*
+ * 函数：packf_lz_compress
+ * 功能：压缩 src 中的 len 字节到 dst
+ * 返回值：
+ *      >= 0 : 成功，返回压缩后的长度
+ *      < 0  : 失败，dst 的空间不足时返回 PACKF_OUT_OF_BUF
+ */
+extern int packf_lz_compress(void const *src, int len, void *dst, int max);
+
+/*
+ * 函数：packf_lz_decompress
+ * 功能：解压 src 中的 len 字节到 dst, 数据不可信时也不会越界
+ * 返回值：
+ *      >= 0 : 成功，返回解压后的长度
+ *      < 0  : 失败，数据不合法时返回 PACKF_BAD_DATA, dst 的空间不足时返回
+ *             PACKF_OUT_OF_BUF
+ */
+extern int packf_lz_decompress(void const *src, int len, void *dst, int max);
+
+struct packf_lz_writer
+{
+    struct packf_sink      *sink;
+    char                   *raw;    /* 当前块的原始数据 */
+    int                     size;   /* raw 的容量，不超过 PACKF_LZ_BLOCK */
+    int                     len;    /* raw 中已经打包的字节数 */
+    char                   *tmp;    /* 压缩缓冲区，PACKF_LZ_BOUND(size) 字节 */
+    int64_t                 raw_total;  /* 已经输出的块的原始字节数 */
+    int64_t                 lz_total;   /* 已经输出的块的字节数 */
+};
+
+/*
+ * 函数：packf_lz_writer_init
+ * 功能：初始化写入端，压缩的块输出到 sink
+ * 参数：
+ *      raw:  块的缓冲区，size 字节
+ *      tmp:  压缩缓冲区，至少 PACKF_LZ_BOUND(size) 字节
+ */
+extern void packf_lz_writer_init(struct packf_lz_writer *w,
+        struct packf_sink *sink, void *raw, int size, void *tmp);
+
+/*
+ * 函数：packf_lz_write
+ * 功能：按 format 打包一条消息放入当前块，块放不下时先输出当前块
+ * 返回值：
+ *      >= 0 : 成功，返回消息的长度（包含长度头）
+ *      < 0  : 失败，一个空块也放不下消息时返回 PACKF_OUT_OF_BUF
+ */
+extern int packf_lz_write(struct packf_lz_writer *w, char const *format, ...);
+extern int packf_lz_writea(struct packf_lz_writer *w, char const *format,
+        va_list arg);
+
+/* 压缩并输出当前块，再调用 packf_sink_flush, 成功返回 0 */
+extern int packf_lz_writer_flush(struct packf_lz_writer *w);
+
+/*
+ * 读取端：src 为完整的压缩批（例如 mmap 的回放文件），raw 为解压一个块
+ * 的缓冲区，size 应不小于写入端的块大小。
+ */
+struct packf_lz_reader
+{
+    uint8_t const          *src;
+    size_t                  len;
+    size_t                  pos;    /* 下一个块在 src 中的偏移 */
+    char                   *raw;
+    int                     size;
+    uint8_t const          *block;      /* 当前块的原始数据，在 raw 或 src 中 */
+    int                     raw_len;    /* 当前块的原始长度 */
+    int                     raw_pos;    /* 下一条消息在当前块中的偏移 */
+};
+
+extern void packf_lz_reader_init(struct packf_lz_reader *r, void const *src,
+        size_t len, void *raw, int size);
+
+/*
+ * 函数：packf_lz_next
+ * 功能：返回下一条消息，当前块读完时解压下一个块
+ * 参数：
+ *      frame: 返回消息体的位置，可以直接 unpackf_frame 或对 data/len unpackf,
+ *             在下一次调用前有效
+ * 返回值：
+ *      1    : 成功
+ *      0    : 批已经读完
+ *      < 0  : 失败，块或消息不完整、数据不合法时返回 PACKF_BAD_DATA
+ */
+extern int packf_lz_next(struct packf_lz_reader *r, struct packf_frame *frame);
+
+# ifdef  __cplusplus
+}
+# endif
+
+# endif
+
@@ -0,0 +1,264 @@
+/*
+ * Multi-producer batching encoder for packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdarg.h>
+# include <stdint.h>
+# include <sched.h>
+
+# include "packf_mpsc.h"
+
+# define ERR_RET_PRINT(ret) do {                                        \
+    if (packf_print_error)                                              \
+        fprintf(stderr, "%s: %s\n", __func__, packf_strerror(ret));     \
+    return ret;                                                         \
+} while (0)
+
+# define MPSC_HDR       2
+# define MPSC_SHIFT     3       /* 每 8 字节一个提交状态 */
+# define MPSC_MIN       (1 << MPSC_SHIFT)   /* 最短的预留，每项最多一条消息 */
+# define MPSC_MIN_SIZE  4096
+# define MPSC_MAX_SIZE  ((size_t)1 << 30)
+# define MPSC_SPIN      64
+# define MPSC_IOV       64
+
+/* 提交状态：高 32 位为预留的长度（不为 0），低 32 位为消息的长度 */
+# define CTRL(need, used)   (((uint64_t)(need) << 32) | (uint32_t)(used))
+# define CTRL_NEED(c)       ((int)((c) >> 32))
+# define CTRL_USED(c)       ((int)(uint32_t)(c))
+
+struct packf_mpsc
+{
+    uint8_t                *ring;
+    uint64_t               *ctrl;
+    size_t                  size;
+    size_t                  mask;
+    /* 生产者和消费者修改的位置放在不同的 cache line 中 */
+    uint64_t                head __attribute__((aligned(64)));
+    uint64_t                tail __attribute__((aligned(64)));
+    uint64_t                scan;   /* 消费者已经 peek 到的位置 */
+};
+
+struct packf_mpsc *packf_mpsc_new(size_t size)
+{
+    struct packf_mpsc *q;
+
+    if (size < MPSC_MIN_SIZE || size > MPSC_MAX_SIZE || (size & (size - 1)))
+        return NULL;
+
+    if (posix_memalign((void **)&q, 64, sizeof(*q)))
+        return NULL;
+    memset(q, 0, sizeof(*q));
+    q->size = size;
+    q->mask = size - 1;
+    q->ring = malloc(size);
+    q->ctrl = calloc(size >> MPSC_SHIFT, sizeof(*q->ctrl));
+    if (!q->ring || !q->ctrl)
+    {
+        packf_mpsc_free(q);
+        return NULL;
+    }
+
+    return q;
+}
+
+void packf_mpsc_free(struct packf_mpsc *q)
+{
+    if (!q)
+        return;
+
+    free(q->ring);
+    free(q->ctrl);
+    free(q);
+}
+
+/* 环形缓冲区中从 off 开始的 len 字节，回绕时为两段 */
+static int __mpsc_iov(struct packf_mpsc const *q, size_t off, size_t len,
+        struct iovec *iov)
+{
+    size_t first = len < q->size - off ? len : q->size - off;
+
+    iov[0].iov_base = q->ring + off;
+    iov[0].iov_len  = first;
+    if (first == len)
+        return 1;
+
+    iov[1].iov_base = q->ring;
+    iov[1].iov_len  = len - first;
+
+    return 2;
+}
+
+/* 等待消费者释放到 pos, 即 [pos, pos + size) 都可以写入 */
+static void __mpsc_wait(struct packf_mpsc *q, uint64_t pos)
+{
+    int spin = 0;
+
+    while ((int64_t)(pos - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) > 0)
+    {
+        if (++spin >= MPSC_SPIN)
+        {
+            sched_yield();
+            spin = 0;
+        }
+    }
+}
+
+/* 在 pos 处打包一条消息，长度不超过 len */
+static int __mpsc_pack(struct packf_mpsc *q, uint64_t pos, int len,
+        char const *format, va_list arg)
+{
+    struct iovec iov[2];
+    size_t off = pos & q->mask;
+    void *current;
+    int ret, left, n;
+
+    if (off + len <= q->size)
+    {
+        current = q->ring + off;
+        left = len;
+        return vpackf_framea(&current, &left, MPSC_HDR, format, arg);
+    }
+
+    /* 回绕时消息体直接打包到末尾和起始处的两段中，长度头单独回填 */
+    n = __mpsc_iov(q, (off + MPSC_HDR) & q->mask, len - MPSC_HDR, iov);
+    ret = format ? packf_iova(iov, n, format, arg) : 0;
+    if (ret < 0)
+        return ret;
+
+    q->ring[off] = (uint8_t)(ret >> 8);
+    q->ring[(off + 1) & q->mask] = (uint8_t)ret;
+
+    return MPSC_HDR + ret;
+}
+
+int packf_mpsc_packa(struct packf_mpsc *q, int max, char const *format,
+        va_list arg)
+{
+    uint64_t pos, end;
+    int need, used, ret;
+
+    if (!q)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (max < 0 || max > 0xFFFF || (size_t)(MPSC_HDR + max) > q->size)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    need = MPSC_HDR + max < MPSC_MIN ? MPSC_MIN : MPSC_HDR + max;
+    pos = __atomic_fetch_add(&q->head, need, __ATOMIC_RELAXED);
+    __mpsc_wait(q, pos + need - q->size);
+
+    ret = __mpsc_pack(q, pos, MPSC_HDR + max, format, arg);
+    used = ret < 0 ? 0 : ret;
+
+    /* 之后还没有其他预留时归还多预留的部分，输出的数据保持连续 */
+    if (used < need)
+    {
+        end = pos + need;
+        if (__atomic_compare_exchange_n(&q->head, &end,
+                    pos + (used < MPSC_MIN ? MPSC_MIN : used), 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            need = used < MPSC_MIN ? MPSC_MIN : used;
+    }
+
+    __atomic_store_n(&q->ctrl[(pos & q->mask) >> MPSC_SHIFT],
+            CTRL(need, used), __ATOMIC_RELEASE);
+
+    return ret;
+}
+
+int packf_mpsc_pack(struct packf_mpsc *q, int max, char const *format, ...)
+{
+    va_list va;
+    int ret;
+
+    va_start(va, format);
+    ret = packf_mpsc_packa(q, max, format, va);
+    va_end(va);
+
+    return ret;
+}
+
+int packf_mpsc_peek(struct packf_mpsc *q, struct iovec *iov, int max)
+{
+    struct iovec seg[2];
+    uint64_t *ctrl, c;
+    size_t off;
+    int n = 0, k, merge;
+
+    if (!q || !iov)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    for (;;)
+    {
+        ctrl = &q->ctrl[(q->scan & q->mask) >> MPSC_SHIFT];
+        if (!(c = __atomic_load_n(ctrl, __ATOMIC_ACQUIRE)))
+            break;
+
+        off = q->scan & q->mask;
+        k = CTRL_USED(c) ? __mpsc_iov(q, off, CTRL_USED(c), seg) : 0;
+        merge = k && n && (uint8_t *)iov[n - 1].iov_base +
+            iov[n - 1].iov_len == (uint8_t *)seg[0].iov_base;
+        if (n + k - merge > max)
+            break;
+
+        if (merge)
+        {
+            iov[n - 1].iov_len += seg[0].iov_len;
+            if (k == 2)
+                iov[n++] = seg[1];
+        }
+        else
+        {
+            memcpy(iov + n, seg, k * sizeof(*seg));
+            n += k;
+        }
+
+        /* 在释放前清除，下一圈的生产者提交前不会读到旧的状态 */
+        __atomic_store_n(ctrl, 0, __ATOMIC_RELAXED);
+        q->scan += CTRL_NEED(c);
+    }
+
+    return n;
+}
+
+void packf_mpsc_release(struct packf_mpsc *q)
+{
+    __atomic_store_n(&q->tail, q->scan, __ATOMIC_RELEASE);
+}
+
+int packf_mpsc_flush(struct packf_mpsc *q,
+        int (*flush)(void *ctx, void const *data, int len), void *ctx)
+{
+    struct iovec iov[MPSC_IOV];
+    uint64_t start;
+    int n, i, ret, total = 0;
+
+    if (!q || !flush)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    start = q->scan;
+    do
+    {
+        n = packf_mpsc_peek(q, iov, MPSC_IOV);
+        for (i = 0; i < n; ++i)
+        {
+            if ((ret = flush(ctx, iov[i].iov_base, (int)iov[i].iov_len)) < 0)
+            {
+                packf_mpsc_release(q);
+                ERR_RET_PRINT(ret);
+            }
+            total += (int)iov[i].iov_len;
+        }
+        /* 只跳过了失败的消息时也要释放 */
+        packf_mpsc_release(q);
+    } while (n > 0 && q->scan - start < q->size);
+
+    return total;
+}
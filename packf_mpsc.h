@@ -0,0 +1,100 @@
+/*
+ * Multi-producer batching encoder for packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# ifndef _PACKF_MPSC_H_
+# define _PACKF_MPSC_H_
+
+# include <stddef.h>
+# include <stdarg.h>
+# include <sys/uio.h>
+
+# include "packf.h"
+# include "packf_frame.h"
+
+# ifdef  __cplusplus
+extern "C"
+{
+# endif
+
+/*
+ * 多生产者单消费者的打包队列：多个线程向同一个连接发送消息时，各自直接
+ * 打包到共享的环形缓冲区中，由一个消费者线程批量输出，不需要加锁，也不
+ * 需要先打包到线程自己的缓冲区再拷贝。
+ *
+ * 每条消息和 packf_frame 相同，为 2 字节长度头 + 消息体，在环形缓冲区中
+ * 首尾相接，输出的数据可以直接用 packf_frame_scan 分帧。
+ *
+ * 生产者用一次原子加法预留消息的最大长度，打包后如果之后还没有其他预留，
+ * 归还多预留的部分；否则多预留的部分留在缓冲区中，输出时跳过。提交状态
+ * 保存在缓冲区之外（每 8 字节一项），提交不需要等待之前的生产者。
+ * 缓冲区满时生产者等待消费者释放空间。
+ *
+ * 消费者按预留的顺序取出已经提交的消息，遇到还没有提交的消息时停止；
+ * 连续的消息合并为一段，可以直接 writev 或交给 packf_sink 的 flush 函数。
+ */
+
+/*
+ * 函数：packf_mpsc_new
+ * 功能：创建一个队列
+ * 参数：
+ *      size: 环形缓冲区的长度，2 的幂，4096 到 1G, 应不小于最长消息的几倍
+ * 返回值：
+ *      成功返回队列，参数错误或内存不足时返回 NULL
+ */
+extern struct packf_mpsc *packf_mpsc_new(size_t size);
+
+extern void packf_mpsc_free(struct packf_mpsc *q);
+
+/*
+ * 函数：packf_mpsc_pack
+ * 功能：按 format 打包一条消息放入队列，可以在多个线程中同时调用
+ * 参数：
+ *      max:    消息体的最大长度，不超过 65535
+ *      format: 格式字符串，和后面的变参对应
+ * 返回值：
+ *      >= 0 : 成功，返回消息的长度（包含长度头）
+ *      < 0  : 失败，消息体超过 max 时返回 PACKF_OUT_OF_BUF, 失败的消息不会
+ *             输出
+ */
+extern int packf_mpsc_pack(struct packf_mpsc *q, int max,
+        char const *format, ...);
+extern int packf_mpsc_packa(struct packf_mpsc *q, int max,
+        char const *format, va_list arg);
+
+/*
+ * 函数：packf_mpsc_peek
+ * 功能：消费者取出上次 peek 之后已经提交的连续消息，只能在一个线程中调用
+ * 参数：
+ *      iov: 返回数据所在的段，回绕或跳过多预留的部分时分为多段
+ *      max: iov 数组的长度
+ * 返回值：
+ *      >= 0 : 返回段的个数，0 表示没有新提交的消息
+ *      < 0  : 失败
+ */
+extern int packf_mpsc_peek(struct packf_mpsc *q, struct iovec *iov, int max);
+
+/* 释放 peek 返回的所有数据，之后生产者可以重用这部分空间 */
+extern void packf_mpsc_release(struct packf_mpsc *q);
+
+/*
+ * 函数：packf_mpsc_flush
+ * 功能：依次 peek, 对每一段调用 flush（同 packf_sink）, 再 release,
+ *       直到没有已提交的消息，或者已经输出了一个缓冲区长度的数据
+ * 返回值：
+ *      >= 0 : 成功，返回输出的字节数
+ *      < 0  : flush 返回的错误，这一批中还没有输出的数据被丢弃
+ */
+extern int packf_mpsc_flush(struct packf_mpsc *q,
+        int (*flush)(void *ctx, void const *data, int len), void *ctx);
+
+# ifdef  __cplusplus
+}
+# endif
+
+# endif
+
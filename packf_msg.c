@@ -0,0 +1,251 @@
+/*
+ * Reference counted packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdarg.h>
+# include <stdint.h>
+# include <pthread.h>
+
+# include "packf_msg.h"
+
+# define ERR_RET_PRINT(ret) do {                                        \
+    if (packf_print_error)                                              \
+        fprintf(stderr, "%s: %s\n", __func__, packf_strerror(ret));     \
+    return ret;                                                         \
+} while (0)
+
+# define MSG_CLASSES    10              /* 64 字节到 32K 字节 */
+# define MSG_MIN_SHIFT  6
+# define MSG_SLAB_SIZE  (256 * 1024)
+# define MSG_LOCAL_MAX  256             /* 线程空闲链表的最大长度 */
+# define MSG_HDR        ((sizeof(struct packf_msg) + 15) & ~(size_t)15)
+
+# define CHUNK_SIZE(cls) ((size_t)1 << (MSG_MIN_SHIFT + (cls)))
+
+struct __msg_list
+{
+    struct packf_msg   *head;
+    int                 n;
+};
+
+static __thread struct __msg_list local_free[MSG_CLASSES];
+static struct __msg_list global_free[MSG_CLASSES];
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int __msg_class(int size)
+{
+    int cls;
+
+    for (cls = 0; cls < MSG_CLASSES; ++cls)
+        if (CHUNK_SIZE(cls) >= MSG_HDR + (size_t)size)
+            return cls;
+
+    return -1;
+}
+
+/* 从链表头部取出最多 n 个节点，返回取出的个数 */
+static int __msg_take(struct __msg_list *list, int n,
+        struct packf_msg **head, struct packf_msg **tail)
+{
+    struct packf_msg *p = list->head;
+    int k;
+
+    if (!p || n <= 0)
+        return 0;
+
+    for (k = 1; k < n && p->next; ++k)
+        p = p->next;
+
+    *head = list->head;
+    *tail = p;
+    list->head = p->next;
+    list->n   -= k;
+    p->next    = NULL;
+
+    return k;
+}
+
+static void __msg_give(struct __msg_list *list, struct packf_msg *head,
+        struct packf_msg *tail, int n)
+{
+    tail->next = list->head;
+    list->head = head;
+    list->n   += n;
+}
+
+/*
+ * 分配一个 slab, 第一块返回给调用者，其余的放入当前线程的空闲链表，
+ * 超过 MSG_LOCAL_MAX / 2 的部分放入全局链表
+ */
+static struct packf_msg *__msg_slab(int cls)
+{
+    size_t chunk = CHUNK_SIZE(cls), n = MSG_SLAB_SIZE / chunk, i;
+    char *slab = malloc(MSG_SLAB_SIZE);
+    struct __msg_list chain = { NULL, 0 };
+    struct packf_msg *msg, *head, *tail;
+    int k;
+
+    if (!slab)
+        return NULL;
+
+    for (i = n - 1; i > 0; --i)
+    {
+        msg = (struct packf_msg *)(slab + i * chunk);
+        msg->next  = chain.head;
+        chain.head = msg;
+        ++chain.n;
+    }
+
+    if ((k = __msg_take(&chain, MSG_LOCAL_MAX / 2, &head, &tail)))
+        __msg_give(&local_free[cls], head, tail, k);
+    if ((k = __msg_take(&chain, chain.n, &head, &tail)))
+    {
+        pthread_mutex_lock(&global_lock);
+        __msg_give(&global_free[cls], head, tail, k);
+        pthread_mutex_unlock(&global_lock);
+    }
+
+    return (struct packf_msg *)slab;
+}
+
+struct packf_msg *packf_msg_alloc(int size)
+{
+    struct __msg_list *list;
+    struct packf_msg *msg, *head, *tail;
+    int cls, n;
+
+    if (size < 0)
+        return NULL;
+
+    if ((cls = __msg_class(size)) < 0)
+    {
+        if (!(msg = malloc(MSG_HDR + (size_t)size)))
+            return NULL;
+        msg->cap = size;
+    }
+    else
+    {
+        list = &local_free[cls];
+        if (!list->head)
+        {
+            pthread_mutex_lock(&global_lock);
+            n = __msg_take(&global_free[cls], MSG_LOCAL_MAX / 2, &head,
+                    &tail);
+            pthread_mutex_unlock(&global_lock);
+            if (n)
+                __msg_give(list, head, tail, n);
+        }
+
+        if (list->head)
+        {
+            msg = list->head;
+            list->head = msg->next;
+            --list->n;
+        }
+        else if (!(msg = __msg_slab(cls)))
+        {
+            return NULL;
+        }
+        msg->cap = (int)(CHUNK_SIZE(cls) - MSG_HDR);
+    }
+
+    msg->data   = (char *)msg + MSG_HDR;
+    msg->len    = 0;
+    msg->refcnt = 1;
+    msg->cls    = cls;
+    msg->next   = NULL;
+
+    return msg;
+}
+
+int packf_msg_pack(struct packf_msg **msg, int max, char const *format, ...)
+{
+    struct packf_msg *m;
+    va_list va;
+    void *current;
+    int ret, left = max;
+
+    if (!msg)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    *msg = NULL;
+    if (!(m = packf_msg_alloc(max)))
+        ERR_RET_PRINT(PACKF_NO_MEMORY);
+
+    current = m->data;
+    va_start(va, format);
+    ret = vpacka(&current, &left, format, va);
+    va_end(va);
+
+    if (ret < 0)
+    {
+        packf_msg_unref(m);
+        return ret;
+    }
+
+    m->len = ret;
+    *msg   = m;
+
+    return ret;
+}
+
+struct packf_msg *packf_msg_ref(struct packf_msg *msg)
+{
+    __atomic_fetch_add(&msg->refcnt, 1, __ATOMIC_RELAXED);
+
+    return msg;
+}
+
+void packf_msg_unref(struct packf_msg *msg)
+{
+    struct __msg_list *list;
+    struct packf_msg *head, *tail;
+    int n, cls;
+
+    if (!msg || __atomic_sub_fetch(&msg->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    if (msg->cls < 0)
+    {
+        free(msg);
+        return;
+    }
+
+    cls  = msg->cls;
+    list = &local_free[cls];
+    msg->next  = list->head;
+    list->head = msg;
+    ++list->n;
+
+    /* 释放消息的线程不一定分配消息，过多的部分交给其他线程 */
+    if (list->n > MSG_LOCAL_MAX)
+    {
+        n = __msg_take(list, MSG_LOCAL_MAX / 2, &head, &tail);
+        pthread_mutex_lock(&global_lock);
+        __msg_give(&global_free[cls], head, tail, n);
+        pthread_mutex_unlock(&global_lock);
+    }
+}
+
+void packf_msg_thread_exit(void)
+{
+    struct packf_msg *head, *tail;
+    int cls, n;
+
+    for (cls = 0; cls < MSG_CLASSES; ++cls)
+    {
+        if (!(n = __msg_take(&local_free[cls], local_free[cls].n, &head,
+                        &tail)))
+            continue;
+        pthread_mutex_lock(&global_lock);
+        __msg_give(&global_free[cls], head, tail, n);
+        pthread_mutex_unlock(&global_lock);
+    }
+}
+
@@ -0,0 +1,80 @@
+/*
+ * Reference counted packed messages, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# ifndef _PACKF_MSG_H_
+# define _PACKF_MSG_H_
+
+# include <stddef.h>
+
+# include "packf.h"
+
+# ifdef  __cplusplus
+extern "C"
+{
+# endif
+
+/*
+ * 引用计数的打包消息：一条消息打包一次后，可以被多个发送线程只读地共享
+ * （例如同一条行情发给几百个订阅者），不需要为每个订阅者拷贝一份。
+ *
+ * 消息的内存按大小分级从 slab 中分配，一个 slab 中可以放多条消息。最后一个
+ * 引用释放时，消息回到当前线程的空闲链表中，下次同一线程分配时直接复用；
+ * 线程的空闲链表过长时，一部分会移到全局链表，供其他线程使用。超过最大
+ * 级别的消息直接使用 malloc/free. slab 不会还给系统。
+ *
+ * 引用计数使用原子操作，packf_msg_ref/packf_msg_unref 可以在任意线程调用。
+ * 消息共享后数据不能再修改。
+ */
+struct packf_msg
+{
+    void               *data;   /* 打包的数据 */
+    int                 len;    /* 数据长度 */
+    int                 cap;    /* data 的容量 */
+    int                 refcnt; /* 内部使用 */
+    int                 cls;    /* 内部使用 */
+    struct packf_msg   *next;   /* 内部使用 */
+};
+
+/*
+ * 函数：packf_msg_alloc
+ * 功能：分配一条容量至少为 size 的空消息，引用计数为 1
+ * 返回值：
+ *      成功返回消息，内存不足时返回 NULL
+ */
+extern struct packf_msg *packf_msg_alloc(int size);
+
+/*
+ * 函数：packf_msg_pack
+ * 功能：分配容量为 max 的消息，并按 format 打包
+ * 参数：
+ *      msg:    成功时返回消息，引用计数为 1
+ *      max:    消息的最大长度
+ *      format: 格式字符串，和后面的变参对应
+ *      ...:    变参，和 format 对应
+ * 返回值：
+ *      >= 0 : 成功，返回打包的数据总长度
+ *      < 0  : 失败，*msg 为 NULL
+ */
+extern int packf_msg_pack(struct packf_msg **msg, int max,
+        char const *format, ...);
+
+/* 增加一个引用，返回 msg */
+extern struct packf_msg *packf_msg_ref(struct packf_msg *msg);
+
+/* 释放一个引用，最后一个引用释放时回收消息 */
+extern void packf_msg_unref(struct packf_msg *msg);
+
+/* 线程退出前调用，把当前线程的空闲链表移到全局链表 */
+extern void packf_msg_thread_exit(void);
+
+# ifdef  __cplusplus
+}
+# endif
+
+# endif
+
@@ -0,0 +1,933 @@
+/*
+ * Transcoding packed messages to JSON and CSV text, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdint.h>
+# include <math.h>
+# include <float.h>
+
+# include "packf_text.h"
+
+# define ERR_RET_PRINT(ret) do {                                        \
+    if (packf_print_error)                                              \
+        fprintf(stderr, "%s: %s\n", __func__, packf_strerror(ret));     \
+    return ret;                                                         \
+} while (0)
+
+# define NEG_RET(x) do {                                                \
+    int __ret = (x);                                                    \
+    if (__ret < 0) return __ret;                                        \
+} while (0)
+
+# define TEXT_DEPTH     32
+# define TEXT_PREFIX    256
+# define TEXT_NUM       48      /* 一个数字最长的输出 */
+# define TEXT_FULL      (-1000) /* 输出缓冲区已满，不在错误码的范围内 */
+
+# define TEXT_NEED(c, n) do {                                           \
+    if ((c)->end - (c)->p < (long)(n)) return TEXT_FULL;                \
+} while (0)
+
+# define TEXT_PUT(c, ch) do {                                           \
+    TEXT_NEED(c, 1);                                                    \
+    *(c)->p++ = (ch);                                                   \
+} while (0)
+
+struct __text_name
+{
+    char const                 *name;
+    int                         len;
+    struct __text_name const   *kids;   /* 结构体的字段名 */
+    int                         nkids;
+};
+
+struct packf_text
+{
+    char                       *format;
+    char                       *names;
+    struct __text_name         *pool;
+    struct __text_name const   *root;
+    int                         nroot;
+    int                         mode;
+};
+
+struct __text_level
+{
+    struct __text_name const   *names;  /* 结构体的字段名，数组为元素的字段名 */
+    int                         nnames;
+    int                         count;  /* 已经输出的元素个数 */
+    int                         obj;    /* 按字段名输出为对象 */
+    int                         plen;   /* CSV 展开时外层列名前缀的长度 */
+};
+
+struct __text_ctx
+{
+    struct packf_text const    *t;
+    char                       *p;
+    char                       *end;
+    int                         csv;
+    int                         header;
+    int                         cell;   /* CSV 中以 JSON 输出的列所在的层 */
+    int                         skip;   /* 列名行中跳过的层数 */
+    int                         cols;
+    int                         top;
+    int                         plen;
+    char                        prefix[TEXT_PREFIX];
+    struct __text_level         lv[TEXT_DEPTH];
+};
+
+static char const __text_digits[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static double const __text_p10[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+};
+
+/*
+ * JSON 字符串中需要转义的字符，值为 '\\' 之后的字符，'u' 为 \u00XX.
+ * 'x' 为 UTF-8 多字节字符的字节，不合法时按 \u00XX 输出
+ */
+static char const __text_esc[256] =
+{
+    [0 ... 7] = 'u', ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', [0x0B] = 'u',
+    ['\f'] = 'f', ['\r'] = 'r', [0x0E ... 0x1F] = 'u',
+    ['"'] = '"', ['\\'] = '\\', [0x80 ... 0xFF] = 'x',
+};
+
+/* ---------------------------------------------------------------- */
+/* 字段名 */
+
+static int __text_name_char(char ch)
+{
+    return ch && ch != ',' && ch != '[' && ch != ']' && ch != ' ' &&
+        ch != '\t' && ch != '\n' && ch != '\r';
+}
+
+static char const *__text_space(char const *s)
+{
+    while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+        ++s;
+
+    return s;
+}
+
+/* 这一层（到 ']' 或结尾）字段名的个数 */
+static int __text_count(char const *s)
+{
+    int depth = 0, n;
+
+    s = __text_space(s);
+    if (!*s || *s == ']')
+        return 0;
+
+    for (n = 1; *s && (depth || *s != ']'); ++s)
+    {
+        if (*s == '[')
+            ++depth;
+        else if (*s == ']')
+            --depth;
+        else if (*s == ',' && !depth)
+            ++n;
+    }
+
+    return n;
+}
+
+static char const *__text_parse(char const *s, struct __text_name *list,
+        int n, struct __text_name **next)
+{
+    struct __text_name *kids;
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        s = __text_space(s);
+        list[i].name = s;
+        for (; __text_name_char(*s); ++s)
+        {
+            if (*s == '"' || *s == '\\' || (uint8_t)*s < 0x20)
+                return NULL;
+        }
+        if (!(list[i].len = (int)(s - list[i].name)))
+            return NULL;
+
+        s = __text_space(s);
+        if (*s == '[')
+        {
+            list[i].nkids = __text_count(++s);
+            kids = *next;
+            *next += list[i].nkids;
+            if (!(s = __text_parse(s, kids, list[i].nkids, next)))
+                return NULL;
+            s = __text_space(s);
+            if (*s++ != ']')
+                return NULL;
+            list[i].kids = list[i].nkids ? kids : NULL;
+            s = __text_space(s);
+        }
+
+        if (i < n - 1 && *s++ != ',')
+            return NULL;
+    }
+
+    return s;
+}
+
+struct packf_text *packf_text_new(char const *format, char const *names,
+        int mode)
+{
+    struct packf_text *t;
+    struct __text_name *next;
+    char const *s;
+    int n;
+
+    if (!format || (mode != PACKF_TEXT_JSON && mode != PACKF_TEXT_CSV))
+        return NULL;
+
+    if (!(t = calloc(1, sizeof(*t))))
+        return NULL;
+    t->mode = mode;
+    if (!(t->format = strdup(format)))
+        goto fail;
+    if (!names)
+        return t;
+
+    /* 每个字段名之后是 ',' '[' ']' 或结尾 */
+    for (s = names, n = 1; *s; ++s)
+        n += *s == ',' || *s == '[';
+    if (!(t->names = strdup(names)) ||
+            !(t->pool = calloc(n, sizeof(*t->pool))))
+        goto fail;
+
+    t->nroot = __text_count(t->names);
+    next = t->pool + t->nroot;
+    s = __text_parse(t->names, t->pool, t->nroot, &next);
+    if (!s || *__text_space(s))
+        goto fail;
+    t->root = t->nroot ? t->pool : NULL;
+
+    return t;
+
+fail:
+    packf_text_free(t);
+
+    return NULL;
+}
+
+void packf_text_free(struct packf_text *t)
+{
+    if (!t)
+        return;
+
+    free(t->format);
+    free(t->names);
+    free(t->pool);
+    free(t);
+}
+
+/* ---------------------------------------------------------------- */
+/* 数字 */
+
+static char *__text_u64(char *p, uint64_t v)
+{
+    char tmp[20], *q = tmp + sizeof(tmp);
+
+    while (v >= 100)
+    {
+        q -= 2;
+        memcpy(q, __text_digits + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10)
+    {
+        q -= 2;
+        memcpy(q, __text_digits + v * 2, 2);
+    }
+    else
+    {
+        *--q = (char)('0' + v);
+    }
+
+    memcpy(p, q, tmp + sizeof(tmp) - q);
+
+    return p + (tmp + sizeof(tmp) - q);
+}
+
+static char *__text_i64(char *p, int64_t v)
+{
+    if (v < 0)
+    {
+        *p++ = '-';
+        return __text_u64(p, -(uint64_t)v);
+    }
+
+    return __text_u64(p, (uint64_t)v);
+}
+
+/* 输出 r / 10^k */
+static char *__text_fixed(char *p, uint64_t r, int k)
+{
+    char tmp[24];
+    int n = (int)(__text_u64(tmp, r) - tmp);
+
+    if (k == 0)
+    {
+        memcpy(p, tmp, n);
+        return p + n;
+    }
+    if (n > k)
+    {
+        memcpy(p, tmp, n - k);
+        p += n - k;
+        *p++ = '.';
+        memcpy(p, tmp + n - k, k);
+        return p + k;
+    }
+
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', k - n);
+    p += k - n;
+    memcpy(p, tmp, n);
+
+    return p + n;
+}
+
+static uint64_t __text_round(double s)
+{
+    uint64_t r = (uint64_t)s;
+
+    return s - (double)r >= 0.5 ? r + 1 : r;
+}
+
+/*
+ * 能还原为 v 的最短的十进制数。先找最少的小数位数 k, 使 v * 10^k 取整后
+ * 除以 10^k 仍为 v（整数和除法都是精确的或正确舍入的，与 strtod 的结果
+ * 相同）；不满足时（很大、很小或有效数字很多）用 %.*g 从 15 位开始尝试。
+ */
+static char *__text_double(char *p, double v)
+{
+    double a = fabs(v), s;
+    uint64_t r;
+    int k;
+
+    if (signbit(v))
+        *p++ = '-';
+    if (a == 0)
+    {
+        *p++ = '0';
+        return p;
+    }
+
+    for (k = 0; k < (int)(sizeof(__text_p10) / sizeof(__text_p10[0])); ++k)
+    {
+        s = a * __text_p10[k];
+        if (s >= 9007199254740992.0)
+            break;
+        r = __text_round(s);
+        if ((double)r / __text_p10[k] == a)
+            return __text_fixed(p, r, k);
+    }
+
+    /* 非规格化数的有效数字可能少于 15 位 */
+    for (k = a < DBL_MIN ? 1 : 15; k < 17; ++k)
+    {
+        snprintf(p, TEXT_NUM - 1, "%.*g", k, a);
+        if (strtod(p, NULL) == a)
+            break;
+    }
+    if (k == 17)
+        snprintf(p, TEXT_NUM - 1, "%.17g", a);
+
+    return p + strlen(p);
+}
+
+/*
+ * float 的还原：r / 10^k 在 v 与相邻的两个 float 的中点之间。v 只有 24 位
+ * 有效数字，k <= 12 时中点乘以 10^k 在 double 中是精确的。
+ */
+static char *__text_float(char *p, float v)
+{
+    float a = fabsf(v);
+    double lo, hi, s;
+    uint64_t r;
+    char g[TEXT_NUM], *q = NULL;
+    int k, n;
+
+    if (signbit(v))
+        *p++ = '-';
+    if (a == 0)
+    {
+        *p++ = '0';
+        return p;
+    }
+
+    lo = ((double)nextafterf(a, 0) + a) / 2;
+    hi = ((double)nextafterf(a, INFINITY) + a) / 2;
+    for (k = 0; k <= 12; ++k)
+    {
+        s = a * __text_p10[k];
+        if (s >= 9007199254740992.0)
+            break;
+        r = __text_round(s);
+        if (lo * __text_p10[k] < (double)r && (double)r < hi * __text_p10[k])
+        {
+            q = __text_fixed(p, r, k);
+            /* 10 位以上的整数超过 float 的精度，指数形式可能更短 */
+            if (k || r < 1000000000)
+                return q;
+            break;
+        }
+    }
+
+    for (k = a < FLT_MIN ? 1 : 6; k < 9; ++k)
+    {
+        snprintf(g, TEXT_NUM - 1, "%.*g", k, a);
+        if (strtof(g, NULL) == a)
+            break;
+    }
+    if (k == 9)
+        snprintf(g, TEXT_NUM - 1, "%.9g", a);
+
+    n = (int)strlen(g);
+    if (q && q - p <= n)
+        return q;
+    memcpy(p, g, n);
+
+    return p + n;
+}
+
+/* ---------------------------------------------------------------- */
+/* 输出 */
+
+/* CSV 的 JSON 列中 '"' 写为 '""' */
+static int __text_quote(struct __text_ctx *c)
+{
+    TEXT_NEED(c, 2);
+    *c->p++ = '"';
+    if (c->cell)
+        *c->p++ = '"';
+
+    return 0;
+}
+
+/* s 开始的合法 UTF-8 字符的字节数，不合法（包括过长的编码和代理）时返回 0 */
+static int __text_utf8(uint8_t const *s, int len)
+{
+    uint8_t lo = 0x80, hi = 0xBF;
+    int n, i;
+
+    if (s[0] < 0xC2 || s[0] > 0xF4)
+        return 0;
+    n = s[0] < 0xE0 ? 2 : (s[0] < 0xF0 ? 3 : 4);
+    if (len < n)
+        return 0;
+    if (s[0] == 0xE0)
+        lo = 0xA0;
+    else if (s[0] == 0xED)
+        hi = 0x9F;
+    else if (s[0] == 0xF0)
+        lo = 0x90;
+    else if (s[0] == 0xF4)
+        hi = 0x8F;
+    if (s[1] < lo || s[1] > hi)
+        return 0;
+    for (i = 2; i < n; ++i)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+            return 0;
+    }
+
+    return n;
+}
+
+static int __text_json_str(struct __text_ctx *c, uint8_t const *s, int len)
+{
+    char e;
+    int i, run;
+
+    NEG_RET(__text_quote(c));
+    for (i = 0; i < len; )
+    {
+        for (run = i; run < len && !__text_esc[s[run]]; ++run)
+            ;
+        TEXT_NEED(c, run - i + 8);
+        memcpy(c->p, s + i, run - i);
+        c->p += run - i;
+        if ((i = run) == len)
+            break;
+
+        e = __text_esc[s[i]];
+        if (e == 'x' && (run = __text_utf8(s + i, len - i)))
+        {
+            memcpy(c->p, s + i, run);
+            c->p += run;
+            i += run;
+            continue;
+        }
+        *c->p++ = '\\';
+        if (e == '"')
+        {
+            NEG_RET(__text_quote(c));
+        }
+        else if (e == 'u' || e == 'x')
+        {
+            memcpy(c->p, "u00", 3);
+            c->p[3] = "0123456789abcdef"[s[i] >> 4];
+            c->p[4] = "0123456789abcdef"[s[i] & 0xF];
+            c->p += 5;
+        }
+        else
+        {
+            *c->p++ = e;
+        }
+        ++i;
+    }
+
+    return __text_quote(c);
+}
+
+/* RFC 4180: 含有 ',' '"' 或换行时加引号，其中的 '"' 写为 '""' */
+static int __text_csv_str(struct __text_ctx *c, uint8_t const *s, int len)
+{
+    int i, n;
+
+    for (i = 0; i < len; ++i)
+    {
+        if (s[i] == ',' || s[i] == '"' || s[i] == '\n' || s[i] == '\r')
+            break;
+    }
+
+    if (i == len)
+    {
+        TEXT_NEED(c, len);
+        memcpy(c->p, s, len);
+        c->p += len;
+        return 0;
+    }
+
+    for (n = len + 2; i < len; ++i)
+        n += s[i] == '"';
+    TEXT_NEED(c, n);
+    *c->p++ = '"';
+    for (i = 0; i < len; ++i)
+    {
+        *c->p++ = (char)s[i];
+        if (s[i] == '"')
+            *c->p++ = '"';
+    }
+    *c->p++ = '"';
+
+    return 0;
+}
+
+static int __text_name_out(struct __text_ctx *c, struct __text_name const *node,
+        int index)
+{
+    if (node)
+    {
+        TEXT_NEED(c, node->len);
+        memcpy(c->p, node->name, node->len);
+        c->p += node->len;
+    }
+    else
+    {
+        TEXT_NEED(c, TEXT_NUM);
+        c->p = __text_u64(c->p, (uint64_t)index);
+    }
+
+    return 0;
+}
+
+/* CSV 中当前的字段在一行中展开为列，不在 JSON 的列中 */
+static int __text_flat(struct __text_ctx const *c)
+{
+    return c->csv && !c->cell;
+}
+
+/* 所在结构体中字段的名字，没有字段名时为 NULL */
+static int __text_node(struct __text_ctx const *c,
+        struct packf_visit_field const *fld, struct __text_name const **node)
+{
+    struct __text_level const *l = &c->lv[c->top];
+
+    *node = NULL;
+    if (!l->obj)
+        return 0;
+    if (fld->index >= l->nnames)
+        return PACKF_NOT_MATCH;
+    *node = &l->names[fld->index];
+
+    return 0;
+}
+
+/* 输出一个值之前的分隔符和 JSON 的键，或者 CSV 的列名 */
+static int __text_item(struct __text_ctx *c,
+        struct packf_visit_field const *fld, struct __text_name const **node)
+{
+    struct __text_level *l = &c->lv[c->top];
+
+    NEG_RET(__text_node(c, fld, node));
+    if (__text_flat(c))
+    {
+        if (c->cols++)
+            TEXT_PUT(c, ',');
+        if (c->header)
+        {
+            TEXT_NEED(c, c->plen);
+            memcpy(c->p, c->prefix, c->plen);
+            c->p += c->plen;
+            NEG_RET(__text_name_out(c, *node, fld->index));
+        }
+        return 0;
+    }
+
+    if (l->count++)
+        TEXT_PUT(c, ',');
+    if (l->obj && fld->elem < 0)
+    {
+        NEG_RET(__text_quote(c));
+        NEG_RET(__text_name_out(c, *node, fld->index));
+        NEG_RET(__text_quote(c));
+        TEXT_PUT(c, ':');
+    }
+
+    return 0;
+}
+
+static int __text_push(struct __text_ctx *c, struct __text_name const *node,
+        int obj)
+{
+    struct __text_level *l;
+
+    if (c->top + 1 >= TEXT_DEPTH)
+        return PACKF_OVER_LIMIT;
+
+    l = &c->lv[++c->top];
+    l->names  = node ? node->kids : NULL;
+    l->nnames = node ? node->nkids : 0;
+    l->count  = 0;
+    l->obj    = obj && l->names;
+    l->plen   = c->plen;
+
+    return 0;
+}
+
+/* ---------------------------------------------------------------- */
+/* packf_visit 的回调 */
+
+static int __text_value(void *ctx, struct packf_visit_field const *fld,
+        struct packf_value const *value)
+{
+    struct __text_ctx *c = ctx;
+    struct __text_name const *node;
+
+    if (c->skip)
+        return 0;
+    NEG_RET(__text_item(c, fld, &node));
+    if (c->header)
+        return 0;
+
+    TEXT_NEED(c, TEXT_NUM);
+    if (fld->type == 'f' || fld->type == 'F')
+    {
+        if (!isfinite(value->f))
+        {
+            if (!__text_flat(c))
+            {
+                memcpy(c->p, "null", 4);
+                c->p += 4;
+            }
+        }
+        else if (fld->type == 'f')
+        {
+            c->p = __text_float(c->p, (float)value->f);
+        }
+        else
+        {
+            c->p = __text_double(c->p, value->f);
+        }
+    }
+    else
+    {
+        c->p = __text_i64(c->p, value->i);
+    }
+
+    return 0;
+}
+
+static int __text_bytes(void *ctx, struct packf_visit_field const *fld,
+        void const *data, int len)
+{
+    struct __text_ctx *c = ctx;
+    struct __text_name const *node;
+    int8_t const *s = data;
+    int i;
+
+    if (c->skip)
+        return 0;
+    NEG_RET(__text_item(c, fld, &node));
+    if (c->header)
+        return 0;
+
+    if (fld->type != 'c')
+    {
+        if (__text_flat(c))
+            return __text_csv_str(c, data, len);
+        return __text_json_str(c, data, len);
+    }
+
+    /* c 数组为整数的数组 */
+    TEXT_NEED(c, 4);
+    if (__text_flat(c))
+        *c->p++ = '"';
+    *c->p++ = '[';
+    for (i = 0; i < len; ++i)
+    {
+        TEXT_NEED(c, 8);
+        if (i)
+            *c->p++ = ',';
+        c->p = __text_i64(c->p, s[i]);
+    }
+    TEXT_NEED(c, 2);
+    *c->p++ = ']';
+    if (__text_flat(c))
+        *c->p++ = '"';
+
+    return 0;
+}
+
+static int __text_array_begin(void *ctx, struct packf_visit_field const *fld,
+        int count)
+{
+    struct __text_ctx *c = ctx;
+    struct __text_name const *node;
+
+    (void)count;
+    if (c->skip)
+    {
+        ++c->skip;
+        return 0;
+    }
+    NEG_RET(__text_item(c, fld, &node));
+    if (__text_flat(c))
+    {
+        /* 整个数组为一列 */
+        if (c->header)
+        {
+            c->skip = 1;
+            return 0;
+        }
+        TEXT_PUT(c, '"');
+        c->cell = c->top + 1;
+    }
+    TEXT_PUT(c, '[');
+
+    return __text_push(c, node, 0);
+}
+
+static int __text_array_end(void *ctx, struct packf_visit_field const *fld)
+{
+    struct __text_ctx *c = ctx;
+
+    (void)fld;
+    if (c->skip)
+    {
+        --c->skip;
+        return 0;
+    }
+    TEXT_PUT(c, ']');
+    if (c->cell == c->top)
+    {
+        TEXT_PUT(c, '"');
+        c->cell = 0;
+    }
+    --c->top;
+
+    return 0;
+}
+
+static int __text_struct_begin(void *ctx, struct packf_visit_field const *fld)
+{
+    struct __text_ctx *c = ctx;
+    struct __text_level *l = &c->lv[c->top];
+    struct __text_name const *node;
+    struct __text_name elem;
+    int len;
+
+    if (c->skip)
+    {
+        ++c->skip;
+        return 0;
+    }
+
+    if (fld->elem >= 0)
+    {
+        /* 结构体数组的元素，字段名保存在数组的一层中 */
+        if (l->count++)
+            TEXT_PUT(c, ',');
+        elem.kids  = l->names;
+        elem.nkids = l->nnames;
+        node = &elem;
+    }
+    else if (__text_flat(c))
+    {
+        /* 展开为多列，列名加上前缀 */
+        NEG_RET(__text_node(c, fld, &node));
+        NEG_RET(__text_push(c, node, 1));
+        if (c->header)
+        {
+            len = node ? node->len : 10;
+            if (c->plen + len + 1 >= TEXT_PREFIX)
+                return PACKF_OVER_LIMIT;
+            if (node)
+                memcpy(c->prefix + c->plen, node->name, len);
+            else
+                len = (int)(__text_u64(c->prefix + c->plen,
+                            (uint64_t)fld->index) - (c->prefix + c->plen));
+            c->plen += len;
+            c->prefix[c->plen++] = '.';
+        }
+        return 0;
+    }
+    else
+    {
+        NEG_RET(__text_item(c, fld, &node));
+    }
+
+    NEG_RET(__text_push(c, node, 1));
+    TEXT_PUT(c, c->lv[c->top].obj ? '{' : '[');
+
+    return 0;
+}
+
+static int __text_struct_end(void *ctx, struct packf_visit_field const *fld)
+{
+    struct __text_ctx *c = ctx;
+
+    (void)fld;
+    if (c->skip)
+    {
+        --c->skip;
+        return 0;
+    }
+    if (__text_flat(c))
+    {
+        c->plen = c->lv[c->top--].plen;
+        return 0;
+    }
+    TEXT_PUT(c, c->lv[c->top].obj ? '}' : ']');
+    --c->top;
+
+    return 0;
+}
+
+static struct packf_visitor const __text_visitor =
+{
+    .value        = __text_value,
+    .bytes        = __text_bytes,
+    .array_begin  = __text_array_begin,
+    .array_end    = __text_array_end,
+    .struct_begin = __text_struct_begin,
+    .struct_end   = __text_struct_end,
+};
+
+/* ---------------------------------------------------------------- */
+
+static int __text_run(struct packf_text const *t, void const *buf, size_t len,
+        char *out, size_t max, int header, int *used)
+{
+    struct __text_ctx c;
+    int ret;
+
+    c.t      = t;
+    c.p      = out;
+    c.end    = out + (max > INT32_MAX ? INT32_MAX : max);
+    c.csv    = t->mode == PACKF_TEXT_CSV;
+    c.header = header;
+    c.cell   = 0;
+    c.skip   = 0;
+    c.cols   = 0;
+    c.top    = 0;
+    c.plen   = 0;
+    c.lv[0].names  = t->root;
+    c.lv[0].nnames = t->nroot;
+    c.lv[0].count  = 0;
+    c.lv[0].obj    = t->root != NULL;
+    c.lv[0].plen   = 0;
+
+    if (!c.csv)
+        TEXT_PUT(&c, c.lv[0].obj ? '{' : '[');
+    if ((ret = packf_visit(buf, len, t->format, &__text_visitor, &c)) < 0)
+        return ret;
+    *used = ret;
+    if (!c.csv)
+        TEXT_PUT(&c, c.lv[0].obj ? '}' : ']');
+    TEXT_PUT(&c, '\n');
+
+    return (int)(c.p - out);
+}
+
+int packf_text(struct packf_text const *t, void const *buf, size_t len,
+        char *out, size_t max)
+{
+    int ret, used;
+
+    if (!t || !buf || !out)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    if ((ret = __text_run(t, buf, len, out, max, 0, &used)) == TEXT_FULL)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    return ret;
+}
+
+int packf_text_next(struct packf_text const *t, void const **current,
+        int *left, char *out, size_t max)
+{
+    int ret, used;
+
+    if (!t || !current || !*current || !left || !out)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+
+    if ((ret = __text_run(t, *current, *left, out, max, 0, &used)) < 0)
+    {
+        if (ret == TEXT_FULL)
+            ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+        return ret;
+    }
+
+    *current = (uint8_t const *)*current + used;
+    *left   -= used;
+
+    return ret;
+}
+
+int packf_text_header(struct packf_text const *t, void const *buf,
+        size_t len, char *out, size_t max)
+{
+    int ret, used;
+
+    if (!t || !buf || !out)
+        ERR_RET_PRINT(PACKF_NULL_POINTER);
+    if (t->mode != PACKF_TEXT_CSV)
+        return 0;
+
+    if ((ret = __text_run(t, buf, len, out, max, 1, &used)) == TEXT_FULL)
+        ERR_RET_PRINT(PACKF_OUT_OF_BUF);
+
+    return ret;
+}
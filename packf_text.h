@@ -0,0 +1,100 @@
+/*
+ * Transcoding packed messages to JSON and CSV text, built on packf
+ *
+ * This code is in the public domain.
+ * You may use this code any way you wish, private, educational,
+ * or commercial. It's free.
+ */
+
+# ifndef _PACKF_TEXT_H_
+# define _PACKF_TEXT_H_
+
+# include <stddef.h>
+
+# include "packf.h"
+
+# ifdef  __cplusplus
+extern "C"
+{
+# endif
+
+/*
+ * 文本转换：按 format 直接把打包的数据转换为 JSON 或 CSV 的一行（以 '\n'
+ * 结尾），不需要先 unpackf 到结构体再逐个字段 printf, 用于审计、调试和
+ * 回放日志。数据的解析与 packf_visit 相同，不支持的格式也相同。
+ *
+ * 字段名 names 和 format 一起给出，按顺序用逗号分隔，结构体（包括结构体
+ * 数组）的字段名放在 [] 中，a 和 C 也占一个名字（不输出）。
+ * example: format 为 "D -16s =10[w d] F" 时
+ *          names 为 "id, name, legs[qty, px], total"
+ * names 为 NULL, 或结构体没有给出字段名时，结构体按字段的顺序输出为数组。
+ * 名字中不能有 '"' '\\' 和控制字符。
+ *
+ * JSON: 结构体为对象，数组为数组，s/S 为字符串，c 数组为整数的数组。
+ *      字符串中不合法的 UTF-8 字节输出为 \u00XX. 整数按有符号数输出；
+ *      f/F 输出能精确还原的最短的十进制数，NaN 和无穷大输出为 null.
+ * CSV:  每个字段一列，结构体的字段展开为多列（列名为 "legs.qty" 的形式），
+ *      数组和结构体数组在一列中，内容为数组的 JSON. 含有 ',' '"' 或换行的
+ *      列按 RFC 4180 加引号。NaN 和无穷大为空列。
+ */
+# define PACKF_TEXT_JSON    0
+# define PACKF_TEXT_CSV     1
+
+struct packf_text;
+
+/*
+ * 函数：packf_text_new
+ * 功能：创建转换器，format 和 names 会被复制
+ * 参数：
+ *      format: 消息的格式字符串
+ *      names:  字段名，可以为 NULL
+ *      mode:   PACKF_TEXT_JSON 或 PACKF_TEXT_CSV
+ * 返回值：
+ *      成功返回转换器，参数错误或内存不足时返回 NULL
+ */
+extern struct packf_text *packf_text_new(char const *format,
+        char const *names, int mode);
+
+extern void packf_text_free(struct packf_text *t);
+
+/*
+ * 函数：packf_text
+ * 功能：把 buf 中的一条消息转换为一行文本，写入 out
+ * 参数：
+ *      buf:    打包的数据
+ *      len:    buf 的长度
+ *      out:    输出缓冲区，不以 '\0' 结尾
+ *      max:    out 的长度
+ * 返回值：
+ *      >= 0 : 成功，返回写入 out 的长度
+ *      < 0  : 失败，out 放不下时返回 PACKF_OUT_OF_BUF, 字段名不够时返回
+ *             PACKF_NOT_MATCH
+ */
+extern int packf_text(struct packf_text const *t, void const *buf,
+        size_t len, char *out, size_t max);
+
+/*
+ * 函数：packf_text_next
+ * 功能：类似 packf_text, 用于连续存放的多条消息，成功后 *current 和 *left
+ *       指向下一条消息。返回 PACKF_OUT_OF_BUF 时它们不变，可以输出 out 中
+ *       已有的数据后重试。
+ */
+extern int packf_text_next(struct packf_text const *t, void const **current,
+        int *left, char *out, size_t max);
+
+/*
+ * 函数：packf_text_header
+ * 功能：CSV 时按 buf 中的一条消息写出列名的一行，JSON 时不写入
+ * 返回值：
+ *      >= 0 : 成功，返回写入 out 的长度
+ *      < 0  : 失败
+ */
+extern int packf_text_header(struct packf_text const *t, void const *buf,
+        size_t len, char *out, size_t max);
+
+# ifdef  __cplusplus
+}
+# endif
+
+# endif
+
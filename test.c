@@ -1,9 +1,20 @@
 # include <stdio.h>
 # include <stdint.h>
 # include <string.h>
+# include <stdlib.h>
+# include <math.h>
 # include <assert.h>
+# include <pthread.h>
+# include <unistd.h>
+# include <sys/socket.h>
 
 # include "packf.h"
+# include "packf_frame.h"
+# include "packf_msg.h"
+# include "packf_lz.h"
+# include "packf_io.h"
+# include "packf_mpsc.h"
+# include "packf_text.h"
 
 void bin_dump(void *pkg, int len)
 {
@@ -24,6 +35,2696 @@ void bin_dump(void *pkg, int len)
         putchar('\n');
 }
 
+static void test_frame(void)
+{
+    char buf[512], ring[32], name[32];
+    struct packf_frame frames[8];
+    size_t used;
+    uint32_t id;
+    int i, n, len = 0;
+    void *cur = buf;
+    int left = sizeof(buf);
+
+    for (i = 0; i < 3; ++i)
+        len += vpackf_frame(&cur, &left, 2, "d -32s", 100 + i, "frame");
+    assert(len == 3 * (2 + 4 + 1 + 5));
+
+    /* 最后一条消息不完整 */
+    n = packf_frame_scan(buf, len - 1, 2, frames, 8, &used);
+    assert(n == 2 && used == 2 * 12);
+    n = packf_frame_scan(buf, len, 2, frames, 8, &used);
+    assert(n == 3 && used == (size_t)len);
+    for (i = 0; i < n; ++i)
+    {
+        assert(unpackf(frames[i].data, frames[i].len, "d -32s",
+                    &id, name) == 10);
+        assert(id == (uint32_t)(100 + i) && strcmp(name, "frame") == 0);
+    }
+
+    /* 环形缓冲区：第二条消息的消息体跨越缓冲区末尾 */
+    for (i = 0; i < 2 * 12; ++i)
+        ring[(20 + i) % sizeof(ring)] = buf[i];
+    n = packf_frame_scan_ring(ring, sizeof(ring), 20, 24, 2, frames, 8, &used);
+    assert(n == 2 && used == 24);
+    assert(frames[0].len == 10 && frames[0].wrap == NULL);
+    assert(frames[1].data == ring + 2 && frames[1].len == 10);
+
+    for (i = 0; i < 12; ++i)
+        ring[(28 + i) % sizeof(ring)] = buf[i];
+    n = packf_frame_scan_ring(ring, sizeof(ring), 28, 12, 2, frames, 8, &used);
+    assert(n == 1 && used == 12);
+    assert(frames[0].len == 2 && frames[0].wrap == ring);
+    assert(frames[0].wrap_len == 8);
+
+    assert(packf_frame(buf, sizeof(buf), 1, "300a") == PACKF_BE_CUT_OFF);
+}
+
+static void test_iov(void)
+{
+# pragma pack(1)
+    struct seg_msg
+    {
+        uint8_t         c;
+        uint16_t        w;
+        uint32_t        d;
+        uint64_t        D;
+        float           f;
+        double          F;
+        uint8_t         sub_len;
+        struct
+        {
+            uint32_t    id;
+            uint8_t     name_len;
+            char        name[16];
+        } sub;
+        uint16_t        arr_len;
+        uint16_t        arr[4];
+        char            s8[8];
+        char            S6[6];
+        char            a[2];
+        uint16_t        items_len;
+        struct
+        {
+            uint8_t     c;
+            uint16_t    w;
+        } items[3];
+    } msg, out, ref;
+# pragma pack()
+
+    char const *fmt = "[c w d D f F -[d -16s] =4w 8s 6S 2a =3[c w]]";
+    char buf[256], seg_buf[256];
+    struct iovec iov[3];
+    int len, a, b;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.c = 1; msg.w = 0x0203; msg.d = 0x04050607; msg.D = 0x08090a0b0c0d0e0fllu;
+    msg.f = 1.5; msg.F = 2.25;
+    msg.sub.id = 77;
+    strcpy(msg.sub.name, "segment");
+    msg.arr_len = 3; msg.arr[0] = 1; msg.arr[1] = 2; msg.arr[2] = 0x8001;
+    strcpy(msg.s8, "ring");
+    strcpy(msg.S6, "wrap");
+    msg.items_len = 2;
+    msg.items[0].c = 9; msg.items[0].w = 0x1234;
+    msg.items[1].c = 8; msg.items[1].w = 0x5678;
+
+    len = packf(buf, sizeof(buf), fmt, &msg);
+    assert(len > 0);
+    memset(&ref, 0, sizeof(ref));
+    assert(unpackf(buf, len, fmt, &ref) == len);
+    assert(ref.sub_len == 4 + 1 + 7 && ref.sub.id == 77);
+    assert(strcmp(ref.sub.name, "segment") == 0 && ref.arr[2] == 0x8001);
+
+    /* 在任意两个位置把缓冲区分为三段 */
+    for (a = 0; a <= len; ++a)
+    {
+        for (b = a; b <= len; ++b)
+        {
+            iov[0].iov_base = seg_buf;
+            iov[0].iov_len  = a;
+            iov[1].iov_base = seg_buf + a + 16;
+            iov[1].iov_len  = b - a;
+            iov[2].iov_base = seg_buf + b + 32;
+            iov[2].iov_len  = sizeof(seg_buf) - b - 32;
+
+            memset(seg_buf, 0xff, sizeof(seg_buf));
+            assert(packf_iov(iov, 3, fmt, &msg) == len);
+            assert(memcmp(seg_buf, buf, a) == 0);
+            assert(memcmp(seg_buf + a + 16, buf + a, b - a) == 0);
+            assert(memcmp(seg_buf + b + 32, buf + b, len - b) == 0);
+
+            memset(&out, 0, sizeof(out));
+            assert(unpackf_iov(iov, 3, fmt, &out) == len);
+            assert(memcmp(&out, &ref, sizeof(out)) == 0);
+        }
+    }
+
+    iov[0].iov_base = buf;
+    iov[0].iov_len  = 10;
+    iov[1].iov_base = buf + 10;
+    iov[1].iov_len  = len - 11;
+    assert(unpackf_iov(iov, 2, fmt, &out) == PACKF_OUT_OF_BUF);
+}
+
+static void test_fixed(void)
+{
+# pragma pack(1)
+    struct rec
+    {
+        uint8_t         c;
+        uint16_t        w;
+        uint32_t        d;
+        uint64_t        D;
+        float           f;
+        double          F;
+        char            name[6];
+        char            pad[2];
+        struct
+        {
+            uint16_t    w;
+            uint8_t     c;
+        } sub[2];
+        uint32_t        ids[3];
+    } recs[4], out[4], ref[4];
+# pragma pack()
+
+    char const *fmt = "c w d D f F 6s 2a 2[w c] 3d";
+    char buf[512], ref_buf[512];
+    struct packf_fixed *fx;
+    int i, len, ref_len = 0;
+
+    memset(recs, 0, sizeof(recs));
+    for (i = 0; i < 4; ++i)
+    {
+        recs[i].c = i;
+        recs[i].w = 0x0102 + i;
+        recs[i].d = 0x03040506 + i;
+        recs[i].D = 0x0708090a0b0c0d0ellu + i;
+        recs[i].f = 1.5 + i;
+        recs[i].F = 2.25 + i;
+        strcpy(recs[i].name, "fix");
+        recs[i].pad[0] = 'x';
+        recs[i].sub[1].w = 0x0f0e + i;
+        recs[i].sub[1].c = 'c';
+        recs[i].ids[0] = recs[i].ids[2] = 0x11223344 + i;
+    }
+
+    /* 逐个元素按 format 解析的结果作为参照 */
+    for (i = 0; i < 4; ++i)
+        ref_len += packf(ref_buf + ref_len, sizeof(ref_buf) - ref_len,
+                "[c w d D f F 6s 2a 2[w c] 3d]", &recs[i]);
+    assert(ref_len == (int)sizeof(recs));
+    memset(ref, 0, sizeof(ref));
+    for (i = 0; i < 4; ++i)
+        assert(unpackf(ref_buf + i * sizeof(ref[0]), sizeof(ref[0]),
+                    "[c w d D f F 6s 2a 2[w c] 3d]", &ref[i]) > 0);
+
+    len = packf(buf, sizeof(buf), "4[c w d D f F 6s 2a 2[w c] 3d]", recs);
+    assert(len == ref_len && memcmp(buf, ref_buf, len) == 0);
+    memset(out, 0, sizeof(out));
+    assert(unpackf(buf, len, "4[c w d D f F 6s 2a 2[w c] 3d]", out) == len);
+    assert(memcmp(out, ref, sizeof(out)) == 0);
+
+    fx = packf_fixed_new(fmt);
+    assert(fx && packf_fixed_len(fx) == (int)sizeof(recs[0]));
+    memset(buf, 0xff, sizeof(buf));
+    assert(packf_fixed(fx, buf, sizeof(buf), recs, 4) == ref_len);
+    assert(memcmp(buf, ref_buf, ref_len) == 0);
+    memset(out, 0, sizeof(out));
+    assert(unpackf_fixed(fx, buf, ref_len, out, 4) == ref_len);
+    assert(memcmp(out, ref, sizeof(out)) == 0);
+    assert(packf_fixed(fx, buf, ref_len - 1, recs, 4) == PACKF_OUT_OF_BUF);
+
+    memset(recs[2].name, 'z', sizeof(recs[2].name));
+    assert(packf_fixed(fx, buf, sizeof(buf), recs, 4) == PACKF_BE_CUT_OFF);
+    packf_fixed_free(fx);
+
+    assert(packf_fixed_new("d -16s") == NULL);
+    assert(packf_fixed_new("d 8S") == NULL);
+    assert(packf_fixed_new("d s") == NULL);
+    assert(packf_fixed_new("d [w") == NULL);
+
+    /* 0 个元素的结构体数组不产生任何操作 */
+    fx = packf_fixed_new("d 0[w] 0[w c]");
+    assert(fx && packf_fixed_len(fx) == 4);
+    memset(buf, 0xff, sizeof(buf));
+    assert(packf_fixed(fx, buf, 4, &recs[0].d, 1) == 4);
+    assert(memcmp(buf, "\x03\x04\x05\x06", 4) == 0 &&
+            (uint8_t)buf[4] == 0xff);
+    memset(out, 0xff, sizeof(out));
+    assert(unpackf_fixed(fx, buf, 4, out, 1) == 4);
+    assert(memcmp(out, &recs[0].d, 4) == 0 &&
+            ((uint8_t *)out)[4] == 0xff);
+    packf_fixed_free(fx);
+}
+
+static void test_view(void)
+{
+# pragma pack(1)
+    struct item
+    {
+        uint16_t        w;
+        uint8_t         str_len;
+        char            str[8];
+    } items[3] = { { 1, 0, "one" }, { 2, 0, "two" }, { 3, 0, "three" } };
+    struct pair
+    {
+        uint8_t         c;
+        uint16_t        w;
+    } pairs[2] = { { 'a', 0x1234 }, { 'b', 0x5678 } };
+    struct sub
+    {
+        uint16_t        w;
+        uint32_t        d;
+    } sub = { 7, 0x0a0b0c0d }, sub_out;
+# pragma pack()
+
+    char const *fmt = "d -16s =4d =3[w -8s] 2[c w] -[w d]";
+    uint32_t arr[4] = { 10, 20, 30, 40 }, d;
+    uint16_t w;
+    char buf[256], str[16];
+    struct packf_view view;
+    void *ptr;
+    int len, n;
+
+    len = packf(buf, sizeof(buf), fmt, 99, "viewed", 3, arr, 3, items,
+            pairs, &sub);
+    assert(len > 0);
+
+    memset(&view, 0, sizeof(view));
+    assert(packf_view_init(&view, buf, len, fmt) == len);
+    assert(!view.fixed);
+
+    assert(packf_view_get(&view, (int []){ 0 }, 1, &d) == 4 && d == 99);
+    assert(packf_view_ref(&view, (int []){ 1 }, 1, &ptr, &n) == 0);
+    assert(n == 6 && memcmp(ptr, "viewed", 6) == 0);
+    assert(packf_view_count(&view, (int []){ 2 }, 1) == 3);
+    assert(packf_view_get(&view, (int []){ 2, 1 }, 2, &d) == 4 && d == 20);
+    assert(packf_view_get(&view, (int []){ 2, 3 }, 2, &d) < 0);
+    assert(packf_view_get(&view, (int []){ 3, 2, 1 }, 3, str) == 5);
+    assert(strcmp(str, "three") == 0);
+    assert(packf_view_get(&view, (int []){ 3, 1, 0 }, 3, &w) == 2 && w == 2);
+    assert(packf_view_get(&view, (int []){ 4, 1, 1 }, 3, &w) == 2);
+    assert(w == 0x5678);
+    assert(packf_view_get(&view, (int []){ 5, 1 }, 2, &d) == 4);
+    assert(d == 0x0a0b0c0d);
+    assert(packf_view_get(&view, (int []){ 5 }, 1, &sub_out) == 6);
+    assert(sub_out.w == 7 && sub_out.d == 0x0a0b0c0d);
+    assert(packf_view_get(&view, (int []){ 6 }, 1, &d) < 0);
+
+    /* 数据被截断 */
+    assert(packf_view_init(&view, buf, len - 1, fmt) < 0);
+
+    /* 固定布局不需要索引 */
+    len = packf(buf, sizeof(buf), "d 2[c w] 8s", 5, pairs, "fixed");
+    assert(packf_view_init(&view, buf, len, "d 2[c w] 8s") == len);
+    assert(view.fixed);
+    assert(packf_view_get(&view, (int []){ 1, 1, 0 }, 3, str) == 1);
+    assert(str[0] == 'b');
+    assert(packf_view_get(&view, (int []){ 1, 0, 1 }, 3, &w) == 2);
+    assert(w == 0x1234);
+    assert(packf_view_get(&view, (int []){ 2 }, 1, str) == 5);
+    assert(strcmp(str, "fixed") == 0);
+
+    packf_view_free(&view);
+}
+
+static void test_crc(void)
+{
+    char buf[256], seg_buf[256], name[32];
+    uint32_t arr[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, out[8], id;
+    uint16_t n;
+    struct iovec iov[2];
+    int len;
+
+    assert(packf_crc32c(0, "123456789", 9) == 0xe3069283);
+    assert(packf_crc32c(packf_crc32c(0, "1234", 4), "56789", 5) == 0xe3069283);
+
+    len = packf(buf, sizeof(buf), "d -32s =8d C", 42, "checked", 8, arr);
+    assert(len == 4 + 8 + 2 + 32 + 4);
+    assert(packf_crc32c(0, buf, len - 4) ==
+            (uint32_t)(((uint8_t)buf[len - 4] << 24) |
+                ((uint8_t)buf[len - 3] << 16) |
+                ((uint8_t)buf[len - 2] << 8) | (uint8_t)buf[len - 1]));
+
+    memset(out, 0, sizeof(out));
+    assert(unpackf(buf, len, "d -32s =8d C", &id, name, &n, out) > 0);
+    assert(id == 42 && strcmp(name, "checked") == 0);
+    assert(memcmp(out, arr, sizeof(arr)) == 0);
+
+    assert(n == 8);
+    buf[20] ^= 1;
+    assert(unpackf(buf, len, "d -32s =8d C", &id, name, &n, out) ==
+            PACKF_BAD_CHECKSUM);
+    buf[20] ^= 1;
+
+    /* 跨越段边界时结果相同 */
+    iov[0].iov_base = seg_buf;
+    iov[0].iov_len  = 15;
+    iov[1].iov_base = seg_buf + 100;
+    iov[1].iov_len  = 100;
+    assert(packf_iov(iov, 2, "d -32s =8d C", 42, "checked", 8, arr) == len);
+    assert(memcmp(seg_buf, buf, 15) == 0);
+    assert(memcmp(seg_buf + 100, buf + 15, len - 15) == 0);
+    assert(unpackf_iov(iov, 2, "d -32s =8d C", &id, name, &n, out) > 0);
+
+    assert(packf(buf, sizeof(buf), "[d C]", &id) == PACKF_NOT_FORMAT);
+}
+
+static void test_codec(void)
+{
+    static int64_t ts[4096], ts_out[4096];
+    static int32_t seq[300], seq_out[300];
+    static uint8_t buf[40000], seg_buf[40000];
+    char const *codecs[] = { "%", "+", "^" };
+    char format[32];
+    int16_t w[5] = { 32767, -32768, 0, -1, 1 }, w_out[5];
+    int32_t d_out[10];
+    uint16_t n, m;
+    int i, c, len, plain, sizes[] = { 0, 1, 2, 127, 128, 129, 300 };
+    struct iovec iov[2];
+    struct packf_view view;
+    int path[1];
+
+# pragma pack(1)
+    struct rec
+    {
+        int32_t     id;
+        uint8_t     n;
+        int32_t     v[10];
+        int16_t     tail;
+    } rec[3], rec_out[3];
+# pragma pack()
+
+    for (i = 0; i < 4096; ++i)
+        ts[i] = 1700000000000LL + i * 1000LL + (i % 7);
+    for (i = 0; i < 300; ++i)
+        seq[i] = (int32_t)(i * 2654435761u);
+
+    plain = packf(buf, sizeof(buf), "=4096D", 4096, ts);
+    assert(plain == 2 + 4096 * 8);
+    for (c = 0; c < 3; ++c)
+    {
+        sprintf(format, "=4096D%s", codecs[c]);
+        len = packf(buf, sizeof(buf), format, 4096, ts);
+        assert(len > 0 && len < plain);
+        memset(ts_out, 0, sizeof(ts_out));
+        assert(unpackf(buf, len, format, &n, ts_out) == len);
+        assert(n == 4096 && memcmp(ts, ts_out, sizeof(ts)) == 0);
+        if (codecs[c][0] == '^')
+            assert(len * 10 < plain);
+
+        /* 数据不完整 */
+        assert(unpackf(buf, len - 1, format, &n, ts_out) == PACKF_OUT_OF_BUF);
+        assert(packf(buf, len - 1, format, 4096, ts) == PACKF_OUT_OF_BUF);
+    }
+
+    /* 各种长度的块和不可压缩的数据 */
+    for (c = 0; c < 3; ++c)
+    {
+        for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i)
+        {
+            sprintf(format, "=300d%s w", codecs[c]);
+            len = packf(buf, sizeof(buf), format, sizes[i], seq, 7);
+            assert(len > 0);
+            memset(seq_out, 0, sizeof(seq_out));
+            assert(unpackf(buf, len, format, &n, seq_out, &m) == len);
+            assert(n == sizes[i] && m == 7);
+            assert(memcmp(seq, seq_out, sizes[i] * sizeof(int32_t)) == 0);
+        }
+
+        sprintf(format, "5w%s", codecs[c]);
+        len = packf(buf, sizeof(buf), format, w);
+        assert(len > 0);
+        assert(unpackf(buf, len, format, w_out) == len);
+        assert(memcmp(w, w_out, sizeof(w)) == 0);
+    }
+
+    /* 结构体中的压缩数组 */
+    for (i = 0; i < 3; ++i)
+    {
+        rec[i].id   = i;
+        rec[i].n    = i * 4;
+        for (c = 0; c < 10; ++c)
+            rec[i].v[c] = 1000 + i + c * 3;
+        rec[i].tail = -i;
+    }
+    len = packf(buf, sizeof(buf), "3[d -10d+ w]", rec);
+    assert(len > 0);
+    memset(rec_out, 0, sizeof(rec_out));
+    assert(unpackf(buf, len, "3[d -10d+ w]", rec_out) == len);
+    for (i = 0; i < 3; ++i)
+    {
+        assert(rec_out[i].id == i && rec_out[i].n == i * 4);
+        assert(memcmp(rec_out[i].v, rec[i].v, rec[i].n * 4) == 0);
+        assert(rec_out[i].tail == -i);
+    }
+
+    /* 跨越段边界 */
+    len = packf(buf, sizeof(buf), "=300d%", 300, seq);
+    for (i = 1; i < len; i += 37)
+    {
+        iov[0].iov_base = seg_buf;
+        iov[0].iov_len  = i;
+        iov[1].iov_base = seg_buf + i + 16;
+        iov[1].iov_len  = len - i;
+        assert(packf_iov(iov, 2, "=300d%", 300, seq) == len);
+        assert(memcmp(seg_buf, buf, i) == 0);
+        assert(memcmp(seg_buf + i + 16, buf + i, len - i) == 0);
+        memset(seq_out, 0, sizeof(seq_out));
+        assert(unpackf_iov(iov, 2, "=300d%", &n, seq_out) == len);
+        assert(memcmp(seq, seq_out, sizeof(seq)) == 0);
+    }
+
+    /* 视图 */
+    len = packf(buf, sizeof(buf), "d =300d^ 10d", 1, 300, seq, seq);
+    memset(&view, 0, sizeof(view));
+    assert(packf_view_init(&view, buf, len, "d =300d^ 10d") == len);
+    path[0] = 1;
+    assert(packf_view_count(&view, path, 1) == 300);
+    assert(packf_view_get(&view, path, 1, seq_out) == 300 * 4);
+    assert(memcmp(seq, seq_out, sizeof(seq)) == 0);
+    path[0] = 2;
+    assert(packf_view_get(&view, path, 1, d_out) == 40);
+    assert(memcmp(seq, d_out, sizeof(d_out)) == 0);
+    packf_view_free(&view);
+
+    /* 位宽不合法 */
+    len = packf(buf, sizeof(buf), "=300d%", 300, seq);
+    buf[2] = 33;
+    assert(unpackf(buf, len, "=300d%", &n, seq_out) == PACKF_BAD_DATA);
+
+    assert(packf(buf, sizeof(buf), "d+", 1) == PACKF_NOT_FORMAT);
+    assert(packf(buf, sizeof(buf), "4c+", "abcd") == PACKF_NOT_FORMAT);
+}
+
+static void test_tmpl(void)
+{
+    uint8_t buf[256], ref[256];
+    struct packf_tmpl tmpl;
+    struct packf_tmpl_field price, size, seq, sym, elem, arr, field;
+    int32_t arr_in[3] = { 1, 2, 3 }, arr_new[3] = { 7, 8, 9 };
+    int len, path[3];
+# pragma pack(1)
+    struct
+    {
+        int16_t     w;
+        int32_t     d[3];
+    } inner = { 5, { 10, 20, 30 } };
+# pragma pack()
+    char const *format = "d -16s F D 8s [w 3d] =3d C";
+
+    memset(&tmpl, 0, sizeof(tmpl));
+    len = packf_tmpl_init(&tmpl, buf, sizeof(buf), format, 1, "QUOTE",
+            1.5, (int64_t)100, "ABC", &inner, 3, arr_in);
+    assert(len > 0);
+
+    path[0] = 2;
+    assert(packf_tmpl_field(&tmpl, path, 1, &price) == 0);
+    path[0] = 3;
+    assert(packf_tmpl_field(&tmpl, path, 1, &size) == 0);
+    path[0] = 0;
+    assert(packf_tmpl_field(&tmpl, path, 1, &seq) == 0);
+    path[0] = 4;
+    assert(packf_tmpl_field(&tmpl, path, 1, &sym) == 0);
+    path[0] = 5, path[1] = 1, path[2] = 2;
+    assert(packf_tmpl_field(&tmpl, path, 3, &elem) == 0);
+    path[0] = 6;
+    assert(packf_tmpl_field(&tmpl, path, 1, &arr) == 0);
+
+    assert(packf_tmpl_set(&tmpl, &price, 2.25) == 0);
+    assert(packf_tmpl_set(&tmpl, &size, (int64_t)-7) == 0);
+    assert(packf_tmpl_set(&tmpl, &seq, 42) == 0);
+    assert(packf_tmpl_set(&tmpl, &sym, "XYZW") == 0);
+    assert(packf_tmpl_set(&tmpl, &elem, 33) == 0);
+    assert(packf_tmpl_set(&tmpl, &arr, arr_new) == 0);
+    assert(packf_tmpl_set(&tmpl, &sym, "TOOLONGSYM") == PACKF_BE_CUT_OFF);
+
+    inner.d[2] = 33;
+    assert(packf(ref, sizeof(ref), format, 42, "QUOTE", 2.25, (int64_t)-7,
+                "XYZW", &inner, 3, arr_new) == len);
+    assert(memcmp(ref, buf, len) == 0);
+
+    /* 长度可变的字段不能修改 */
+    path[0] = 1;
+    assert(packf_tmpl_field(&tmpl, path, 1, &field) == PACKF_NOT_MATCH);
+    path[0] = 5;
+    assert(packf_tmpl_field(&tmpl, path, 1, &field) == PACKF_NOT_MATCH);
+    path[0] = 7;
+    assert(packf_tmpl_field(&tmpl, path, 1, &field) == PACKF_NOT_MATCH);
+    packf_tmpl_free(&tmpl);
+
+    /* 固定布局 */
+    len = packf_tmpl_init(&tmpl, buf, sizeof(buf), "w D", 1, (int64_t)2);
+    assert(len == 10);
+    path[0] = 1;
+    assert(packf_tmpl_field(&tmpl, path, 1, &field) == 0);
+    assert(field.offset == 2 && field.type == 'D');
+    assert(packf_tmpl_set(&tmpl, &field, (int64_t)0x0102030405060708LL) == 0);
+    assert(buf[2] == 1 && buf[9] == 8);
+    packf_tmpl_free(&tmpl);
+
+    /* 只有一个元素的数组仍然按指针设置 */
+    len = packf_tmpl_init(&tmpl, buf, sizeof(buf), "1d =3d d", arr_in, 1,
+            arr_in + 1, 5);
+    assert(len == 4 + 2 + 4 + 4);
+    path[0] = 0;
+    assert(packf_tmpl_field(&tmpl, path, 1, &field) == 0 && field.array);
+    assert(packf_tmpl_set(&tmpl, &field, arr_new) == 0);
+    path[0] = 1;
+    assert(packf_tmpl_field(&tmpl, path, 1, &arr) == 0 && arr.count == 1);
+    assert(packf_tmpl_set(&tmpl, &arr, arr_new + 1) == 0);
+    path[0] = 1, path[1] = 0;
+    assert(packf_tmpl_field(&tmpl, path, 2, &elem) == 0 && !elem.array);
+    path[0] = 2;
+    assert(packf_tmpl_field(&tmpl, path, 1, &seq) == 0 && !seq.array);
+    assert(packf_tmpl_set(&tmpl, &seq, 6) == 0);
+    assert(packf(ref, sizeof(ref), "1d =3d d", arr_new, 1, arr_new + 1, 6) ==
+            len);
+    assert(memcmp(ref, buf, len) == 0);
+    packf_tmpl_free(&tmpl);
+}
+
+static void test_proj(void)
+{
+    char const *format = "w d -32s D =5[d -8s] [w 2d] 4w 8s =100d+ d";
+    uint8_t buf[1024];
+    int p0[] = { 0 }, p1[] = { 1 }, p3[] = { 3 }, p4[] = { 4, 2, 1 },
+        p5[] = { 5, 1 }, p6[] = { 6, 2 }, p7[] = { 7 }, p8[] = { 8 },
+        p9[] = { 9 }, bad[2];
+    struct packf_path paths[] = { { p0, 1 }, { p1, 1 }, { p3, 1 },
+        { p4, 3 }, { p5, 2 }, { p6, 2 }, { p7, 1 }, { p8, 1 }, { p9, 1 } };
+    struct packf_path bad_path = { bad, 1 };
+    struct packf_proj *proj;
+    struct packf_view view;
+    int16_t w, ws[4] = { 1, 2, 3, 4 }, w6;
+    int32_t d, d5[2], d9, seq[100], seq_out[100], i, len;
+    int64_t D;
+    char str[16], str7[8];
+    uint8_t ref[256];
+# pragma pack(1)
+    struct
+    {
+        int32_t     id;
+        uint8_t     n;
+        char        s[8];
+    } arr[5];
+    struct
+    {
+        int16_t     w;
+        int32_t     d[2];
+    } inner = { 9, { 10, 11 } };
+# pragma pack()
+
+    for (i = 0; i < 5; ++i)
+    {
+        arr[i].id = i;
+        sprintf(arr[i].s, "e%d", i * 11);
+    }
+    for (i = 0; i < 100; ++i)
+        seq[i] = 1000 + i;
+
+    len = packf(buf, sizeof(buf), format, 7, 8, "variable", (int64_t)-3,
+            3, arr, &inner, ws, "fix", 100, seq, 99);
+    assert(len > 0);
+
+    proj = packf_proj_new(format, paths, 9);
+    assert(proj);
+    assert(packf_proj(proj, buf, len, &w, &d, &D, str, d5, &w6, str7,
+                seq_out, &d9) == 9);
+    assert(w == 7 && d == 8 && D == -3);
+    assert(strcmp(str, "e22") == 0);
+    assert(d5[0] == 10 && d5[1] == 11);
+    assert(w6 == 3);
+    assert(strcmp(str7, "fix") == 0);
+    assert(memcmp(seq, seq_out, sizeof(seq)) == 0);
+    assert(d9 == 99);
+
+    /* 与视图的结果相同 */
+    memset(&view, 0, sizeof(view));
+    assert(packf_view_init(&view, buf, len, format) == len);
+    assert(packf_view_get(&view, p4, 3, ref) == 3);
+    assert(strcmp((char *)ref, str) == 0);
+    packf_view_free(&view);
+
+    /* 固定前缀中的字段不需要后面的数据 */
+    assert(packf_proj(proj, buf, 6, &w, &d, &D, str, d5, &w6, str7,
+                seq_out, &d9) == PACKF_OUT_OF_BUF);
+    packf_proj_free(proj);
+    proj = packf_proj_new(format, paths, 2);
+    assert(packf_proj(proj, buf, 6, &w, &d) == 2);
+    assert(packf_proj(proj, buf, 5, &w, &d) == PACKF_OUT_OF_BUF);
+    packf_proj_free(proj);
+
+    /* 在固定前缀中就能发现的错误路径 */
+    bad[0] = 0;
+    bad[1] = 1;
+    bad_path.path  = bad;
+    bad_path.depth = 2;
+    assert(packf_proj_new(format, &bad_path, 1) == NULL);
+    bad[0] = 10;
+    bad_path.depth = 1;
+    proj = packf_proj_new(format, &bad_path, 1);
+    assert(proj);
+    assert(packf_proj(proj, buf, len, &d) == PACKF_NOT_MATCH);
+    packf_proj_free(proj);
+
+    /* 定点小数、h 和 b<n> 不能投影，与视图相同 */
+    bad[0] = 0;
+    bad_path.depth = 1;
+    assert(packf_proj_new("d.4 d", &bad_path, 1) == NULL);
+    assert(packf_proj_new("d [w D.2]", &bad_path, 1) == NULL);
+    assert(packf_proj_new("h d", &bad_path, 1) == NULL);
+    assert(packf_proj_new("d b4 d", &bad_path, 1) == NULL);
+    len = packf(buf, sizeof(buf), "d.4 d", 12.5, 7);
+    assert(len == 8);
+    assert(packf_view_init(&view, buf, len, "d.4 d") == PACKF_NOT_FORMAT);
+    packf_view_free(&view);
+}
+
+static int key_tuple_cmp(int32_t a1, double a2, char const *a3, int n4,
+        int8_t const *a4, int32_t b1, double b2, char const *b3, int m4,
+        int8_t const *b4)
+{
+    int i, r;
+
+    if (a1 != b1)
+        return a1 < b1 ? -1 : 1;
+    if (a2 != b2)
+        return a2 < b2 ? -1 : 1;
+    if (signbit(a2) != signbit(b2))
+        return signbit(a2) ? -1 : 1;
+    if ((r = strcmp(a3, b3)) != 0)
+        return r < 0 ? -1 : 1;
+    for (i = 0; i < n4 && i < m4; ++i)
+        if (a4[i] != b4[i])
+            return a4[i] < b4[i] ? -1 : 1;
+
+    return n4 == m4 ? 0 : (n4 < m4 ? -1 : 1);
+}
+
+static int key_cmp(uint8_t const *a, int alen, uint8_t const *b, int blen)
+{
+    int r = memcmp(a, b, alen < blen ? alen : blen);
+
+    if (r == 0)
+        return alen == blen ? 0 : (alen < blen ? -1 : 1);
+
+    return r < 0 ? -1 : 1;
+}
+
+static void test_key(void)
+{
+    static int32_t i1[64];
+    static double d2[64];
+    static char s3[64][8];
+    static int8_t c4[64][4];
+    static int n4[64];
+    double specials[] = { -1e300, -2.5, -0.0, 0.0, 1e-300, 3.0, 1e300 };
+    int8_t bytes[] = { -128, -1, 0, 127 };
+    uint8_t ka[128], kb[128];
+    int i, j, la, lb, r;
+    char s_out[16];
+    int32_t i_out;
+    double d_out;
+    int8_t c_out[8];
+    uint8_t n_out;
+# pragma pack(1)
+    struct
+    {
+        int16_t     w;
+        uint8_t     len;
+        char        s[16];
+        uint16_t    n;
+        float       f[4];
+    } rec[3], rec_out[3];
+# pragma pack()
+    uint8_t nrec, nrec_out;
+
+    srand(7);
+    for (i = 0; i < 64; ++i)
+    {
+        i1[i] = (rand() % 5) - 2;
+        if (i % 9 == 0)
+            i1[i] = i % 2 ? INT32_MIN : INT32_MAX;
+        d2[i] = specials[rand() % 7];
+        for (j = 0; j < 3; ++j)
+            s3[i][j] = 'a' + rand() % 2;
+        s3[i][rand() % 4] = '\0';
+        n4[i] = rand() % 5;
+        for (j = 0; j < 4; ++j)
+            c4[i][j] = bytes[rand() % 4];
+    }
+
+    for (i = 0; i < 64; ++i)
+    {
+        la = packf_key(ka, sizeof(ka), "d F -8s -4c", i1[i], d2[i], s3[i],
+                n4[i], c4[i]);
+        assert(la > 0);
+        assert(unpackf_key(ka, la, "d F -8s -4c", &i_out, &d_out, s_out,
+                    &n_out, c_out) == la);
+        assert(i_out == i1[i] && d_out == d2[i] && strcmp(s_out, s3[i]) == 0);
+        assert(n_out == n4[i] && memcmp(c_out, c4[i], n4[i]) == 0);
+
+        for (j = 0; j < 64; ++j)
+        {
+            lb = packf_key(kb, sizeof(kb), "d F -8s -4c", i1[j], d2[j],
+                    s3[j], n4[j], c4[j]);
+            r = key_tuple_cmp(i1[i], d2[i], s3[i], n4[i], c4[i], i1[j],
+                    d2[j], s3[j], n4[j], c4[j]);
+            assert(key_cmp(ka, la, kb, lb) == r);
+        }
+    }
+
+    /* 结构体和 LV 结构体数组 */
+    nrec = 2;
+    for (i = 0; i < 3; ++i)
+    {
+        rec[i].w = -i;
+        sprintf(rec[i].s, "k%d", i);
+        rec[i].n = 2;
+        rec[i].f[0] = -1.5f * i;
+        rec[i].f[1] = 0.25f;
+    }
+    la = packf_key(ka, sizeof(ka), "-3[w -16s =4f]", nrec, rec);
+    assert(la > 0);
+    memset(rec_out, 0, sizeof(rec_out));
+    assert(unpackf_key(ka, la, "-3[w -16s =4f]", &nrec_out, rec_out) == la);
+    assert(nrec_out == 2);
+    for (i = 0; i < 2; ++i)
+    {
+        assert(rec_out[i].w == rec[i].w && rec_out[i].n == 2);
+        assert(rec_out[i].len == strlen(rec[i].s));
+        assert(strcmp(rec_out[i].s, rec[i].s) == 0);
+        assert(memcmp(rec_out[i].f, rec[i].f, 2 * sizeof(float)) == 0);
+    }
+
+    assert(packf_key(ka, sizeof(ka), "d C", 1) == PACKF_NOT_FORMAT);
+    assert(packf_key(ka, 3, "d", 1) == PACKF_OUT_OF_BUF);
+    memcpy(ka, "abc", 3);
+    assert(unpackf_key(ka, 3, "s", s_out) == PACKF_OUT_OF_BUF);
+}
+
+struct visit_trace
+{
+    char        out[512];
+    int         len;
+    int         stop;
+};
+
+static int visit_value(void *ctx, struct packf_visit_field const *field,
+        struct packf_value const *value)
+{
+    struct visit_trace *t = ctx;
+
+    if (field->type == 'f' || field->type == 'F')
+        t->len += sprintf(t->out + t->len, "%c%g ", field->type, value->f);
+    else
+        t->len += sprintf(t->out + t->len, "%c%lld ", field->type,
+                (long long)value->i);
+
+    return --t->stop == 0 ? -100 : 0;
+}
+
+static int visit_bytes(void *ctx, struct packf_visit_field const *field,
+        void const *data, int len)
+{
+    struct visit_trace *t = ctx;
+
+    t->len += sprintf(t->out + t->len, "%c'%.*s' ", field->type, len,
+            (char const *)data);
+
+    return 0;
+}
+
+static int visit_array_begin(void *ctx, struct packf_visit_field const *field,
+        int count)
+{
+    struct visit_trace *t = ctx;
+
+    t->len += sprintf(t->out + t->len, "%d:%d( ", field->index, count);
+
+    return 0;
+}
+
+static int visit_array_end(void *ctx, struct packf_visit_field const *field)
+{
+    struct visit_trace *t = ctx;
+
+    (void)field;
+    t->len += sprintf(t->out + t->len, ") ");
+
+    return 0;
+}
+
+static int visit_struct_begin(void *ctx, struct packf_visit_field const *field)
+{
+    struct visit_trace *t = ctx;
+
+    t->len += sprintf(t->out + t->len, "%d{ ", field->elem);
+
+    return 0;
+}
+
+static int visit_struct_end(void *ctx, struct packf_visit_field const *field)
+{
+    struct visit_trace *t = ctx;
+
+    t->len += sprintf(t->out + t->len, "%d} ", field->depth);
+
+    return 0;
+}
+
+static int visit_collect(void *ctx, struct packf_visit_field const *field,
+        struct packf_value const *value)
+{
+    int64_t *out = ctx;
+
+    out[field->elem] = value->i;
+
+    return 0;
+}
+
+static void test_visit(void)
+{
+    struct packf_visitor visitor = { visit_value, visit_bytes,
+        visit_array_begin, visit_array_end, visit_struct_begin,
+        visit_struct_end };
+    struct packf_visitor empty;
+    struct visit_trace t;
+    char const *format = "w -8s =4d+ 2[c D] -[f 3c a] F C";
+    static char const *codecs[] = { "=600D%", "=600D+", "=600D^", "=600w^" };
+    static int64_t vals[600], seen[600];
+    static uint8_t big[8192];
+    uint8_t buf[256];
+    int32_t ds[3] = { 100, 90, 120 };
+    int16_t ws[600];
+    int len, k, i;
+# pragma pack(1)
+    struct
+    {
+        int8_t      c;
+        int64_t     D;
+    } arr[2] = { { -1, 1LL << 40 }, { 2, -5 } };
+    struct
+    {
+        float       f;
+        char        c[3];
+        char        pad;
+    } inner = { 1.5f, { 'x', 'y', 'z' }, 0 };
+# pragma pack()
+
+    len = packf(buf, sizeof(buf), format, -7, "hello", 3, ds, arr, &inner,
+            -0.25);
+    assert(len > 0);
+
+    memset(&t, 0, sizeof(t));
+    assert(packf_visit(buf, len, format, &visitor, &t) == len);
+    assert(strcmp(t.out, "w-7 s'hello' 2:3( d100 d90 d120 ) "
+                "3:2( 0{ c-1 D1099511627776 0} 1{ c2 D-5 0} ) "
+                "-1{ f1.5 c'xyz' 0} F-0.25 ") == 0);
+
+    /* 回调返回负值时停止 */
+    memset(&t, 0, sizeof(t));
+    t.stop = 3;
+    assert(packf_visit(buf, len, format, &visitor, &t) == -100);
+    assert(strcmp(t.out, "w-7 s'hello' 2:3( d100 d90 ") == 0);
+
+    /* 没有回调时只检查数据 */
+    memset(&empty, 0, sizeof(empty));
+    assert(packf_visit(buf, len, format, &empty, NULL) == len);
+    assert(packf_visit(buf, len - 1, format, &empty, NULL) ==
+            PACKF_OUT_OF_BUF);
+    buf[1] ^= 1;
+    assert(packf_visit(buf, len, format, &empty, NULL) == PACKF_BAD_CHECKSUM);
+    assert(packf_visit(buf, len, "w d%", &empty, NULL) == PACKF_NOT_FORMAT);
+
+    /* 跨多个块的压缩编码数组，按块解码 */
+    for (i = 0; i < 600; ++i)
+    {
+        vals[i] = (int64_t)i * i * 37 - 5000 + (i % 7) * 1000003;
+        ws[i] = (int16_t)(i * 3 - 700);
+    }
+    memset(&empty, 0, sizeof(empty));
+    empty.value = visit_collect;
+    for (k = 0; k < 4; ++k)
+    {
+        len = packf(big, sizeof(big), codecs[k], 555,
+                k == 3 ? (void *)ws : (void *)vals);
+        assert(len > 0);
+        memset(seen, 0, sizeof(seen));
+        assert(packf_visit(big, len, codecs[k], &empty, seen) == len);
+        for (i = 0; i < 555; ++i)
+            assert(seen[i] == (k == 3 ? ws[i] : vals[i]));
+        assert(seen[555] == 0);
+        assert(packf_visit(big, len - 1, codecs[k], &empty, seen) ==
+                PACKF_OUT_OF_BUF);
+    }
+}
+
+static void test_arena(void)
+{
+    char const *format = "d -100s =4096d -20[w -30s] =64D+ -[c =8w]";
+    char const *msg_format = "[d -100s =4096d -20[w -30s] =64D+ -[c =8w]]";
+    char const *top = "-100s =10d";
+    uint8_t buf[512], mem[512];
+    struct packf_arena arena;
+    int32_t ds[3] = { 5, -6, 7 }, *dp;
+    int64_t Ds[4] = { 100, 101, 103, 110 };
+    int16_t ws[2] = { -1, 2 };
+    char *name;
+    uint16_t n;
+    int len, i;
+# pragma pack(1)
+    struct
+    {
+        int16_t     w;
+        uint8_t     len;
+        char        s[30];
+    } items[2] = { { 1, 0, "one" }, { 2, 0, "two" } };
+    struct
+    {
+        int8_t      c;
+        uint16_t    n;
+        int16_t     w[8];
+    } tail = { 9, 2, { -1, 2 } };
+    struct
+    {
+        int32_t     id;
+        uint8_t     name_len;
+        char       *name;
+        uint16_t    nd;
+        int32_t    *d;
+        uint8_t     nitem;
+        struct
+        {
+            int16_t     w;
+            uint8_t     len;
+            char       *s;
+        }          *item;
+        uint16_t    nD;
+        int64_t    *D;
+        uint8_t     tail_len;
+        int8_t      c;
+        uint16_t    nw;
+        int16_t    *w;
+    } msg;
+# pragma pack()
+
+    len = packf(buf, sizeof(buf), format, 42, "hello", 3, ds, 2, items, 4,
+            Ds, &tail);
+    assert(len > 0);
+
+    packf_arena_init(&arena, mem, sizeof(mem));
+    memset(&msg, 0, sizeof(msg));
+    assert(unpackf_arena(buf, len, &arena, msg_format, &msg) == len);
+    assert(msg.id == 42);
+    assert(msg.name_len == 5 && strcmp(msg.name, "hello") == 0);
+    assert(msg.nd == 3 && memcmp(msg.d, ds, sizeof(ds)) == 0);
+    assert(msg.nitem == 2);
+    for (i = 0; i < 2; ++i)
+    {
+        assert(msg.item[i].w == items[i].w);
+        assert(msg.item[i].len == strlen(items[i].s));
+        assert(strcmp(msg.item[i].s, items[i].s) == 0);
+    }
+    assert(msg.nD == 4 && memcmp(msg.D, Ds, sizeof(Ds)) == 0);
+    assert(msg.c == 9 && msg.nw == 2 && memcmp(msg.w, ws, sizeof(ws)) == 0);
+    assert((uintptr_t)msg.D % 8 == 0);
+    assert(arena.used < 128);
+
+    /* 最外层的 LV 字段 */
+    len = packf(buf, sizeof(buf), top, "top", 3, ds);
+    assert(len > 0);
+    assert(unpackf_arena(buf, len, &arena, top, &name, &n, &dp) == len);
+    assert(strcmp(name, "top") == 0 && n == 3);
+    assert(memcmp(dp, ds, sizeof(ds)) == 0);
+
+    /* 空间不足或数据错误时不占用 arena */
+    i = (int)arena.used;
+    arena.size = arena.used + 8;
+    assert(unpackf_arena(buf, len, &arena, top, &name, &n, &dp) ==
+            PACKF_NO_MEMORY);
+    assert((int)arena.used == i);
+    arena.size = sizeof(mem);
+    assert(unpackf_arena(buf, len - 1, &arena, top, &name, &n, &dp) ==
+            PACKF_OUT_OF_BUF);
+    assert((int)arena.used == i);
+}
+
+struct sink_out
+{
+    uint8_t     data[8192];
+    int         len;
+    int         calls;
+    int         fail;
+};
+
+static int sink_write(void *ctx, void const *data, int len)
+{
+    struct sink_out *out = ctx;
+
+    if (out->fail && ++out->calls == out->fail)
+        return -100;
+    assert(out->len + len <= (int)sizeof(out->data));
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+
+    return 0;
+}
+
+static void test_sink(void)
+{
+    char const *format = "d =1000[w -[c -8s] =20d%] =[=300d] -16s";
+    static uint8_t ref[8192];
+    static struct sink_out out;
+    struct packf_sink sink;
+    uint8_t stage[64], tiny[16], page[2048];
+    int32_t big[300];
+    int len, ret, i, fd;
+    FILE *fp;
+# pragma pack(1)
+    struct
+    {
+        int16_t     w;
+        uint8_t     inner_len;
+        int8_t      c;
+        uint8_t     s_len;
+        char        s[8];
+        uint16_t    n;
+        int32_t     d[20];
+    } items[100];
+    struct
+    {
+        uint16_t    n;
+        int32_t     d[300];
+    } lv;
+# pragma pack()
+
+    for (i = 0; i < 100; ++i)
+    {
+        items[i].w = (int16_t)(i * 7);
+        items[i].c = (int8_t)i;
+        sprintf(items[i].s, "n%d", i);
+        items[i].n = (uint16_t)(i % 21);
+        memset(items[i].d, 0, sizeof(items[i].d));
+        items[i].d[0] = i;
+    }
+    lv.n = 3;
+    lv.d[0] = 1;
+    lv.d[1] = 2;
+    lv.d[2] = 3;
+    for (i = 0; i < 300; ++i)
+        big[i] = i;
+
+    len = packf(ref, sizeof(ref), format, 1, 100, items, &lv, "tail");
+    assert(len > (int)sizeof(stage) * 10);
+
+    /* 输出的数据与 packf 相同，可以连续打包多条消息 */
+    memset(&out, 0, sizeof(out));
+    packf_sink_init(&sink, stage, sizeof(stage), sink_write, &out);
+    assert(packf_sink(&sink, format, 1, 100, items, &lv, "tail") == len);
+    assert(packf_sink(&sink, format, 1, 100, items, &lv, "tail") == len);
+    assert(out.len + sink.len == 2 * len);
+    assert(packf_sink_flush(&sink) == 0);
+    assert(out.len == 2 * len && sink.flushed == 2 * len);
+    assert(memcmp(out.data, ref, len) == 0);
+    assert(memcmp(out.data + len, ref, len) == 0);
+
+    /* 缓冲区放不下 LV 结构体 */
+    lv.n = 300;
+    memcpy(lv.d, big, sizeof(big));
+    packf_sink_init(&sink, tiny, sizeof(tiny), sink_write, &out);
+    assert(packf_sink(&sink, "=[=300d]", &lv) == PACKF_OUT_OF_BUF);
+    assert(packf_sink(&sink, "=300d", 300, big) == 1202);
+
+    /* flush 失败 */
+    memset(&out, 0, sizeof(out));
+    out.fail = 2;
+    packf_sink_init(&sink, stage, sizeof(stage), sink_write, &out);
+    assert(packf_sink(&sink, "=300d", 300, big) == -100);
+    assert(packf_sink(&sink, "d C", 1) == PACKF_NOT_FORMAT);
+
+    /* 写入文件描述符 */
+    fp = tmpfile();
+    assert(fp);
+    fd = fileno(fp);
+    packf_sink_init(&sink, page, sizeof(page), packf_sink_fd, &fd);
+    assert(packf_sink(&sink, format, 1, 100, items, &lv, "tail") > 0);
+    assert(packf_sink_flush(&sink) == 0);
+    ret = (int)sink.flushed;
+    rewind(fp);
+    assert((int)fread(out.data, 1, sizeof(out.data), fp) == ret);
+    fclose(fp);
+    assert(unpackf(out.data, ret, "d =1000[w -[c -8s] =20d%] =[=300d]",
+                &i, &len, items, &lv) > 0);
+    assert(i == 1 && len == 100 && lv.n == 300);
+    assert(memcmp(lv.d, big, sizeof(big)) == 0);
+}
+
+static void test_trusted(void)
+{
+    char const *format = "[c w d D f F 6s 2a -12s =6d =5D^ -[w -4c] "
+        "3[w -8s] -3[d c] 10S s]";
+    uint8_t buf[512];
+    int len, i;
+    int32_t d, d_out;
+    uint8_t n, n_out;
+    int16_t ws[4] = { 1, -2, 3, -4 }, ws_out[4];
+    int32_t dv[4] = { 7, -8, 9, -10 }, dv_out[10];
+    uint8_t *cut;
+    char str[8], str_out[8];
+# pragma pack(1)
+    struct msg
+    {
+        int8_t      c;
+        int16_t     w;
+        int32_t     d;
+        int64_t     D;
+        float       f;
+        double      F;
+        char        name[6];
+        char        pad[2];
+        uint8_t     s_len;
+        char        s[12];
+        uint16_t    nd;
+        int32_t     ds[6];
+        uint16_t    nD;
+        int64_t     Ds[5];
+        uint8_t     inner_len;
+        int16_t     iw;
+        uint8_t     nc;
+        int8_t      cs[4];
+        struct
+        {
+            int16_t w;
+            uint8_t len;
+            char    s[8];
+        } sub[3];
+        uint8_t     nsub;
+        struct
+        {
+            int32_t d;
+            int8_t  c;
+        } lsub[3];
+        char        S[10];
+        char        tail[16];
+    } in, out, ref;
+# pragma pack()
+
+    memset(&in, 0, sizeof(in));
+    in.c = -3;
+    in.w = 300;
+    in.d = -70000;
+    in.D = 1LL << 50;
+    in.f = 0.5f;
+    in.F = -1e100;
+    strcpy(in.name, "abc");
+    strcpy(in.s, "variable");
+    in.nd = 4;
+    for (i = 0; i < 4; ++i)
+        in.ds[i] = i * 1000 - 1;
+    in.nD = 5;
+    for (i = 0; i < 5; ++i)
+        in.Ds[i] = 1600000000000LL + i * 1000;
+    in.iw = 7;
+    in.nc = 2;
+    in.cs[0] = 'x';
+    in.cs[1] = 'y';
+    for (i = 0; i < 3; ++i)
+    {
+        in.sub[i].w = (int16_t)i;
+        sprintf(in.sub[i].s, "s%d", i);
+    }
+    in.nsub = 2;
+    in.lsub[0].d = 11;
+    in.lsub[1].c = 12;
+    strcpy(in.S, "short");
+    strcpy(in.tail, "last");
+
+    len = packf(buf, sizeof(buf), format, &in);
+    assert(len > 0);
+
+    memset(&ref, 0, sizeof(ref));
+    assert(unpackf(buf, len, format, &ref) == len);
+    memset(&out, 0, sizeof(out));
+    assert(unpackf_trusted(buf, len, format, &out) == len);
+    assert(memcmp(&out, &ref, sizeof(out)) == 0);
+
+    /* 最外层的字段和 C */
+    strcpy(str, "top");
+    len = packf(buf, sizeof(buf), "d -8s -4w C", -5, str, 4, ws);
+    assert(len > 0);
+    memset(str_out, 0, sizeof(str_out));
+    assert(unpackf_trusted(buf, len, "d -8s -4w C", &d_out, str_out, &n_out,
+                ws_out) == len);
+    assert(d_out == -5 && strcmp(str_out, "top") == 0);
+    assert(n_out == 4 && memcmp(ws, ws_out, sizeof(ws)) == 0);
+
+    /* 长度只检查一次 */
+    assert(unpackf_trusted(buf, len - 1, "d -8s -4w C", &d_out, str_out,
+                &n_out, ws_out) == PACKF_OUT_OF_BUF);
+    d = 9;
+    n = 1;
+    len = packf(buf, sizeof(buf), "d c", d, n);
+    assert(unpackf_trusted(buf, 4, "d c", &d_out, &n_out) == PACKF_OUT_OF_BUF);
+    assert(unpackf_trusted(buf, len, "d c", &d_out, &n_out) == len);
+    assert(d_out == 9 && n_out == 1);
+
+    /* 不是固定布局时也在解包之前检查，截断的数据不会越界读 */
+    len = packf(buf, sizeof(buf), "-10d", 4, dv);
+    assert(len == 1 + 16);
+    cut = malloc(3);
+    assert(cut);
+    memcpy(cut, buf, 3);
+    assert(unpackf_trusted(cut, 3, "-10d", &n_out, dv_out) ==
+            PACKF_OUT_OF_BUF);
+    memcpy(cut, "abc", 3);
+    assert(unpackf_trusted(cut, 3, "s d", str_out, &d_out) ==
+            PACKF_OUT_OF_BUF);
+    free(cut);
+    assert(unpackf_trusted(buf, len, "-10d", &n_out, dv_out) == len);
+    assert(n_out == 4 && memcmp(dv, dv_out, 16) == 0);
+
+    /* 结构体数组按第一个元素推算长度 */
+    n = 4;
+    len = packf(buf, sizeof(buf), "-4[d]", n, dv);
+    assert(len == 1 + 16);
+    assert(unpackf_trusted(buf, len - 1, "-4[d]", &n_out, dv_out) ==
+            PACKF_OUT_OF_BUF);
+    assert(unpackf_trusted(buf, len, "-4[d]", &n_out, dv_out) == len);
+    assert(n_out == 4 && memcmp(dv, dv_out, 16) == 0);
+}
+
+# define MSG_THREADS 4
+
+static void *msg_release(void *arg)
+{
+    struct packf_msg **msgs = arg;
+    struct packf_msg *own;
+    int i;
+
+    for (i = 0; i < 1000; ++i)
+        packf_msg_unref(msgs[i]);
+
+    /* 其他线程释放的消息可以在本线程分配 */
+    for (i = 0; i < 1000; ++i)
+    {
+        own = packf_msg_alloc(100);
+        assert(own && own->cap >= 100);
+        packf_msg_unref(own);
+    }
+    packf_msg_thread_exit();
+
+    return NULL;
+}
+
+static void test_msg(void)
+{
+    static struct packf_msg *msgs[1000];
+    struct packf_msg *msg, *big, *again;
+    pthread_t tid[MSG_THREADS];
+    char name[16];
+    int32_t d;
+    int i, len;
+
+    len = packf_msg_pack(&msg, 64, "d -16s", 42, "quote");
+    assert(len == 10 && msg->len == 10 && msg->cap >= 64);
+    assert(unpackf(msg->data, msg->len, "d -16s", &d, name) == len);
+    assert(d == 42 && strcmp(name, "quote") == 0);
+
+    /* 最后一个引用释放后，同一级别的下一次分配复用它 */
+    assert(packf_msg_ref(msg) == msg);
+    packf_msg_unref(msg);
+    packf_msg_unref(msg);
+    again = packf_msg_alloc(60);
+    assert(again == msg && again->len == 0);
+    packf_msg_unref(again);
+
+    /* 超过最大级别的消息 */
+    big = packf_msg_alloc(1 << 20);
+    assert(big && big->cap == 1 << 20);
+    memset(big->data, 1, big->cap);
+    packf_msg_unref(big);
+
+    assert(packf_msg_pack(&msg, 4, "d d", 1, 2) == PACKF_OUT_OF_BUF);
+    assert(msg == NULL);
+
+    /* 多个线程共享同一批消息，最后一个引用在任意线程释放 */
+    for (i = 0; i < 1000; ++i)
+    {
+        assert(packf_msg_pack(&msgs[i], 100, "d", i) == 4);
+        packf_msg_ref(msgs[i]);
+        packf_msg_ref(msgs[i]);
+        packf_msg_ref(msgs[i]);
+    }
+    for (i = 0; i < MSG_THREADS; ++i)
+        assert(pthread_create(&tid[i], NULL, msg_release, msgs) == 0);
+    for (i = 0; i < MSG_THREADS; ++i)
+        pthread_join(tid[i], NULL);
+    for (i = 0; i < 1000; ++i)
+    {
+        msg = packf_msg_alloc(100);
+        assert(msg && msg->refcnt == 1);
+        msgs[i] = msg;
+    }
+    for (i = 0; i < 1000; ++i)
+        packf_msg_unref(msgs[i]);
+}
+
+static void test_limits(void)
+{
+    struct packf_limits limits = { 0, 0, 0 };
+    uint8_t buf[1024];
+    char format[1024];
+    int32_t ds[10], ds_out[10], x = 7, x_out;
+    uint16_t nd = 0;
+    int len, i, pos;
+# pragma pack(1)
+    struct
+    {
+        uint16_t    n;
+        int8_t      c;
+    } z = { 60000, 'x' }, z_out;
+    struct
+    {
+        uint8_t     c[200];
+        uint8_t     n[2];
+    } wide, wide_out;
+# pragma pack()
+
+    /* 0 字节的结构体数组元素只解析一次 */
+    len = packf(buf, sizeof(buf), "[=60000[0s 0d] c]", &z);
+    assert(len == 3);
+    memset(&z_out, 0, sizeof(z_out));
+    assert(unpackf(buf, len, "[=60000[0s 0d] c]", &z_out) == len);
+    assert(z_out.n == 60000 && z_out.c == 'x');
+
+    limits.max_elems = 1000;
+    assert(unpackf_limited(buf, len, &limits, "[=60000[0s 0d] c]", &z_out) ==
+            PACKF_OVER_LIMIT);
+    limits.max_elems = 60001;
+    assert(unpackf_limited(buf, len, &limits, "[=60000[0s 0d] c]", &z_out) ==
+            len);
+
+    /* 嵌套层数 */
+    len = packf(buf, sizeof(buf), "[[[[d]]]]", &x);
+    assert(len == 4);
+    limits.max_depth = 3;
+    assert(unpackf_limited(buf, len, &limits, "[[[[d]]]]", &x_out) ==
+            PACKF_OVER_LIMIT);
+    limits.max_depth = 4;
+    assert(unpackf_limited(buf, len, &limits, "[[[[d]]]]", &x_out) == len);
+    assert(x_out == x);
+
+    /* 输出的字节数 */
+    for (i = 0; i < 10; ++i)
+        ds[i] = i * 1000;
+    len = packf(buf, sizeof(buf), "=10d", 10, ds);
+    assert(len == 42);
+    limits.max_out = 39;
+    assert(unpackf_limited(buf, len, &limits, "=10d", &nd, ds_out) ==
+            PACKF_OVER_LIMIT);
+    limits.max_out = 40;
+    assert(unpackf_limited(buf, len, &limits, "=10d", &nd, ds_out) == len);
+    assert(nd == 10 && memcmp(ds, ds_out, sizeof(ds)) == 0);
+
+    /* 超过栈上括号表长度的 format */
+    pos = sprintf(format, "[");
+    for (i = 0; i < 200; ++i)
+        pos += sprintf(format + pos, "c ");
+    sprintf(format + pos, "2[c]]");
+    for (i = 0; i < 200; ++i)
+        wide.c[i] = (uint8_t)i;
+    wide.n[0] = 1;
+    wide.n[1] = 2;
+    len = packf(buf, sizeof(buf), format, &wide);
+    assert(len == 202);
+    assert(unpackf(buf, len, format, &wide_out) == len);
+    assert(memcmp(&wide, &wide_out, sizeof(wide)) == 0);
+
+    assert(unpackf(buf, len, "[c", &x_out) == PACKF_NOT_MATCH);
+}
+
+/*
+ * 嵌套很深的 format 在默认 8M 的栈上可以打包和解包，递归的栈帧不能包含
+ * 只在某些字段用到的大缓冲区。ASan 的栈帧大得多，减少层数
+ */
+static void test_deep(void)
+{
+# if defined(__SANITIZE_ADDRESS__)
+    int depth = 2000;
+# else
+    int depth = 8000;
+# endif
+    char *format;
+    uint8_t buf[8];
+    int32_t x = -5, x_out = 0;
+    struct packf_visitor visitor;
+    int i, k;
+
+    memset(&visitor, 0, sizeof(visitor));
+    format = malloc(2 * depth + 2);
+    assert(format);
+    for (i = 0, k = 0; k < depth; ++k)
+        format[i++] = '[';
+    format[i++] = 'd';
+    for (k = 0; k < depth; ++k)
+        format[i++] = ']';
+    format[i] = '\0';
+
+    assert(packf(buf, sizeof(buf), format, &x) == 4);
+    assert(unpackf(buf, 4, format, &x_out) == 4 && x_out == -5);
+    assert(packf_visit(buf, 4, format, &visitor, NULL) == 4);
+    free(format);
+}
+
+static void test_optional(void)
+{
+    char const *format = "?[D -32s d w c F =8d [w d] 4c 8s d w]";
+    struct packf_arena arena;
+    char pool[256];
+    uint8_t buf[512];
+    uint64_t mask, mask_out;
+    int len, i;
+# pragma pack(1)
+    struct account
+    {
+        int64_t     id;
+        uint8_t     name_len;
+        char        name[32];
+        int32_t     level;
+        int16_t     flags;
+        int8_t      kind;
+        double      balance;
+        uint16_t    nlimits;
+        int32_t     limits[8];
+        struct
+        {
+            int16_t w;
+            int32_t d;
+        } sub;
+        int8_t      tags[4];
+        char        code[8];
+        int32_t     x;
+        int16_t     y;
+    } in, out;
+    struct
+    {
+        uint16_t    n;
+        struct
+        {
+            uint64_t    mask;
+            int32_t     d;
+            int16_t     w;
+            int8_t      c;
+        } e[3];
+    } arr, arr_out;
+    struct
+    {
+        uint64_t    mask;
+        int32_t     d;
+        uint8_t     len;
+        char       *s;
+    } lv;
+    struct
+    {
+        uint64_t    mask;
+        int32_t     d;
+        uint8_t     len;
+        char        s[16];
+    } lv_in;
+    struct
+    {
+        int32_t     a;
+        char        s[8];
+        int32_t     b;
+    } ss, ss_out;
+# pragma pack()
+
+    memset(&in, 0, sizeof(in));
+    in.id = 123456789;
+    in.name_len = 5;
+    strcpy(in.name, "alice");
+    in.level   = 7;
+    in.flags   = -3;
+    in.kind    = 'k';
+    in.balance = 1024.5;
+    in.nlimits = 3;
+    for (i = 0; i < 3; ++i)
+        in.limits[i] = i * 100;
+    in.sub.w = 9;
+    in.sub.d = -9;
+    memcpy(in.tags, "abcd", 4);
+    strcpy(in.code, "USD");
+    in.x = 42;
+    in.y = 43;
+
+    /* 只打包存在的字段，不存在的字段保持不变 */
+    mask = 1 << 0 | 1 << 5 | 1 << 11;
+    len = packf(buf, sizeof(buf), format, mask, &in);
+    assert(len == 2 + 8 + 8 + 2);
+    assert(buf[0] == 0x21 && buf[1] == 0x08);
+    memset(&out, 0x5A, sizeof(out));
+    mask_out = 0;
+    assert(unpackf(buf, len, format, &mask_out, &out) == len);
+    assert(mask_out == mask);
+    assert(out.id == in.id && out.balance == in.balance && out.y == in.y);
+    assert(out.level == 0x5A5A5A5A && out.kind == 0x5A && out.x == 0x5A5A5A5A);
+
+    mask = (1 << 12) - 1;
+    len = packf(buf, sizeof(buf), format, mask, &in);
+    assert(len > 0);
+    memset(&out, 0, sizeof(out));
+    assert(unpackf(buf, len, format, &mask_out, &out) == len);
+    assert(mask_out == mask && memcmp(&in, &out, sizeof(in)) == 0);
+
+    assert(packf(buf, sizeof(buf), format, (uint64_t)0, &in) == 2);
+    assert(packf(buf, sizeof(buf), format, (uint64_t)1 << 12, &in) ==
+            PACKF_BAD_DATA);
+    buf[1] = 0x10;
+    assert(unpackf(buf, 2, format, &mask_out, &out) == PACKF_BAD_DATA);
+    assert(packf(buf, sizeof(buf), "-?[d]", (uint64_t)1, &in) ==
+            PACKF_NOT_FORMAT);
+    assert(unpackf_trusted(buf, 2, format, &mask_out, &out) < 0);
+
+    /* 结构体数组中的可选字段 */
+    arr.n = 3;
+    for (i = 0; i < 3; ++i)
+    {
+        arr.e[i].mask = i;
+        arr.e[i].d = i & 1 ? i * 10 : 0;
+        arr.e[i].w = i & 2 ? (int16_t)(i * 20) : 0;
+        arr.e[i].c = (int8_t)i;
+    }
+    len = packf(buf, sizeof(buf), "[=3[?[d w] c]]", &arr);
+    assert(len == 2 + (1 + 1) + (1 + 4 + 1) + (1 + 2 + 1));
+    memset(&arr_out, 0, sizeof(arr_out));
+    assert(unpackf(buf, len, "[=3[?[d w] c]]", &arr_out) == len);
+    assert(memcmp(&arr, &arr_out, sizeof(arr)) == 0);
+
+    /* arena 解包时字段表按 arena 的本地布局计算 */
+    lv_in.mask = 3;
+    lv_in.d    = 5;
+    strcpy(lv_in.s, "hello");
+    len = packf(buf, sizeof(buf), "[?[d -16s]]", &lv_in);
+    assert(len == 1 + 4 + 1 + 5);
+    packf_arena_init(&arena, pool, sizeof(pool));
+    memset(&lv, 0, sizeof(lv));
+    assert(unpackf_arena(buf, len, &arena, "[?[d -16s]]", &lv) == len);
+    assert(lv.mask == 3 && lv.d == 5 && lv.len == 5);
+    assert(strcmp(lv.s, "hello") == 0);
+
+    /* S 在本地和 s 一样占 num 字节 */
+    memset(&ss, 0, sizeof(ss));
+    ss.a = 1;
+    strcpy(ss.s, "xyz");
+    ss.b = -1;
+    len = packf(buf, sizeof(buf), "?[d 8S d]", (uint64_t)7, &ss);
+    assert(len == 1 + 4 + 4 + 4);
+    memset(&ss_out, 0x5A, sizeof(ss_out));
+    assert(unpackf(buf, len, "?[d 8S d]", &mask_out, &ss_out) == len);
+    assert(mask_out == 7 && ss_out.a == 1 && ss_out.b == -1);
+    assert(strcmp(ss_out.s, "xyz") == 0);
+}
+
+static void test_lz(void)
+{
+    static uint8_t src[20000], lz[PACKF_LZ_BOUND(20000)], dst[20000];
+    static uint8_t raw[256], tmp[PACKF_LZ_BOUND(256)], block[256];
+    static struct sink_out out;
+    struct packf_sink sink;
+    struct packf_lz_writer w;
+    struct packf_lz_reader r;
+    struct packf_frame frame;
+    uint8_t stage[64];
+    char name[32];
+    int32_t d;
+    uint32_t seed = 1;
+    int len, n, i, k, ret;
+
+    /* 重复的数据、全 0 的数据、随机数据和空数据 */
+    for (i = 0; i < (int)sizeof(src); ++i)
+        src[i] = "packf message header "[i % 21] + (i / 1000);
+    for (k = 0; k < 4; ++k)
+    {
+        if (k == 1)
+            memset(src, 0, sizeof(src));
+        if (k == 2)
+        {
+            for (i = 0; i < (int)sizeof(src); ++i)
+            {
+                seed = seed * 1103515245 + 12345;
+                src[i] = (uint8_t)(seed >> 16);
+            }
+        }
+        len = k == 3 ? 0 : (int)sizeof(src);
+        n = packf_lz_compress(src, len, lz, sizeof(lz));
+        assert(n > 0 && n <= PACKF_LZ_BOUND(len));
+        if (k < 2)
+            assert(n < len / 10);
+        assert(packf_lz_decompress(lz, n, dst, sizeof(dst)) == len);
+        assert(memcmp(src, dst, len) == 0);
+    }
+    assert(packf_lz_compress(src, sizeof(src), lz, 100) == PACKF_OUT_OF_BUF);
+
+    /* 不合法的数据不会越界 */
+    memset(src, 'x', 1000);
+    n = packf_lz_compress(src, 1000, lz, sizeof(lz));
+    assert(packf_lz_decompress(lz, n, dst, 999) == PACKF_OUT_OF_BUF);
+    lz[0] = 0x04;
+    lz[1] = 0x00;
+    lz[2] = 0x01;
+    assert(packf_lz_decompress(lz, 3, dst, sizeof(dst)) == PACKF_BAD_DATA);
+    for (k = 0; k < 2000; ++k)
+    {
+        for (i = 0; i < 64; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            lz[i] = (uint8_t)(seed >> 16);
+        }
+        ret = packf_lz_decompress(lz, 64, dst, 256);
+        assert(ret <= 256);
+    }
+
+    /* 写入端跨越多个块，读取端逐条返回 */
+    memset(&out, 0, sizeof(out));
+    packf_sink_init(&sink, stage, sizeof(stage), sink_write, &out);
+    packf_lz_writer_init(&w, &sink, raw, sizeof(raw), tmp);
+    for (i = 0; i < 200; ++i)
+    {
+        snprintf(name, sizeof(name), "account-%d", i % 7);
+        assert(packf_lz_write(&w, "d -32s 16a", i, name) == 2 + 4 + 1 +
+                (int)strlen(name) + 16);
+    }
+    assert(packf_lz_writer_flush(&w) == 0);
+    assert(w.lz_total == out.len && w.raw_total > 2 * w.lz_total);
+
+    packf_lz_reader_init(&r, out.data, out.len, block, sizeof(block));
+    for (i = 0; (ret = packf_lz_next(&r, &frame)) == 1; ++i)
+    {
+        assert(unpackf_frame(&frame, "d -32s 16a", &d, name) == frame.len);
+        assert(d == i && atoi(name + 8) == i % 7);
+    }
+    assert(ret == 0 && i == 200);
+
+    /* 块不完整 */
+    packf_lz_reader_init(&r, out.data, out.len - 1, block, sizeof(block));
+    while ((ret = packf_lz_next(&r, &frame)) == 1)
+        ;
+    assert(ret == PACKF_BAD_DATA);
+
+    assert(packf_lz_write(&w, "300a") == PACKF_OUT_OF_BUF);
+}
+
+static void test_bits(void)
+{
+    static uint8_t ref[] = { 0xDA, 0xBC, 0x12, 0x34, 0x56, 0x78, 0xAB,
+        'z' };
+    uint8_t buf[256], a, b, c = 0;
+    uint16_t w;
+    uint64_t D;
+    int len, i;
+# pragma pack(1)
+    struct flags
+    {
+        uint8_t     on;
+        uint8_t     off;
+        uint16_t    level;
+        uint32_t    seq;
+        uint8_t     nibbles[20];
+        uint8_t     pairs[33];
+        uint8_t     bools[7];
+        int32_t     d;
+    } in, out;
+    struct
+    {
+        uint8_t     bools[256];
+        uint8_t     pairs[100];
+        uint8_t     nibbles[50];
+        uint8_t     tail;
+        int32_t     d;
+    } arr, arr_out;
+    struct
+    {
+        uint8_t     skew;
+        uint8_t     bools[256];
+        uint8_t     pairs[100];
+        uint8_t     nibbles[50];
+        uint8_t     tail;
+        int32_t     d;
+    } skew, skew_out;
+    struct
+    {
+        uint64_t    mask;
+        uint8_t     x;
+        uint8_t     y;
+        int32_t     d;
+    } opt, opt_out;
+# pragma pack()
+
+    /* 56 位的位流后跟一个字节 */
+    len = packf(buf, sizeof(buf), "b1 b3 b12 b40 c", 1, 5, 0xABC,
+            (uint64_t)0x12345678AB, 'z');
+    assert(len == 8 && memcmp(buf, ref, len) == 0);
+    assert(unpackf(buf, len, "b1 b3 b12 b40 c", &a, &b, &w, &D, &c) == len);
+    assert(a == 1 && b == 5 && w == 0xABC && D == 0x12345678ABull &&
+            c == 'z');
+
+    /* 结构体中不对齐的位域数组 */
+    in.on    = 1;
+    in.off   = 0;
+    in.level = 4000;
+    in.seq   = 0xFFFFF;
+    for (i = 0; i < 20; ++i)
+        in.nibbles[i] = i % 16;
+    for (i = 0; i < 33; ++i)
+        in.pairs[i] = i % 4;
+    for (i = 0; i < 7; ++i)
+        in.bools[i] = i & 1;
+    in.d = -1;
+    len = packf(buf, sizeof(buf), "[b1 b1 b12 b20 20b4 33b2 7b1 d]", &in);
+    assert(len == (1 + 1 + 12 + 20 + 80 + 66 + 7 + 7) / 8 + 4);
+    memset(&out, 0xFF, sizeof(out));
+    assert(unpackf(buf, len, "[b1 b1 b12 b20 20b4 33b2 7b1 d]", &out) ==
+            len);
+    assert(memcmp(&in, &out, sizeof(in)) == 0);
+
+    /* 字节对齐的数组按字节展开，与不对齐的结果相同 */
+    for (i = 0; i < 256; ++i)
+        arr.bools[i] = skew.bools[i] = (i * 7 / 3) & 1;
+    for (i = 0; i < 100; ++i)
+        arr.pairs[i] = skew.pairs[i] = (i * 5) % 4;
+    for (i = 0; i < 50; ++i)
+        arr.nibbles[i] = skew.nibbles[i] = (i * 11) % 16;
+    arr.tail = skew.tail = 5;
+    arr.d    = skew.d    = 12345;
+    skew.skew = 2;
+    len = packf(buf, sizeof(buf), "[256b1 100b2 50b4 b3 d]", &arr);
+    assert(len == (256 + 200 + 200 + 3 + 7) / 8 + 4);
+    memset(&arr_out, 0, sizeof(arr_out));
+    assert(unpackf(buf, len, "[256b1 100b2 50b4 b3 d]", &arr_out) == len);
+    assert(memcmp(&arr, &arr_out, sizeof(arr)) == 0);
+    len = packf(buf, sizeof(buf), "[b2 256b1 100b2 50b4 b3 d]", &skew);
+    assert(len == (2 + 256 + 200 + 200 + 3 + 7) / 8 + 4);
+    memset(&skew_out, 0, sizeof(skew_out));
+    assert(unpackf(buf, len, "[b2 256b1 100b2 50b4 b3 d]", &skew_out) ==
+            len);
+    assert(memcmp(&skew, &skew_out, sizeof(skew)) == 0);
+
+    /* 可选字段中的位域各自补齐 */
+    opt.mask = 3;
+    opt.x    = 1;
+    opt.y    = 2;
+    opt.d    = 9;
+    len = packf(buf, sizeof(buf), "[?[b1 b2 d]]", &opt);
+    assert(len == 3 && buf[1] == 0x80 && buf[2] == 0x80);
+    memset(&opt_out, 0, sizeof(opt_out));
+    assert(unpackf(buf, len, "[?[b1 b2 d]]", &opt_out) == len);
+    assert(opt_out.mask == 3 && opt_out.x == 1 && opt_out.y == 2 && opt_out.d == 0);
+
+    assert(packf(buf, sizeof(buf), "b3", 8) == PACKF_BE_CUT_OFF);
+    assert(packf(buf, sizeof(buf), "b64", 1) == PACKF_NOT_FORMAT);
+    assert(packf(buf, sizeof(buf), "b", 1) == PACKF_NOT_FORMAT);
+    assert(packf(buf, sizeof(buf), "-4b3", 1, &a) == PACKF_NOT_FORMAT);
+    assert(packf(buf, 6, "b1 b3 b12 b40 c", 1, 5, 0xABC,
+                (uint64_t)0x12345678AB, 'z') == PACKF_OUT_OF_BUF);
+    assert(unpackf(ref, 6, "b1 b3 b12 b40", &a, &b, &w, &D) ==
+            PACKF_OUT_OF_BUF);
+}
+
+static void test_numeric(void)
+{
+    static uint8_t ref[] = { 0x00, 0x01, 0xE2, 0x40, 0xFF, 0x85, 0x3C, 0x00,
+        0xC0, 0x00 };
+    static uint16_t const halves[] = { 0x0000, 0x8000, 0x3C00, 0x3555,
+        0x7BFF, 0x0001, 0x03FF, 0x0400, 0x7C00, 0xFC00, 0xC000 };
+    uint8_t buf[4096];
+    struct packf_view view;
+    double px, qty;
+    float h, hv[300], hout[300];
+    uint16_t n;
+    int len, i;
+# pragma pack(1)
+    struct quote
+    {
+        uint8_t     flag;
+        double      px;
+        double      qty;
+        uint16_t    n;
+        double      levels[8];
+        float       temp[5];
+        int32_t     d;
+    } in, out;
+# pragma pack()
+
+    /* 12.3456 为 4 字节的 123456, -1.23 为 2 字节的 -123 */
+    len = packf(buf, sizeof(buf), "d.4 w.2 h h", 12.3456, -1.23, 1.0, -2.0);
+    assert(len == 10 && memcmp(buf, ref, len) == 0);
+    assert(unpackf(buf, len, "d.4 w.2 h h", &px, &qty, &h, &hv[0]) == len);
+    assert(px == 12.3456 && qty == -1.23 && h == 1.0f && hv[0] == -2.0f);
+
+    /* 结构体中的定点小数和半精度浮点，与 F/f 混合 */
+    memset(&in, 0, sizeof(in));
+    in.flag = 7;
+    in.px   = 1234.5678;
+    in.qty  = -0.000001;
+    in.n    = 5;
+    for (i = 0; i < 5; ++i)
+        in.levels[i] = (12345000 + i) / 1e4;
+    for (i = 0; i < 5; ++i)
+        in.temp[i] = 20.5f + i * 0.25f;
+    in.d = -9;
+    len = packf(buf, sizeof(buf), "[c D.4 d.6 =8d.4 5h d]", &in);
+    assert(len == 1 + 8 + 4 + 2 + 5 * 4 + 5 * 2 + 4);
+    memset(&out, 0xFF, sizeof(out));
+    out.n = 0;
+    for (i = 5; i < 8; ++i)
+        out.levels[i] = 0;
+    assert(unpackf(buf, len, "[c D.4 d.6 =8d.4 5h d]", &out) == len);
+    assert(memcmp(&in, &out, sizeof(in)) == 0);
+
+    /* 二进制16 的边界值：0, -0, 1, 1/3, 最大值，最小非规格化数，无穷大 */
+    for (i = 0; i < 11; ++i)
+    {
+        buf[2 * i]     = halves[i] >> 8;
+        buf[2 * i + 1] = halves[i] & 0xFF;
+    }
+    assert(unpackf(buf, 22, "11h", hv) == 22);
+    assert(hv[2] == 1.0f && hv[4] == 65504.0f && hv[5] == ldexpf(1, -24));
+    assert(hv[6] == ldexpf(1023, -24) && hv[7] == ldexpf(1, -14));
+    assert(isinf(hv[8]) && hv[8] > 0 && isinf(hv[9]) && hv[9] < 0);
+    assert(packf(buf + 100, 22, "11h", hv) == 22);
+    assert(memcmp(buf, buf + 100, 22) == 0);
+
+    /* 舍入到最近的偶数，溢出为无穷大，小于最小非规格化数的一半为 0 */
+    hv[0] = 1.0f + ldexpf(1, -11);
+    hv[1] = 1.0f + ldexpf(3, -11);
+    hv[2] = 65520.0f;
+    hv[3] = ldexpf(1, -26);
+    hv[4] = ldexpf(3, -25);
+    hv[5] = NAN;
+    assert(packf(buf, sizeof(buf), "6h", hv) == 12);
+    assert(buf[0] == 0x3C && buf[1] == 0x00 && buf[2] == 0x3C &&
+            buf[3] == 0x02 && buf[4] == 0x7C && buf[5] == 0x00);
+    assert(buf[6] == 0 && buf[7] == 0 && buf[8] == 0 && buf[9] == 0x02);
+    assert((buf[10] & 0x7C) == 0x7C && (buf[10] & 0x03 || buf[11]));
+
+    /* 跨越转换块的 LV 数组，每个半精度浮点与单精度的误差不超过 2^-11 */
+    for (i = 0; i < 300; ++i)
+        hv[i] = (i - 150) * 0.37f;
+    len = packf(buf, sizeof(buf), "=300h", 300, hv);
+    assert(len == 2 + 600);
+    memset(hout, 0, sizeof(hout));
+    assert(unpackf(buf, len, "=300h", &n, hout) == len && n == 300);
+    for (i = 0; i < 300; ++i)
+        assert(fabsf(hout[i] - hv[i]) <= fabsf(hv[i]) * ldexpf(1, -11));
+
+    /* 整数的范围：d.4 最大约 214748.3647 */
+    assert(packf(buf, sizeof(buf), "d.4", 214748.3647) == 4);
+    assert(packf(buf, sizeof(buf), "d.4", 214748.3648) == PACKF_BE_CUT_OFF);
+    assert(packf(buf, sizeof(buf), "c.1", -12.8) == 1 && buf[0] == 0x80);
+    assert(packf(buf, sizeof(buf), "c.1", -12.86) == PACKF_BE_CUT_OFF);
+    assert(packf(buf, sizeof(buf), "D.0", NAN) == PACKF_BE_CUT_OFF);
+    assert(packf(buf, sizeof(buf), "D.18", 9.2) == 8);
+    assert(packf(buf, sizeof(buf), "D.18", 9.3) == PACKF_BE_CUT_OFF);
+    assert(packf(buf, sizeof(buf), "w.2", 0.005) == 2 && buf[1] == 1);
+    assert(packf(buf, sizeof(buf), "w.2", -0.005) == 2 && buf[1] == 0xFF);
+
+    assert(packf(buf, sizeof(buf), "d.19", 1.0) == PACKF_NOT_FORMAT);
+    assert(packf(buf, sizeof(buf), "d.", 1.0) == PACKF_NOT_FORMAT);
+    assert(packf(buf, sizeof(buf), "F.2", 1.0) == PACKF_NOT_FORMAT);
+    assert(packf(buf, sizeof(buf), "4d.2+", hv) == PACKF_NOT_FORMAT);
+    assert(packf(buf, 3, "d.2", 1.0) == PACKF_OUT_OF_BUF);
+    assert(unpackf(ref, 9, "d.4 w.2 h h", &px, &qty, &h, &hv[0]) ==
+            PACKF_OUT_OF_BUF);
+    memset(&view, 0, sizeof(view));
+    assert(packf_view_init(&view, buf, 4, "d.2") < 0);
+    packf_view_free(&view);
+    assert(unpackf_trusted(buf, 2, "h", &h) < 0);
+}
+
+# define IO_MSGS 20000
+
+struct io_peer
+{
+    int     fd;
+    int     flags;
+};
+
+/* 第 i 条消息：每 1000 条有一条比接收缓冲区长得多的消息 */
+static void *io_sender(void *arg)
+{
+    struct io_peer *peer = arg;
+    struct packf_io *io;
+    static char big[3000];
+    char str[200];
+    int i, n;
+
+    io = packf_io_open(peer->fd, 8, 4096, peer->flags);
+    assert(io);
+    assert(packf_io_send(io, "=5000c", 5000, big) == PACKF_OUT_OF_BUF);
+    for (i = 0; i < IO_MSGS; ++i)
+    {
+        if (i % 1000 == 999)
+        {
+            memset(big, i & 0x7F, sizeof(big));
+            assert(packf_io_send(io, "d =3000c", i, 3000, big) == 2 + 4 +
+                    2 + 3000);
+            continue;
+        }
+        n = i % 200;
+        memset(str, 'a' + i % 26, n);
+        str[n] = '\0';
+        assert(packf_io_send(io, "d -200s", i, str) == 2 + 4 + 1 + n);
+        if (i % 5000 == 0)
+            assert(packf_io_submit(io) == 0);
+    }
+    assert(packf_io_flush(io) == 0);
+    packf_io_close(io);
+    shutdown(peer->fd, SHUT_WR);
+
+    return NULL;
+}
+
+static void test_io(void)
+{
+    static int const flags[][2] =
+    {
+        { 0, 0 },
+        { 0, PACKF_IO_POLL },
+        { PACKF_IO_POLL, 0 },
+    };
+    static char big[3000];
+    struct packf_frame frame;
+    struct packf_io *io;
+    struct io_peer peer;
+    pthread_t tid;
+    char str[201];
+    uint16_t len;
+    int32_t d;
+    int sv[2], k, i, n;
+
+    for (k = 0; k < 3; ++k)
+    {
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        peer.fd    = sv[0];
+        peer.flags = flags[k][0];
+        assert(pthread_create(&tid, NULL, io_sender, &peer) == 0);
+
+        /* 接收缓冲区很小，大部分消息都会跨越缓冲区 */
+        io = packf_io_open(sv[1], 4, 256, flags[k][1]);
+        assert(io);
+        for (i = 0; i < IO_MSGS; ++i)
+        {
+            if (i % 1000 == 999)
+            {
+                assert(packf_io_unpack(io, "d =3000c", &d, &len, big) == 1);
+                assert(d == i && len == 3000 && big[0] == (i & 0x7F) &&
+                        big[2999] == (i & 0x7F));
+                continue;
+            }
+            assert(packf_io_recv(io, &frame) == 1);
+            n = i % 200;
+            assert(frame.len == 4 + 1 + n);
+            assert(unpackf_frame(&frame, "d -200s", &d, str) == frame.len);
+            assert(d == i && (int)strlen(str) == n);
+            assert(n == 0 || (str[0] == 'a' + i % 26 &&
+                        str[n - 1] == 'a' + i % 26));
+        }
+        assert(packf_io_recv(io, &frame) == 0);
+        packf_io_close(io);
+        pthread_join(tid, NULL);
+        close(sv[0]);
+        close(sv[1]);
+    }
+
+    /* 关闭时有不完整的消息 */
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert(write(sv[0], "\x00\x02" "ab" "\x00\x05" "abc", 9) == 9);
+    close(sv[0]);
+    io = packf_io_open(sv[1], 2, 64, 0);
+    assert(io);
+    assert(packf_io_recv(io, &frame) == 1 && frame.len == 2);
+    assert(packf_io_recv(io, &frame) == PACKF_BAD_DATA);
+    packf_io_close(io);
+    close(sv[1]);
+
+    assert(packf_io_open(0, 0, 64, 0) == NULL);
+    assert(packf_io_open(0, 4, 2, 0) == NULL);
+}
+
+# define MPSC_THREADS 4
+# define MPSC_MSGS 20000
+
+struct mpsc_out
+{
+    char   *buf;
+    int     len;
+};
+
+struct mpsc_peer
+{
+    struct packf_mpsc  *q;
+    int                 id;
+    int                *done;
+};
+
+static int mpsc_collect(void *ctx, void const *data, int len)
+{
+    struct mpsc_out *out = ctx;
+
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+
+    return 0;
+}
+
+/*
+ * 第 i 条消息的字符串长度为 i % 50. 第一个生产者每 100 条有一条超过 max
+ * 的消息（出错时写 packf_error_format, 只在一个线程中出错）
+ */
+static void *mpsc_producer(void *arg)
+{
+    struct mpsc_peer *peer = arg;
+    char str[64];
+    int i, n;
+
+    for (i = 0; i < MPSC_MSGS; ++i)
+    {
+        if (peer->id == 0 && i % 100 == 50)
+            assert(packf_mpsc_pack(peer->q, 4, "d d", i, i) ==
+                    PACKF_OUT_OF_BUF);
+        n = i % 50;
+        memset(str, 'a' + i % 26, n);
+        str[n] = '\0';
+        assert(packf_mpsc_pack(peer->q, 200, "c d -100s", peer->id, i,
+                    str) == 2 + 1 + 4 + 1 + n);
+    }
+    __atomic_add_fetch(peer->done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+static void test_mpsc(void)
+{
+    struct mpsc_peer peers[MPSC_THREADS];
+    pthread_t tids[MPSC_THREADS];
+    struct packf_frame frames[64];
+    struct packf_mpsc *q;
+    struct mpsc_out out;
+    struct iovec iov[4];
+    int next[MPSC_THREADS] = { 0 };
+    int k, i, n, done = 0, pos, total;
+    uint16_t hdr, len;
+    char str[101];
+    uint8_t id;
+    int32_t d;
+    size_t used;
+
+    /* 缓冲区很小，生产者经常等待，消息经常回绕 */
+    q = packf_mpsc_new(4096);
+    assert(q);
+    out.buf = malloc((size_t)MPSC_THREADS * MPSC_MSGS * 64);
+    out.len = 0;
+    assert(out.buf);
+    for (k = 0; k < MPSC_THREADS; ++k)
+    {
+        peers[k].q  = q;
+        peers[k].id = k;
+        peers[k].done = &done;
+        assert(pthread_create(&tids[k], NULL, mpsc_producer, &peers[k]) == 0);
+    }
+
+    while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) < MPSC_THREADS)
+        assert(packf_mpsc_flush(q, mpsc_collect, &out) >= 0);
+    assert(packf_mpsc_flush(q, mpsc_collect, &out) >= 0);
+    for (k = 0; k < MPSC_THREADS; ++k)
+        pthread_join(tids[k], NULL);
+
+    /* 每个生产者的消息按顺序出现，失败的消息没有输出 */
+    for (pos = 0, total = 0; pos < out.len; pos += (int)used)
+    {
+        n = packf_frame_scan(out.buf + pos, out.len - pos, 2, frames, 64,
+                &used);
+        assert(n > 0);
+        for (i = 0; i < n; ++i, ++total)
+        {
+            assert(unpackf_frame(&frames[i], "c d -100s", &id, &d, str) ==
+                    frames[i].len);
+            assert(id < MPSC_THREADS && d == next[id]++);
+            assert((int)strlen(str) == d % 50);
+            assert(d % 50 == 0 || (str[0] == 'a' + d % 26 &&
+                        str[d % 50 - 1] == 'a' + d % 26));
+        }
+    }
+    assert(total == MPSC_THREADS * MPSC_MSGS);
+    for (k = 0; k < MPSC_THREADS; ++k)
+        assert(next[k] == MPSC_MSGS);
+
+    /* 单线程时多预留的部分都会归还，消息是连续的一段 */
+    for (i = 0; i < 10; ++i)
+        assert(packf_mpsc_pack(q, 1000, "d d", i, i) == 10);
+    n = packf_mpsc_peek(q, iov, 4);
+    assert(n == 1 ? iov[0].iov_len == 100 :
+            n == 2 && iov[0].iov_len + iov[1].iov_len == 100);
+    assert(packf_mpsc_peek(q, iov, 4) == 0);
+    packf_mpsc_release(q);
+
+    /* 回绕的消息分为两段 */
+    memset(str, 'x', 100);
+    while (packf_mpsc_pack(q, 102, "=100c", 100, str) == 104 &&
+            packf_mpsc_peek(q, iov, 4) == 1)
+        packf_mpsc_release(q);
+    assert(iov[0].iov_len + iov[1].iov_len == 104);
+    assert(unpackf_iov(iov, 2, "w =100c", &hdr, &len, str) == 104);
+    assert(hdr == 102 && len == 100 && str[99] == 'x');
+    packf_mpsc_release(q);
+
+    assert(packf_mpsc_pack(q, 5000, "d", 1) == PACKF_OUT_OF_BUF);
+    assert(packf_mpsc_new(5000) == NULL);
+    packf_mpsc_free(q);
+    free(out.buf);
+}
+
+# pragma pack(1)
+struct dict_order
+{
+    uint8_t     sym_len;
+    char        sym[16];
+    uint8_t     venue_len;
+    char        venue[8];
+    int64_t     qty;
+    char        acct[12];
+};
+# pragma pack()
+
+static int dict_order_eq(struct dict_order const *a,
+        struct dict_order const *b)
+{
+    return a->sym_len == b->sym_len && strcmp(a->sym, b->sym) == 0 &&
+        a->venue_len == b->venue_len && strcmp(a->venue, b->venue) == 0 &&
+        a->qty == b->qty && strcmp(a->acct, b->acct) == 0;
+}
+
+static void test_dict(void)
+{
+    static char const *syms[] = { "600000", "000001", "AAPL", "600000" };
+    static char const *fmt = "[-16s@ -8s@ D 12s@]";
+    struct dict_order orders[40], out[40];
+    struct packf_dict *pd, *ud, *sd, *ld;
+    struct packf_view view;
+    struct packf_path proj_path;
+    char buf[4096], plain[4096], sym[32], venue[8];
+    int off[40], len[40], i, pos, plain_len, ret, path[1];
+    uint16_t n;
+    int64_t qty;
+
+    pd = packf_dict_new(64, 1024, 0);
+    ud = packf_dict_new(64, 1024, 0);
+    sd = packf_dict_new(64, 0, PACKF_DICT_SHARED);
+    assert(pd && ud && sd);
+
+    /* 一批消息，同样的代码、交易所和账户反复出现 */
+    for (i = 0; i < 40; ++i)
+    {
+        memset(&orders[i], 0, sizeof(orders[i]));
+        strcpy(orders[i].sym, syms[i % 4]);
+        strcpy(orders[i].venue, i % 3 ? "SSE" : "SZSE");
+        strcpy(orders[i].acct, "ACC-7");
+        orders[i].sym_len   = (uint8_t)strlen(orders[i].sym);
+        orders[i].venue_len = (uint8_t)strlen(orders[i].venue);
+        orders[i].qty = 100 * i;
+    }
+    for (i = 0, pos = 0, plain_len = 0; i < 40; ++i)
+    {
+        off[i] = pos;
+        assert((len[i] = packf_dict(buf + pos, sizeof(buf) - pos, pd, fmt,
+                        &orders[i])) > 0);
+        pos += len[i];
+        assert((ret = packf(plain + plain_len, sizeof(plain) - plain_len,
+                        fmt, &orders[i])) > 0);
+        plain_len += ret;
+    }
+    /* 第一次出现后每个字符串字段只占 1 字节 */
+    assert(packf_dict_count(pd) == 6);
+    assert(len[39] == 1 + 1 + 8 + 1);
+    assert(pos < plain_len / 2);
+
+    for (i = 0; i < 40; ++i)
+    {
+        memset(&out[i], 0xFF, sizeof(out[i]));
+        assert(unpackf_dict(buf + off[i], len[i], ud, fmt, &out[i]) ==
+                len[i]);
+        assert(dict_order_eq(&out[i], &orders[i]));
+        memset(&out[i], 0xFF, sizeof(out[i]));
+        assert(unpackf_dict(buf + off[i], len[i], sd, fmt, &out[i]) ==
+                len[i]);
+        assert(dict_order_eq(&out[i], &orders[i]));
+    }
+    assert(packf_dict_count(ud) == 6 && packf_dict_count(sd) == 6);
+
+    /* 不使用字典的函数只打包字面量，也能解包字面量 */
+    assert(unpackf(plain, plain_len, fmt, &out[0]) > 0);
+    assert(dict_order_eq(&out[0], &orders[0]));
+    assert(unpackf(buf + off[39], len[39], fmt, &out[0]) == PACKF_BAD_DATA);
+
+    /* -16s@ 和 -32s@ 的字面量相同，可以互相引用；变参和 S@ */
+    packf_dict_reset(pd);
+    packf_dict_reset(ud);
+    assert(packf_dict(buf, sizeof(buf), pd, "-16s@ -32s@ S@", "IBM", "IBM",
+                "IBM") == 1 + 4 + 1 + 1 + 4);
+    assert(packf_dict(buf + 11, sizeof(buf), pd, "S@", "IBM") == 1);
+    assert(unpackf_dict(buf, 11, ud, "-16s@ -32s@ S@", sym, sym,
+                venue) == 11);
+    assert(strcmp(sym, "IBM") == 0 && strcmp(venue, "IBM") == 0);
+    assert(unpackf_dict(buf + 11, 1, ud, "S@", venue) == 1);
+    assert(strcmp(venue, "IBM") == 0);
+
+    /* 引用比字面量长时仍然打包字面量 */
+    ld = packf_dict_new(256, 4096, 0);
+    for (i = 0; i < 130; ++i)
+    {
+        snprintf(sym, sizeof(sym), "%d", i);
+        assert(packf_dict(buf, sizeof(buf), ld, "-8s@", sym) > 0);
+    }
+    assert(packf_dict(buf, sizeof(buf), ld, "-8s@ -8s@ -8s@", "", "",
+                "1") == 2 + 2 + 1);
+    packf_dict_free(ld);
+
+    /* 失败时撤销本条消息加入的字面量 */
+    n = packf_dict_count(pd);
+    assert(packf_dict(buf, 8, pd, "-16s@ D", "MSFT", (int64_t)1) ==
+            PACKF_OUT_OF_BUF);
+    assert(packf_dict_count(pd) == n);
+    assert(packf_dict(buf, sizeof(buf), pd, "-16s@ D", "MSFT",
+                (int64_t)1) == 1 + 5 + 8);
+    assert(packf_dict_count(pd) == n + 1);
+
+    /* 超过字典中的编号，标记不完整 */
+    packf_dict_reset(ud);
+    assert(unpackf_dict("\x02", 1, ud, "-16s@", sym) == PACKF_BAD_DATA);
+    assert(unpackf_dict("\x81", 1, ud, "-16s@", sym) ==
+            PACKF_OUT_OF_BUF);
+    assert(unpackf_dict("\x81\x80\x80\x00", 4, ud, "-16s@", sym) ==
+            PACKF_BAD_DATA);
+    /* 字面量加入后被截断的消息不会留在字典中 */
+    assert(unpackf_dict("\x01\x03" "abc", 5, ud, "-16s@ D", sym,
+                &qty) == PACKF_OUT_OF_BUF);
+    assert(packf_dict_count(ud) == 0);
+
+    /* 字面量超过 num 时和不加 @ 一样报错 */
+    assert(packf_dict(buf, sizeof(buf), pd, "-4s@", "ABCDE") ==
+            PACKF_BE_CUT_OFF);
+    assert(unpackf_dict("\x01\x05" "ABCDE", 7, ud, "-4s@", sym) ==
+            PACKF_BE_CUT_OFF);
+
+    assert(packf(buf, sizeof(buf), "d@", 1) == PACKF_NOT_FORMAT);
+    assert(unpackf(buf, sizeof(buf), "d@", &i) == PACKF_NOT_FORMAT);
+    memset(&view, 0, sizeof(view));
+    assert(packf_view_init(&view, buf, sizeof(buf), "-16s@") < 0);
+    packf_view_free(&view);
+    assert(packf_key(buf, sizeof(buf), "-16s@", "A") < 0);
+    path[0] = 0;
+    proj_path.path  = path;
+    proj_path.depth = 1;
+    assert(packf_proj_new("8s@ d", &proj_path, 1) == NULL);
+    assert(packf_proj_new("d [-8s@]", &proj_path, 1) == NULL);
+    assert(packf_dict_new(0, 0, 0) == NULL);
+    assert(packf_dict_new(PACKF_DICT_MAX + 1, 0, 0) == NULL);
+
+    packf_dict_free(pd);
+    packf_dict_free(ud);
+    packf_dict_free(sd);
+}
+
+# pragma pack(1)
+struct text_leg
+{
+    int16_t     qty;
+    int32_t     px;
+};
+
+struct text_pos
+{
+    uint16_t    qty;
+    uint8_t     tag_len;
+    char        tag[8];
+};
+
+struct text_str
+{
+    uint8_t     len;
+    char        s[8];
+};
+# pragma pack()
+
+static void test_text(void)
+{
+    struct text_leg legs[2] = { { 1, -2 }, { 3, 4 } };
+    struct text_pos pos = { 3, 0, "x,y" };
+    struct text_str strs[2] = { { 0, "a\"b" }, { 0, "" } };
+    struct packf_text *t, *u;
+    char buf[256], out[512];
+    char const *p;
+    void const *cur;
+    int32_t vals[2] = { 1, 2 };
+    int len, ret, left, i;
+    uint64_t bits;
+    double d;
+    float f;
+
+    /* JSON, 有字段名和没有字段名 */
+    len = packf(buf, sizeof(buf), "D -16s =3[w d] F f 3c", (int64_t)42,
+            "a\"b\n\x01", 2, legs, 100.25, 0.1, "\x01\x02\xFF");
+    assert(len > 0);
+    t = packf_text_new("D -16s =3[w d] F f 3c",
+            "id, name, legs[qty, px], total, ratio, flag", PACKF_TEXT_JSON);
+    assert(t);
+    ret = packf_text(t, buf, len, out, sizeof(out));
+    p = "{\"id\":42,\"name\":\"a\\\"b\\n\\u0001\",\"legs\":[{\"qty\":1,"
+        "\"px\":-2},{\"qty\":3,\"px\":4}],\"total\":100.25,\"ratio\":0.1,"
+        "\"flag\":[1,2,-1]}\n";
+    assert(ret == (int)strlen(p) && memcmp(out, p, ret) == 0);
+    /* 没有 header, 放不下时失败 */
+    assert(packf_text_header(t, buf, len, out, sizeof(out)) == 0);
+    assert(packf_text(t, buf, len, out, ret - 1) == PACKF_OUT_OF_BUF);
+    packf_text_free(t);
+
+    t = packf_text_new("D -16s =3[w d] F f 3c", NULL, PACKF_TEXT_JSON);
+    assert(t);
+    ret = packf_text(t, buf, len, out, sizeof(out));
+    p = "[42,\"a\\\"b\\n\\u0001\",[[1,-2],[3,4]],100.25,0.1,[1,2,-1]]\n";
+    assert(ret == (int)strlen(p) && memcmp(out, p, ret) == 0);
+    packf_text_free(t);
+
+    /* 字段名不够 */
+    t = packf_text_new("D -16s", "id", PACKF_TEXT_JSON);
+    assert(packf_text(t, buf, len, out, sizeof(out)) == PACKF_NOT_MATCH);
+    packf_text_free(t);
+
+    /* 合法的 UTF-8 原样输出，不合法的字节（包括代理）为 \u00XX */
+    len = packf(buf, sizeof(buf), "-16s", "\xC3\xA9\xFF\xC3x\xED\xA0\x80");
+    assert(len > 0);
+    t = packf_text_new("-16s", NULL, PACKF_TEXT_JSON);
+    assert(t);
+    ret = packf_text(t, buf, len, out, sizeof(out));
+    p = "[\"\xC3\xA9\\u00ff\\u00c3x\\u00ed\\u00a0\\u0080\"]\n";
+    assert(ret == (int)strlen(p) && memcmp(out, p, ret) == 0);
+    packf_text_free(t);
+
+    /* CSV: 结构体展开，数组为 JSON 的一列，NaN 为空列 */
+    len = packf(buf, sizeof(buf), "d [w -8s] =4d =2[-8s] F", 7, &pos, 2, vals,
+            2, strs, NAN);
+    assert(len > 0);
+    t = packf_text_new("d [w -8s] =4d =2[-8s] F",
+            "id, pos[qty, tag], vals, strs, px", PACKF_TEXT_CSV);
+    assert(t);
+    ret = packf_text_header(t, buf, len, out, sizeof(out));
+    p = "id,pos.qty,pos.tag,vals,strs,px\n";
+    assert(ret == (int)strlen(p) && memcmp(out, p, ret) == 0);
+    ret = packf_text(t, buf, len, out, sizeof(out));
+    p = "7,3,\"x,y\",\"[1,2]\",\"[[\"\"a\\\"\"b\"\"],[\"\"\"\"]]\",\n";
+    assert(ret == (int)strlen(p) && memcmp(out, p, ret) == 0);
+    packf_text_free(t);
+
+    u = packf_text_new("d [w -8s] =4d =2[-8s] F", NULL, PACKF_TEXT_CSV);
+    assert(u);
+    ret = packf_text_header(u, buf, len, out, sizeof(out));
+    p = "0,1.0,1.1,2,3,4\n";
+    assert(ret == (int)strlen(p) && memcmp(out, p, ret) == 0);
+    packf_text_free(u);
+
+    /* 连续的消息，放不下时位置不变 */
+    t = packf_text_new("d w", "a, b", PACKF_TEXT_CSV);
+    len  = packf(buf, sizeof(buf), "d w", 1, 2);
+    len += packf(buf + len, sizeof(buf) - len, "d w", -3, 65535);
+    cur  = buf;
+    left = len;
+    assert(packf_text_next(t, &cur, &left, out, sizeof(out)) == 4);
+    assert(memcmp(out, "1,2\n", 4) == 0 && left == 6);
+    assert(packf_text_next(t, &cur, &left, out, 5) == PACKF_OUT_OF_BUF);
+    assert(left == 6);
+    assert(packf_text_next(t, &cur, &left, out, sizeof(out)) == 6);
+    assert(memcmp(out, "-3,-1\n", 6) == 0 && left == 0);
+    packf_text_free(t);
+
+    /* 最短的还原表示 */
+    t = packf_text_new("F", NULL, PACKF_TEXT_JSON);
+    u = packf_text_new("f", NULL, PACKF_TEXT_JSON);
+    {
+        static struct { double v; char const *s; } const dv[] = {
+            { 0.1, "[0.1]\n" }, { -0.0, "[-0]\n" }, { 1e300, "[1e+300]\n" },
+            { 5e-324, "[5e-324]\n" }, { 1.0 / 3, "[0.3333333333333333]\n" },
+            { 123456, "[123456]\n" }, { INFINITY, "[null]\n" },
+        };
+        for (i = 0; i < (int)(sizeof(dv) / sizeof(dv[0])); ++i)
+        {
+            len = packf(buf, sizeof(buf), "F", dv[i].v);
+            ret = packf_text(t, buf, len, out, sizeof(out));
+            assert(ret == (int)strlen(dv[i].s) &&
+                    memcmp(out, dv[i].s, ret) == 0);
+        }
+    }
+    len = packf(buf, sizeof(buf), "f", 3.4028235e38);
+    ret = packf_text(u, buf, len, out, sizeof(out));
+    assert(ret == 16 && memcmp(out, "[3.4028235e+38]\n", ret) == 0);
+    len = packf(buf, sizeof(buf), "f", 1e-45);
+    ret = packf_text(u, buf, len, out, sizeof(out));
+    assert(ret == 8 && memcmp(out, "[1e-45]\n", ret) == 0);
+    /* 很大的整数取较短的形式 */
+    len = packf(buf, sizeof(buf), "f", 1.5e10);
+    ret = packf_text(u, buf, len, out, sizeof(out));
+    assert(ret == 10 && memcmp(out, "[1.5e+10]\n", ret) == 0);
+    len = packf(buf, sizeof(buf), "f", 4294967296.0);
+    ret = packf_text(u, buf, len, out, sizeof(out));
+    assert(ret == 13 && memcmp(out, "[4294967296]\n", ret) == 0);
+
+    srand(11);
+    for (i = 0; i < 20000; ++i)
+    {
+        bits = (uint64_t)rand() << 62 ^ (uint64_t)rand() << 31 ^ rand();
+        if (i & 1)
+            bits = (bits & 0xFFFFFFFFFFULL) | 0x40F0000000000000ULL;
+        memcpy(&d, &bits, sizeof(d));
+        memcpy(&f, &bits, sizeof(f));
+        if (isfinite(d))
+        {
+            len = packf(buf, sizeof(buf), "F", d);
+            ret = packf_text(t, buf, len, out, sizeof(out));
+            assert(ret > 0 && ret < 32);
+            out[ret] = 0;
+            assert(strtod(out + 1, NULL) == d);
+        }
+        if (isfinite(f))
+        {
+            len = packf(buf, sizeof(buf), "f", f);
+            ret = packf_text(u, buf, len, out, sizeof(out));
+            assert(ret > 0 && ret < 24);
+            out[ret] = 0;
+            assert(strtof(out + 1, NULL) == f);
+        }
+    }
+    packf_text_free(t);
+    packf_text_free(u);
+
+    assert(packf_text_new(NULL, NULL, PACKF_TEXT_JSON) == NULL);
+    assert(packf_text_new("d", NULL, 5) == NULL);
+    assert(packf_text_new("d d", "a,,b", PACKF_TEXT_JSON) == NULL);
+    assert(packf_text_new("d [d]", "a, b[c", PACKF_TEXT_JSON) == NULL);
+    assert(packf_text_new("d", "a\"", PACKF_TEXT_JSON) == NULL);
+}
+
+/* 大块的拷贝与逐个元素的转换结果相同，包括不对齐的位置和各种长度 */
+static void test_bulk(void)
+{
+    static char const *formats[] = { "%dc", "%dw", "%dd", "%dD", "%df",
+        "%dF" };
+    static int const sizes[] = { 1, 2, 4, 8, 4, 8 };
+    static int const counts[] = { 63, 64, 65, 517, 4099 };
+    size_t saved = packf_bulk_threshold;
+    char *src, *a, *b, *out, fmt[32];
+    int i, k, c, off, n, ra, rb;
+
+    src = malloc(1 << 17);
+    a   = malloc((1 << 17) + 16);
+    b   = malloc((1 << 17) + 16);
+    out = malloc((1 << 17) + 16);
+    assert(src && a && b && out);
+    for (i = 0; i < 1 << 17; ++i)
+        src[i] = (char)(i * 131 + (i >> 8));
+
+    for (k = 0; k < 6; ++k)
+    {
+        for (c = 0; c < 5; ++c)
+        {
+            n = counts[c];
+            snprintf(fmt, sizeof(fmt), formats[k], n);
+            for (off = 0; off < 16; off += 3)
+            {
+                packf_bulk_threshold = 0;
+                ra = packf(a + off, 1 << 17, fmt, src);
+                packf_bulk_threshold = 64;
+                rb = packf(b + off, 1 << 17, fmt, src);
+                assert(ra == n * sizes[k] && ra == rb);
+                assert(memcmp(a + off, b + off, ra) == 0);
+
+                memset(out, 0, (1 << 17) + 16);
+                assert(unpackf(b + off, rb, fmt, out + off) == rb);
+                assert(memcmp(out + off, src, rb) == 0);
+            }
+        }
+    }
+
+    /* LV 数组，默认的阈值 */
+    packf_bulk_threshold = saved;
+    assert(packf_bulk_threshold >= 64 * 1024);
+    packf_bulk_threshold = 4096;
+    ra = packf(a + 1, (1 << 17) + 15, "=65535w", 60000, src);
+    assert(ra == 2 + 120000);
+    memset(out, 0, (1 << 17) + 16);
+    assert(unpackf(a + 1, ra, "=65535w", &n, out + 5) == ra);
+    assert(n == 60000 && memcmp(out + 5, src, 120000) == 0);
+    packf_bulk_threshold = 0;
+    rb = packf(b, 1 << 17, "=65535w", 60000, src);
+    assert(rb == ra && memcmp(a + 1, b, ra) == 0);
+
+    packf_bulk_threshold = saved;
+    free(src);
+    free(a);
+    free(b);
+    free(out);
+}
+
+static void test_delta(void)
+{
+    char const *format = "D -16s d w F =4d [w d] 8s";
+    struct packf_delta *d;
+    uint8_t buf[256];
+    uint64_t mask;
+    char big[256];
+    int len, i, pos;
+# pragma pack(1)
+    struct quote
+    {
+        int64_t     id;
+        uint8_t     name_len;
+        char        name[16];
+        int32_t     bid;
+        int16_t     qty;
+        double      px;
+        uint16_t    nlevels;
+        int32_t     levels[4];
+        struct
+        {
+            int16_t w;
+            int32_t d;
+        } sub;
+        char        code[8];
+    } prev, cur, rx;
+    struct
+    {
+        uint8_t     c[70];
+    } wide, wide_prev, wide_rx;
+    struct
+    {
+        int32_t     a;
+        char        s[8];
+        int32_t     b;
+    } sp, sc, sr;
+# pragma pack()
+
+    d = packf_delta_new(format);
+    assert(d && packf_delta_len(d) == (int)sizeof(cur));
+
+    memset(&cur, 0, sizeof(cur));
+    cur.id = 1001;
+    cur.name_len = 4;
+    strcpy(cur.name, "ibm");
+    cur.bid = 12000;
+    cur.qty = 300;
+    cur.px  = 120.25;
+    cur.nlevels = 2;
+    cur.levels[0] = 1;
+    cur.levels[1] = 2;
+    cur.sub.w = 5;
+    cur.sub.d = -5;
+    strcpy(cur.code, "NYSE");
+
+    /* 第一条消息打包所有字段，和 ?[...] 相同 */
+    assert(packf_delta_mask(d, NULL, &cur) == 0xFF);
+    len = packf_delta(d, buf, sizeof(buf), NULL, &cur);
+    assert(len == packf(buf + 128, 128, "?[D -16s d w F =4d [w d] 8s]",
+                (uint64_t)0xFF, &cur));
+    assert(memcmp(buf, buf + 128, len) == 0);
+    memset(&rx, 0x5A, sizeof(rx));
+    rx.name_len = 0;
+    rx.nlevels = 0;
+    assert(unpackf_delta(d, buf, len, &rx, &mask) == len && mask == 0xFF);
+    assert(rx.id == 1001 && strcmp(rx.name, "ibm") == 0 && rx.px == 120.25);
+    assert(rx.nlevels == 2 && rx.levels[1] == 2 && rx.sub.d == -5);
+    assert(strcmp(rx.code, "NYSE") == 0);
+    memcpy(&prev, &cur, sizeof(cur));
+
+    /* 没有变化时只有位图 */
+    assert(packf_delta(d, buf, sizeof(buf), &prev, &cur) == 1 && buf[0] == 0);
+    assert(unpackf_delta(d, buf, 1, &rx, &mask) == 1 && mask == 0);
+
+    /* 只打包变化的字段，结构体和数组中一个字节的变化也标记整个字段 */
+    cur.px = 120.5;
+    cur.sub.d = -6;
+    assert(packf_delta_mask(d, &prev, &cur) == (1 << 4 | 1 << 6));
+    len = packf_delta(d, buf, sizeof(buf), &prev, &cur);
+    assert(len == 1 + 8 + 2 + 4);
+    assert(unpackf_delta(d, buf, len, &rx, &mask) == len);
+    assert(mask == (1 << 4 | 1 << 6));
+    assert(rx.px == 120.5 && rx.sub.d == -6 && rx.sub.w == 5);
+    assert(rx.id == 1001 && rx.qty == 300);
+    memcpy(&prev, &cur, sizeof(cur));
+
+    cur.levels[3] = 9;
+    cur.code[7] = 'x';
+    cur.id = 1002;
+    assert(packf_delta_mask(d, &prev, &cur) == (1 << 0 | 1 << 5 | 1 << 7));
+    len = packf_delta(d, buf, sizeof(buf), &prev, &cur);
+    assert(unpackf_delta(d, buf, len, &rx, NULL) == len);
+    assert(rx.id == 1002 && rx.nlevels == 2 && rx.levels[3] != 9);
+    memcpy(&prev, &cur, sizeof(cur));
+
+    /* 截断的数据 */
+    assert(packf_delta(d, buf, 3, NULL, &cur) == PACKF_OUT_OF_BUF);
+    len = packf_delta(d, buf, sizeof(buf), NULL, &cur);
+    assert(unpackf_delta(d, buf, len - 1, &rx, NULL) == PACKF_OUT_OF_BUF);
+    packf_delta_free(d);
+
+    /* 超过 16 字节的结构体，每个位置的变化都要找到所在的字段 */
+    pos = 0;
+    for (i = 0; i < 64; ++i)
+        pos += sprintf(big + pos, i < 6 ? "w " : "c ");
+    big[pos - 1] = '\0';
+    d = packf_delta_new(big);
+    assert(d && packf_delta_len(d) == 70);
+    memset(&wide_prev, 0, sizeof(wide_prev));
+    memset(&wide_rx, 0, sizeof(wide_rx));
+    assert(packf_delta(d, buf, sizeof(buf), &wide_prev, &wide_prev) == 8);
+    for (i = 0; i < 70; ++i)
+    {
+        memcpy(&wide, &wide_prev, sizeof(wide));
+        wide.c[i] = (uint8_t)(i + 1);
+        wide.c[69 - i] ^= 0x80;
+        len = packf_delta(d, buf, sizeof(buf), &wide_prev, &wide);
+        assert(unpackf_delta(d, buf, len, &wide_rx, &mask) == len);
+        assert(mask == ((uint64_t)1 << (i < 12 ? i / 2 : i - 6) |
+                    (uint64_t)1 << (69 - i < 12 ? (69 - i) / 2 : 63 - i)));
+        assert(memcmp(&wide, &wide_rx, sizeof(wide)) == 0);
+        memcpy(&wide_prev, &wide, sizeof(wide));
+    }
+    packf_delta_free(d);
+
+    /* S 字段 */
+    d = packf_delta_new("d 8S d");
+    assert(d && packf_delta_len(d) == (int)sizeof(sc));
+    memset(&sp, 0, sizeof(sp));
+    memcpy(&sc, &sp, sizeof(sc));
+    strcpy(sc.s, "abc");
+    assert(packf_delta_mask(d, &sp, &sc) == 2);
+    len = packf_delta(d, buf, sizeof(buf), &sp, &sc);
+    assert(len == 1 + 4);
+    memset(&sr, 0, sizeof(sr));
+    assert(unpackf_delta(d, buf, len, &sr, &mask) == len && mask == 2);
+    assert(memcmp(&sr, &sc, sizeof(sc)) == 0);
+    packf_delta_free(d);
+
+    /* 格式错误 */
+    assert(!packf_delta_new(NULL));
+    assert(!packf_delta_new(""));
+    assert(!packf_delta_new("d ] d"));
+    assert(!packf_delta_new("d [w"));
+    pos = 0;
+    for (i = 0; i < 65; ++i)
+        pos += sprintf(big + pos, "c ");
+    assert(!packf_delta_new(big));
+}
 
 int main()
 {
@@ -80,6 +2781,33 @@ int main()
 
     printf("%u\n", ue.n);
 
+    test_frame();
+    test_iov();
+    test_fixed();
+    test_view();
+    test_crc();
+    test_codec();
+    test_tmpl();
+    test_proj();
+    test_key();
+    test_visit();
+    test_arena();
+    test_sink();
+    test_trusted();
+    test_msg();
+    test_limits();
+    test_deep();
+    test_optional();
+    test_lz();
+    test_bits();
+    test_numeric();
+    test_io();
+    test_mpsc();
+    test_dict();
+    test_text();
+    test_bulk();
+    test_delta();
+
     return 0;
 }
 